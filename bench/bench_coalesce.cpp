@@ -0,0 +1,108 @@
+// Measures the CPU time per entry and the output size with and without --coalesce, for
+// synthetic journals in which a flapping device logs a growing share of the entries, eg.
+// `bin/bench_coalesce 200000`.
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "coalesce.hpp"
+#include "encoder.hpp"
+#include "event_loop.hpp"
+#include "journal.hpp"
+#include "output.hpp"
+#include "synthetic_journal.hpp"
+
+// the window used for the coalesced passes, as with `--coalesce 1s`.
+constexpr uint64_t WINDOW_NS = 1'000'000'000;
+
+struct PassResult {
+  uint64_t entries = 0;
+  uint64_t written = 0;
+  uint64_t elapsed_ns = 0;
+  uint64_t file_bytes = 0;
+};
+
+int run_pass(uint32_t storm_percent, bool coalesce, uint64_t entry_count, PassResult *result) {
+  sd_journal *j = nullptr;
+  int err = synthetic_journal_open(&j, entry_count, 42, storm_percent);
+  if (err != 0) {
+    return err;
+  }
+  char path[] = "/tmp/bench_coalesce-XXXXXX";
+  int fd = mkstemp(path);
+  if (fd < 0) {
+    sd_journal_close(j);
+    return -errno;
+  }
+  close(fd);
+  std::unique_ptr<LogEncoder> encoder = make_encoder(ENCODING_JSON);
+  LogWriter writer;
+  if (auto res = writer.open(path, *encoder, LogWriterOptions()); !res.ok()) {
+    fprintf(stderr, "open failed: %s\n", res.message.c_str());
+    err = -EIO;
+  }
+  EntryCoalescer coalescer(WINDOW_NS);
+  auto write = [&](const JournalEntry &entry) {
+    if (auto res = writer.write(entry.timestamp, channel_key(entry), encoder->encode(entry));
+        !res.ok()) {
+      fprintf(stderr, "write failed: %s\n", res.message.c_str());
+      err = -EIO;
+    }
+    result->written++;
+  };
+  const uint64_t start = monotonic_ns();
+  JournalEntry entry;
+  while (err == 0 && read_journal_entry(j, UINT64_MAX, &entry) > 0) {
+    result->entries++;
+    const bool absorbed = coalesce && !coalescer.add(entry);
+    if (const JournalEntry *summary = coalescer.take_summary(); summary != nullptr) {
+      write(*summary);
+    }
+    if (!absorbed) {
+      write(entry);
+    }
+  }
+  coalescer.finish();
+  if (const JournalEntry *summary = coalescer.take_summary(); summary != nullptr) {
+    write(*summary);
+  }
+  writer.close();
+  result->elapsed_ns = monotonic_ns() - start;
+  struct stat st;
+  if (stat(path, &st) == 0) {
+    result->file_bytes = st.st_size;
+  }
+  unlink(path);
+  sd_journal_close(j);
+  return err;
+}
+
+int main(int argc, const char **argv) {
+  const uint64_t entry_count = argc > 1 ? std::stoull(argv[1]) : 200'000;
+  printf("%llu json entries per pass, 1 ms apart; 'storm' is the share of entries repeating "
+         "one kernel line, and --coalesce uses a 1 s window\n",
+         (unsigned long long)(entry_count));
+  printf("%-6s %10s %10s %12s %10s %10s %12s %8s\n", "storm", "ns/entry", "messages", "bytes",
+         "+coalesce", "messages", "bytes", "size");
+  for (uint32_t storm_percent : {0, 50, 90, 99, 100}) {
+    PassResult plain;
+    PassResult coalesced;
+    int err = run_pass(storm_percent, false, entry_count, &plain);
+    if (err == 0) {
+      err = run_pass(storm_percent, true, entry_count, &coalesced);
+    }
+    if (err != 0) {
+      fprintf(stderr, "pass failed: %s\n", strerror(-err));
+      return 1;
+    }
+    printf("%5u%% %10.0f %10llu %12llu %10.0f %10llu %12llu %7.1f%%\n", storm_percent,
+           double(plain.elapsed_ns) / double(plain.entries),
+           (unsigned long long)(plain.written), (unsigned long long)(plain.file_bytes),
+           double(coalesced.elapsed_ns) / double(coalesced.entries),
+           (unsigned long long)(coalesced.written), (unsigned long long)(coalesced.file_bytes),
+           100.0 * double(coalesced.file_bytes) / double(plain.file_bytes));
+  }
+  return 0;
+}
@@ -0,0 +1,64 @@
+// Compares the portable table-driven CRC32 with the implementation `crc32Update` dispatches
+// to on this machine, over buffer sizes from a single small record up to a whole chunk, eg.
+// `bin/bench_crc32 2000` to spend about 2 seconds on each.
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "vendor/mcap/crc32.hpp"
+
+using CrcFunction = uint32_t (*)(uint32_t, const std::byte *, size_t);
+
+/**
+ * @brief returns the throughput of `crc` over `size`-byte buffers in GB/s.
+ */
+double measure(CrcFunction crc, const std::vector<std::byte> &buffer, size_t size,
+               double budget_ms) {
+  // cycle through the buffer so that each call starts at a different alignment.
+  const size_t positions = buffer.size() - size;
+  uint64_t bytes = 0;
+  uint32_t r = mcap::internal::CRC32_INIT;
+  size_t offset = 0;
+  const auto start = std::chrono::steady_clock::now();
+  std::chrono::duration<double> elapsed{};
+  while (elapsed.count() * 1000 < budget_ms) {
+    for (int i = 0; i < 1000; ++i) {
+      r = crc(r, buffer.data() + offset, size);
+      bytes += size;
+      offset = (offset + 1) % (positions + 1);
+    }
+    elapsed = std::chrono::steady_clock::now() - start;
+  }
+  // keep the result live, so that the calls are not optimized out.
+  volatile uint32_t sink = r;
+  (void)(sink);
+  return bytes / elapsed.count() / 1e9;
+}
+
+int main(int argc, const char **argv) {
+  const double budget_ms = argc > 1 ? std::stod(argv[1]) : 300;
+  std::vector<std::byte> buffer((1 << 20) + 64);
+  std::mt19937 rng(42);
+  for (auto &b : buffer) {
+    b = std::byte(rng());
+  }
+  printf("dispatching to '%s'\n", mcap::internal::crc32Implementation());
+  printf("%10s %12s %12s %8s\n", "bytes", "table GB/s", "fast GB/s", "speedup");
+  for (size_t size : {16, 64, 200, 1024, 4096, 65536, 1 << 20}) {
+    const uint32_t table_crc =
+        mcap::internal::crc32UpdateTable(mcap::internal::CRC32_INIT, buffer.data() + 1, size);
+    const uint32_t fast_crc =
+        mcap::internal::crc32Update(mcap::internal::CRC32_INIT, buffer.data() + 1, size);
+    if (table_crc != fast_crc) {
+      fprintf(stderr, "CRC mismatch for %zu-byte buffers: %08x != %08x\n", size, table_crc,
+              fast_crc);
+      return 1;
+    }
+    const double table = measure(mcap::internal::crc32UpdateTable, buffer, size, budget_ms);
+    const double fast = measure(mcap::internal::crc32Update, buffer, size, budget_ms);
+    printf("%10zu %12.2f %12.2f %7.1fx\n", size, table, fast, fast / table);
+  }
+  return 0;
+}
@@ -0,0 +1,120 @@
+// Compares compressing chunks with and without a trained zstd dictionary, for chunk sizes from
+// 4 KiB to 4 MiB, eg. `bin/bench_dictionary 200000`. The dictionary is trained on entries from
+// a differently seeded synthetic journal, so it is not trained on the entries it compresses.
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "dictionary.hpp"
+#include "encoder.hpp"
+#include "journal.hpp"
+#include "output.hpp"
+#include "synthetic_journal.hpp"
+
+int train(Encoding encoding, std::string *dictionary) {
+  sd_journal *j = nullptr;
+  int err = synthetic_journal_open(&j, 1'000'000, 7);
+  if (err != 0) {
+    return err;
+  }
+  std::unique_ptr<LogEncoder> encoder = make_encoder(encoding);
+  DictionarySampler sampler;
+  JournalEntry entry;
+  while (!sampler.full() && read_journal_entry(j, UINT64_MAX, &entry) > 0) {
+    sampler.add(encoder->encode(entry));
+  }
+  sd_journal_close(j);
+  return sampler.train(dictionary);
+}
+
+struct PassResult {
+  ChunkSizeStats chunks;
+  uint64_t entries = 0;
+  uint64_t file_bytes = 0;
+};
+
+int run_pass(Encoding encoding, uint64_t chunk_size, const std::string &dictionary,
+             uint64_t entry_count, PassResult *result) {
+  sd_journal *j = nullptr;
+  int err = synthetic_journal_open(&j, entry_count);
+  if (err != 0) {
+    return err;
+  }
+  char path[] = "/tmp/bench_dictionary-XXXXXX";
+  int fd = mkstemp(path);
+  if (fd < 0) {
+    sd_journal_close(j);
+    return -errno;
+  }
+  close(fd);
+  std::unique_ptr<LogEncoder> encoder = make_encoder(encoding);
+  LogWriterOptions options;
+  options.chunk_size = chunk_size;
+  options.zstd_dictionary = dictionary;
+  LogWriter writer;
+  if (auto res = writer.open(path, *encoder, options); !res.ok()) {
+    fprintf(stderr, "open failed: %s\n", res.message.c_str());
+    err = -EIO;
+  }
+  JournalEntry entry;
+  while (err == 0 && read_journal_entry(j, UINT64_MAX, &entry) > 0) {
+    if (auto res = writer.write(entry.timestamp, channel_key(entry), encoder->encode(entry));
+        !res.ok()) {
+      fprintf(stderr, "write failed: %s\n", res.message.c_str());
+      err = -EIO;
+    }
+    result->entries++;
+  }
+  writer.close();
+  result->chunks = writer.chunk_stats();
+  struct stat st;
+  if (stat(path, &st) == 0) {
+    result->file_bytes = st.st_size;
+  }
+  unlink(path);
+  sd_journal_close(j);
+  return err;
+}
+
+int main(int argc, const char **argv) {
+  const uint64_t entry_count = argc > 1 ? std::stoull(argv[1]) : 200'000;
+  printf("%llu entries per pass; chunks are compressed inline with zstd. 'ratio' and 'MB/s' "
+         "cover the chunk contents, and '+dict size' is the whole file's size with the "
+         "dictionary relative to without\n",
+         (unsigned long long)(entry_count));
+  printf("%-9s %10s %8s %10s %8s %10s %14s\n", "encoding", "chunk size", "ratio", "MB/s",
+         "+dict", "+dict MB/s", "+dict size");
+  for (Encoding encoding : {ENCODING_JSON, ENCODING_PROTOBUF}) {
+    std::string dictionary;
+    if (int err = train(encoding, &dictionary); err != 0) {
+      fprintf(stderr, "failed to train dictionary: %s\n", strerror(-err));
+      return 1;
+    }
+    for (uint64_t chunk_size = 4 << 10; chunk_size <= 4 << 20; chunk_size *= 4) {
+      PassResult plain;
+      PassResult with_dictionary;
+      int err = run_pass(encoding, chunk_size, "", entry_count, &plain);
+      if (err == 0) {
+        err = run_pass(encoding, chunk_size, dictionary, entry_count, &with_dictionary);
+      }
+      if (err != 0) {
+        fprintf(stderr, "pass failed: %s\n", strerror(-err));
+        return 1;
+      }
+      auto ratio = [](const ChunkSizeStats &stats) {
+        return double(stats.uncompressed_bytes) / double(stats.compressed_bytes);
+      };
+      auto speed = [](const ChunkSizeStats &stats) {
+        return stats.uncompressed_bytes * 1e3 / double(stats.compression_ns);
+      };
+      printf("%-9s %9lluK %8.2f %10.1f %8.2f %10.1f %13.0f%%\n",
+             encoding == ENCODING_JSON ? "json" : "protobuf",
+             (unsigned long long)(chunk_size >> 10), ratio(plain.chunks), speed(plain.chunks),
+             ratio(with_dictionary.chunks), speed(with_dictionary.chunks),
+             100.0 * double(with_dictionary.file_bytes) / double(plain.file_bytes));
+    }
+  }
+  return 0;
+}
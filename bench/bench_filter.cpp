@@ -0,0 +1,85 @@
+// Compares reading and encoding the whole local journal with reading only the entries which
+// match a filter, eg. `bin/bench_filter --unit sshd --priority warning`. With matches applied
+// inside libsystemd the filtered pass should cost roughly in proportion to the entries it
+// matches, rather than to the size of the journal.
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+#include <systemd/sd-journal.h>
+
+#include "cmdline.hpp"
+#include "encoder.hpp"
+#include "journal.hpp"
+
+struct PassResult {
+  uint64_t entries = 0;
+  uint64_t bytes = 0;
+  double seconds = 0;
+};
+
+int run_pass(const Options &options, bool filtered, PassResult *result) {
+  sd_journal *j = nullptr;
+  int err = sd_journal_open(&j, SD_JOURNAL_LOCAL_ONLY);
+  if (err != 0) {
+    return err;
+  }
+  const auto start = std::chrono::steady_clock::now();
+  err = apply_boot_id_match(j, options);
+  if (err == 0 && filtered) {
+    err = apply_filter_matches(j, options);
+  }
+  if (err == 0) {
+    err = seek_to_start(j, options.start, options.start_sec);
+  }
+  std::unique_ptr<LogEncoder> encoder = make_encoder(options.encoding);
+  JournalEntry entry;
+  const uint64_t end_usec = end_usec_for(options.end, options.end_sec);
+  while (err == 0) {
+    err = read_journal_entry(j, end_usec, &entry);
+    if (err <= 0) {
+      break;
+    }
+    err = 0;
+    result->entries++;
+    result->bytes += encoder->encode(entry).size();
+  }
+  result->seconds =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  sd_journal_close(j);
+  return err;
+}
+
+void print_pass(const char *name, const PassResult &result) {
+  printf("%-10s %10llu entries  %8.3f s  %8.0f ns/entry  %10.0f entries/s\n", name,
+         (unsigned long long)(result.entries), result.seconds,
+         result.entries ? result.seconds * 1e9 / result.entries : 0.0,
+         result.entries / result.seconds);
+}
+
+int main(int argc, const char **argv) {
+  Options options;
+  if (int err = parse_options(argc, argv, &options); err != 0) {
+    return err;
+  }
+  // the bounded default of 'now' keeps the passes comparable.
+  if (options.end == TIME_WAIT) {
+    options.end = TIME_NOW;
+  }
+  PassResult all;
+  PassResult filtered;
+  int err = run_pass(options, false, &all);
+  if (err == 0) {
+    err = run_pass(options, true, &filtered);
+  }
+  if (err < 0) {
+    fprintf(stderr, "failed to read journal: %s\n", strerror(-err));
+    return 1;
+  }
+  print_pass("all", all);
+  print_pass("filtered", filtered);
+  printf("filtered pass read %.2f%% of entries in %.2f%% of the time\n",
+         all.entries ? 100.0 * filtered.entries / all.entries : 0.0,
+         all.seconds > 0 ? 100.0 * filtered.seconds / all.seconds : 0.0);
+  return 0;
+}
@@ -0,0 +1,120 @@
+// Measures parsing a Journal Export Format file with the export reader, alone and with each
+// encoder, against reading the same entries from the synthetic in-process journal, eg.
+// `bin/bench_import 1000000`.
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <unistd.h>
+
+#include "encoder.hpp"
+#include "event_loop.hpp"
+#include "export_reader.hpp"
+#include "journal.hpp"
+#include "synthetic_journal.hpp"
+
+// writes the synthetic journal's entries to `path` as `journalctl -o export` would.
+int write_export_file(const char *path, uint64_t entry_count, uint64_t *size) {
+  sd_journal *j = nullptr;
+  int err = synthetic_journal_open(&j, entry_count);
+  if (err != 0) {
+    return err;
+  }
+  FILE *file = fopen(path, "w");
+  if (file == nullptr) {
+    sd_journal_close(j);
+    return -errno;
+  }
+  JournalEntry entry;
+  while (read_journal_entry(j, UINT64_MAX, &entry) > 0) {
+    fprintf(file, "__REALTIME_TIMESTAMP=%llu\n", (unsigned long long)(entry.timestamp / 1000));
+    for (const auto &field : entry.fields) {
+      const std::string_view key = entry.key(field);
+      const std::string_view value = entry.value(field);
+      fwrite(key.data(), 1, key.size(), file);
+      if (value.find('\n') == value.npos) {
+        fputc('=', file);
+      } else {
+        fputc('\n', file);
+        for (int i = 0; i < 8; ++i) {
+          fputc(int((uint64_t(value.size()) >> (8 * i)) & 0xff), file);
+        }
+      }
+      fwrite(value.data(), 1, value.size(), file);
+      fputc('\n', file);
+    }
+    fputc('\n', file);
+  }
+  *size = ftell(file);
+  sd_journal_close(j);
+  return fclose(file) == 0 ? 0 : -errno;
+}
+
+// reads every entry from the export file, or from the synthetic journal if `path` is null,
+// encoding each with `encoder` unless it is null.
+int run_pass(const char *path, uint64_t entry_count, LogEncoder *encoder, uint64_t *elapsed_ns) {
+  ExportReader reader;
+  sd_journal *j = nullptr;
+  int err = path != nullptr ? reader.open(path) : synthetic_journal_open(&j, entry_count);
+  if (err != 0) {
+    return err;
+  }
+  uint64_t encoded_bytes = 0;
+  const uint64_t start = monotonic_ns();
+  JournalEntry entry;
+  while ((err = path != nullptr ? reader.read(&entry)
+                                : read_journal_entry(j, UINT64_MAX, &entry)) > 0) {
+    if (encoder != nullptr) {
+      encoded_bytes += encoder->encode(entry).size();
+    }
+  }
+  *elapsed_ns = monotonic_ns() - start;
+  if (j != nullptr) {
+    sd_journal_close(j);
+  }
+  // keeps the encoding from being optimized away.
+  return encoded_bytes == UINT64_MAX ? -EIO : err;
+}
+
+int main(int argc, const char **argv) {
+  const uint64_t entry_count = argc > 1 ? std::stoull(argv[1]) : 1'000'000;
+  char path[] = "/tmp/bench_import-XXXXXX";
+  int fd = mkstemp(path);
+  if (fd < 0) {
+    perror("mkstemp");
+    return 1;
+  }
+  close(fd);
+  uint64_t file_size = 0;
+  int err = write_export_file(path, entry_count, &file_size);
+  if (err != 0) {
+    fprintf(stderr, "failed to write %s: %s\n", path, strerror(-err));
+    unlink(path);
+    return 1;
+  }
+  printf("%llu entries, %.1f MB in the export format\n", (unsigned long long)(entry_count),
+         double(file_size) / 1e6);
+  printf("%-10s %-10s %10s %10s\n", "input", "encoding", "ns/entry", "MB/s");
+  const struct {
+    const char *encoding;
+    std::unique_ptr<LogEncoder> encoder;
+  } encoders[] = {{"none", nullptr},
+                  {"json", make_encoder(ENCODING_JSON)},
+                  {"protobuf", make_encoder(ENCODING_PROTOBUF)}};
+  for (const char *input : {"export", "synthetic"}) {
+    for (const auto &[encoding, encoder] : encoders) {
+      uint64_t elapsed_ns = 0;
+      err = run_pass(strcmp(input, "export") == 0 ? path : nullptr, entry_count, encoder.get(),
+                     &elapsed_ns);
+      if (err != 0) {
+        fprintf(stderr, "pass failed: %s\n", strerror(-err));
+        unlink(path);
+        return 1;
+      }
+      printf("%-10s %-10s %10.0f %10.0f\n", input, encoding,
+             double(elapsed_ns) / double(entry_count),
+             double(file_size) / (double(elapsed_ns) / 1e9) / 1e6);
+    }
+  }
+  unlink(path);
+  return 0;
+}
@@ -0,0 +1,99 @@
+// Measures reading a journal file with libsystemd and with the memory-mapped reader, alone and
+// with JSON encoding, eg. `bin/bench_journal_file 2000000`. The file is generated first, in the
+// compact format journald writes by default, with fields of 512 bytes or more compressed with
+// ZSTD, and is read from the page cache by both.
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "encoder.hpp"
+#include "journal.hpp"
+#include "journal_file.hpp"
+#include "journal_file_builder.hpp"
+
+struct PassResult {
+  uint64_t entries = 0;
+  double seconds = 0;
+};
+
+int run_pass(const std::string &path, bool mapped, LogEncoder *encoder, PassResult *result) {
+  sd_journal *j = nullptr;
+  MappedJournal journal;
+  int err = 0;
+  if (mapped) {
+    err = journal.open(JournalSource{"", {path}});
+    journal.seek_head();
+  } else {
+    const char *paths[] = {path.c_str(), nullptr};
+    err = sd_journal_open_files(&j, paths, 0);
+  }
+  if (err != 0) {
+    return err;
+  }
+  uint64_t encoded_bytes = 0;
+  const auto start = std::chrono::steady_clock::now();
+  JournalEntry entry;
+  while ((err = mapped ? journal.read_entry(UINT64_MAX, &entry)
+                       : read_journal_entry(j, UINT64_MAX, &entry)) > 0) {
+    result->entries++;
+    if (encoder != nullptr) {
+      encoded_bytes += encoder->encode(entry).size();
+    }
+  }
+  result->seconds =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  if (j != nullptr) {
+    sd_journal_close(j);
+  }
+  // keeps the encoding from being optimized away.
+  return encoded_bytes == UINT64_MAX ? -EIO : err;
+}
+
+int main(int argc, const char **argv) {
+  const uint64_t entry_count = argc > 1 ? std::stoull(argv[1]) : 1'000'000;
+  char path[] = "/tmp/bench_journal_file-XXXXXX";
+  int fd = mkstemp(path);
+  if (fd < 0) {
+    perror("mkstemp");
+    return 1;
+  }
+  close(fd);
+  size_t file_size = 0;
+  {
+    JournalFileBuilder builder;
+    generate_entries(&builder, entry_count);
+    file_size = builder.size();
+    printf("%llu entries, %zu distinct fields, %.1f MB journal file\n",
+           (unsigned long long)(entry_count), builder.data_count(), double(file_size) / 1e6);
+    if (int err = builder.write(path); err != 0) {
+      fprintf(stderr, "failed to write %s: %s\n", path, strerror(-err));
+      unlink(path);
+      return 1;
+    }
+  }
+  std::unique_ptr<LogEncoder> json = make_encoder(ENCODING_JSON);
+  printf("%-12s %-10s %10s %12s %8s\n", "reader", "encoding", "ns/entry", "entries/s",
+         "speedup");
+  for (LogEncoder *encoder : {(LogEncoder *)(nullptr), json.get()}) {
+    double libsystemd_seconds = 0;
+    for (bool mapped : {false, true}) {
+      PassResult result;
+      if (int err = run_pass(path, mapped, encoder, &result); err != 0) {
+        fprintf(stderr, "pass failed: %s\n", strerror(-err));
+        unlink(path);
+        return 1;
+      }
+      if (!mapped) {
+        libsystemd_seconds = result.seconds;
+      }
+      printf("%-12s %-10s %10.0f %12.0f %7.1fx\n", mapped ? "mmap" : "libsystemd",
+             encoder != nullptr ? "json" : "none", result.seconds * 1e9 / double(result.entries),
+             double(result.entries) / result.seconds, libsystemd_seconds / result.seconds);
+    }
+  }
+  unlink(path);
+  return 0;
+}
@@ -0,0 +1,165 @@
+// Compares the export loop which encodes and writes each entry as it is read with the
+// pipeline which does so on other threads, as used with --jobs in live mode, eg.
+// `bin/bench_live 2000000`. Entries come from a synthetic in-process journal, and are
+// compressed with zstd on one background thread as by default.
+//
+// 'sustained' reads every entry as fast as it can be taken. 'bursts' lets entries arrive in
+// bursts of BURST_SIZE every BURST_INTERVAL_MS, as after a service restart, and reports the
+// ingest lag: how long after a burst arrived its last entry was read from the journal. Each
+// mode's output is compared with that of the sequential loop.
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "encoder.hpp"
+#include "journal.hpp"
+#include "output.hpp"
+#include "pipeline.hpp"
+#include "synthetic_journal.hpp"
+
+constexpr uint64_t BURST_SIZE = 5'000;
+constexpr uint64_t BURST_INTERVAL_MS = 200;
+
+struct PassResult {
+  uint64_t entries = 0;
+  double seconds = 0;
+  // the ingest lag of each burst, in milliseconds.
+  std::vector<double> lags_ms;
+  std::string output;
+};
+
+std::string read_file(const char *path) {
+  std::string contents;
+  FILE *file = fopen(path, "r");
+  if (file == nullptr) {
+    return contents;
+  }
+  char buf[1 << 16];
+  size_t length;
+  while ((length = fread(buf, 1, sizeof(buf), file)) > 0) {
+    contents.append(buf, length);
+  }
+  fclose(file);
+  return contents;
+}
+
+// `encoder_threads` 0 runs the sequential loop.
+int run_pass(uint64_t entry_count, uint32_t encoder_threads, bool bursts, PassResult *result) {
+  sd_journal *j = nullptr;
+  int err = synthetic_journal_open(&j, entry_count);
+  if (err != 0) {
+    return err;
+  }
+  char path[] = "/tmp/bench_live-XXXXXX";
+  int fd = mkstemp(path);
+  if (fd < 0) {
+    sd_journal_close(j);
+    return -errno;
+  }
+  close(fd);
+  std::unique_ptr<LogEncoder> encoder = make_encoder(ENCODING_JSON);
+  LogWriterOptions writer_options;
+  writer_options.compression_threads = 1;
+  LogWriter writer;
+  if (auto res = writer.open(path, *encoder, writer_options); !res.ok()) {
+    fprintf(stderr, "open failed: %s\n", res.message.c_str());
+    err = -EIO;
+  }
+  std::unique_ptr<EntryPipeline> pipeline;
+  if (encoder_threads > 0) {
+    PipelineOptions options;
+    options.encoder_threads = encoder_threads;
+    pipeline = std::make_unique<EntryPipeline>(&writer, options);
+    pipeline->start();
+  }
+  const auto start = std::chrono::steady_clock::now();
+  auto burst_arrival = start;
+  JournalEntry entry;
+  while (err == 0) {
+    if (bursts && result->entries % BURST_SIZE == 0 && result->entries > 0) {
+      // the burst has been read; hand over what is left of it and wait for the next one.
+      result->lags_ms.push_back(std::chrono::duration<double, std::milli>(
+                                    std::chrono::steady_clock::now() - burst_arrival)
+                                    .count());
+      if (pipeline) {
+        pipeline->submit();
+      }
+      burst_arrival += std::chrono::milliseconds(BURST_INTERVAL_MS);
+      std::this_thread::sleep_until(burst_arrival);
+    }
+    int ret = read_journal_entry(j, UINT64_MAX, &entry);
+    if (ret <= 0) {
+      err = ret;
+      break;
+    }
+    if (pipeline) {
+      if (!pipeline->write(entry)) {
+        fprintf(stderr, "write failed: %s\n", pipeline->error().c_str());
+        err = -EIO;
+      }
+    } else if (auto res = writer.write(entry.timestamp, channel_key(entry), encoder->encode(entry));
+               !res.ok()) {
+      fprintf(stderr, "write failed: %s\n", res.message.c_str());
+      err = -EIO;
+    }
+    result->entries++;
+  }
+  if (pipeline && !pipeline->finish() && err == 0) {
+    err = -EIO;
+  }
+  writer.close();
+  result->seconds =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  result->output = read_file(path);
+  unlink(path);
+  sd_journal_close(j);
+  return err;
+}
+
+double percentile(std::vector<double> values, double fraction) {
+  if (values.empty()) {
+    return 0;
+  }
+  std::sort(values.begin(), values.end());
+  return values[std::min(values.size() - 1, size_t(fraction * double(values.size())))];
+}
+
+int main(int argc, const char **argv) {
+  const uint64_t entry_count = argc > 1 ? std::stoull(argv[1]) : 2'000'000;
+  printf("%llu entries per pass, bursts of %llu every %llu ms, %u CPUs\n",
+         (unsigned long long)(entry_count), (unsigned long long)(BURST_SIZE),
+         (unsigned long long)(BURST_INTERVAL_MS), std::thread::hardware_concurrency());
+  printf("%-10s %-12s %12s %12s %12s %8s\n", "mode", "loop", "entries/s", "p50 lag ms",
+         "p99 lag ms", "output");
+  for (bool bursts : {false, true}) {
+    std::string expected;
+    for (uint32_t threads : {0, 1, 2, 4}) {
+      PassResult result;
+      if (int err = run_pass(entry_count, threads, bursts, &result); err != 0) {
+        fprintf(stderr, "pass failed: %s\n", strerror(-err));
+        return 1;
+      }
+      if (threads == 0) {
+        expected = result.output;
+      }
+      const std::string loop =
+          threads == 0 ? "sequential" : "pipeline -j" + std::to_string(threads);
+      // sustained passes have no idle gaps, so only their throughput is shown.
+      if (bursts) {
+        printf("%-10s %-12s %12.0f %12.1f %12.1f %8s\n", "bursts", loop.c_str(),
+               double(result.entries) / result.seconds, percentile(result.lags_ms, 0.5),
+               percentile(result.lags_ms, 0.99), result.output == expected ? "same" : "DIFFERS");
+      } else {
+        printf("%-10s %-12s %12.0f %12s %12s %8s\n", "sustained", loop.c_str(),
+               double(result.entries) / result.seconds, "-", "-",
+               result.output == expected ? "same" : "DIFFERS");
+      }
+    }
+  }
+  return 0;
+}
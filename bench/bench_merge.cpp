@@ -0,0 +1,126 @@
+// Measures the k-way merge of --directory and --file sources as the number of sources grows,
+// eg. `bin/bench_merge 2000000`. The same number of entries is split between 1 to 8
+// synthetic journals, each read and encoded into batches on a thread of its own as
+// `export_sources()` does, and merged by timestamp with a `BatchMerger`. The journals log at
+// the same times, so every source takes turns at the top of the heap.
+//
+// 'discard' drops the merged entries, measuring the reading, encoding and merging alone, and
+// 'write' writes them to a file with zstd compression, as an export does.
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "batch_merge.hpp"
+#include "encoder.hpp"
+#include "journal.hpp"
+#include "output.hpp"
+#include "synthetic_journal.hpp"
+
+// the same as in merge.cpp.
+constexpr size_t BATCH_ENTRIES = 1024;
+constexpr size_t MAX_QUEUED_BATCHES = 4;
+
+void read_source(size_t index, sd_journal *j, BatchMerger *merger) {
+  int err = 0;
+  std::unique_ptr<LogEncoder> encoder = make_encoder(ENCODING_JSON);
+  const std::string machine = "machine" + std::to_string(index);
+  EntryBatch batch;
+  JournalEntry entry;
+  while ((err = read_journal_entry(j, UINT64_MAX, &entry)) > 0) {
+    ChannelKey key;
+    key.transport = entry.transport;
+    key.machine = machine;
+    batch.append(entry.timestamp, key, encoder->encode(entry));
+    if (batch.size() >= BATCH_ENTRIES && !merger->push(index, &batch)) {
+      break;
+    }
+  }
+  if (err == 0 && !batch.empty()) {
+    merger->push(index, &batch);
+  }
+  merger->finish(index, err < 0 ? err : 0);
+}
+
+int run_pass(size_t source_count, uint64_t entry_count, bool write, double *seconds) {
+  char path[] = "/tmp/bench_merge-XXXXXX";
+  int fd = mkstemp(path);
+  if (fd < 0) {
+    return -errno;
+  }
+  close(fd);
+  // the journals generate their entries when opened, which is left out of the time.
+  std::vector<sd_journal *> journals(source_count, nullptr);
+  int err = 0;
+  for (size_t i = 0; i < source_count && err == 0; ++i) {
+    err = synthetic_journal_open(&journals[i], entry_count / source_count, 42 + i);
+  }
+  auto cleanup = [&]() {
+    for (sd_journal *j : journals) {
+      if (j != nullptr) {
+        sd_journal_close(j);
+      }
+    }
+    unlink(path);
+  };
+  if (err != 0) {
+    cleanup();
+    return err;
+  }
+  const auto start = std::chrono::steady_clock::now();
+  std::unique_ptr<LogEncoder> encoder = make_encoder(ENCODING_JSON);
+  LogWriterOptions options;
+  options.compression = mcap::Compression::Zstd;
+  LogWriter writer;
+  if (auto res = writer.open(path, *encoder, options); !res.ok()) {
+    fprintf(stderr, "open failed: %s\n", res.message.c_str());
+    cleanup();
+    return -EIO;
+  }
+  BatchMerger merger(source_count, MAX_QUEUED_BATCHES);
+  std::vector<std::thread> readers;
+  for (size_t i = 0; i < source_count; ++i) {
+    readers.emplace_back(read_source, i, journals[i], &merger);
+  }
+  size_t failed_source = 0;
+  err = merger.merge(
+      [&](uint64_t timestamp, const ChannelKey &key, std::string_view encoded) {
+        return !write || writer.write(timestamp, key, encoded).ok();
+      },
+      &failed_source);
+  for (auto &reader : readers) {
+    reader.join();
+  }
+  writer.close();
+  *seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  cleanup();
+  return err > 0 ? -EIO : err;
+}
+
+int main(int argc, const char **argv) {
+  const uint64_t entry_count = argc > 1 ? std::stoull(argv[1]) : 2'000'000;
+  printf("%llu entries per pass, split between the sources\n",
+         (unsigned long long)(entry_count));
+  printf("%-8s %8s %12s %8s\n", "output", "sources", "entries/s", "speedup");
+  for (bool write : {false, true}) {
+    double single_seconds = 0;
+    for (size_t source_count : {1, 2, 4, 8}) {
+      double seconds = 0;
+      if (int err = run_pass(source_count, entry_count, write, &seconds); err != 0) {
+        fprintf(stderr, "pass failed: %s\n", strerror(-err));
+        return 1;
+      }
+      if (source_count == 1) {
+        single_seconds = seconds;
+      }
+      printf("%-8s %8zu %12.0f %7.2fx\n", write ? "write" : "discard", source_count,
+             double(entry_count / source_count * source_count) / seconds,
+             single_seconds / seconds);
+      fflush(stdout);
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,164 @@
+// Measures the time to the first entry of an export from a journal directory of many archived
+// files, opening every file with libsystemd as `sd_journal_open()` does, and opening only the
+// files whose headers show they may hold the exported entries, as the local journal is read,
+// eg. `bin/bench_open 200 1000`. The files are generated first, as journald leaves them
+// after as many rotations, and are read from the page cache.
+//
+// 'now' starts at the tail of the journal, as `--start now` does, and 'timestamp' halfway
+// through the last archived file, as `--start` with a recent timestamp does. Both ways of
+// opening the journal are checked to find the same first entry.
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <systemd/sd-journal.h>
+#include <vector>
+
+#include "journal_file.hpp"
+#include "journal_file_builder.hpp"
+
+constexpr int REPEATS = 15;
+constexpr uint64_t FIRST_USEC = 1'700'000'000'000'000;
+constexpr uint64_t ENTRY_INTERVAL_USEC = 1000;
+
+struct PassResult {
+  double seconds = 0;
+  size_t file_count = 0;
+  uint64_t first_realtime_usec = 0;
+};
+
+// opens the journal in `dir` and reads the first entry at or after `start_usec`, or the last
+// entry if it is 0.
+int first_entry(const std::string &dir, bool selected, uint64_t start_usec, PassResult *result) {
+  const auto start = std::chrono::steady_clock::now();
+  sd_journal *j = nullptr;
+  int err = 0;
+  if (selected) {
+    std::vector<std::string> paths;
+    err = list_journal_files(dir, &paths);
+    if (err != 0) {
+      return err;
+    }
+    JournalFileFilter filter;
+    if (start_usec != 0) {
+      filter.start_usec = start_usec;
+    } else {
+      struct timespec now;
+      clock_gettime(CLOCK_REALTIME, &now);
+      filter.start_usec = uint64_t(now.tv_sec) * 1'000'000 + uint64_t(now.tv_nsec) / 1000;
+    }
+    const std::vector<std::string> picked = select_journal_files(paths, filter);
+    std::vector<const char *> c_paths;
+    for (const auto &path : picked) {
+      c_paths.push_back(path.c_str());
+    }
+    c_paths.push_back(nullptr);
+    result->file_count = picked.size();
+    err = sd_journal_open_files(&j, c_paths.data(), 0);
+  } else {
+    err = sd_journal_open_directory(&j, dir.c_str(), 0);
+  }
+  if (err != 0) {
+    return err;
+  }
+  if (start_usec == 0) {
+    err = sd_journal_seek_tail(j);
+    if (err == 0) {
+      err = sd_journal_previous(j);
+    }
+  } else {
+    err = sd_journal_seek_realtime_usec(j, start_usec);
+    if (err == 0) {
+      err = sd_journal_next(j);
+    }
+  }
+  if (err == 1) {
+    err = sd_journal_get_realtime_usec(j, &result->first_realtime_usec);
+  } else if (err == 0) {
+    err = -ENOENT;
+  }
+  result->seconds =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  sd_journal_close(j);
+  if (!selected && err == 0) {
+    std::vector<std::string> paths;
+    err = list_journal_files(dir, &paths);
+    result->file_count = paths.size();
+  }
+  return err;
+}
+
+int generate_directory(const std::string &dir, uint64_t file_count, uint64_t entries_per_file) {
+  uint64_t seqnum = 1;
+  uint64_t usec = FIRST_USEC;
+  for (uint64_t i = 0; i <= file_count; ++i) {
+    JournalFileBuilder builder;
+    generate_entries(&builder, entries_per_file, seqnum, usec);
+    // named as journald names the files it archives.
+    char name[128];
+    snprintf(name, sizeof(name), "system@01010101010101010101010101010101-%016llx-%016llx.journal",
+             (unsigned long long)(seqnum), (unsigned long long)(usec));
+    const bool archived = i < file_count;
+    if (int err = builder.write(dir + "/" + (archived ? name : "system.journal"), archived);
+        err != 0) {
+      return err;
+    }
+    seqnum += entries_per_file;
+    usec += entries_per_file * ENTRY_INTERVAL_USEC;
+  }
+  return 0;
+}
+
+int main(int argc, const char **argv) {
+  const uint64_t file_count = argc > 1 ? std::stoull(argv[1]) : 200;
+  const uint64_t entries_per_file = argc > 2 ? std::stoull(argv[2]) : 1000;
+  char dir[] = "/tmp/bench_open-XXXXXX";
+  if (mkdtemp(dir) == nullptr) {
+    perror("mkdtemp");
+    return 1;
+  }
+  auto cleanup = [&]() { std::system(("rm -r " + std::string(dir)).c_str()); };
+  if (int err = generate_directory(dir, file_count, entries_per_file); err != 0) {
+    fprintf(stderr, "failed to generate journal files: %s\n", strerror(-err));
+    cleanup();
+    return 1;
+  }
+  printf("%llu archived files and an active one of %llu entries each, median of %d runs\n",
+         (unsigned long long)(file_count), (unsigned long long)(entries_per_file), REPEATS);
+  printf("%-10s %-10s %8s %14s %8s %8s\n", "start", "open", "files", "first entry ms",
+         "speedup", "entry");
+  const uint64_t recent_usec =
+      FIRST_USEC + (file_count - 1) * entries_per_file * ENTRY_INTERVAL_USEC +
+      entries_per_file / 2 * ENTRY_INTERVAL_USEC;
+  for (uint64_t start_usec : {uint64_t(0), recent_usec}) {
+    double directory_ms = 0;
+    uint64_t expected = 0;
+    for (bool selected : {false, true}) {
+      std::vector<double> times_ms;
+      PassResult result;
+      for (int i = 0; i < REPEATS; ++i) {
+        if (int err = first_entry(dir, selected, start_usec, &result); err != 0) {
+          fprintf(stderr, "pass failed: %s\n", strerror(-err));
+          cleanup();
+          return 1;
+        }
+        times_ms.push_back(result.seconds * 1e3);
+      }
+      std::sort(times_ms.begin(), times_ms.end());
+      const double median_ms = times_ms[times_ms.size() / 2];
+      if (!selected) {
+        directory_ms = median_ms;
+        expected = result.first_realtime_usec;
+      }
+      printf("%-10s %-10s %8zu %14.2f %7.1fx %8s\n", start_usec == 0 ? "now" : "timestamp",
+             selected ? "selected" : "directory", result.file_count, median_ms,
+             directory_ms / median_ms,
+             result.first_realtime_usec == expected ? "same" : "DIFFERS");
+    }
+  }
+  cleanup();
+  return 0;
+}
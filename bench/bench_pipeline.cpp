@@ -0,0 +1,181 @@
+// Measures the whole read -> encode -> write pipeline on a synthetic in-process journal, eg.
+// `bin/bench_pipeline 5000000`, for each encoder and compression setting. Each setting runs
+// in its own process, so the peak RSS reported is its own.
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "encoder.hpp"
+#include "journal.hpp"
+#include "output.hpp"
+#include "stats.hpp"
+#include "synthetic_journal.hpp"
+
+struct BenchConfig {
+  const char *name;
+  Encoding encoding;
+  mcap::Compression compression;
+  uint32_t compression_threads;
+  bool stats = false;
+  TopicScheme topics = TOPICS_TRANSPORT;
+  OutputIo io = IO_STDIO;
+};
+
+struct PassResult {
+  uint64_t entries = 0;
+  // the size of the journal fields read.
+  uint64_t input_bytes = 0;
+  uint64_t output_bytes = 0;
+  uint64_t pool_bytes = 0;
+  double seconds = 0;
+  int err = 0;
+};
+
+PassResult run_pass(const BenchConfig &config, uint64_t entry_count) {
+  PassResult result;
+  sd_journal *j = nullptr;
+  result.err = synthetic_journal_open(&j, entry_count);
+  if (result.err != 0) {
+    return result;
+  }
+  result.pool_bytes = synthetic_journal_pool_bytes(j);
+  char path[] = "/tmp/bench_pipeline-XXXXXX";
+  int fd = mkstemp(path);
+  if (fd < 0) {
+    result.err = -errno;
+    sd_journal_close(j);
+    return result;
+  }
+  close(fd);
+
+  const auto start = std::chrono::steady_clock::now();
+  std::unique_ptr<LogEncoder> encoder = make_encoder(config.encoding);
+  LogWriterOptions writer_options;
+  writer_options.compression = config.compression;
+  writer_options.compression_threads = config.compression_threads;
+  writer_options.topics = config.topics;
+  writer_options.io = config.io;
+  LogWriter writer;
+  if (auto res = writer.open(path, *encoder, writer_options); !res.ok()) {
+    fprintf(stderr, "open failed: %s\n", res.message.c_str());
+    result.err = -EIO;
+  }
+  // timed the same way as the export loop in main(), so --stats overhead shows up here.
+  StageTimer timer(config.stats);
+  JournalEntry entry;
+  while (result.err == 0) {
+    timer.begin();
+    int err = read_journal_entry(j, UINT64_MAX, &entry);
+    timer.lap(STAGE_READ);
+    if (err <= 0) {
+      result.err = err;
+      break;
+    }
+    std::string_view encoded = encoder->encode(entry);
+    timer.lap(STAGE_ENCODE);
+    auto res = writer.write(entry.timestamp, channel_key(entry), encoded);
+    timer.lap(STAGE_WRITE);
+    if (!res.ok()) {
+      fprintf(stderr, "write failed: %s\n", res.message.c_str());
+      result.err = -EIO;
+    }
+    result.entries++;
+    result.input_bytes += entry.field_data.size();
+  }
+  writer.close();
+  if (result.err == 0 && writer.output_error() != 0) {
+    result.err = writer.output_error();
+  }
+  result.seconds =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  struct stat st;
+  if (stat(path, &st) == 0) {
+    result.output_bytes = st.st_size;
+  }
+  unlink(path);
+  sd_journal_close(j);
+  return result;
+}
+
+/**
+ * @brief runs the pass in a child process, and returns its result and peak RSS in KiB.
+ */
+int run_isolated(const BenchConfig &config, uint64_t entry_count, PassResult *result,
+                 long *max_rss_kb) {
+  int fds[2];
+  if (pipe(fds) != 0) {
+    return -errno;
+  }
+  pid_t pid = fork();
+  if (pid < 0) {
+    return -errno;
+  }
+  if (pid == 0) {
+    close(fds[0]);
+    PassResult child_result = run_pass(config, entry_count);
+    ssize_t written = write(fds[1], &child_result, sizeof(child_result));
+    _exit(written == sizeof(child_result) ? 0 : 1);
+  }
+  close(fds[1]);
+  ssize_t got = read(fds[0], result, sizeof(*result));
+  close(fds[0]);
+  int status = 0;
+  struct rusage usage;
+  if (wait4(pid, &status, 0, &usage) < 0) {
+    return -errno;
+  }
+  if (got != sizeof(*result) || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    return -ECHILD;
+  }
+  *max_rss_kb = usage.ru_maxrss;
+  return result->err;
+}
+
+int main(int argc, const char **argv) {
+  const uint64_t entry_count = argc > 1 ? std::stoull(argv[1]) : 2'000'000;
+  const BenchConfig configs[] = {
+      {"json      none", ENCODING_JSON, mcap::Compression::None, 0},
+      {"json      lz4", ENCODING_JSON, mcap::Compression::Lz4, 0},
+      {"json      zstd", ENCODING_JSON, mcap::Compression::Zstd, 0},
+      {"json      zstd -t1", ENCODING_JSON, mcap::Compression::Zstd, 1},
+      {"json      zstd stats", ENCODING_JSON, mcap::Compression::Zstd, 0, true},
+      {"json      zstd unit", ENCODING_JSON, mcap::Compression::Zstd, 0, false, TOPICS_UNIT},
+      {"json      none thread", ENCODING_JSON, mcap::Compression::None, 0, false,
+       TOPICS_TRANSPORT, IO_THREAD},
+      {"json      none uring", ENCODING_JSON, mcap::Compression::None, 0, false,
+       TOPICS_TRANSPORT, IO_URING},
+      {"json      zstd uring", ENCODING_JSON, mcap::Compression::Zstd, 0, false,
+       TOPICS_TRANSPORT, IO_URING},
+      {"protobuf  none", ENCODING_PROTOBUF, mcap::Compression::None, 0},
+      {"protobuf  lz4", ENCODING_PROTOBUF, mcap::Compression::Lz4, 0},
+      {"protobuf  zstd", ENCODING_PROTOBUF, mcap::Compression::Zstd, 0},
+      {"protobuf  zstd -t1", ENCODING_PROTOBUF, mcap::Compression::Zstd, 1},
+  };
+  printf("%llu entries per pass; '-t1' compresses on 1 background thread, 'stats' is "
+         "timed as for --stats, 'unit' uses --topics unit, 'thread' and 'uring' set --io\n",
+         (unsigned long long)(entry_count));
+  printf("%-22s %12s %10s %10s %12s %10s\n", "setting", "entries/s", "in MB/s", "out MB/s",
+         "bytes/entry", "peak RSS");
+  PassResult result;
+  for (const auto &config : configs) {
+    long max_rss_kb = 0;
+    int err = run_isolated(config, entry_count, &result, &max_rss_kb);
+    if (err != 0) {
+      fprintf(stderr, "%s failed: %s\n", config.name, strerror(-err));
+      return 1;
+    }
+    printf("%-22s %12.0f %10.1f %10.1f %12.1f %7.1f MB\n", config.name,
+           result.entries / result.seconds, result.input_bytes / result.seconds / 1e6,
+           result.output_bytes / result.seconds / 1e6,
+           double(result.output_bytes) / double(result.entries), max_rss_kb / 1024.0);
+  }
+  printf("the synthetic journal holds %.1f MB of distinct entries, %.0f bytes/entry read\n",
+         result.pool_bytes / 1e6, double(result.input_bytes) / double(result.entries));
+  return 0;
+}
@@ -0,0 +1,159 @@
+// Measures the resident memory of a long recording, with chunk indexes kept in memory until
+// the file is closed and with them spilled to a temporary file as `--end wait` does, eg.
+// `bin/bench_soak 100000000`. As in wait mode with `--max-chunk-latency`, the output is
+// flushed every `flush_interval` entries, so every flush writes a chunk and its index.
+// Each mode runs in a child process, so that neither sees the other's heap. The peak resident
+// memory is reported once the file is closed, as close() writes the chunk indexes out.
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+#include "encoder.hpp"
+#include "journal.hpp"
+#include "output.hpp"
+#include "synthetic_journal.hpp"
+
+// how many distinct entries are encoded up front and written over and over.
+constexpr uint64_t POOL_SIZE = 10'000;
+// how many times resident memory is sampled during each pass.
+constexpr uint64_t SAMPLE_COUNT = 10;
+// `--end wait`'s limit, see WAIT_MAX_INDEX_MEMORY.
+constexpr uint64_t MAX_INDEX_MEMORY = 1 << 20;
+
+struct EncodedEntry {
+  ChannelKey key;
+  std::string data;
+};
+
+int encode_pool(std::vector<EncodedEntry> *pool) {
+  sd_journal *j = nullptr;
+  int err = synthetic_journal_open(&j, POOL_SIZE);
+  if (err != 0) {
+    return err;
+  }
+  std::unique_ptr<LogEncoder> encoder = make_encoder(ENCODING_JSON);
+  JournalEntry entry;
+  while (read_journal_entry(j, UINT64_MAX, &entry) > 0) {
+    // only the transport is kept, as the unit and command would point into the journal.
+    EncodedEntry encoded;
+    encoded.key.transport = entry.transport;
+    encoded.data = encoder->encode(entry);
+    pool->push_back(std::move(encoded));
+  }
+  sd_journal_close(j);
+  return 0;
+}
+
+uint64_t resident_bytes() {
+  FILE *file = fopen("/proc/self/statm", "r");
+  unsigned long long pages = 0;
+  unsigned long long resident = 0;
+  if (file != nullptr) {
+    if (fscanf(file, "%llu %llu", &pages, &resident) != 2) {
+      resident = 0;
+    }
+    fclose(file);
+  }
+  return resident * uint64_t(sysconf(_SC_PAGESIZE));
+}
+
+// the peak resident memory of the process so far, from VmHWM.
+uint64_t peak_resident_bytes() {
+  FILE *file = fopen("/proc/self/status", "r");
+  unsigned long long kb = 0;
+  if (file != nullptr) {
+    char line[256];
+    while (fgets(line, sizeof(line), file) != nullptr) {
+      if (sscanf(line, "VmHWM: %llu kB", &kb) == 1) {
+        break;
+      }
+    }
+    fclose(file);
+  }
+  return kb * 1024;
+}
+
+int run_pass(const std::vector<EncodedEntry> &pool, uint64_t entry_count,
+             uint64_t flush_interval, uint64_t max_index_memory, const std::string &path) {
+  std::unique_ptr<LogEncoder> encoder = make_encoder(ENCODING_JSON);
+  LogWriterOptions options;
+  options.max_index_memory = max_index_memory;
+  LogWriter writer;
+  if (auto res = writer.open(path, *encoder, options); !res.ok()) {
+    fprintf(stderr, "open failed: %s\n", res.message.c_str());
+    return -EIO;
+  }
+  const char *mode = max_index_memory != 0 ? "spilled" : "in memory";
+  const uint64_t sample_interval = std::max<uint64_t>(entry_count / SAMPLE_COUNT, 1);
+  const uint64_t start = resident_bytes();
+  for (uint64_t i = 0; i < entry_count; ++i) {
+    const EncodedEntry &entry = pool[i % pool.size()];
+    if (auto res = writer.write(1'700'000'000'000'000'000 + i * 1000, entry.key, entry.data);
+        !res.ok()) {
+      fprintf(stderr, "write failed: %s\n", res.message.c_str());
+      return -EIO;
+    }
+    if ((i + 1) % flush_interval == 0) {
+      writer.flush();
+    }
+    if ((i + 1) % sample_interval == 0) {
+      const uint64_t resident = resident_bytes();
+      printf("%-10s %12llu %10llu %10.1f %10.1f\n", mode, (unsigned long long)(i + 1),
+             (unsigned long long)(writer.chunk_stats().chunk_count), double(resident) / 1e6,
+             (double(resident) - double(start)) / 1e6);
+      fflush(stdout);
+    }
+  }
+  writer.close();
+  const uint64_t peak = peak_resident_bytes();
+  printf("%-10s %12s %10llu %10.1f %10.1f  peak through close()\n", mode, "closed",
+         (unsigned long long)(writer.chunk_stats().chunk_count), double(peak) / 1e6,
+         (double(peak) - double(start)) / 1e6);
+  fflush(stdout);
+  return writer.output_error();
+}
+
+int main(int argc, const char **argv) {
+  const uint64_t entry_count = argc > 1 ? std::stoull(argv[1]) : 100'000'000;
+  const uint64_t flush_interval = argc > 2 ? std::stoull(argv[2]) : 100;
+  std::vector<EncodedEntry> pool;
+  if (int err = encode_pool(&pool); err != 0) {
+    fprintf(stderr, "failed to encode entries: %s\n", strerror(-err));
+    return 1;
+  }
+  char dir[] = "/tmp/bench_soak-XXXXXX";
+  if (mkdtemp(dir) == nullptr) {
+    perror("mkdtemp");
+    return 1;
+  }
+  const std::string path = std::string(dir) + "/soak.mcap";
+  printf("%llu entries, flushed every %llu\n", (unsigned long long)(entry_count),
+         (unsigned long long)(flush_interval));
+  printf("%-10s %12s %10s %10s %10s\n", "indexes", "entries", "chunks", "rss MB", "growth MB");
+  fflush(stdout);
+  int status = 0;
+  for (uint64_t max_index_memory : {uint64_t(0), MAX_INDEX_MEMORY}) {
+    const pid_t pid = fork();
+    if (pid < 0) {
+      perror("fork");
+      status = 1;
+      break;
+    }
+    if (pid == 0) {
+      _exit(run_pass(pool, entry_count, flush_interval, max_index_memory, path) == 0 ? 0 : 1);
+    }
+    int child_status = 0;
+    if (waitpid(pid, &child_status, 0) < 0 || !WIFEXITED(child_status) ||
+        WEXITSTATUS(child_status) != 0) {
+      fprintf(stderr, "pass failed\n");
+      status = 1;
+    }
+    unlink(path.c_str());
+  }
+  rmdir(dir);
+  return status;
+}
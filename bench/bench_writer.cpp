@@ -0,0 +1,95 @@
+// Measures how fast McapWriter ingests log-sized messages, with chunks compressed inline and
+// by background compression threads.
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+#define MCAP_IMPLEMENTATION
+#include "vendor/mcap/writer.hpp"
+
+/**
+ * @brief Discards everything written to it, so that only chunking and compression are timed.
+ */
+class NullWriter final : public mcap::IWritable {
+public:
+  void handleWrite(const std::byte *data, uint64_t size) override { size_ += size; }
+  void end() override {}
+  uint64_t size() const override { return size_; }
+
+private:
+  uint64_t size_ = 0;
+};
+
+std::vector<std::string> make_messages(size_t count) {
+  const char *words[] = {"started", "stopped", "connection", "from", "timeout", "session",
+                         "opened", "closed", "user", "root", "failed", "succeeded"};
+  std::mt19937 rng(42);
+  std::vector<std::string> messages;
+  messages.reserve(count);
+  for (size_t i = 0; i < count; ++i) {
+    std::string message = R"({"level":2,"message":")";
+    size_t word_count = 4 + rng() % 24;
+    for (size_t w = 0; w < word_count; ++w) {
+      message += words[rng() % (sizeof(words) / sizeof(words[0]))];
+      message += ' ';
+    }
+    message += std::to_string(rng());
+    message += R"(","name":"sshd.service","timestamp":{"nsec":)";
+    message += std::to_string(rng() % 1000000000);
+    message += "}}";
+    messages.push_back(std::move(message));
+  }
+  return messages;
+}
+
+void run(const char *name, mcap::Compression compression, uint32_t threads,
+         const std::vector<std::string> &messages, int rounds) {
+  NullWriter output;
+  mcap::McapWriterOptions options("");
+  options.compression = compression;
+  options.compressionThreads = threads;
+  mcap::McapWriter writer;
+  const auto start = std::chrono::steady_clock::now();
+  writer.open(output, options);
+  mcap::Schema schema("foxglove.Log", "jsonschema", "{}");
+  writer.addSchema(schema);
+  mcap::Channel channel("/journald/syslog", "json", schema.id);
+  writer.addChannel(channel);
+  uint64_t bytes = 0;
+  uint32_t sequence = 0;
+  for (int round = 0; round < rounds; ++round) {
+    for (const auto &data : messages) {
+      mcap::Message message;
+      message.channelId = channel.id;
+      message.sequence = sequence++;
+      message.logTime = sequence;
+      message.publishTime = sequence;
+      message.data = (const std::byte *)(data.data());
+      message.dataSize = data.size();
+      if (auto res = writer.write(message); !res.ok()) {
+        fprintf(stderr, "write failed: %s\n", res.message.c_str());
+        return;
+      }
+      bytes += data.size();
+    }
+  }
+  writer.close();
+  const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  printf("%-6s threads=%u  %10.0f msg/s  %8.1f MB/s  (%llu bytes out)\n", name, threads,
+         sequence / elapsed.count(), bytes / elapsed.count() / 1e6,
+         (unsigned long long)(output.size()));
+}
+
+int main(int argc, const char **argv) {
+  const int rounds = argc > 1 ? std::stoi(argv[1]) : 20;
+  const auto messages = make_messages(100000);
+  for (uint32_t threads : {0, 1, 2, 4}) {
+    run("zstd", mcap::Compression::Zstd, threads, messages, rounds);
+  }
+  for (uint32_t threads : {0, 1, 2}) {
+    run("lz4", mcap::Compression::Lz4, threads, messages, rounds);
+  }
+  return 0;
+}
@@ -0,0 +1,169 @@
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <zstd.h>
+
+#include "journal_file_builder.hpp"
+
+namespace {
+
+// journald's default threshold for compressing a field.
+constexpr size_t COMPRESS_THRESHOLD = 512;
+constexpr size_t HEADER_SIZE = 272;
+
+void append_le(std::string *out, uint64_t value, size_t size) {
+  for (size_t i = 0; i < size; ++i) {
+    out->push_back(char((value >> (8 * i)) & 0xff));
+  }
+}
+
+void write_le(std::string *out, size_t offset, uint64_t value, size_t size) {
+  for (size_t i = 0; i < size; ++i) {
+    (*out)[offset + i] = char((value >> (8 * i)) & 0xff);
+  }
+}
+
+} // namespace
+
+JournalFileBuilder::JournalFileBuilder() : out_(HEADER_SIZE, '\0') {}
+
+void JournalFileBuilder::add(uint64_t seqnum, uint64_t realtime_usec,
+                             const std::vector<std::string> &fields) {
+  std::vector<uint64_t> items;
+  for (const auto &field : fields) {
+    auto [it, inserted] = data_offsets_.emplace(field, 0);
+    if (inserted) {
+      it->second = add_data(field);
+    }
+    items.push_back(it->second);
+  }
+  const size_t offset = begin_object(3, 0);
+  append_le(&out_, seqnum, 8);
+  append_le(&out_, realtime_usec, 8);
+  append_le(&out_, realtime_usec, 8);
+  out_.append(16, char(1));
+  append_le(&out_, seqnum * 0x9e3779b97f4a7c15ull, 8);
+  for (uint64_t item : items) {
+    append_le(&out_, item, 4);
+  }
+  end_object(offset);
+  if (entry_offsets_.empty()) {
+    head_realtime_usec_ = realtime_usec;
+  }
+  tail_realtime_usec_ = realtime_usec;
+  entry_offsets_.push_back(offset);
+}
+
+int JournalFileBuilder::write(const std::string &path, bool archived) {
+  uint64_t first_array = 0;
+  uint64_t previous_array = 0;
+  size_t capacity = 4;
+  for (size_t i = 0; i < entry_offsets_.size(); i += capacity, capacity *= 2) {
+    const size_t offset = begin_object(6, 0);
+    append_le(&out_, 0, 8);
+    for (size_t j = i; j < i + capacity; ++j) {
+      append_le(&out_, j < entry_offsets_.size() ? entry_offsets_[j] : 0, 4);
+    }
+    end_object(offset);
+    if (previous_array != 0) {
+      write_le(&out_, previous_array + 16, offset, 8);
+    } else {
+      first_array = offset;
+    }
+    previous_array = offset;
+  }
+  memcpy(out_.data(), "LPKSHHRH", 8);
+  // compact, with ZSTD compressed fields.
+  write_le(&out_, 12, (1 << 4) | (1 << 3), 4);
+  // offline or archived, and the boot of the last entry.
+  out_[16] = char(archived ? 2 : 0);
+  memset(out_.data() + 56, 1, 16);
+  memset(out_.data() + 72, 1, 16);
+  write_le(&out_, 88, HEADER_SIZE, 8);
+  write_le(&out_, 96, out_.size() - HEADER_SIZE, 8);
+  write_le(&out_, 152, entry_offsets_.size(), 8);
+  write_le(&out_, 176, first_array, 8);
+  write_le(&out_, 184, head_realtime_usec_, 8);
+  write_le(&out_, 192, tail_realtime_usec_, 8);
+  FILE *file = fopen(path.c_str(), "w");
+  if (file == nullptr) {
+    return -errno;
+  }
+  const bool ok = fwrite(out_.data(), 1, out_.size(), file) == out_.size();
+  return fclose(file) == 0 && ok ? 0 : -EIO;
+}
+
+size_t JournalFileBuilder::begin_object(uint8_t type, uint8_t flags) {
+  out_.resize((out_.size() + 7) / 8 * 8, '\0');
+  const size_t offset = out_.size();
+  out_.push_back(char(type));
+  out_.push_back(char(flags));
+  out_.append(14, '\0');
+  return offset;
+}
+
+void JournalFileBuilder::end_object(size_t offset) {
+  write_le(&out_, offset + 8, out_.size() - offset, 8);
+}
+
+uint64_t JournalFileBuilder::add_data(const std::string &field) {
+  std::string payload = field;
+  uint8_t flags = 0;
+  if (field.size() >= COMPRESS_THRESHOLD) {
+    payload.resize(ZSTD_compressBound(field.size()));
+    payload.resize(ZSTD_compress(payload.data(), payload.size(), field.data(), field.size(), 1));
+    flags = 1 << 2;
+  }
+  const size_t offset = begin_object(1, flags);
+  out_.append(56, '\0');
+  out_ += payload;
+  end_object(offset);
+  return offset;
+}
+
+void generate_entries(JournalFileBuilder *builder, uint64_t entry_count, uint64_t first_seqnum,
+                      uint64_t start_usec) {
+  std::mt19937_64 rng(42 + first_seqnum - 1);
+  std::vector<std::string> traces;
+  for (int i = 0; i < 8; ++i) {
+    std::string trace = "MESSAGE=Traceback (most recent call last):\n";
+    for (int frame = 0; frame < 40; ++frame) {
+      trace += "  File \"/usr/lib/python3/dist-packages/service/module" + std::to_string(i) +
+               ".py\", line " + std::to_string(100 + frame * 7) + ", in handler_" +
+               std::to_string(frame) + "\n    result = self.dispatch(request)\n";
+    }
+    traces.push_back(trace + "RuntimeError: request failed");
+  }
+  for (uint64_t i = 0; i < entry_count; ++i) {
+    const uint64_t service = rng() % 40;
+    const std::string name = "service" + std::to_string(service);
+    std::vector<std::string> fields = {
+        "_BOOT_ID=0123456789abcdef0123456789abcdef",
+        "_MACHINE_ID=fedcba9876543210fedcba9876543210",
+        "_HOSTNAME=robot",
+        "_TRANSPORT=stdout",
+        "PRIORITY=" + std::to_string(rng() % 8 == 0 ? 3 : 6),
+        "SYSLOG_FACILITY=3",
+        "SYSLOG_IDENTIFIER=" + name,
+        "_PID=" + std::to_string(1000 + service),
+        "_UID=0",
+        "_GID=0",
+        "_COMM=" + name,
+        "_EXE=/usr/bin/" + name,
+        "_CMDLINE=/usr/bin/" + name + " --config /etc/" + name + ".conf",
+        "_CAP_EFFECTIVE=1ffffffffff",
+        "_SYSTEMD_CGROUP=/system.slice/" + name + ".service",
+        "_SYSTEMD_UNIT=" + name + ".service",
+        "_SYSTEMD_SLICE=system.slice",
+        "_STREAM_ID=" + std::to_string(0xabcdef00 + service),
+    };
+    if (rng() % 200 == 0) {
+      fields.push_back(traces[rng() % traces.size()]);
+    } else {
+      fields.push_back("MESSAGE=handled request " + std::to_string(rng() % 1000000) + " in " +
+                       std::to_string(rng() % 100) + " ms");
+    }
+    builder->add(first_seqnum + i, start_usec + i * 1000, fields);
+  }
+}
@@ -0,0 +1,59 @@
+#ifndef JOURNAL_FILE_BUILDER_HPP
+#define JOURNAL_FILE_BUILDER_HPP
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @brief Builds a journal file in memory the way journald lays it out: DATA objects shared by
+ * every entry with the same field, and entry arrays which double in size. Hash tables are
+ * left out, as readers do not use them to read every entry or to seek by time.
+ *
+ * The file is compact, with fields of 512 bytes or more compressed with ZSTD, as journald
+ * writes by default. Every entry belongs to the boot ID of 0x01 bytes, and every file to the
+ * sequence number ID of 0x01 bytes, so that the files built for a directory read as those of a
+ * single journald.
+ */
+class JournalFileBuilder {
+public:
+  JournalFileBuilder();
+
+  /**
+   * @brief adds an entry, which must come after those already added.
+   */
+  void add(uint64_t seqnum, uint64_t realtime_usec, const std::vector<std::string> &fields);
+
+  /**
+   * @brief writes the file to `path`, marked as archived by journald if `archived`.
+   *
+   * @returns 0 on success, or a negative errno-style value.
+   */
+  int write(const std::string &path, bool archived = false);
+
+  size_t size() const { return out_.size(); }
+  size_t data_count() const { return data_offsets_.size(); }
+
+private:
+  std::string out_;
+  std::unordered_map<std::string, uint64_t> data_offsets_;
+  std::vector<uint64_t> entry_offsets_;
+  uint64_t head_realtime_usec_ = 0;
+  uint64_t tail_realtime_usec_ = 0;
+
+  size_t begin_object(uint8_t type, uint8_t flags);
+  void end_object(size_t offset);
+  uint64_t add_data(const std::string &field);
+};
+
+/**
+ * @brief adds `entry_count` entries like those of a busy server, logged one millisecond apart
+ * from `start_usec` with sequence numbers from `first_seqnum`: a few dozen services, each with
+ * the trusted fields journald adds, logging mostly short lines with a unique part, and now and
+ * then one of a few multi-kilobyte stack traces.
+ */
+void generate_entries(JournalFileBuilder *builder, uint64_t entry_count,
+                      uint64_t first_seqnum = 1,
+                      uint64_t start_usec = 1'700'000'000'000'000);
+
+#endif
@@ -0,0 +1,402 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <iterator>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "synthetic_journal.hpp"
+
+namespace {
+
+// how many distinct entries are generated. Large enough that entries rarely repeat within a
+// chunk, so compression ratios are not flattered.
+constexpr size_t POOL_SIZE = 8192;
+constexpr uint64_t FIRST_USEC = 1'700'000'000'000'000;
+constexpr uint64_t ENTRY_INTERVAL_USEC = 1000;
+
+const char *const WORDS[] = {
+    "started",   "stopped", "connection", "from",     "timeout", "session",   "opened",
+    "closed",    "user",    "root",       "failed",   "retry",   "device",    "frame",
+    "dropped",   "queue",   "latency",    "received", "sent",    "waiting",   "for",
+    "transform", "map",     "odom",       "base_link", "goal",   "reached",   "cancelled",
+    "battery",   "voltage", "motor",      "current",  "limit",   "exceeded",  "publishing",
+};
+
+const char *const UNITS[] = {
+    "robot-controller", "camera-driver", "lidar-driver",   "navigation",
+    "planner",          "rosbridge",     "telemetry-agent", "sshd",
+    "NetworkManager",   "containerd",    "systemd-networkd", "battery-monitor",
+};
+
+const char *const KERNEL_MESSAGES[] = {
+    "usb 1-1.%d: new high-speed USB device number %d using xhci_hcd",
+    "eth0: Link is Up - 1Gbps/Full - flow control rx/tx",
+    "EXT4-fs (mmcblk0p%d): mounted filesystem with ordered data mode. Quota mode: none.",
+    "wlan0: disconnect from AP %02x:%02x:11:22:33:44 for new auth to %02x:%02x:11:22:33:45",
+    "uvcvideo 2-%d:1.0: Non-zero status (-71) in video completion handler.",
+    "audit: type=1400 audit(%d.%03d:1): apparmor=\"DENIED\" operation=\"open\" profile=\"snap\"",
+    "nvme nvme0: I/O %d QID %d timeout, completion polled",
+    "thermal thermal_zone%d: critical temperature reached (%d C), shutting down",
+};
+
+const char *const CODE_FILES[] = {
+    "src/controller/loop.cpp", "src/drivers/camera/v4l2_stream.cpp",
+    "src/nav/costmap_layer.cpp", "src/planner/global_planner.cpp",
+    "src/util/watchdog.cpp",
+};
+
+const char *const CODE_FUNCS[] = {
+    "ControlLoop::tick", "V4l2Stream::dequeue", "CostmapLayer::updateBounds",
+    "GlobalPlanner::makePlan", "Watchdog::check",
+};
+
+const char *const PYTHON_FUNCS[] = {
+    "spin_once", "_execute_callback", "handle_goal", "transform_pose", "lookup_transform",
+    "wait_for_future", "publish", "__call__",
+};
+
+// a pool entry, stored as "KEY=VALUE" fields as journald returns them.
+using SyntheticEntry = std::vector<std::string>;
+
+std::string hex_id(std::mt19937 &rng) {
+  char buf[33];
+  for (int i = 0; i < 4; ++i) {
+    snprintf(buf + i * 8, 9, "%08x", uint32_t(rng()));
+  }
+  return buf;
+}
+
+std::string words(std::mt19937 &rng, size_t count) {
+  std::string out;
+  for (size_t i = 0; i < count; ++i) {
+    if (i != 0) {
+      out.push_back(' ');
+    }
+    out += WORDS[rng() % std::size(WORDS)];
+    if (rng() % 5 == 0) {
+      out += ' ';
+      out += std::to_string(rng() % 100000);
+    }
+  }
+  return out;
+}
+
+std::string python_traceback(std::mt19937 &rng) {
+  std::string out = "Traceback (most recent call last):\n";
+  const size_t frames = 20 + rng() % 60;
+  for (size_t i = 0; i < frames; ++i) {
+    const char *func = PYTHON_FUNCS[rng() % std::size(PYTHON_FUNCS)];
+    out += "  File \"/opt/ros/lib/python3/dist-packages/rclpy/";
+    out += func;
+    out += ".py\", line " + std::to_string(1 + rng() % 900) + ", in " + func + "\n    ";
+    out += words(rng, 3 + rng() % 6) + "\n";
+  }
+  out += "RuntimeError: " + words(rng, 4 + rng() % 8);
+  return out;
+}
+
+class EntryGenerator {
+public:
+  explicit EntryGenerator(uint32_t seed)
+      : rng_(seed), boot_id_(hex_id(rng_)), machine_id_(hex_id(rng_)) {}
+
+  SyntheticEntry next() {
+    const uint32_t kind = rng_() % 100;
+    if (kind < 35) {
+      return kernel();
+    }
+    if (kind < 90) {
+      return stdout_line();
+    }
+    if (kind < 98) {
+      return native();
+    }
+    return stack_trace();
+  }
+
+  SyntheticEntry storm() {
+    SyntheticEntry entry;
+    add_common(&entry, "kernel", 3);
+    entry.push_back("SYSLOG_FACILITY=0");
+    entry.push_back("SYSLOG_IDENTIFIER=kernel");
+    entry.push_back("MESSAGE=usb 1-1.4: device descriptor read/64, error -71");
+    entry.push_back("_KERNEL_DEVICE=+usb:1-1.4");
+    entry.push_back("_KERNEL_SUBSYSTEM=usb");
+    return entry;
+  }
+
+private:
+  std::mt19937 rng_;
+  std::string boot_id_;
+  std::string machine_id_;
+
+  void add_common(SyntheticEntry *entry, const char *transport, int priority) {
+    entry->push_back("_BOOT_ID=" + boot_id_);
+    entry->push_back("_MACHINE_ID=" + machine_id_);
+    entry->push_back("_HOSTNAME=robot-0042");
+    entry->push_back(std::string("_TRANSPORT=") + transport);
+    entry->push_back("PRIORITY=" + std::to_string(priority));
+  }
+
+  // the fields journald adds for a process logging from a service.
+  void add_process(SyntheticEntry *entry, const char *unit) {
+    const std::string pid = std::to_string(300 + rng_() % 30000);
+    entry->push_back("SYSLOG_FACILITY=3");
+    entry->push_back(std::string("SYSLOG_IDENTIFIER=") + unit);
+    entry->push_back("_PID=" + pid);
+    entry->push_back("_UID=" + std::to_string(rng_() % 4 == 0 ? 0 : 1000));
+    entry->push_back("_GID=" + std::to_string(rng_() % 4 == 0 ? 0 : 1000));
+    entry->push_back(std::string("_COMM=") + std::string(unit).substr(0, 15));
+    entry->push_back(std::string("_EXE=/usr/bin/") + unit);
+    entry->push_back(std::string("_CMDLINE=/usr/bin/") + unit + " --config /etc/" + unit +
+                     ".yaml");
+    entry->push_back("_CAP_EFFECTIVE=0");
+    entry->push_back(std::string("_SYSTEMD_CGROUP=/system.slice/") + unit + ".service");
+    entry->push_back(std::string("_SYSTEMD_UNIT=") + unit + ".service");
+    entry->push_back("_SYSTEMD_SLICE=system.slice");
+    entry->push_back("_SYSTEMD_INVOCATION_ID=" + hex_id(rng_));
+  }
+
+  int service_priority() {
+    const uint32_t roll = rng_() % 100;
+    return roll < 70 ? 6 : roll < 85 ? 7 : roll < 95 ? 4 : 3;
+  }
+
+  SyntheticEntry kernel() {
+    SyntheticEntry entry;
+    add_common(&entry, "kernel", rng_() % 10 == 0 ? 4 : 6);
+    entry.push_back("SYSLOG_FACILITY=0");
+    entry.push_back("SYSLOG_IDENTIFIER=kernel");
+    entry.push_back("_SOURCE_MONOTONIC_TIMESTAMP=" + std::to_string(rng_()));
+    char message[256];
+    snprintf(message, sizeof(message), KERNEL_MESSAGES[rng_() % std::size(KERNEL_MESSAGES)],
+             int(rng_() % 8), int(rng_() % 128), int(rng_() % 256), int(rng_() % 256),
+             int(rng_() % 256), int(rng_() % 256));
+    entry.push_back(std::string("MESSAGE=") + message);
+    if (rng_() % 3 == 0) {
+      entry.push_back("_KERNEL_DEVICE=+usb:1-1." + std::to_string(rng_() % 8));
+      entry.push_back("_KERNEL_SUBSYSTEM=usb");
+      entry.push_back("_UDEV_SYSNAME=1-1." + std::to_string(rng_() % 8));
+    }
+    return entry;
+  }
+
+  SyntheticEntry stdout_line() {
+    SyntheticEntry entry;
+    // a few units log most of the lines.
+    const char *unit = UNITS[std::min<uint32_t>(rng_() % 6, rng_() % std::size(UNITS))];
+    add_common(&entry, "stdout", service_priority());
+    add_process(&entry, unit);
+    entry.push_back("_STREAM_ID=" + hex_id(rng_));
+    entry.push_back("MESSAGE=[" + std::to_string(rng_() % 100000) + "] " +
+                    words(rng_, 4 + rng_() % 30));
+    return entry;
+  }
+
+  SyntheticEntry native() {
+    SyntheticEntry entry;
+    const uint32_t code = rng_() % std::size(CODE_FILES);
+    add_common(&entry, "journal", service_priority());
+    add_process(&entry, UNITS[rng_() % 6]);
+    entry.push_back(std::string("CODE_FILE=") + CODE_FILES[code]);
+    entry.push_back("CODE_LINE=" + std::to_string(20 + rng_() % 800));
+    entry.push_back(std::string("CODE_FUNC=") + CODE_FUNCS[code]);
+    entry.push_back("TID=" + std::to_string(300 + rng_() % 30000));
+    if (rng_() % 4 == 0) {
+      entry.push_back("MESSAGE_ID=" + hex_id(rng_));
+    }
+    entry.push_back("MESSAGE=" + words(rng_, 6 + rng_() % 20));
+    return entry;
+  }
+
+  SyntheticEntry stack_trace() {
+    SyntheticEntry entry;
+    add_common(&entry, rng_() % 2 == 0 ? "stdout" : "journal", 3);
+    add_process(&entry, UNITS[rng_() % 6]);
+    entry.push_back("MESSAGE=" + python_traceback(rng_));
+    return entry;
+  }
+};
+
+} // namespace
+
+struct sd_journal {
+  std::vector<SyntheticEntry> pool;
+  SyntheticEntry storm;
+  uint32_t storm_percent = 0;
+  uint64_t entry_count = 0;
+  // the current entry, from -1 before the first entry to entry_count after the last.
+  int64_t position = -1;
+  // the next field returned by sd_journal_enumerate_available_data().
+  size_t next_field = 0;
+  // every entry has its own _SOURCE_REALTIME_TIMESTAMP, formatted in place so that moving
+  // to an entry does not allocate, as libsystemd does not.
+  char timestamp_field[64] = {};
+  size_t timestamp_field_size = 0;
+
+  bool on_entry() const { return position >= 0 && uint64_t(position) < entry_count; }
+
+  const SyntheticEntry &entry() const {
+    if (uint64_t(position) % 100 < storm_percent) {
+      return storm;
+    }
+    // a multiplicative stride visits every pool entry in a scattered order.
+    return pool[(uint64_t(position) * 4099) % pool.size()];
+  }
+
+  uint64_t realtime_usec() const { return FIRST_USEC + uint64_t(position) * ENTRY_INTERVAL_USEC; }
+
+  void moved() {
+    next_field = 0;
+    if (on_entry()) {
+      timestamp_field_size =
+          snprintf(timestamp_field, sizeof(timestamp_field), "_SOURCE_REALTIME_TIMESTAMP=%llu",
+                   (unsigned long long)(realtime_usec() - 17));
+    }
+  }
+};
+
+int synthetic_journal_open(sd_journal **ret, uint64_t entry_count, uint32_t seed,
+                           uint32_t storm_percent) {
+  auto *j = new sd_journal();
+  EntryGenerator generator(seed);
+  j->pool.reserve(POOL_SIZE);
+  for (size_t i = 0; i < POOL_SIZE; ++i) {
+    j->pool.push_back(generator.next());
+  }
+  j->storm = generator.storm();
+  j->storm_percent = storm_percent;
+  j->entry_count = entry_count;
+  *ret = j;
+  return 0;
+}
+
+uint64_t synthetic_journal_pool_bytes(sd_journal *j) {
+  uint64_t bytes = 0;
+  for (const auto &entry : j->pool) {
+    for (const auto &field : entry) {
+      bytes += field.size();
+    }
+  }
+  return bytes;
+}
+
+int sd_journal_open(sd_journal **ret, int flags) { return -EOPNOTSUPP; }
+
+void sd_journal_close(sd_journal *j) { delete j; }
+
+int sd_journal_next(sd_journal *j) {
+  if (j->position + 1 >= int64_t(j->entry_count)) {
+    return 0;
+  }
+  j->position++;
+  j->moved();
+  return 1;
+}
+
+int sd_journal_previous(sd_journal *j) {
+  if (j->position <= 0) {
+    return 0;
+  }
+  j->position = std::min<int64_t>(j->position, j->entry_count) - 1;
+  j->moved();
+  return 1;
+}
+
+int sd_journal_seek_head(sd_journal *j) {
+  j->position = -1;
+  return 0;
+}
+
+int sd_journal_seek_tail(sd_journal *j) {
+  j->position = j->entry_count;
+  return 0;
+}
+
+int sd_journal_seek_realtime_usec(sd_journal *j, uint64_t usec) {
+  uint64_t index = usec <= FIRST_USEC ? 0
+                                      : (usec - FIRST_USEC + ENTRY_INTERVAL_USEC - 1) /
+                                            ENTRY_INTERVAL_USEC;
+  // sd_journal_next() moves to the first entry at or after `usec`.
+  j->position = int64_t(std::min(index, j->entry_count)) - 1;
+  return 0;
+}
+
+int sd_journal_get_realtime_usec(sd_journal *j, uint64_t *ret) {
+  if (!j->on_entry()) {
+    return -EADDRNOTAVAIL;
+  }
+  *ret = j->realtime_usec();
+  return 0;
+}
+
+int sd_journal_get_data(sd_journal *j, const char *field, const void **data, size_t *l) {
+  if (!j->on_entry()) {
+    return -EADDRNOTAVAIL;
+  }
+  const size_t field_size = strlen(field);
+  for (const auto &data_field : j->entry()) {
+    if (data_field.size() > field_size && data_field[field_size] == '=' &&
+        data_field.compare(0, field_size, field) == 0) {
+      *data = data_field.data();
+      *l = data_field.size();
+      return 0;
+    }
+  }
+  return -ENOENT;
+}
+
+void sd_journal_restart_data(sd_journal *j) { j->next_field = 0; }
+
+int sd_journal_enumerate_available_data(sd_journal *j, const void **data, size_t *l) {
+  if (!j->on_entry()) {
+    return -EADDRNOTAVAIL;
+  }
+  const SyntheticEntry &entry = j->entry();
+  if (j->next_field > entry.size()) {
+    return 0;
+  }
+  if (j->next_field == entry.size()) {
+    *data = j->timestamp_field;
+    *l = j->timestamp_field_size;
+  } else {
+    *data = entry[j->next_field].data();
+    *l = entry[j->next_field].size();
+  }
+  j->next_field++;
+  return 1;
+}
+
+int sd_journal_enumerate_data(sd_journal *j, const void **data, size_t *l) {
+  return sd_journal_enumerate_available_data(j, data, l);
+}
+
+int sd_journal_add_match(sd_journal *j, const void *data, size_t size) { return -EOPNOTSUPP; }
+
+int sd_journal_add_disjunction(sd_journal *j) { return -EOPNOTSUPP; }
+
+int sd_journal_add_conjunction(sd_journal *j) { return -EOPNOTSUPP; }
+
+int sd_journal_get_cursor(sd_journal *j, char **cursor) { return -EOPNOTSUPP; }
+
+int sd_journal_seek_cursor(sd_journal *j, const char *cursor) { return -EOPNOTSUPP; }
+
+int sd_journal_test_cursor(sd_journal *j, const char *cursor) { return -EOPNOTSUPP; }
+
+// every entry is there from the start, so there is nothing to wait for.
+int sd_journal_get_fd(sd_journal *j) { return -EOPNOTSUPP; }
+
+int sd_journal_get_events(sd_journal *j) { return -EOPNOTSUPP; }
+
+int sd_journal_get_timeout(sd_journal *j, uint64_t *timeout_usec) { return -EOPNOTSUPP; }
+
+int sd_journal_process(sd_journal *j) { return SD_JOURNAL_NOP; }
+
+int sd_id128_get_boot(sd_id128_t *ret) {
+  *ret = SD_ID128_MAKE(00, 01, 02, 03, 04, 05, 06, 07, 08, 09, 0a, 0b, 0c, 0d, 0e, 0f);
+  return 0;
+}
@@ -0,0 +1,29 @@
+#ifndef SYNTHETIC_JOURNAL_HPP
+#define SYNTHETIC_JOURNAL_HPP
+#include <cstdint>
+
+#include <systemd/sd-journal.h>
+
+/**
+ * @brief Opens an in-memory journal of `entry_count` generated entries, logged one
+ * millisecond apart, which implements enough of the sd-journal API to drive
+ * `read_journal_entry()` in place of libsystemd.
+ *
+ * Entries are drawn from a pool of distinct entries generated up front, so reading one costs
+ * about as little as it does from libsystemd's memory-mapped files. The pool mixes kernel
+ * lines, chatty service output on stdout, native journal entries with code locations, and
+ * multi-kilobyte stack traces, with the fields and sizes journald records for each. Matches,
+ * cursors and waiting for new entries are not supported.
+ *
+ * With `storm_percent`, that many of every 100 consecutive entries are the same kernel line,
+ * as logged by a flapping USB device.
+ */
+int synthetic_journal_open(sd_journal **ret, uint64_t entry_count, uint32_t seed = 42,
+                           uint32_t storm_percent = 0);
+
+/**
+ * @brief The total size of the fields of the distinct entries in the pool, in bytes.
+ */
+uint64_t synthetic_journal_pool_bytes(sd_journal *j);
+
+#endif
@@ -0,0 +1,95 @@
+#ifndef ASYNC_WRITER_HPP
+#define ASYNC_WRITER_HPP
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "vendor/mcap/writer.hpp"
+
+#include "cmdline.hpp"
+
+struct AsyncWriterOptions {
+  // IO_URING falls back to IO_THREAD where io_uring is unavailable. IO_STDIO is taken to
+  // mean IO_THREAD.
+  OutputIo io = IO_URING;
+  // the file is written in blocks of this size, each starting at a multiple of it.
+  uint64_t block_size = 1 << 20;
+  // once this many blocks are waiting to be written, further writes block until one is.
+  uint32_t max_in_flight = 4;
+  // disk space is reserved in extents of this size ahead of the writes, without changing the
+  // file's size. 0 disables.
+  uint64_t preallocate_size = 16 << 20;
+  // start writeback of each block as soon as it is written, and wait for the block before it
+  // to reach the disk, so that dirty pages are written steadily rather than in bursts.
+  bool sync_writeback = false;
+};
+
+class WriteBackend;
+
+/**
+ * @brief An MCAP output file which is written in large blocks in the background, so that
+ * slow storage stalls the export loop only once `max_in_flight` blocks are waiting.
+ *
+ * Records are copied into the block being filled, and full blocks are handed to io_uring or
+ * to a writer thread. `flush()` writes out the partly filled block and waits for every
+ * block to be written; the block is then rewritten in full once it fills, so that writes
+ * stay block-aligned.
+ */
+class AsyncFileWriter final : public mcap::IWritable {
+public:
+  explicit AsyncFileWriter(const AsyncWriterOptions &options = {});
+  ~AsyncFileWriter() override;
+
+  mcap::Status open(const std::string &filename);
+
+  void handleWrite(const std::byte *data, uint64_t size) override;
+  void end() override;
+  void flush() override;
+  uint64_t size() const override;
+
+  /**
+   * @brief the backend writing blocks, IO_URING or IO_THREAD.
+   */
+  OutputIo io() const;
+
+  /**
+   * @brief the first error writing the file, as a negative errno-style value, or 0.
+   */
+  int error() const;
+
+private:
+  AsyncWriterOptions options_;
+  OutputIo io_ = IO_THREAD;
+  int fd_ = -1;
+  std::unique_ptr<WriteBackend> backend_;
+  struct FreeDeleter {
+    void operator()(void *ptr) const;
+  };
+  // `max_in_flight + 1` blocks, so that one can be filled while the others are written.
+  std::unique_ptr<std::byte, FreeDeleter> blocks_;
+  std::vector<uint32_t> free_blocks_;
+  // the blocks reported by the last call to reap().
+  std::vector<uint32_t> written_;
+  // the block being filled, which starts at `block_offset_` in the file.
+  uint32_t current_ = 0;
+  uint64_t fill_ = 0;
+  uint64_t block_offset_ = 0;
+  uint32_t in_flight_ = 0;
+  // the block most recently submitted, which `sync_writeback` waits for after the next one.
+  uint64_t previous_offset_ = 0;
+  uint64_t previous_size_ = 0;
+  uint64_t size_ = 0;
+  // the end of the space reserved with fallocate() so far.
+  uint64_t allocated_ = 0;
+  bool preallocate_failed_ = false;
+  int error_ = 0;
+
+  std::byte *block(uint32_t index);
+  void preallocate(uint64_t end_offset);
+  void submit_block(uint32_t index, uint64_t size);
+  void reap();
+  uint32_t take_free_block();
+};
+
+#endif
@@ -0,0 +1,85 @@
+#ifndef BATCH_MERGE_HPP
+#define BATCH_MERGE_HPP
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string_view>
+#include <vector>
+
+#include "entry_batch.hpp"
+#include "output.hpp"
+
+/**
+ * @brief Merges by timestamp the batches of entries read by several sources, each on a thread
+ * of its own, as `export_sources()` does with the --directory and --file sources.
+ *
+ * Each source hands its batches over in timestamp order with `push()`, and says it is done
+ * with `finish()`. The thread calling `merge()` keeps the sources with entries left in a heap
+ * by the timestamp of their next entry, and writes a source's entries until another source
+ * has an earlier one, so the entries of a busy source are written in runs rather than one
+ * heap operation each. Each source may only hold `max_queued_batches` batches the merge has
+ * not taken, which bounds memory use.
+ */
+class BatchMerger {
+public:
+  using WriteEntry =
+      std::function<bool(uint64_t timestamp, const ChannelKey &key, std::string_view encoded)>;
+
+  BatchMerger(size_t source_count, size_t max_queued_batches);
+  BatchMerger(const BatchMerger &) = delete;
+  BatchMerger &operator=(const BatchMerger &) = delete;
+
+  /**
+   * @brief hands `batch` of `source` to the merge, leaving it empty, and waits while the
+   * source holds as many batches as it may.
+   *
+   * @returns false if the merge has stopped, after which the source should finish.
+   */
+  bool push(size_t source, EntryBatch *batch);
+
+  /**
+   * @brief marks `source` as done, once the merge has taken its batches, having failed with
+   * the negative errno-style value `err` if it is not 0.
+   */
+  void finish(size_t source, int err);
+
+  /**
+   * @brief writes the entries of every source with `write` in timestamp order, ties going to
+   * the source with the lowest index, so the output is the same on every run. Sources whose
+   * batches are not pushed yet are waited for. Once it returns, `push()` returns false.
+   *
+   * @returns 0 once every source is done, 1 if `write` returned false, or the negative
+   * errno-style value of the first source which failed, setting `failed_source`.
+   */
+  int merge(const WriteEntry &write, size_t *failed_source);
+
+  /**
+   * @brief stops the merge, so that `push()` returns false.
+   */
+  void cancel();
+
+  /**
+   * @brief the number of entries `source` has pushed.
+   */
+  uint64_t entry_count(size_t source) const;
+
+private:
+  struct SourceQueue {
+    std::deque<EntryBatch> batches;
+    uint64_t entry_count = 0;
+    int err = 0;
+    bool done = false;
+  };
+
+  int next_batch(size_t source, EntryBatch *batch);
+
+  const size_t max_queued_batches_;
+  mutable std::mutex mutex_;
+  std::condition_variable cv_;
+  std::vector<SourceQueue> queues_;
+  bool cancelled_ = false;
+};
+
+#endif
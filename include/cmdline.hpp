@@ -1,7 +1,13 @@
 #ifndef CMDLINE_HPP
 #define CMDLINE_HPP
 
+#include <cstdint>
 #include <string>
+#include <vector>
+
+// the most --jobs accepted. Each job is a thread with a journal handle or batches of its own,
+// and reading and encoding stop scaling well before this many.
+constexpr uint32_t MAX_JOBS = 64;
 
 enum TimePoint {
   TIME_UNIX,
@@ -11,12 +17,84 @@ enum TimePoint {
   TIME_WAIT,
 };
 
+enum Encoding {
+  ENCODING_JSON,
+  ENCODING_PROTOBUF,
+};
+
+enum OutputIo {
+  IO_STDIO,  // buffered stdio writes, on the thread writing entries.
+  IO_THREAD, // large blocks written by a background thread.
+  IO_URING,  // large blocks written through io_uring, or by a thread where it is unavailable.
+};
+
+enum JournalReader {
+  READER_LIBSYSTEMD, // sd_journal calls.
+  READER_MMAP,       // journal files parsed from read-only memory mappings.
+};
+
+enum OverloadPolicy {
+  OVERLOAD_BLOCK,  // stop reading until the output catches up.
+  OVERLOAD_DROP,   // drop the least important entries, more of them the further it falls behind.
+  OVERLOAD_SAMPLE, // keep only some DEBUG and INFO entries.
+};
+
+enum TopicScheme {
+  TOPICS_TRANSPORT, // /journald/<transport>
+  TOPICS_UNIT,      // /journald/unit/<unit>, else /journald/comm/<command>, else by transport.
+};
+
 struct Options {
   std::string output_filename = "out.mcap";
   TimePoint start = TIME_BOOT;
   uint64_t start_sec = 0;
   TimePoint end = TIME_NOW;
   uint64_t end_sec = 0;
+  Encoding encoding = ENCODING_JSON;
+  TopicScheme topics = TOPICS_TRANSPORT;
+  uint32_t jobs = 1;
+  uint32_t compression_threads = 1;
+  OutputIo io = IO_STDIO;
+  // with --io thread or uring, smooth writeback with sync_file_range().
+  bool sync_writeback = false;
+  // compress chunks with the zstd dictionary in this file.
+  std::string zstd_dictionary;
+  // instead of exporting, train a zstd dictionary on the selected entries and save it here.
+  std::string train_dictionary;
+  // read journal files from these directories and files instead of the local journal. Each
+  // machine's directory, and each directory's files, is read by its own thread.
+  std::vector<std::string> directories;
+  std::vector<std::string> files;
+  // how the --directory and --file sources are read.
+  JournalReader reader = READER_LIBSYSTEMD;
+  // read entries in the Journal Export Format from this file, or stdin if it is "-", instead
+  // of the local journal.
+  std::string import_file;
+  // journal filters. Values for the same filter are alternatives, and different filters
+  // must all match.
+  std::vector<std::string> units;
+  int max_priority = -1; // -1 exports all priorities.
+  std::vector<std::string> transports;
+  std::vector<std::string> matches; // FIELD=VALUE
+  // saves the cursor of the last exported entry, and resumes after it on the next run.
+  std::string state_file;
+  // start a new output file after this many bytes or seconds of log time. 0 disables. Durations
+  // here and below are at most UINT64_MAX nanoseconds, so that they convert without overflow.
+  uint64_t rotate_size = 0;
+  uint64_t rotate_interval_sec = 0;
+  // in wait mode, write out the chunk in progress once an entry has waited this long. 0
+  // disables.
+  uint64_t max_chunk_latency_ms = 0;
+  // collapse runs of repeated entries lasting up to this long into one entry each. 0 disables.
+  uint64_t coalesce_window_ms = 0;
+  // what to do with entries read while more than `high_watermark` are waiting to be written.
+  // 0 is the default.
+  OverloadPolicy overload = OVERLOAD_BLOCK;
+  uint64_t high_watermark = 0;
+  // print stage timings and counters at exit, and keep them up to date in `stats_file`.
+  bool stats = false;
+  std::string stats_file;
+  bool verbose = false;
   bool help = false;
   bool version = false;
 };
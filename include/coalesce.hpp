@@ -0,0 +1,85 @@
+#ifndef COALESCE_HPP
+#define COALESCE_HPP
+#include <cstdint>
+#include <string>
+
+#include "journal.hpp"
+
+/**
+ * @brief the journal fields added to an entry which stands for a run of repeats: the number of
+ * entries in the run, and the timestamp of the last one in nanoseconds since the epoch. The
+ * entry's own timestamp is that of the first.
+ */
+constexpr const char *REPEAT_COUNT_FIELD = "JOURNAL2MCAP_REPEAT_COUNT";
+constexpr const char *REPEAT_LAST_TIMESTAMP_FIELD = "JOURNAL2MCAP_REPEAT_LAST_TIMESTAMP";
+
+/**
+ * @brief Collapses runs of consecutive entries with the same transport, unit, command,
+ * priority and MESSAGE, as logged by a flapping driver, into one entry each.
+ *
+ * The first entry of a run is written as usual. The repeats after it are absorbed without
+ * being encoded, and once the run ends, or has lasted `window_ns`, they are written as a
+ * single entry: the first repeat with `REPEAT_COUNT_FIELD` and `REPEAT_LAST_TIMESTAMP_FIELD`
+ * added. A run of one repeat is written as that entry, unchanged. Every entry is counted
+ * exactly once and entries stay in timestamp order, and memory use does not depend on the
+ * length of a run.
+ */
+class EntryCoalescer {
+public:
+  explicit EntryCoalescer(uint64_t window_ns);
+
+  /**
+   * @brief offers the next entry read.
+   *
+   * @returns false if `entry` repeats the previous one and was absorbed. Either way, a run
+   * which has ended is then available from `take_summary()`, and must be written before
+   * `entry`.
+   */
+  bool add(const JournalEntry &entry);
+
+  /**
+   * @brief ends the run in progress, eg. once its window has passed while waiting for more
+   * entries or before exiting, so that its summary is available from `take_summary()`. A
+   * repeat added after this starts a new run.
+   */
+  void finish();
+
+  /**
+   * @brief when the run in progress should end, in nanoseconds since the epoch, or
+   * UINT64_MAX if there is none.
+   */
+  uint64_t run_deadline() const;
+
+  /**
+   * @brief the entry standing for a run which has ended, or nullptr. It stays valid until the
+   * next call to `add()` or `finish()`.
+   */
+  const JournalEntry *take_summary();
+
+  /**
+   * @brief the number of entries absorbed into runs so far, and the number of summaries
+   * written for them.
+   */
+  uint64_t absorbed_count() const;
+  uint64_t summary_count() const;
+
+private:
+  uint64_t window_ns_;
+  // the identifying fields of the entry just added and the one before it, length-prefixed.
+  std::string key_;
+  std::string previous_key_;
+  size_t previous_hash_ = 0;
+  bool has_previous_ = false;
+  // the first repeat in the run in progress, and how many repeats it has absorbed.
+  JournalEntry run_;
+  uint64_t run_count_ = 0;
+  uint64_t run_last_timestamp_ = 0;
+  JournalEntry summary_;
+  bool summary_ready_ = false;
+  uint64_t absorbed_count_ = 0;
+  uint64_t summary_count_ = 0;
+
+  void end_run();
+};
+
+#endif
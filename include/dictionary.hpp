@@ -0,0 +1,62 @@
+#ifndef DICTIONARY_HPP
+#define DICTIONARY_HPP
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * @brief the name of the attachment holding the zstd dictionary a file's chunks are
+ * compressed with.
+ */
+constexpr const char *DICTIONARY_ATTACHMENT_NAME = "journal2mcap.zstd_dictionary";
+constexpr const char *DICTIONARY_MEDIA_TYPE = "application/x-zstd-dictionary";
+
+/**
+ * @brief zstd's default dictionary size, which suits chunks from a few KiB to a few MiB.
+ */
+constexpr size_t DEFAULT_DICTIONARY_SIZE = 112640;
+
+/**
+ * @brief Collects encoded entries to train a zstd dictionary on, up to about 100 times the
+ * dictionary size, which is what zstd recommends.
+ */
+class DictionarySampler {
+public:
+  explicit DictionarySampler(size_t dictionary_size = DEFAULT_DICTIONARY_SIZE);
+
+  /**
+   * @brief adds one encoded entry to the sample, unless it is full.
+   */
+  void add(std::string_view entry);
+
+  /**
+   * @brief whether the sample holds enough entries that adding more would not help.
+   */
+  bool full() const;
+
+  size_t sample_count() const;
+
+  /**
+   * @brief trains a dictionary on the entries added so far.
+   *
+   * @returns 0 on success, -ENODATA if too few entries were added, or -EINVAL if zstd could
+   * not train a dictionary on them.
+   */
+  int train(std::string *dictionary) const;
+
+private:
+  size_t dictionary_size_;
+  // the entries, one after another, and the size of each.
+  std::string samples_;
+  std::vector<size_t> sample_sizes_;
+};
+
+/**
+ * @brief reads the dictionary saved in the file at `path`.
+ *
+ * @returns 0 on success, or a negative errno-style value.
+ */
+int read_dictionary_file(const std::string &path, std::string *dictionary);
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef ENCODER_HPP
+#define ENCODER_HPP
+#include <cstdint>
+#include <memory>
+#include <string_view>
+
+#include "cmdline.hpp"
+#include "journal.hpp"
+
+/**
+ * @brief Serializes journal entries as `foxglove.Log` messages in a particular message
+ * encoding, and describes the MCAP schema and channel encoding those messages need.
+ */
+class LogEncoder {
+public:
+  virtual ~LogEncoder() = default;
+
+  /**
+   * @brief Serializes a decoded journal entry. The returned view is valid until the next
+   * call to `encode()`.
+   */
+  virtual std::string_view encode(const JournalEntry &entry) = 0;
+
+  /**
+   * @brief The MCAP schema encoding, eg. `jsonschema`.
+   */
+  virtual const char *schema_encoding() const = 0;
+
+  /**
+   * @brief The MCAP schema data describing `foxglove.Log` in `schema_encoding()`.
+   */
+  virtual std::string_view schema_data() const = 0;
+
+  /**
+   * @brief The MCAP channel message encoding, eg. `json`.
+   */
+  virtual const char *message_encoding() const = 0;
+};
+
+/**
+ * @brief constructs the encoder for the given Encoding.
+ */
+std::unique_ptr<LogEncoder> make_encoder(Encoding encoding);
+
+#endif
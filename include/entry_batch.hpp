@@ -0,0 +1,52 @@
+#ifndef ENTRY_BATCH_HPP
+#define ENTRY_BATCH_HPP
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "output.hpp"
+
+/**
+ * @brief Encoded entries with the fields which pick their channel, read by a worker thread
+ * and written in order by another. The bytes of every entry share one buffer, so a batch
+ * costs a few allocations however many entries it holds, and is handed over with a move.
+ */
+class EntryBatch {
+public:
+  /**
+   * @brief appends an entry, copying the bytes `key` views and `encoded`.
+   */
+  void append(uint64_t timestamp, const ChannelKey &key, std::string_view encoded);
+
+  /**
+   * @brief removes every entry, keeping the buffers for reuse.
+   */
+  void clear();
+
+  size_t size() const;
+  bool empty() const;
+  uint64_t timestamp(size_t index) const;
+  /**
+   * @brief the key of entry `index`, which views the batch's bytes.
+   */
+  ChannelKey key(size_t index) const;
+  std::string_view encoded(size_t index) const;
+
+private:
+  struct Entry {
+    uint64_t timestamp;
+    Transport transport;
+    // the entry's machine, unit and command, followed by the encoded entry.
+    size_t offset;
+    uint32_t machine_size;
+    uint32_t unit_size;
+    uint32_t comm_size;
+    size_t size;
+  };
+
+  std::string data_;
+  std::vector<Entry> entries_;
+};
+
+#endif
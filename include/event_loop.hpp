@@ -0,0 +1,100 @@
+#ifndef EVENT_LOOP_HPP
+#define EVENT_LOOP_HPP
+#include <cstdint>
+#include <signal.h>
+
+#include <systemd/sd-journal.h>
+
+/**
+ * @brief the current `CLOCK_MONOTONIC` time in nanoseconds, which timer deadlines are measured
+ * against.
+ */
+uint64_t monotonic_ns();
+
+/**
+ * @brief why `EventLoop::wait()` returned.
+ */
+enum LoopEvent {
+  EVENT_JOURNAL, // the journal changed, and may have new entries.
+  // files were added to or removed from the journal's directories, eg. as journald rotated
+  // one. A journal opened on a list of files does not read files added later.
+  EVENT_JOURNAL_FILES,
+  EVENT_SIGNAL,  // SIGINT or SIGTERM was received.
+  EVENT_TIMER,   // the timer set with `set_timer()` expired.
+};
+
+/**
+ * @brief Waits for new journal entries, termination signals and a timer with a single epoll
+ * instance, so that the process wakes up as soon as an entry is written and not at all while
+ * the journal is idle.
+ *
+ * `open()` blocks SIGINT and SIGTERM for the calling thread and delivers them through a
+ * signalfd instead. It must be called before any other threads are started, so that they
+ * inherit the blocked mask and the signals are not delivered to them.
+ */
+class EventLoop {
+public:
+  ~EventLoop();
+
+  /**
+   * @brief watches `j` for changes, and blocks SIGINT and SIGTERM.
+   *
+   * @returns 0 on success, or a negative errno-style value.
+   */
+  int open(sd_journal *j);
+
+  /**
+   * @brief watches `j` instead of the journal watched so far, eg. once the journal has been
+   * reopened on another set of files. The previous journal must still be open.
+   *
+   * @returns 0 on success, or a negative errno-style value.
+   */
+  int replace_journal(sd_journal *j);
+
+  /**
+   * @brief blocks until the next event. Journal changes are acknowledged with
+   * `sd_journal_process()` before returning. EVENT_JOURNAL_FILES is returned ahead of a timer
+   * which expired at the same time, whose expiry is then dropped, as it is only reported once.
+   *
+   * @returns 0 on success, or a negative errno-style value.
+   */
+  int wait(LoopEvent *event);
+
+  /**
+   * @brief returns true if a termination signal is pending, without blocking. Used to notice
+   * signals while entries are being read as fast as they arrive.
+   */
+  bool signal_pending();
+
+  /**
+   * @brief arms the timer to expire once, when the `CLOCK_MONOTONIC` time reaches
+   * `deadline_ns`. A deadline in the past expires immediately. Replaces any timer that is
+   * already armed.
+   */
+  int set_timer(uint64_t deadline_ns);
+
+  /**
+   * @brief returns true if the timer has expired since it was armed, without blocking.
+   */
+  bool timer_expired();
+
+  /**
+   * @brief disarms the timer.
+   */
+  int clear_timer();
+
+private:
+  sd_journal *journal_ = nullptr;
+  int epoll_fd_ = -1;
+  int journal_fd_ = -1;
+  int signal_fd_ = -1;
+  int timer_fd_ = -1;
+  bool signal_received_ = false;
+  bool restore_mask_ = false;
+  sigset_t old_mask_;
+
+  int read_signal();
+  int watch_journal(sd_journal *j);
+};
+
+#endif
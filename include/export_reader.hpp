@@ -0,0 +1,97 @@
+#ifndef EXPORT_READER_HPP
+#define EXPORT_READER_HPP
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "cmdline.hpp"
+#include "journal.hpp"
+#include "output.hpp"
+
+/**
+ * @brief parses the entry at the start of `data`, which holds entries in the Journal Export
+ * Format, as written by `journalctl -o export`: fields are `KEY=value` lines, or a `KEY`
+ * line followed by a little-endian 64-bit length, the value and a newline for binary values,
+ * and entries are separated by an empty line. See
+ * https://systemd.io/JOURNAL_EXPORT_FORMATS/
+ *
+ * `entry` views the fields in `data` without copying them, so it is only valid while `data`
+ * is. Its timestamp is `__REALTIME_TIMESTAMP`; the other address fields starting with `__`
+ * are skipped, and so are empty values, as libsystemd's enumeration skips them.
+ *
+ * @returns 1 if an entry was parsed, setting `*size` to the bytes it used, including the
+ * separator after it. Returns 0 if `data` holds no entry, or only the start of one and
+ * `at_end` is false, so that more data is needed. Returns -EBADMSG if the entry is
+ * malformed or has no `__REALTIME_TIMESTAMP`.
+ */
+int parse_export_entry(std::string_view data, bool at_end, size_t *size, JournalEntry *entry);
+
+/**
+ * @brief Reads entries in the Journal Export Format from a file or a pipe, without libsystemd.
+ *
+ * Regular files are memory-mapped and parsed in place. Pipes, such as stdin fed by
+ * `journalctl -o export`, are read in large blocks into a buffer, which is parsed in place
+ * and only grows to fit the largest entry.
+ */
+class ExportReader {
+public:
+  ExportReader() = default;
+  ExportReader(const ExportReader &) = delete;
+  ExportReader &operator=(const ExportReader &) = delete;
+  ~ExportReader();
+
+  /**
+   * @brief opens the file at `path`, or stdin if it is "-".
+   *
+   * @returns 0 on success, or a negative errno-style value.
+   */
+  int open(const std::string &path);
+
+  /**
+   * @brief reads the next entry into `entry`, which views the reader's bytes until the next
+   * call.
+   *
+   * @returns 1 if an entry was read, 0 at the end of the input, or a negative errno-style
+   * value, including -EBADMSG if the input is malformed.
+   */
+  int read(JournalEntry *entry);
+
+  /**
+   * @brief the number of input bytes consumed so far.
+   */
+  uint64_t bytes_read() const;
+
+private:
+  int fd_ = -1;
+  bool close_fd_ = false;
+  // the mapped file, or nullptr when reading a pipe.
+  const char *mapping_ = nullptr;
+  size_t mapping_size_ = 0;
+  // the buffer a pipe is read into, and whether the pipe has reached its end.
+  std::string buffer_;
+  size_t buffer_size_ = 0;
+  bool at_end_ = false;
+  // the start of the next entry in the mapping or the buffer.
+  size_t position_ = 0;
+  uint64_t bytes_read_ = 0;
+
+  int fill_buffer();
+};
+
+/**
+ * @brief returns true if `options` can be used with --import: only timestamps select the
+ * range, and no journal filters or state file are used.
+ */
+bool supports_import(const Options &options);
+
+/**
+ * @brief Exports the entries in `options.import_file` into `writer`, with the same channels,
+ * timestamps and encoding as entries read from the journal. Entries outside the --start and
+ * --end timestamps are skipped, and the rest are written in input order.
+ *
+ * @returns a process exit code, after printing any error.
+ */
+int import_export_file(const Options &options, LogWriter *writer);
+
+#endif
@@ -1,7 +1,10 @@
 #ifndef JOURNAL_HPP
 #define JOURNAL_HPP
+#include <cstdint>
 #include <string>
+#include <string_view>
 #include <atomic>
+#include <vector>
 
 #include <systemd/sd-journal.h>
 
@@ -28,11 +31,107 @@ enum Transport {
  */
 const char *name_for_transport(Transport transport);
 
+/**
+ * @brief parses a `_TRANSPORT` value, returning TRANSPORT_UNKNOWN if it is not recognized.
+ */
+Transport parse_transport(std::string_view name);
+
 /**
  * @brief parses the Transport used by the current entry in the journal.
  */
 Transport get_transport(sd_journal *j);
 
+/**
+ * @brief the journal fields which are used for every entry, to pick its channel or to fill
+ * in `foxglove.Log` members.
+ */
+enum WellKnownField {
+  FIELD_OTHER,
+  FIELD_MESSAGE,
+  FIELD_PRIORITY,
+  FIELD_TRANSPORT,
+  FIELD_SYSTEMD_UNIT,
+  FIELD_EXE,
+  FIELD_CODE_FILE,
+  FIELD_CODE_LINE,
+  FIELD_COMM,
+  FIELD_MACHINE_ID,
+  _FIELD_COUNT,
+};
+
+/**
+ * @brief classifies a journal field name, returning FIELD_OTHER if it is not well-known.
+ */
+WellKnownField classify_field(std::string_view key);
+
+/**
+ * @brief a journal entry decoded with a single enumeration of its fields.
+ */
+struct JournalEntry {
+  struct Field {
+    uint32_t key_offset;
+    uint32_t key_size;
+    uint32_t value_offset;
+    uint32_t value_size;
+  };
+
+  // the realtime timestamp of the entry as a count of nanoseconds since the epoch.
+  uint64_t timestamp = 0;
+  Transport transport = TRANSPORT_UNKNOWN;
+  // libsystemd only guarantees that field data stays valid until the next enumeration call,
+  // so field bytes are copied here. Reused between entries.
+  std::string field_data;
+  // when set, field offsets are into these bytes instead of `field_data`, which a reader
+  // owns and keeps valid until it reads the next entry, such as an entry in a memory-mapped
+  // export file. Copies of the entry view the same bytes; see `copy_from()`.
+  const char *external_data = nullptr;
+  // fields with a non-empty value, in enumeration order.
+  std::vector<Field> fields;
+  // the index in `fields` of the last occurrence of each well-known field, or -1.
+  int well_known[_FIELD_COUNT];
+
+  const char *data() const {
+    return external_data != nullptr ? external_data : field_data.data();
+  }
+  std::string_view key(const Field &field) const {
+    return std::string_view(data() + field.key_offset, field.key_size);
+  }
+  std::string_view value(const Field &field) const {
+    return std::string_view(data() + field.value_offset, field.value_size);
+  }
+  /**
+   * @brief the last occurrence of a well-known field, or nullptr if the entry has none.
+   */
+  const Field *find(WellKnownField field) const {
+    return well_known[field] >= 0 ? &fields[well_known[field]] : nullptr;
+  }
+  /**
+   * @brief copies `other` into this entry's own `field_data`, so that it stays valid after
+   * the reader of `other` moves on. Buffers are reused, as with assignment.
+   */
+  void copy_from(const JournalEntry &other);
+};
+
+/**
+ * @brief enumerates the fields of the current journal entry into `entry`, classifying
+ * well-known fields and the transport as they are copied. `entry->timestamp` is not set.
+ */
+void decode_journal_fields(sd_journal *j, JournalEntry *entry);
+
+/** Moves the journal cursor to the next entry and decodes it into `entry`, stopping at
+ * entries with a realtime timestamp at or after `end_usec`. The timestamp is read once and
+ * the fields are enumerated once.
+ *
+ * @returns the same values as `next_journal_entry()`.
+*/
+int read_journal_entry(sd_journal *j, uint64_t end_usec, JournalEntry *entry);
+
+/**
+ * @brief the exclusive realtime bound for entries exported up to `end`, for use with
+ * `read_journal_entry()` and `next_journal_entry_before()`. Unbounded ends give UINT64_MAX.
+ */
+uint64_t end_usec_for(TimePoint end, uint64_t end_sec);
+
 /**
  * @brief Get the real-time timestamp of the current journal entry as a count of nanoseconds since
  * the epoch.
@@ -45,10 +144,12 @@ int get_ts(sd_journal *j, uint64_t *out);
  * https://wiki.archlinux.org/title/Systemd/Journal#Priority_level
  * https://github.com/foxglove/schemas/blob/main/schemas/jsonschema/Log.json
  */
-int level_for_priority(const std::string &priority);
+int level_for_priority(std::string_view priority);
 
 /**
- * @brief Serializes the current journal entry as a JSON `foxglove.Log`.
+ * @brief Serializes the current journal entry as a JSON `foxglove.Log`. This builds a
+ * nlohmann::json DOM for every entry; `JsonEncoder` produces the same output much faster and
+ * is what the exporter uses.
  */
 std::string serialize_json(sd_journal *j, uint64_t timestamp);
 
@@ -57,10 +158,36 @@ std::string serialize_json(sd_journal *j, uint64_t timestamp);
  */
 int apply_boot_id_match(sd_journal *j, const Options& options);
 
+/**
+ * @brief adds the --unit, --priority, --transport and --match filters in `options` as
+ * journal matches, so that libsystemd skips non-matching entries using its field indexes.
+ * Must be called after `apply_boot_id_match()`, which it combines with.
+ */
+int apply_filter_matches(sd_journal *j, const Options &options);
+
 /** Seeks to the start of the journal as specified by `start` and `start_secs`.
 */
 int seek_to_start(sd_journal *j, TimePoint start, uint64_t start_secs);
 
+/** Seeks to just after the entry identified by `cursor`, so that the next read returns the
+ * first entry after it. If that entry no longer exists, eg. because the journal was vacuumed,
+ * the next read returns the first entry after where it was.
+*/
+int seek_after_cursor(sd_journal *j, const char *cursor);
+
+/**
+ * @brief parses the realtime timestamp of the entry identified by `cursor`, in microseconds
+ * since the epoch.
+ *
+ * @returns 0 on success, or -EINVAL if `cursor` does not hold one.
+ */
+int cursor_realtime_usec(std::string_view cursor, uint64_t *usec);
+
+/** Gets the cursor of the last entry read by `read_journal_entry(j, end_usec, ...)`, after it
+ * has returned 0 or the caller stopped reading. At least one entry must have been read.
+*/
+int get_last_read_cursor(sd_journal *j, uint64_t end_usec, std::string *cursor);
+
 /** Moves the journal cursor to the next journal entry.
  *
  * @returns a negative errno-style value if an error occurred.
@@ -69,4 +196,54 @@ int seek_to_start(sd_journal *j, TimePoint start, uint64_t start_secs);
 */
 int next_journal_entry(sd_journal* j, TimePoint end, uint64_t end_secs);
 
+/** Moves the journal cursor to the next journal entry, stopping at entries with a realtime
+ * timestamp at or after `end_usec`.
+ *
+ * @returns the same values as `next_journal_entry()`.
+*/
+int next_journal_entry_before(sd_journal* j, uint64_t end_usec);
+
+/**
+ * @brief a range of journal entries with realtime timestamps in [start_usec, end_usec).
+ */
+struct TimeSlice {
+  uint64_t start_usec;
+  uint64_t end_usec;
+};
+
+/**
+ * @brief finds the realtime range [start_usec, end_usec) selected by `options`. The boot ID
+ * match from `apply_boot_id_match()` should already be applied. Only bounded ranges are
+ * supported, so `--start now` and `--end wait` return -EINVAL. An empty journal produces an
+ * empty range.
+ */
+int get_export_range(sd_journal *j, const Options &options, uint64_t *start_usec,
+                     uint64_t *end_usec);
+
+/**
+ * @brief splits [start_usec, end_usec) into at most `count` contiguous, non-empty slices of
+ * near-equal duration.
+ */
+std::vector<TimeSlice> split_time_range(uint64_t start_usec, uint64_t end_usec, size_t count);
+
+/**
+ * @brief a set of journal files which is read by one thread: a machine's journal directory,
+ * or the files given with --file which are in the same directory.
+ */
+struct JournalSource {
+  // opened with sd_journal_open_directory() if not empty, and otherwise `files` are opened
+  // with sd_journal_open_files().
+  std::string directory;
+  std::vector<std::string> files;
+};
+
+/**
+ * @brief finds the sources to read for the --directory and --file options. A directory with
+ * subdirectories named by machine ID, like /var/log/journal, gives a source for each of them,
+ * and any other directory is a single source.
+ *
+ * @returns 0 on success, or a negative errno-style value if a directory cannot be read.
+ */
+int find_journal_sources(const Options &options, std::vector<JournalSource> *sources);
+
 #endif
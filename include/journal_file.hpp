@@ -0,0 +1,279 @@
+#ifndef JOURNAL_FILE_HPP
+#define JOURNAL_FILE_HPP
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <systemd/sd-id128.h>
+
+#include "journal.hpp"
+
+struct ZSTD_DCtx_s;
+
+/**
+ * @brief where an entry sits in the journal, as libsystemd compares entries from different
+ * files.
+ */
+struct JournalLocation {
+  // the ID which sequence numbers count in, shared by the files one journald instance wrote.
+  sd_id128_t seqnum_id;
+  uint64_t seqnum = 0;
+  sd_id128_t boot_id;
+  uint64_t monotonic_usec = 0;
+  uint64_t realtime_usec = 0;
+  uint64_t xor_hash = 0;
+};
+
+/**
+ * @brief orders entries as libsystemd does: by sequence number if they count in the same
+ * ID, then by monotonic time within the same boot, then by realtime. Returns 0 for the same
+ * entry in two files.
+ */
+int compare_locations(const JournalLocation &a, const JournalLocation &b);
+
+/**
+ * @brief Reads the entries of a journal file written by journald from a read-only memory
+ * mapping, without libsystemd. See https://systemd.io/JOURNAL_FILE_FORMAT/
+ *
+ * Entries are read in the order of the file's entry arrays, which is the order journald
+ * appended them in, and their fields are resolved straight from the DATA objects they
+ * reference. Both the regular and the compact format are supported, with fields compressed
+ * with XZ, LZ4 or ZSTD. Large fields are the ones journald compresses, and the same stack
+ * trace or dump is often shared by many entries, so decompressed fields are cached by the
+ * offset of their object.
+ */
+class JournalFile {
+public:
+  JournalFile() = default;
+  JournalFile(const JournalFile &) = delete;
+  JournalFile &operator=(const JournalFile &) = delete;
+  ~JournalFile();
+
+  /**
+   * @brief maps the file at `path` and indexes its entry arrays. Entries appended to the file
+   * after it is opened are not read.
+   *
+   * @returns 0 on success, -EBADMSG if the file is not a valid journal file,
+   * -EPROTONOSUPPORT if it uses a format feature which is not supported, or another negative
+   * errno-style value.
+   */
+  int open(const std::string &path);
+
+  /**
+   * @brief positions the file so that `next()` reads its first entry.
+   */
+  void seek_head();
+
+  /**
+   * @brief positions the file so that `next()` reads the first entry with a realtime
+   * timestamp at or after `usec`. Like libsystemd, this bisects the entries, so timestamps are
+   * taken to increase through the file.
+   *
+   * @returns 0 on success, or -EBADMSG if the file is corrupt.
+   */
+  int seek_realtime_usec(uint64_t usec);
+
+  /**
+   * @brief moves to the entry before the position set by `seek_realtime_usec()` or
+   * `seek_head()`, making it current. The position `next()` reads from is unchanged.
+   *
+   * @returns 1 if there is one, 0 if the position is the first entry, or -EBADMSG if the
+   * file is corrupt.
+   */
+  int previous();
+
+  /**
+   * @brief moves to the next entry, making it current.
+   *
+   * @returns 1 if there is one, 0 after the last entry, or -EBADMSG if the file is corrupt.
+   */
+  int next();
+
+  /**
+   * @brief the location of the current entry.
+   */
+  const JournalLocation &location() const;
+
+  /**
+   * @brief decodes the fields of the current entry into `entry`, with the same fields and
+   * classification as `decode_journal_fields()`. `entry->timestamp` is not set. Fields which
+   * cannot be read, such as ones with a corrupt object, are skipped as libsystemd skips them.
+   */
+  void decode_fields(JournalEntry *entry);
+
+  const std::string &path() const;
+  uint64_t entry_count() const;
+
+private:
+  // where the items of an entry array start, and the index of the file's first entry in it.
+  struct EntryArray {
+    uint64_t items_offset;
+    uint64_t first_entry;
+    uint64_t count;
+  };
+
+  std::string path_;
+  const uint8_t *data_ = nullptr;
+  size_t mapping_size_ = 0;
+  // the part of the mapping which journald had written when the file was opened.
+  size_t size_ = 0;
+  // compact files use 32-bit offsets in entries and entry arrays.
+  bool compact_ = false;
+  std::vector<EntryArray> arrays_;
+  uint64_t entry_count_ = 0;
+  // the index of the entry `next()` reads, and the offset of the current entry's object.
+  uint64_t position_ = 0;
+  uint64_t entry_offset_ = 0;
+  JournalLocation location_;
+  // decompressed fields by the offset of their DATA object, and their total size.
+  std::unordered_map<uint64_t, std::string> decompressed_;
+  size_t decompressed_bytes_ = 0;
+  ZSTD_DCtx_s *zstd_ = nullptr;
+
+  int read_header();
+  int index_entry_arrays(uint64_t first_array_offset);
+  int entry_offset_at(uint64_t index, uint64_t *offset) const;
+  int load_entry(uint64_t index);
+  int load_realtime(uint64_t index, uint64_t *realtime_usec) const;
+  int field_payload(uint64_t data_offset, std::string_view *payload);
+  int decompress(uint64_t data_offset, int compression, std::string_view compressed,
+                 std::string_view *payload);
+};
+
+/**
+ * @brief the header fields of a journal file which bound the entries it holds.
+ */
+struct JournalFileHeader {
+  // journald has archived the file, and will not add entries to it again.
+  bool archived = false;
+  uint64_t entry_count = 0;
+  // the realtime timestamps of the first and last entries, or 0 without entries.
+  uint64_t head_realtime_usec = 0;
+  uint64_t tail_realtime_usec = 0;
+  // the boot ID of the last entry. journald before v254 recorded the boot which last opened
+  // the file for writing instead, which is the same for every file it wrote to during a boot.
+  sd_id128_t tail_boot_id = {};
+};
+
+/**
+ * @brief reads the header of the journal file at `path`, without mapping the rest of it.
+ *
+ * @returns 0 on success, -EBADMSG if the file is not a journal file, or another negative
+ * errno-style value.
+ */
+int read_journal_file_header(const std::string &path, JournalFileHeader *header);
+
+/**
+ * @brief the entries an export reads: those with realtime timestamps in
+ * [start_usec, end_usec), and of `boot_id` if `match_boot` is set.
+ */
+struct JournalFileFilter {
+  uint64_t start_usec = 0;
+  uint64_t end_usec = UINT64_MAX;
+  bool match_boot = false;
+  sd_id128_t boot_id = {};
+};
+
+/**
+ * @brief lists the journal files in `directory`, active, archived and dirty ones alike, as
+ * libsystemd reads them, in name order. Subdirectories are not searched.
+ *
+ * @returns 0 on success, or a negative errno-style value if the directory cannot be read.
+ */
+int list_journal_files(const std::string &directory, std::vector<std::string> *paths);
+
+/**
+ * @brief picks the files among `paths` which may hold entries matching `filter`, judging by
+ * their headers alone, so that a journal opened on them finds its first entry without
+ * opening every archived file. Only archived files are left out, as journald may append an
+ * entry of any time and boot to an active file; files whose header cannot be read are kept,
+ * for libsystemd to judge.
+ */
+std::vector<std::string> select_journal_files(const std::vector<std::string> &paths,
+                                              const JournalFileFilter &filter);
+
+/**
+ * @brief Reads the journal files of a `JournalSource` through `JournalFile`s, as a faster
+ * replacement for opening it with libsystemd. Entries from the files are interleaved in the
+ * order libsystemd reads them in, see `compare_locations()`, and an entry found in more than
+ * one file is read once.
+ */
+class MappedJournal {
+public:
+  /**
+   * @brief opens the `.journal` files in the source's directory, or its files.
+   *
+   * @returns 0 on success, or a negative errno-style value, which `JournalFile::open()`
+   * returns for files which cannot be read.
+   */
+  int open(const JournalSource &source);
+
+  /**
+   * @brief only reads entries logged during this boot from now on.
+   */
+  void match_boot_id(const sd_id128_t &boot_id);
+
+  /**
+   * @brief positions every file at its first entry.
+   */
+  void seek_head();
+
+  /**
+   * @brief positions every file at its first entry at or after `usec`, like
+   * `sd_journal_seek_realtime_usec()`.
+   */
+  int seek_realtime_usec(uint64_t usec);
+
+  /**
+   * @brief finds the last entry before `usec` in libsystemd's order, as
+   * `sd_journal_seek_realtime_usec()` followed by `sd_journal_previous()` does, and stores
+   * its boot ID in `boot_id`. The files are left positioned as by `seek_head()`.
+   *
+   * @returns 1 if there is an entry before `usec`, 0 if not, or a negative errno-style value.
+   */
+  int find_boot_before(uint64_t usec, sd_id128_t *boot_id);
+
+  /**
+   * @brief moves to the next entry of the files, making it current.
+   *
+   * @returns 1 if there is one, 0 after the last entry, or a negative errno-style value.
+   */
+  int next();
+
+  /**
+   * @brief the location of the current entry.
+   */
+  const JournalLocation &location() const;
+
+  /**
+   * @brief reads the next entry into `entry` as `read_journal_entry()` does, stopping at
+   * entries with a realtime timestamp at or after `end_usec`.
+   *
+   * @returns the same values as `read_journal_entry()`.
+   */
+  int read_entry(uint64_t end_usec, JournalEntry *entry);
+
+  size_t file_count() const;
+
+private:
+  enum FileState {
+    FILE_STALE, // the file's current entry has been read, or it was just positioned.
+    FILE_READY, // the file's current entry has not been read.
+    FILE_DONE,
+  };
+
+  std::vector<std::unique_ptr<JournalFile>> files_;
+  std::vector<FileState> states_;
+  JournalFile *current_ = nullptr;
+  bool has_location_ = false;
+  JournalLocation last_location_;
+  bool has_boot_match_ = false;
+  sd_id128_t boot_match_;
+
+  // moves `file` to its next entry of the matching boot, updating its state.
+  int advance(size_t file);
+};
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef JSON_ENCODER_HPP
+#define JSON_ENCODER_HPP
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "encoder.hpp"
+
+/**
+ * @brief Appends `value` to `out` as a quoted JSON string, escaped the same way as
+ * `nlohmann::json::dump()`. Invalid UTF-8 sequences are replaced with U+FFFD.
+ */
+void append_json_string(std::string *out, std::string_view value);
+
+/**
+ * @brief Serializes journal entries as JSON `foxglove.Log` messages.
+ *
+ * Produces byte-for-byte the same output as `serialize_json()`, but writes escaped JSON
+ * directly into a buffer that is reused between entries instead of building a DOM. Once
+ * the buffers have grown to fit the largest entry seen, encoding does not allocate.
+ */
+class JsonEncoder final : public LogEncoder {
+public:
+  std::string_view encode(const JournalEntry &entry) override;
+  const char *schema_encoding() const override;
+  std::string_view schema_data() const override;
+  const char *message_encoding() const override;
+
+private:
+  // indexes into `JournalEntry::fields`, sorted by key with duplicate keys removed.
+  std::vector<uint32_t> order_;
+  std::string out_;
+};
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef LOCAL_JOURNAL_HPP
+#define LOCAL_JOURNAL_HPP
+#include <string>
+
+#include <systemd/sd-journal.h>
+
+#include "cmdline.hpp"
+#include "journal_file.hpp"
+
+/**
+ * @brief the entries selected by `options`, as far as they can be told apart by the headers of
+ * journal files, for an export which starts after `resume_cursor` if it is not empty.
+ */
+JournalFileFilter journal_file_filter(const Options &options, const std::string &resume_cursor);
+
+/**
+ * @brief opens the local journal on only the files which may hold entries matching `filter`,
+ * so that it does not open and search every archived file. Falls back to opening every file
+ * with `sd_journal_open()` if they cannot be listed or opened, eg. without permission to read
+ * some of them.
+ *
+ * A journal opened on a list of files does not pick up files created later, so with `follow`,
+ * every file is also opened if none of them is active, as while journald is rotating its
+ * files, so that the file journald creates next is read.
+ *
+ * @returns 0 on success, setting `selected` if the journal was opened on a list of files, or
+ * a negative errno-style value.
+ */
+int open_local_journal(sd_journal **j, const JournalFileFilter &filter, bool follow,
+                       bool verbose, bool *selected);
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef MERGE_HPP
+#define MERGE_HPP
+
+#include "cmdline.hpp"
+#include "journal.hpp"
+#include "output.hpp"
+
+/**
+ * @brief returns true if `options` can be used to export the --directory and --file sources:
+ * their range must be bounded, and no state file needs the last entry's cursor.
+ */
+bool supports_source_export(const Options &options);
+
+/**
+ * @brief returns true if `options` can be used with --reader mmap: journal files are read
+ * from --directory or --file sources, and there are no journal filters.
+ */
+bool supports_mapped_read(const Options &options);
+
+/**
+ * @brief opens the journal files of `source`.
+ *
+ * @returns 0 on success, or a negative errno-style value.
+ */
+int open_journal_source(const JournalSource &source, sd_journal **j);
+
+/**
+ * @brief Exports the --directory and --file sources in `options`, as found by
+ * `find_journal_sources()`, into `writer`.
+ *
+ * Each source is read and encoded by its own thread in batches, and the calling thread merges
+ * the batches by timestamp with a `BatchMerger`, so that logTime order is the same as for a
+ * single journal. Each source may only run a few batches ahead of the merge, which bounds
+ * memory use.
+ * Entries are written to channels namespaced by their machine, eg.
+ * `/journald/<machine-id>/kernel`.
+ *
+ * With --reader mmap, each source's files are parsed by a `MappedJournal` instead of
+ * libsystemd, in the same order and with the same fields. Sources with files in a format it
+ * does not support are still read with libsystemd.
+ *
+ * The current boot means nothing for journals copied from other machines, so unless --end
+ * picks a boot by its timestamp, `--start boot` exports every boot in the sources.
+ *
+ * @returns a process exit code, after printing any error.
+ */
+int export_sources(const Options &options, LogWriter *writer);
+
+#endif
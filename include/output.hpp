@@ -0,0 +1,284 @@
+#ifndef OUTPUT_HPP
+#define OUTPUT_HPP
+#include <array>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "vendor/mcap/writer.hpp"
+
+#include "async_writer.hpp"
+#include "cmdline.hpp"
+#include "encoder.hpp"
+#include "journal.hpp"
+
+/**
+ * @brief provides the MCAP topic used for entries with the given Transport.
+ */
+std::string get_topic(Transport transport);
+
+/**
+ * @brief The fields which pick the channel for an entry, viewing the entry's own bytes so
+ * that the channel can be found without building its topic.
+ */
+struct ChannelKey {
+  Transport transport = TRANSPORT_UNKNOWN;
+  // the entry's _SYSTEMD_UNIT and _COMM, or empty.
+  std::string_view unit;
+  std::string_view comm;
+  // the entry's _MACHINE_ID when exporting journals from other machines, which namespaces
+  // its channel as /journald/<machine>/..., or empty.
+  std::string_view machine;
+};
+
+/**
+ * @brief provides the ChannelKey for `entry`, which views its fields.
+ */
+ChannelKey channel_key(const JournalEntry &entry);
+
+/**
+ * @brief the name of the metadata record describing each output file's place in a rotated
+ * sequence of files.
+ */
+constexpr const char *SEQUENCE_METADATA_NAME = "journal2mcap.sequences";
+
+/**
+ * @brief expands the output filename template for the file with the given index. `{n}` is
+ * replaced with the index; without it, `.<index>` is inserted before the extension.
+ */
+std::string expand_output_filename(const std::string &filename_template, uint32_t index);
+
+struct LogWriterOptions {
+  mcap::Compression compression = mcap::Compression::Zstd;
+  TopicScheme topics = TOPICS_TRANSPORT;
+  // Full chunks are compressed by this many background threads while the next chunk fills,
+  // or inline when it is 0.
+  uint32_t compression_threads = 0;
+  // The uncompressed size at which chunks are closed, or 0 for the MCAP writer's default.
+  uint64_t chunk_size = 0;
+  // Start a new file once this many bytes have been written to the current one. 0 disables.
+  // Bytes are counted as chunks are written, so files may be up to about a chunk larger.
+  uint64_t rotate_size = 0;
+  // Start a new file once an entry is logged this many nanoseconds after the first entry in
+  // the current one. 0 disables.
+  uint64_t rotate_interval = 0;
+  // `flush_deadline()` falls due this many nanoseconds after an entry is written, unless the
+  // output has been flushed since. 0 disables.
+  uint64_t max_chunk_latency = 0;
+  // How files are written: with stdio, or in large blocks by io_uring or a writer thread.
+  OutputIo io = IO_STDIO;
+  // With IO_THREAD or IO_URING, start writeback of each block as soon as it is written.
+  bool sync_writeback = false;
+  // A zstd dictionary to compress chunks with, or empty. Each file starts with a copy of it in
+  // a `journal2mcap.zstd_dictionary` attachment, which readers need to decompress the chunks.
+  std::string zstd_dictionary;
+  // Once the chunk indexes of a file take up this many bytes, they are spilled to a temporary
+  // file next to it until its summary is written, so that memory use does not grow with the
+  // length of the file. 0 keeps them in memory. See `LogWriter::take_index_warning()`.
+  uint64_t max_index_memory = 0;
+};
+
+/**
+ * @brief The distribution of chunk sizes across all files written by a `LogWriter`, used to
+ * weigh the compression ratio of large chunks against the latency of flushing small ones.
+ */
+struct ChunkSizeStats {
+  uint64_t chunk_count = 0;
+  // calls to `LogWriter::flush()` which wrote out entries early.
+  uint64_t forced_flushes = 0;
+  uint64_t uncompressed_bytes = 0;
+  uint64_t compressed_bytes = 0;
+  // time spent compressing chunks, on whichever thread compressed them.
+  uint64_t compression_ns = 0;
+  // `size_histogram[i]` counts chunks whose uncompressed size has `i` significant bits, ie.
+  // is in [2^(i-1), 2^i).
+  std::array<uint64_t, 65> size_histogram = {};
+
+  void add(uint64_t uncompressed_size, uint64_t compressed_size);
+
+  /**
+   * @brief a power of 2 which the uncompressed size of the smallest `fraction` of chunks is
+   * below. It is at most twice the exact percentile.
+   */
+  uint64_t percentile(double fraction) const;
+};
+
+/**
+ * @brief describes `stats` in one line, eg. for printing at exit.
+ */
+std::string describe_chunk_stats(const ChunkSizeStats &stats);
+
+/**
+ * @brief Writes encoded `foxglove.Log` messages to an MCAP file, using one channel per
+ * transport, or with TOPICS_UNIT one per unit or command as well. Sequence numbers are
+ * counted separately for each channel.
+ *
+ * Unit and command channels are created the first time an entry for them is written, and
+ * added to each file as they are first used in it. Channels are numbered across all files:
+ * the first `_TRANSPORT_COUNT` are the transport channels in Transport order, followed by
+ * the others in the order they were created.
+ *
+ * When rotation is enabled, output moves on to the next file from the filename template
+ * between two entries, so no entry is dropped or written twice. Sequence numbers continue
+ * across files, and each file ends with a `journal2mcap.sequences` metadata record giving the
+ * range of sequence numbers it holds for each topic. The previous file's summary is written
+ * on a background thread while entries go to the next file.
+ */
+class LogWriter {
+public:
+  ~LogWriter();
+
+  /**
+   * @brief Opens `filename` for writing and registers the schema and channels used by
+   * `encoder`. `encoder` must outlive the writer. With rotation enabled, `filename` is a
+   * template for `expand_output_filename()`.
+   */
+  mcap::Status open(const std::string &filename, const LogEncoder &encoder,
+                    const LogWriterOptions &options = {});
+
+  /**
+   * @brief Writes one encoded entry to the channel for `key`, first rotating to a new file if
+   * the current one is full.
+   */
+  mcap::Status write(uint64_t timestamp, const ChannelKey &key, std::string_view data);
+
+  /**
+   * @brief Writes one encoded entry to the channel for `transport`.
+   */
+  mcap::Status write(uint64_t timestamp, Transport transport, std::string_view data);
+
+  /**
+   * @brief The monotonic time in nanoseconds by which `flush()` should be called so that no
+   * entry waits in memory for longer than `max_chunk_latency`, or UINT64_MAX if nothing is
+   * waiting.
+   */
+  uint64_t flush_deadline() const;
+
+  /**
+   * @brief Closes the chunk in progress, even if it is below the target chunk size, and
+   * flushes the file so that readers can see every entry written so far.
+   */
+  void flush();
+
+  /**
+   * @brief Writes a metadata record to the current file, between the entries written before
+   * and after it.
+   */
+  mcap::Status write_metadata(const mcap::Metadata &metadata);
+
+  /**
+   * @brief Writes the MCAP summary and closes the file.
+   */
+  void close();
+
+  /**
+   * @brief The sizes of the chunks written to every file so far.
+   */
+  ChunkSizeStats chunk_stats() const;
+
+  /**
+   * @brief Why chunk indexes could not be spilled with `max_index_memory` since the last call,
+   * or an empty string. Indexes which cannot be spilled stay in memory, and a file whose
+   * spilled indexes cannot be read back is closed without chunk indexes.
+   */
+  std::string take_index_warning();
+
+  /**
+   * @brief The number of channels created so far, including every transport channel.
+   */
+  size_t channel_count() const;
+
+  /**
+   * @brief The topic of channel number `channel`.
+   */
+  const std::string &channel_topic(size_t channel) const;
+
+  /**
+   * @brief The number of entries written to channel number `channel`, across all files.
+   * Transport channels are numbered by their Transport.
+   */
+  uint64_t entry_count(size_t channel) const;
+
+  /**
+   * @brief The total size of the encoded entries written to channel number `channel`,
+   * across all files.
+   */
+  uint64_t byte_count(size_t channel) const;
+
+  /**
+   * @brief The number of files opened so far.
+   */
+  uint32_t file_count() const;
+
+  /**
+   * @brief The first error writing a file closed so far with IO_THREAD or IO_URING, or its
+   * sequence metadata when rotating, as a negative errno-style value, or 0. Such errors are only
+   * seen once the file is closed in the background, so `write()` cannot return them.
+   */
+  int output_error() const;
+
+private:
+  const LogEncoder *encoder_ = nullptr;
+  LogWriterOptions options_;
+  std::string filename_template_;
+  // the file `writer_` writes to with IO_THREAD or IO_URING, which must outlive it.
+  std::unique_ptr<AsyncFileWriter> output_;
+  std::unique_ptr<mcap::McapWriter> writer_;
+  std::string filename_;
+  std::string previous_filename_;
+  uint32_t file_index_ = 0;
+  uint64_t file_start_timestamp_ = 0;
+  bool file_has_entries_ = false;
+  // the monotonic time of the first entry written since the output was last flushed, or 0.
+  uint64_t unflushed_since_ = 0;
+  // the chunks written so far, added to as each is written, including by `closer_`.
+  mutable std::mutex chunk_stats_mutex_;
+  ChunkSizeStats chunk_stats_;
+  std::atomic<int> output_error_{0};
+  // set by the writers' spill callbacks, including on `closer_`.
+  std::mutex index_warning_mutex_;
+  std::string index_warning_;
+  mcap::SchemaId schema_id_ = 0;
+  // indexed by channel number.
+  std::vector<std::string> channel_topics_;
+  std::vector<uint32_t> sequence_counts_;
+  std::vector<uint64_t> byte_counts_;
+  // the sequence count of each channel when the current file was opened. Channels created
+  // since then started at 0.
+  std::vector<uint32_t> file_first_sequences_;
+  // the id of each channel in the current file, or 0 if it has not been added to it yet.
+  std::vector<mcap::ChannelId> file_channel_ids_;
+  size_t file_channel_count_ = 0;
+  // unit, command and other machines' channel numbers, keyed by views of `channel_names_`,
+  // which keeps each name at a stable address. Other machines' channels are keyed by their
+  // topic after the /journald/ prefix, built in `machine_channel_name_`.
+  std::unordered_map<std::string_view, uint32_t> unit_channels_;
+  std::unordered_map<std::string_view, uint32_t> comm_channels_;
+  std::unordered_map<std::string_view, uint32_t> machine_channels_;
+  std::string machine_channel_name_;
+  std::deque<std::string> channel_names_;
+  // closes the previous file while entries are written to the current one.
+  std::thread closer_;
+
+  bool rotation_enabled() const;
+  bool should_rotate(uint64_t timestamp) const;
+  mcap::Status open_file(const std::string &filename);
+  uint32_t add_channel(std::string topic);
+  uint32_t named_channel(std::unordered_map<std::string_view, uint32_t> *channels,
+                         std::string_view topic_prefix, std::string_view name);
+  uint32_t channel_for(const ChannelKey &key);
+  uint32_t machine_channel(const ChannelKey &key);
+  mcap::ChannelId add_file_channel(uint32_t channel);
+  mcap::Metadata sequence_metadata(const std::string &next_filename) const;
+  void close_file(mcap::McapWriter *writer, AsyncFileWriter *output,
+                  const mcap::Metadata *metadata);
+  mcap::Status rotate();
+};
+
+#endif
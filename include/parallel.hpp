@@ -0,0 +1,29 @@
+#ifndef PARALLEL_HPP
+#define PARALLEL_HPP
+
+#include "cmdline.hpp"
+#include "output.hpp"
+
+/**
+ * @brief returns true if the range selected by `options` is bounded at both ends, so that it
+ * can be split up between worker threads, and no state file needs the last entry's cursor.
+ */
+bool supports_parallel_export(const Options &options);
+
+/**
+ * @brief Exports the range selected by `options` using `options.jobs` worker threads.
+ *
+ * The range is split into many short time slices. Each worker opens its own journal handle
+ * on the files which may hold the range, as `open_local_journal()` does, and repeatedly claims the next slice, seeks to its start and serializes entries until the
+ * slice end. The calling thread writes finished slices to `writer` in order, so logTime order
+ * and per-channel sequence numbers are the same as for a sequential export. Workers may only
+ * run a few slices ahead of the writer, which bounds memory use.
+ *
+ * Like `next_journal_entry()`, this assumes entry realtime timestamps increase through the
+ * range; entries logged before a backwards clock jump may land in a different slice.
+ *
+ * @returns a process exit code, after printing any error.
+ */
+int export_parallel(const Options &options, LogWriter *writer);
+
+#endif
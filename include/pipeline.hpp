@@ -0,0 +1,162 @@
+#ifndef PIPELINE_HPP
+#define PIPELINE_HPP
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "encoder.hpp"
+#include "entry_batch.hpp"
+#include "journal.hpp"
+#include "output.hpp"
+#include "shedding.hpp"
+#include "spsc_ring.hpp"
+#include "stats.hpp"
+
+struct PipelineOptions {
+  Encoding encoding = ENCODING_JSON;
+  uint32_t encoder_threads = 2;
+  // entries are handed between threads in batches of up to this many.
+  size_t batch_size = 256;
+  // how many batches each encoder thread may hold, read or encoded, before the reader
+  // blocks. Together these bound the memory used by entries in flight.
+  size_t batches_per_encoder = 4;
+  // what to do with entries read while more than `high_watermark` are waiting to be written,
+  // see LoadShedder. The batches hold up to `2 * encoder_threads * batches_per_encoder *
+  // batch_size` entries, and more batches are used if that is not a third above the
+  // watermark. 0 is three quarters of what the batches hold.
+  OverloadPolicy overload = OVERLOAD_BLOCK;
+  uint64_t high_watermark = 0;
+  // how often the writer thread writes a DROPPED_METADATA_NAME record once entries have been
+  // dropped since the last one. 0 writes one only when finishing.
+  uint64_t dropped_metadata_interval_ns = 0;
+  // times the encode and write stages, as `StageTimer`s of their own.
+  bool time_stages = false;
+  // called on the writer thread every `stats_interval_ns` with the stage times so far, eg. to
+  // write the --stats-file, which reads the writer's counters. 0 disables.
+  uint64_t stats_interval_ns = 0;
+  std::function<void(const StageTimer &timer)> write_stats;
+};
+
+/**
+ * @brief Reads, encodes and writes entries on separate threads, so that a slow write or a
+ * compression stall does not hold up reading the journal, and a burst of entries is encoded
+ * by several threads at once.
+ *
+ * The thread reading the journal copies each entry into a batch with `write()`. Batches are
+ * dealt out to the encoder threads in turn, each of which encodes its batches in order, and
+ * a single writer thread takes the encoded batches from the encoders in the same turn, so
+ * entries reach `LogWriter::write()` in the order they were read and the output is the same
+ * as that of encoding and writing each entry as it is read. Each encoder is connected to the
+ * reader and to the writer by `SpscRing`s, which also return the emptied batches, so batches
+ * are only allocated up front.
+ *
+ * While the writer falls behind, entries may be dropped as they are written, before they are
+ * copied, according to the `overload` policy; the writer thread records the drops in the
+ * output with `DROPPED_METADATA_NAME` records.
+ *
+ * Once `start()` has been called, the `LogWriter` belongs to the writer thread until
+ * `finish()` returns: it flushes chunks when `LogWriter::flush_deadline()` falls due.
+ */
+class EntryPipeline {
+public:
+  EntryPipeline(LogWriter *writer, const PipelineOptions &options);
+  EntryPipeline(const EntryPipeline &) = delete;
+  EntryPipeline &operator=(const EntryPipeline &) = delete;
+  ~EntryPipeline();
+
+  /**
+   * @brief starts the encoder and writer threads. `reader_timer`, if not null, is the
+   * calling thread's timer, whose stage times are passed on to `write_stats`.
+   */
+  void start(const StageTimer *reader_timer = nullptr);
+
+  /**
+   * @brief copies `entry` into the batch being filled, handing the batch over once it is
+   * full. Blocks while every batch of the next encoder is in use.
+   *
+   * @returns false if an entry could not be written, see `error()`. Entries written after
+   * the first failure are dropped.
+   */
+  bool write(const JournalEntry &entry);
+
+  /**
+   * @brief hands over the batch being filled, even if it is not full, eg. before waiting for
+   * more entries, so that the entries in it are written without waiting for more.
+   */
+  void submit();
+
+  /**
+   * @brief hands over the last batch, waits until every entry has been written and stops the
+   * threads. The `LogWriter` can then be used, eg. closed, by the calling thread again.
+   *
+   * @returns false if an entry could not be written, see `error()`.
+   */
+  bool finish();
+
+  /**
+   * @brief why the first entry which could not be written failed, once `write()` or
+   * `finish()` has returned false.
+   */
+  const std::string &error() const;
+
+  /**
+   * @brief the number of entries dropped so far by the `overload` policy.
+   */
+  uint64_t dropped_count() const;
+
+  /**
+   * @brief adds the time the encoder and writer threads spent in each stage to `timer`. Only
+   * valid once `finish()` has returned.
+   */
+  void add_stage_times(StageTimer *timer) const;
+
+private:
+  // raw entries copied from the journal by the reader.
+  struct RawBatch {
+    std::vector<JournalEntry> entries;
+    size_t size = 0;
+  };
+  // the rings connecting one encoder thread to the reader and to the writer.
+  struct Lane {
+    explicit Lane(size_t capacity)
+        : raw(capacity), free_raw(capacity), encoded(capacity), free_encoded(capacity) {}
+    SpscRing<std::unique_ptr<RawBatch>> raw;
+    SpscRing<std::unique_ptr<RawBatch>> free_raw;
+    SpscRing<std::unique_ptr<EntryBatch>> encoded;
+    SpscRing<std::unique_ptr<EntryBatch>> free_encoded;
+    std::thread thread;
+  };
+
+  LogWriter *writer_;
+  PipelineOptions options_;
+  std::vector<std::unique_ptr<Lane>> lanes_;
+  std::thread writer_thread_;
+  bool running_ = false;
+  // the batch the reader is filling, and the lane it goes to.
+  std::unique_ptr<RawBatch> current_;
+  size_t next_lane_ = 0;
+  // entries handed to the pipeline by the reader, and taken from it by the writer thread.
+  uint64_t handed_count_ = 0;
+  std::atomic<uint64_t> taken_count_{0};
+  std::unique_ptr<LoadShedder> shedder_;
+  std::atomic<bool> failed_{false};
+  std::string error_;
+  // the stage times of each encoder, of the writer and of the reader, in that order, which
+  // each thread publishes as it hands over a batch, for `write_stats`.
+  std::mutex timers_mutex_;
+  std::vector<StageTimer> timers_;
+  const StageTimer *reader_timer_ = nullptr;
+
+  void run_encoder(size_t lane);
+  void run_writer();
+  void publish_timer(size_t index, const StageTimer &timer);
+  void write_stats(const StageTimer &writer_timer);
+  void write_dropped_metadata();
+};
+
+#endif
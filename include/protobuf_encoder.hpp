@@ -0,0 +1,49 @@
+#ifndef PROTOBUF_ENCODER_HPP
+#define PROTOBUF_ENCODER_HPP
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "encoder.hpp"
+
+/**
+ * @brief The field number of `foxglove.Log.journal_fields`, a repeated `foxglove.KeyValuePair`
+ * holding the journal fields which have no equivalent in `foxglove.Log`. Upstream
+ * `foxglove.Log` only uses field numbers 1 to 6.
+ */
+constexpr uint32_t JOURNAL_FIELDS_FIELD_NUMBER = 15;
+
+/**
+ * @brief Serializes journal entries as protobuf `foxglove.Log` messages.
+ *
+ * The wire format is written by hand, so no protobuf library is needed. `MESSAGE`,
+ * `CODE_FILE`, `CODE_LINE` and the field used for `name` are stored only in their
+ * `foxglove.Log` fields; every other journal field is kept in `journal_fields`. Strings are
+ * written as-is when they are valid UTF-8, otherwise malformed sequences are replaced with
+ * U+FFFD.
+ */
+class ProtobufEncoder final : public LogEncoder {
+public:
+  ProtobufEncoder();
+
+  std::string_view encode(const JournalEntry &entry) override;
+  const char *schema_encoding() const override;
+  std::string_view schema_data() const override;
+  const char *message_encoding() const override;
+
+private:
+  std::string descriptor_set_;
+  std::string out_;
+  std::string key_scratch_;
+  std::string value_scratch_;
+};
+
+/**
+ * @brief Builds a serialized `google.protobuf.FileDescriptorSet` describing `foxglove.Log`,
+ * including its repeated `foxglove.KeyValuePair journal_fields = 15` field, and the files it
+ * depends on.
+ */
+std::string log_file_descriptor_set();
+
+#endif
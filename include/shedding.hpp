@@ -0,0 +1,80 @@
+#ifndef SHEDDING_HPP
+#define SHEDDING_HPP
+#include <array>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "vendor/mcap/types.hpp"
+
+#include "cmdline.hpp"
+#include "journal.hpp"
+
+/**
+ * @brief the name of the metadata records counting the entries dropped so far.
+ */
+constexpr const char *DROPPED_METADATA_NAME = "journal2mcap.dropped";
+
+/**
+ * @brief With OVERLOAD_SAMPLE, one in this many DEBUG and INFO entries is kept while the
+ * queue is above its high watermark.
+ */
+constexpr uint64_t OVERLOAD_SAMPLE_INTERVAL = 10;
+
+/**
+ * @brief Decides which entries to drop while the output falls behind the journal, so that a
+ * stalled disk does not stop entries from being read until journald rotates them away, and
+ * counts the entries dropped.
+ *
+ * Entries are judged by how many are waiting in memory to be written, the queue depth. Below
+ * `high_watermark` every entry is kept. Above it, OVERLOAD_DROP drops entries by their
+ * `level_for_priority()` level, least important first: DEBUG and entries without a priority,
+ * then also INFO once the queue is a third of the way from the watermark to `capacity`, then
+ * also WARNING two thirds of the way. OVERLOAD_SAMPLE keeps one in
+ * `OVERLOAD_SAMPLE_INTERVAL` DEBUG and INFO entries. ERROR and FATAL entries are never
+ * dropped; once the queue is full, they wait for room as with OVERLOAD_BLOCK.
+ *
+ * Dropped entries are counted by unit, or by command or transport for entries outside a unit,
+ * and by level. `admit()` is called by the thread reading entries, and `take_metadata()` may
+ * be called by another.
+ */
+class LoadShedder {
+public:
+  LoadShedder(OverloadPolicy policy, uint64_t high_watermark, uint64_t capacity);
+
+  /**
+   * @brief whether to keep `entry`, read while `depth` entries are waiting to be written.
+   * Entries which are not kept are counted as dropped.
+   */
+  bool admit(const JournalEntry &entry, uint64_t depth);
+
+  /**
+   * @brief the number of entries dropped so far.
+   */
+  uint64_t dropped_count() const;
+
+  /**
+   * @brief fills in a `DROPPED_METADATA_NAME` record with the number of entries dropped so
+   * far, under the key `<unit>/<LEVEL>` for each unit and level with drops and `total`.
+   *
+   * @returns false, leaving `metadata` unchanged, if no entry has been dropped since the last
+   * record was taken.
+   */
+  bool take_metadata(mcap::Metadata *metadata);
+
+private:
+  OverloadPolicy policy_;
+  uint64_t high_watermark_;
+  uint64_t capacity_;
+  // counts the DEBUG and INFO entries seen above the watermark, for sampling.
+  std::array<uint64_t, 6> sampled_ = {};
+  mutable std::mutex mutex_;
+  std::unordered_map<std::string, uint64_t> counts_;
+  uint64_t dropped_ = 0;
+  uint64_t reported_ = 0;
+  // the key of the entry being counted, reused so that repeat drops do not allocate.
+  std::string key_;
+};
+
+#endif
@@ -0,0 +1,148 @@
+#ifndef SPSC_RING_HPP
+#define SPSC_RING_HPP
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <ctime>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <vector>
+
+#include "event_loop.hpp"
+
+/**
+ * @brief A bounded queue which hands values from one producer thread to one consumer thread
+ * without locks. Each side only blocks when the ring is full or empty, on a futex which the
+ * other side only wakes if it is waiting, so a ring which keeps up makes no system calls.
+ *
+ * Values are moved in and out, and are meant to be cheap handles to batches of work, such as
+ * `std::unique_ptr`s, so that the cost of each handover is shared by many entries.
+ */
+template <typename T> class SpscRing {
+public:
+  /**
+   * @brief `capacity` is rounded up to a power of 2.
+   */
+  explicit SpscRing(size_t capacity) {
+    size_t size = 1;
+    while (size < capacity) {
+      size *= 2;
+    }
+    slots_.resize(size);
+    mask_ = uint32_t(size - 1);
+  }
+
+  /**
+   * @brief moves `value` into the ring, blocking while it is full.
+   *
+   * @returns false, leaving `value` unchanged, if the ring has been closed.
+   */
+  bool push(T &&value) {
+    while (!closed_.load(std::memory_order_acquire)) {
+      const uint32_t tail = tail_.load(std::memory_order_relaxed);
+      if (tail - head_.load(std::memory_order_acquire) <= mask_) {
+        slots_[tail & mask_] = std::move(value);
+        tail_.store(tail + 1, std::memory_order_seq_cst);
+        wake(&consumer_waiting_, &consumer_events_);
+        return true;
+      }
+      wait(&producer_waiting_, &producer_events_, UINT64_MAX,
+           [&] { return tail - head_.load(std::memory_order_seq_cst) <= mask_; });
+    }
+    return false;
+  }
+
+  /**
+   * @brief moves the oldest value out of the ring into `value`, blocking while the ring is
+   * empty, until the `CLOCK_MONOTONIC` time reaches `deadline_ns`.
+   *
+   * @returns 1 if a value was taken, 0 if the ring is empty and closed, or -ETIMEDOUT.
+   */
+  int pop(T *value, uint64_t deadline_ns = UINT64_MAX) {
+    while (true) {
+      const uint32_t head = head_.load(std::memory_order_relaxed);
+      if (tail_.load(std::memory_order_acquire) != head) {
+        *value = std::move(slots_[head & mask_]);
+        head_.store(head + 1, std::memory_order_seq_cst);
+        wake(&producer_waiting_, &producer_events_);
+        return 1;
+      }
+      if (closed_.load(std::memory_order_acquire)) {
+        // values pushed before the ring was closed are still taken.
+        if (tail_.load(std::memory_order_acquire) == head) {
+          return 0;
+        }
+        continue;
+      }
+      if (deadline_ns != UINT64_MAX && monotonic_ns() >= deadline_ns) {
+        return -ETIMEDOUT;
+      }
+      wait(&consumer_waiting_, &consumer_events_, deadline_ns,
+           [&] { return tail_.load(std::memory_order_seq_cst) != head; });
+    }
+  }
+
+  /**
+   * @brief ends the ring: the consumer takes the values already pushed and is then told it is
+   * closed, and further pushes fail. Either side may close it.
+   */
+  void close() {
+    closed_.store(true, std::memory_order_seq_cst);
+    consumer_events_.fetch_add(1, std::memory_order_seq_cst);
+    producer_events_.fetch_add(1, std::memory_order_seq_cst);
+    futex(&consumer_events_, FUTEX_WAKE_PRIVATE, INT32_MAX, nullptr);
+    futex(&producer_events_, FUTEX_WAKE_PRIVATE, INT32_MAX, nullptr);
+  }
+
+private:
+  std::vector<T> slots_;
+  uint32_t mask_ = 0;
+  // the next slot to pop and to push. They count up without wrapping at the capacity, so the
+  // ring is full when they are `capacity` apart.
+  alignas(64) std::atomic<uint32_t> head_{0};
+  alignas(64) std::atomic<uint32_t> tail_{0};
+  // each side sets its flag before sleeping on its event count, which the other side then
+  // bumps before waking it, so that a wakeup between its last check and the futex call is
+  // not lost.
+  alignas(64) std::atomic<bool> consumer_waiting_{false};
+  std::atomic<uint32_t> consumer_events_{0};
+  alignas(64) std::atomic<bool> producer_waiting_{false};
+  std::atomic<uint32_t> producer_events_{0};
+  std::atomic<bool> closed_{false};
+
+  static long futex(std::atomic<uint32_t> *word, int op, uint32_t value,
+                    const struct timespec *timeout) {
+    return syscall(SYS_futex, reinterpret_cast<uint32_t *>(word), op, value, timeout, nullptr,
+                   0);
+  }
+
+  static void wake(std::atomic<bool> *waiting, std::atomic<uint32_t> *events) {
+    if (waiting->load(std::memory_order_seq_cst)) {
+      events->fetch_add(1, std::memory_order_seq_cst);
+      futex(events, FUTEX_WAKE_PRIVATE, 1, nullptr);
+    }
+  }
+
+  template <typename Ready>
+  void wait(std::atomic<bool> *waiting, std::atomic<uint32_t> *events, uint64_t deadline_ns,
+            Ready ready) {
+    const uint32_t observed = events->load(std::memory_order_seq_cst);
+    waiting->store(true, std::memory_order_seq_cst);
+    if (!ready() && !closed_.load(std::memory_order_seq_cst)) {
+      struct timespec timeout;
+      const struct timespec *timeout_ptr = nullptr;
+      if (deadline_ns != UINT64_MAX) {
+        const uint64_t now = monotonic_ns();
+        const uint64_t remaining = deadline_ns > now ? deadline_ns - now : 0;
+        timeout.tv_sec = time_t(remaining / 1'000'000'000);
+        timeout.tv_nsec = long(remaining % 1'000'000'000);
+        timeout_ptr = &timeout;
+      }
+      futex(events, FUTEX_WAIT_PRIVATE, observed, timeout_ptr);
+    }
+    waiting->store(false, std::memory_order_relaxed);
+  }
+};
+
+#endif
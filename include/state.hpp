@@ -0,0 +1,31 @@
+#ifndef STATE_HPP
+#define STATE_HPP
+#include <string>
+#include <string_view>
+
+/**
+ * @brief reads the journal cursor saved in the state file at `path`. A missing file is not an
+ * error, and leaves `cursor` empty.
+ *
+ * @returns 0 on success, or a negative errno-style value.
+ */
+int read_state_file(const std::string &path, std::string *cursor);
+
+/**
+ * @brief saves `cursor` in the state file at `path`. The cursor is written and synced to a
+ * temporary file next to `path`, which is then renamed over it, so a crash leaves either the
+ * old or the new state file and never a partial one.
+ *
+ * @returns 0 on success, or a negative errno-style value.
+ */
+int write_state_file(const std::string &path, std::string_view cursor);
+
+/**
+ * @brief replaces the file at `path` with `contents` the same way, so that readers and crashes
+ * only ever see a complete file.
+ *
+ * @returns 0 on success, or a negative errno-style value.
+ */
+int replace_file(const std::string &path, std::string_view contents);
+
+#endif
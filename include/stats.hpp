@@ -0,0 +1,117 @@
+#ifndef STATS_HPP
+#define STATS_HPP
+#include <cstdint>
+#include <string>
+
+#include "event_loop.hpp"
+#include "output.hpp"
+
+/**
+ * @brief the stages an entry passes through in the export loop, plus the work done for
+ * chunks and files as a whole.
+ */
+enum Stage {
+  STAGE_READ,     // sd_journal_next() and decoding the entry's fields.
+  STAGE_ENCODE,   // LogEncoder::encode().
+  STAGE_WRITE,    // LogWriter::write(), including inline chunk compression.
+  STAGE_COMPRESS, // compressing chunks, on whichever thread compressed them.
+  STAGE_SYNC,     // flushing and closing output files, and saving the state file.
+  _STAGE_COUNT,
+};
+
+/**
+ * @brief provides the name for a Stage as a static C string.
+ */
+const char *name_for_stage(Stage stage);
+
+/**
+ * @brief Accumulates the time the export loop spends in each stage.
+ *
+ * Reading the clock for every entry would cost more than some stages do, so only one loop
+ * iteration in `SAMPLE_INTERVAL` is timed and the per-entry stages are scaled up from those
+ * samples. While disabled, each call costs a single branch.
+ */
+class StageTimer {
+public:
+  static constexpr uint32_t SAMPLE_INTERVAL = 16;
+
+  explicit StageTimer(bool enabled = false);
+
+  /**
+   * @brief starts a loop iteration, which is timed if it is a sample.
+   */
+  void begin() {
+    if (enabled_) {
+      begin_sample();
+    }
+  }
+
+  /**
+   * @brief attributes the time since the previous call to `begin()` or `lap()` to `stage`.
+   */
+  void lap(Stage stage) {
+    if (sampling_) {
+      lap_sample(stage);
+    }
+  }
+
+  /**
+   * @brief times one call to `f` and attributes it to `stage`, unsampled. For work which is
+   * done once per chunk or file rather than once per entry.
+   */
+  template <typename F> void time(Stage stage, F &&f) {
+    if (!enabled_) {
+      f();
+      return;
+    }
+    const uint64_t start = monotonic_ns();
+    f();
+    unsampled_ns_[stage] += monotonic_ns() - start;
+  }
+
+  /**
+   * @brief adds the estimated stage times of `other`, eg. a timer kept by another thread, to
+   * this timer's.
+   */
+  void add(const StageTimer &other);
+
+  /**
+   * @brief the estimated total time spent in `stage`, in seconds. STAGE_COMPRESS is not
+   * timed here, see `ChunkSizeStats::compression_ns`.
+   */
+  double seconds(Stage stage) const;
+
+  /**
+   * @brief the time since the timer was created, in seconds.
+   */
+  double elapsed_seconds() const;
+
+  bool enabled() const { return enabled_; }
+
+private:
+  bool enabled_;
+  bool sampling_ = false;
+  uint64_t iterations_ = 0;
+  uint64_t sampled_iterations_ = 0;
+  uint64_t last_ns_ = 0;
+  uint64_t start_ns_ = 0;
+  uint64_t sampled_ns_[_STAGE_COUNT] = {};
+  uint64_t unsampled_ns_[_STAGE_COUNT] = {};
+
+  void begin_sample();
+  void lap_sample(Stage stage);
+};
+
+/**
+ * @brief describes the stage times, per-channel counters and chunks of an export for
+ * `--stats`, as a human-readable table.
+ */
+std::string format_stats_text(const StageTimer &timer, const LogWriter &writer);
+
+/**
+ * @brief describes the same statistics as `format_stats_text()` as a JSON object, for
+ * `--stats-file`.
+ */
+std::string format_stats_json(const StageTimer &timer, const LogWriter &writer);
+
+#endif
@@ -0,0 +1,26 @@
+#ifndef UTF8_HPP
+#define UTF8_HPP
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+/**
+ * @brief Returns the number of bytes at the start of `s` which form a well-formed UTF-8
+ * prefix, using the same acceptance rules as the decoder in nlohmann::json. `complete` is
+ * set if those bytes make up a whole code point. Returns 0 if `s[0]` cannot start a code point.
+ */
+size_t utf8_prefix_length(const uint8_t *s, size_t size, bool *complete);
+
+/**
+ * @brief Returns true if `value` is entirely well-formed UTF-8.
+ */
+bool is_valid_utf8(std::string_view value);
+
+/**
+ * @brief Appends `value` to `out`, replacing malformed UTF-8 sequences with U+FFFD the same
+ * way nlohmann::json's `error_handler_t::replace` mode does.
+ */
+void append_utf8(std::string *out, std::string_view value);
+
+#endif
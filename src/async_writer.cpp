@@ -0,0 +1,554 @@
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <mutex>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <thread>
+#include <unistd.h>
+
+#include "async_writer.hpp"
+
+namespace {
+
+// blocks are aligned in memory for the page cache and any direct I/O below it.
+constexpr uint64_t BLOCK_ALIGNMENT = 4096;
+
+struct WriteJob {
+  uint32_t block;
+  const std::byte *data;
+  uint64_t offset;
+  uint64_t size;
+  // with sync_writeback, the previous block, which is waited for once this one is written.
+  uint64_t previous_offset;
+  uint64_t previous_size;
+};
+
+/**
+ * @brief writes the rest of `job` from `written` bytes in, with pwrite().
+ */
+int write_rest(int fd, const WriteJob &job, uint64_t written) {
+  while (written < job.size) {
+    ssize_t n = pwrite(fd, job.data + written, job.size - written, job.offset + written);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -errno;
+    }
+    written += n;
+  }
+  return 0;
+}
+
+} // namespace
+
+/**
+ * @brief Writes blocks in the background, reporting each one back once it is written.
+ */
+class WriteBackend {
+public:
+  virtual ~WriteBackend() = default;
+
+  virtual void submit(const WriteJob &job) = 0;
+
+  /**
+   * @brief blocks until at least one submitted block is written, and appends the indexes of
+   * the blocks which have been. Sets `err` to the first error, if any.
+   */
+  virtual void wait(std::vector<uint32_t> *blocks, int *err) = 0;
+};
+
+namespace {
+
+class ThreadBackend final : public WriteBackend {
+public:
+  ThreadBackend(int fd, bool sync_writeback) : fd_(fd), sync_writeback_(sync_writeback) {
+    thread_ = std::thread([this]() { run(); });
+  }
+
+  ~ThreadBackend() override {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    cv_.notify_all();
+    thread_.join();
+  }
+
+  void submit(const WriteJob &job) override {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      jobs_.push_back(job);
+    }
+    cv_.notify_all();
+  }
+
+  void wait(std::vector<uint32_t> *blocks, int *err) override {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait(lock, [this]() { return !done_.empty(); });
+    blocks->insert(blocks->end(), done_.begin(), done_.end());
+    done_.clear();
+    if (*err == 0) {
+      *err = error_;
+    }
+  }
+
+private:
+  int fd_;
+  bool sync_writeback_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<WriteJob> jobs_;
+  std::vector<uint32_t> done_;
+  int error_ = 0;
+  bool stop_ = false;
+  std::thread thread_;
+
+  void run() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+      cv_.wait(lock, [this]() { return stop_ || !jobs_.empty(); });
+      if (jobs_.empty()) {
+        return;
+      }
+      const WriteJob job = jobs_.front();
+      jobs_.pop_front();
+      lock.unlock();
+      int err = write_rest(fd_, job, 0);
+      if (err == 0 && sync_writeback_) {
+        sync_file_range(fd_, job.offset, job.size, SYNC_FILE_RANGE_WRITE);
+        if (job.previous_size != 0) {
+          sync_file_range(fd_, job.previous_offset, job.previous_size,
+                          SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE |
+                              SYNC_FILE_RANGE_WAIT_AFTER);
+        }
+      }
+      lock.lock();
+      done_.push_back(job.block);
+      if (error_ == 0) {
+        error_ = err;
+      }
+      cv_.notify_all();
+    }
+  }
+};
+
+/**
+ * @brief Submits each block as an io_uring write, linked to its sync_file_range() calls, using
+ * the raw system calls so that liburing is not needed.
+ */
+class UringBackend final : public WriteBackend {
+public:
+  /**
+   * @brief sets up a ring for `block_count` blocks, or returns nullptr if io_uring is not
+   * available.
+   */
+  static std::unique_ptr<UringBackend> create(int fd, uint32_t block_count,
+                                              bool sync_writeback) {
+    auto backend = std::unique_ptr<UringBackend>(new UringBackend(fd, sync_writeback));
+    // each block needs up to three submissions: the write and two sync_file_range() calls.
+    if (backend->setup(block_count * OPS_PER_BLOCK) != 0) {
+      return nullptr;
+    }
+    backend->jobs_.resize(block_count);
+    backend->pending_ops_.assign(block_count, 0);
+    return backend;
+  }
+
+  ~UringBackend() override {
+    if (sqes_ != nullptr) {
+      munmap(sqes_, sqes_size_);
+    }
+    if (cq_ring_ != nullptr && cq_ring_ != sq_ring_) {
+      munmap(cq_ring_, cq_ring_size_);
+    }
+    if (sq_ring_ != nullptr) {
+      munmap(sq_ring_, sq_ring_size_);
+    }
+    if (ring_fd_ >= 0) {
+      close(ring_fd_);
+    }
+  }
+
+  void submit(const WriteJob &job) override {
+    jobs_[job.block] = job;
+    const bool sync_previous = sync_writeback_ && job.previous_size != 0;
+    io_uring_sqe *sqe = next_sqe();
+    sqe->opcode = IORING_OP_WRITE;
+    sqe->fd = fd_;
+    sqe->addr = uint64_t(uintptr_t(job.data));
+    sqe->len = uint32_t(job.size);
+    sqe->off = job.offset;
+    sqe->flags = sync_writeback_ ? IOSQE_IO_LINK : 0;
+    sqe->user_data = user_data(job.block, OP_WRITE);
+    uint32_t ops = 1;
+    if (sync_writeback_) {
+      sqe = next_sqe();
+      sqe->opcode = IORING_OP_SYNC_FILE_RANGE;
+      sqe->fd = fd_;
+      sqe->len = uint32_t(job.size);
+      sqe->off = job.offset;
+      sqe->sync_range_flags = SYNC_FILE_RANGE_WRITE;
+      sqe->flags = sync_previous ? IOSQE_IO_LINK : 0;
+      sqe->user_data = user_data(job.block, OP_SYNC);
+      ops++;
+    }
+    if (sync_previous) {
+      sqe = next_sqe();
+      sqe->opcode = IORING_OP_SYNC_FILE_RANGE;
+      sqe->fd = fd_;
+      sqe->len = uint32_t(job.previous_size);
+      sqe->off = job.previous_offset;
+      sqe->sync_range_flags =
+          SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER;
+      sqe->user_data = user_data(job.block, OP_SYNC);
+      ops++;
+    }
+    pending_ops_[job.block] = ops;
+    unsubmitted_ += ops;
+    // a submission the kernel could not take now is retried by `wait()`.
+    enter(0);
+  }
+
+  void wait(std::vector<uint32_t> *blocks, int *err) override {
+    const size_t found = blocks->size();
+    while (blocks->size() == found) {
+      reap(blocks, err);
+      if (blocks->size() != found) {
+        break;
+      }
+      const int ret = enter(1);
+      // EAGAIN and EBUSY clear up once completions are reaped, while other errors would keep
+      // the entries left in the queue from ever completing.
+      if (ret < 0 && ret != -EAGAIN && ret != -EBUSY) {
+        abandon_unsubmitted(blocks, err, ret);
+      }
+    }
+  }
+
+private:
+  static constexpr uint32_t OPS_PER_BLOCK = 3;
+  static constexpr uint64_t OP_WRITE = 0;
+  static constexpr uint64_t OP_SYNC = 1;
+
+  int fd_;
+  bool sync_writeback_;
+  int ring_fd_ = -1;
+  void *sq_ring_ = nullptr;
+  void *cq_ring_ = nullptr;
+  io_uring_sqe *sqes_ = nullptr;
+  size_t sq_ring_size_ = 0;
+  size_t cq_ring_size_ = 0;
+  size_t sqes_size_ = 0;
+  unsigned *sq_tail_ = nullptr;
+  unsigned *sq_mask_ = nullptr;
+  unsigned *sq_array_ = nullptr;
+  unsigned *cq_head_ = nullptr;
+  unsigned *cq_tail_ = nullptr;
+  unsigned *cq_mask_ = nullptr;
+  io_uring_cqe *cqes_ = nullptr;
+  std::vector<WriteJob> jobs_;
+  // the completions still expected for each block.
+  std::vector<uint32_t> pending_ops_;
+  // the entries at the end of the submission queue which the kernel has not taken yet.
+  uint32_t unsubmitted_ = 0;
+
+  UringBackend(int fd, bool sync_writeback) : fd_(fd), sync_writeback_(sync_writeback) {}
+
+  static uint64_t user_data(uint32_t block, uint64_t op) { return uint64_t(block) << 1 | op; }
+
+  int setup(uint32_t entries) {
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    ring_fd_ = int(syscall(__NR_io_uring_setup, entries, &params));
+    if (ring_fd_ < 0) {
+      return -errno;
+    }
+    // IORING_OP_WRITE arrived in Linux 5.6; FAST_POLL in 5.7 is the closest feature flag.
+    if ((params.features & IORING_FEAT_FAST_POLL) == 0) {
+      return -EOPNOTSUPP;
+    }
+    sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_ring_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    const bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single_mmap) {
+      sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+    }
+    sq_ring_ = map(sq_ring_size_, IORING_OFF_SQ_RING);
+    if (sq_ring_ == nullptr) {
+      return -errno;
+    }
+    cq_ring_ = single_mmap ? sq_ring_ : map(cq_ring_size_, IORING_OFF_CQ_RING);
+    if (cq_ring_ == nullptr) {
+      return -errno;
+    }
+    sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+    sqes_ = (io_uring_sqe *)(map(sqes_size_, IORING_OFF_SQES));
+    if (sqes_ == nullptr) {
+      return -errno;
+    }
+    char *sq = (char *)(sq_ring_);
+    char *cq = (char *)(cq_ring_);
+    sq_tail_ = (unsigned *)(sq + params.sq_off.tail);
+    sq_mask_ = (unsigned *)(sq + params.sq_off.ring_mask);
+    sq_array_ = (unsigned *)(sq + params.sq_off.array);
+    cq_head_ = (unsigned *)(cq + params.cq_off.head);
+    cq_tail_ = (unsigned *)(cq + params.cq_off.tail);
+    cq_mask_ = (unsigned *)(cq + params.cq_off.ring_mask);
+    cqes_ = (io_uring_cqe *)(cq + params.cq_off.cqes);
+    return 0;
+  }
+
+  void *map(size_t size, off_t offset) {
+    void *ptr =
+        mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, offset);
+    return ptr == MAP_FAILED ? nullptr : ptr;
+  }
+
+  /**
+   * @brief the next submission queue entry, cleared. There are enough entries for every block,
+   * including those the kernel has not taken yet, so the queue is never full.
+   */
+  io_uring_sqe *next_sqe() {
+    const unsigned tail = *sq_tail_;
+    const unsigned index = tail & *sq_mask_;
+    io_uring_sqe *sqe = &sqes_[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sq_array_[index] = index;
+    __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+    return sqe;
+  }
+
+  /**
+   * @brief submits the entries the kernel has not taken yet, and waits for `min_complete`
+   * completions.
+   *
+   * @returns the number of entries submitted, or a negative errno-style value.
+   */
+  int enter(uint32_t min_complete) {
+    const unsigned flags = min_complete != 0 ? IORING_ENTER_GETEVENTS : 0;
+    while (true) {
+      const long ret = syscall(__NR_io_uring_enter, ring_fd_, unsubmitted_, min_complete, flags,
+                               nullptr, 0);
+      if (ret >= 0) {
+        unsubmitted_ -= std::min<uint32_t>(uint32_t(ret), unsubmitted_);
+        return int(ret);
+      }
+      if (errno != EINTR) {
+        return -errno;
+      }
+    }
+  }
+
+  /**
+   * @brief takes the entries the kernel has not taken back out of the submission queue, and
+   * reports their blocks as failed with `error` once nothing else is expected for them.
+   */
+  void abandon_unsubmitted(std::vector<uint32_t> *blocks, int *err, int error) {
+    if (*err == 0) {
+      *err = error;
+    }
+    unsigned tail = *sq_tail_;
+    for (; unsubmitted_ > 0; --unsubmitted_) {
+      --tail;
+      const uint32_t block = uint32_t(sqes_[tail & *sq_mask_].user_data >> 1);
+      if (--pending_ops_[block] == 0) {
+        blocks->push_back(block);
+      }
+    }
+    __atomic_store_n(sq_tail_, tail, __ATOMIC_RELEASE);
+  }
+
+  void reap(std::vector<uint32_t> *blocks, int *err) {
+    unsigned head = *cq_head_;
+    const unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+    for (; head != tail; ++head) {
+      const io_uring_cqe &cqe = cqes_[head & *cq_mask_];
+      const uint32_t block = uint32_t(cqe.user_data >> 1);
+      if ((cqe.user_data & 1) == OP_WRITE) {
+        int res = cqe.res;
+        if (res >= 0 && uint64_t(res) < jobs_[block].size) {
+          // short writes are rare enough to finish synchronously.
+          res = write_rest(fd_, jobs_[block], res);
+        }
+        if (res < 0 && *err == 0) {
+          *err = res;
+        }
+      }
+      // a failed or short write cancels the sync_file_range() calls linked to it, which is
+      // not an error in itself.
+      if (--pending_ops_[block] == 0) {
+        blocks->push_back(block);
+      }
+    }
+    __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+  }
+};
+
+} // namespace
+
+void AsyncFileWriter::FreeDeleter::operator()(void *ptr) const { free(ptr); }
+
+AsyncFileWriter::AsyncFileWriter(const AsyncWriterOptions &options) : options_(options) {
+  options_.block_size = std::max<uint64_t>(
+      BLOCK_ALIGNMENT, (options_.block_size + BLOCK_ALIGNMENT - 1) / BLOCK_ALIGNMENT *
+                           BLOCK_ALIGNMENT);
+  options_.max_in_flight = std::max<uint32_t>(options_.max_in_flight, 1);
+}
+
+AsyncFileWriter::~AsyncFileWriter() { end(); }
+
+mcap::Status AsyncFileWriter::open(const std::string &filename) {
+  end();
+  fd_ = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd_ < 0) {
+    return mcap::Status(mcap::StatusCode::OpenFailed,
+                        "failed to open file \"" + filename + "\" for writing: " +
+                            strerror(errno));
+  }
+  const uint32_t block_count = options_.max_in_flight + 1;
+  blocks_.reset((std::byte *)(aligned_alloc(BLOCK_ALIGNMENT, block_count * options_.block_size)));
+  if (!blocks_) {
+    close(fd_);
+    fd_ = -1;
+    return mcap::Status(mcap::StatusCode::OpenFailed,
+                        "failed to allocate write buffers for \"" + filename + "\": " +
+                            strerror(ENOMEM));
+  }
+  free_blocks_.clear();
+  for (uint32_t i = block_count - 1; i > 0; --i) {
+    free_blocks_.push_back(i);
+  }
+  current_ = 0;
+  fill_ = 0;
+  block_offset_ = 0;
+  in_flight_ = 0;
+  previous_offset_ = 0;
+  previous_size_ = 0;
+  size_ = 0;
+  allocated_ = 0;
+  preallocate_failed_ = options_.preallocate_size == 0;
+  error_ = 0;
+  io_ = IO_THREAD;
+  if (options_.io == IO_URING) {
+    backend_ = UringBackend::create(fd_, block_count, options_.sync_writeback);
+    if (backend_) {
+      io_ = IO_URING;
+    }
+  }
+  if (!backend_) {
+    backend_ = std::make_unique<ThreadBackend>(fd_, options_.sync_writeback);
+  }
+  return mcap::StatusCode::Success;
+}
+
+void AsyncFileWriter::handleWrite(const std::byte *data, uint64_t size) {
+  if (fd_ < 0) {
+    return;
+  }
+  size_ += size;
+  while (size > 0) {
+    const uint64_t n = std::min(size, options_.block_size - fill_);
+    memcpy(block(current_) + fill_, data, n);
+    fill_ += n;
+    data += n;
+    size -= n;
+    if (fill_ == options_.block_size) {
+      const uint32_t full = current_;
+      // no block is being filled while waiting for a free one, see reap().
+      current_ = UINT32_MAX;
+      submit_block(full, fill_);
+      block_offset_ += fill_;
+      fill_ = 0;
+      current_ = take_free_block();
+    }
+  }
+}
+
+void AsyncFileWriter::flush() {
+  if (fd_ < 0) {
+    return;
+  }
+  if (fill_ > 0) {
+    // the block stays current, and is written again from its start once it fills.
+    submit_block(current_, fill_);
+  }
+  while (in_flight_ > 0) {
+    reap();
+  }
+}
+
+void AsyncFileWriter::end() {
+  if (fd_ < 0) {
+    return;
+  }
+  flush();
+  backend_.reset();
+  if (allocated_ > size_ && ftruncate(fd_, size_) != 0 && error_ == 0) {
+    // truncating to the current size releases the space reserved past it.
+    error_ = -errno;
+  }
+  if (close(fd_) != 0 && error_ == 0) {
+    error_ = -errno;
+  }
+  fd_ = -1;
+  blocks_.reset();
+}
+
+uint64_t AsyncFileWriter::size() const { return size_; }
+
+OutputIo AsyncFileWriter::io() const { return io_; }
+
+int AsyncFileWriter::error() const { return error_; }
+
+std::byte *AsyncFileWriter::block(uint32_t index) {
+  return blocks_.get() + index * options_.block_size;
+}
+
+void AsyncFileWriter::preallocate(uint64_t end_offset) {
+  while (!preallocate_failed_ && allocated_ < end_offset) {
+    if (fallocate(fd_, FALLOC_FL_KEEP_SIZE, allocated_, options_.preallocate_size) != 0) {
+      // eg. EOPNOTSUPP from filesystems which cannot reserve space.
+      preallocate_failed_ = true;
+      return;
+    }
+    allocated_ += options_.preallocate_size;
+  }
+}
+
+void AsyncFileWriter::submit_block(uint32_t index, uint64_t size) {
+  preallocate(block_offset_ + size);
+  WriteJob job{index, block(index), block_offset_, size, previous_offset_, previous_size_};
+  backend_->submit(job);
+  in_flight_++;
+  previous_offset_ = block_offset_;
+  previous_size_ = size;
+}
+
+void AsyncFileWriter::reap() {
+  written_.clear();
+  backend_->wait(&written_, &error_);
+  for (uint32_t index : written_) {
+    in_flight_--;
+    // a block written by flush() is still being filled.
+    if (index != current_) {
+      free_blocks_.push_back(index);
+    }
+  }
+}
+
+uint32_t AsyncFileWriter::take_free_block() {
+  while (free_blocks_.empty()) {
+    reap();
+  }
+  const uint32_t index = free_blocks_.back();
+  free_blocks_.pop_back();
+  return index;
+}
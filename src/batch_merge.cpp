@@ -0,0 +1,105 @@
+#include <queue>
+
+#include "batch_merge.hpp"
+
+BatchMerger::BatchMerger(size_t source_count, size_t max_queued_batches)
+    : max_queued_batches_(max_queued_batches), queues_(source_count) {}
+
+bool BatchMerger::push(size_t source, EntryBatch *batch) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  SourceQueue &queue = queues_[source];
+  cv_.wait(lock, [&] { return cancelled_ || queue.batches.size() < max_queued_batches_; });
+  if (cancelled_) {
+    return false;
+  }
+  queue.entry_count += batch->size();
+  queue.batches.push_back(std::move(*batch));
+  *batch = EntryBatch();
+  lock.unlock();
+  cv_.notify_all();
+  return true;
+}
+
+void BatchMerger::finish(size_t source, int err) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    queues_[source].err = err;
+    queues_[source].done = true;
+  }
+  cv_.notify_all();
+}
+
+void BatchMerger::cancel() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    cancelled_ = true;
+  }
+  cv_.notify_all();
+}
+
+uint64_t BatchMerger::entry_count(size_t source) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return queues_[source].entry_count;
+}
+
+// takes the next batch of `source`, returning 0 once it has no more.
+int BatchMerger::next_batch(size_t source, EntryBatch *batch) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  SourceQueue &queue = queues_[source];
+  cv_.wait(lock, [&] { return !queue.batches.empty() || queue.done; });
+  if (queue.batches.empty()) {
+    return queue.err;
+  }
+  *batch = std::move(queue.batches.front());
+  queue.batches.pop_front();
+  lock.unlock();
+  cv_.notify_all();
+  return 1;
+}
+
+int BatchMerger::merge(const WriteEntry &write, size_t *failed_source) {
+  // the batch each source is being merged from, and the next entry in it.
+  std::vector<EntryBatch> current(queues_.size());
+  std::vector<size_t> positions(queues_.size(), 0);
+  // the sources with entries left, by the timestamp of their next entry and then by index.
+  using HeapEntry = std::pair<uint64_t, size_t>;
+  std::priority_queue<HeapEntry, std::vector<HeapEntry>, std::greater<HeapEntry>> heap;
+  int ret = 0;
+  auto advance = [&](size_t i) {
+    // sources may hand over empty batches, which are skipped.
+    while (positions[i] == current[i].size()) {
+      int err = next_batch(i, &current[i]);
+      if (err <= 0) {
+        if (err < 0) {
+          *failed_source = i;
+          ret = err;
+        }
+        return;
+      }
+      positions[i] = 0;
+    }
+    heap.push(HeapEntry{current[i].timestamp(positions[i]), i});
+  };
+  for (size_t i = 0; i < queues_.size() && ret == 0; ++i) {
+    advance(i);
+  }
+  while (!heap.empty() && ret == 0) {
+    const size_t i = heap.top().second;
+    heap.pop();
+    // write the source's entries until another source has an earlier one.
+    const EntryBatch &batch = current[i];
+    do {
+      const size_t position = positions[i]++;
+      if (!write(batch.timestamp(position), batch.key(position), batch.encoded(position))) {
+        ret = 1;
+        break;
+      }
+    } while (positions[i] < batch.size() &&
+             (heap.empty() || HeapEntry{batch.timestamp(positions[i]), i} < heap.top()));
+    if (ret == 0) {
+      advance(i);
+    }
+  }
+  cancel();
+  return ret;
+}
@@ -1,5 +1,6 @@
 #include "cmdline.hpp"
 #include <cassert>
+#include <cstdint>
 #include <string_view>
 
 enum CmdlineToken {
@@ -9,6 +10,32 @@ enum CmdlineToken {
   TOKEN_START,
   TOKEN_END,
   TOKEN_OUTPUT,
+  TOKEN_ENCODING,
+  TOKEN_TOPICS,
+  TOKEN_JOBS,
+  TOKEN_COMPRESSION_THREADS,
+  TOKEN_IO,
+  TOKEN_SYNC_WRITEBACK,
+  TOKEN_ZSTD_DICTIONARY,
+  TOKEN_TRAIN_DICTIONARY,
+  TOKEN_DIRECTORY,
+  TOKEN_FILE,
+  TOKEN_READER,
+  TOKEN_IMPORT,
+  TOKEN_UNIT,
+  TOKEN_PRIORITY,
+  TOKEN_TRANSPORT,
+  TOKEN_MATCH,
+  TOKEN_STATE_FILE,
+  TOKEN_ROTATE_SIZE,
+  TOKEN_ROTATE_INTERVAL,
+  TOKEN_MAX_CHUNK_LATENCY,
+  TOKEN_COALESCE,
+  TOKEN_OVERLOAD,
+  TOKEN_HIGH_WATERMARK,
+  TOKEN_VERBOSE,
+  TOKEN_STATS,
+  TOKEN_STATS_FILE,
   TOKEN_INT,
   TOKEN_NOW,
   TOKEN_BOOT,
@@ -23,8 +50,60 @@ CmdlineToken token_of(const char *arg) {
     return TOKEN_HELP;
   } else if (this_arg == "--version") {
     return TOKEN_VERSION;
+  } else if (this_arg == "-v" || this_arg == "--verbose") {
+    return TOKEN_VERBOSE;
   } else if (this_arg == "-o" || this_arg == "--output") {
     return TOKEN_OUTPUT;
+  } else if (this_arg == "-j" || this_arg == "--jobs") {
+    return TOKEN_JOBS;
+  } else if (this_arg == "-u" || this_arg == "--unit") {
+    return TOKEN_UNIT;
+  } else if (this_arg == "-p" || this_arg == "--priority") {
+    return TOKEN_PRIORITY;
+  } else if (this_arg == "--transport") {
+    return TOKEN_TRANSPORT;
+  } else if (this_arg == "-m" || this_arg == "--match") {
+    return TOKEN_MATCH;
+  } else if (this_arg == "--rotate-size") {
+    return TOKEN_ROTATE_SIZE;
+  } else if (this_arg == "--rotate-interval") {
+    return TOKEN_ROTATE_INTERVAL;
+  } else if (this_arg == "--max-chunk-latency") {
+    return TOKEN_MAX_CHUNK_LATENCY;
+  } else if (this_arg == "--coalesce") {
+    return TOKEN_COALESCE;
+  } else if (this_arg == "--overload") {
+    return TOKEN_OVERLOAD;
+  } else if (this_arg == "--high-watermark") {
+    return TOKEN_HIGH_WATERMARK;
+  } else if (this_arg == "--state-file") {
+    return TOKEN_STATE_FILE;
+  } else if (this_arg == "--stats") {
+    return TOKEN_STATS;
+  } else if (this_arg == "--stats-file") {
+    return TOKEN_STATS_FILE;
+  } else if (this_arg == "--compression-threads") {
+    return TOKEN_COMPRESSION_THREADS;
+  } else if (this_arg == "--io") {
+    return TOKEN_IO;
+  } else if (this_arg == "--sync-writeback") {
+    return TOKEN_SYNC_WRITEBACK;
+  } else if (this_arg == "--zstd-dictionary") {
+    return TOKEN_ZSTD_DICTIONARY;
+  } else if (this_arg == "--train-dictionary") {
+    return TOKEN_TRAIN_DICTIONARY;
+  } else if (this_arg == "-D" || this_arg == "--directory") {
+    return TOKEN_DIRECTORY;
+  } else if (this_arg == "--file") {
+    return TOKEN_FILE;
+  } else if (this_arg == "--reader") {
+    return TOKEN_READER;
+  } else if (this_arg == "--import") {
+    return TOKEN_IMPORT;
+  } else if (this_arg == "--encoding") {
+    return TOKEN_ENCODING;
+  } else if (this_arg == "--topics") {
+    return TOKEN_TOPICS;
   } else if (this_arg == "-s" || this_arg == "--start") {
     return TOKEN_START;
   } else if (this_arg == "-e" || this_arg == "--end") {
@@ -45,6 +124,54 @@ CmdlineToken token_of(const char *arg) {
   return TOKEN_STRING;
 }
 
+/**
+ * @brief parses a syslog priority given as a number or as its journalctl name. Returns -1 if
+ * it is neither.
+ */
+int parse_priority(std::string_view arg) {
+  const char *names[] = {"emerg", "alert", "crit", "err", "warning", "notice", "info", "debug"};
+  for (int i = 0; i < 8; ++i) {
+    if (arg == names[i] || (arg.size() == 1 && arg[0] == '0' + i)) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+/**
+ * @brief parses a positive integer with an optional single-character unit suffix, where
+ * `multipliers[i]` is the value of `suffixes[i]`. Returns 0 if `arg` is not valid, or if its
+ * value overflows or is more than `max`.
+ */
+uint64_t parse_scaled(std::string_view arg, std::string_view suffixes,
+                      const uint64_t *multipliers, uint64_t max = UINT64_MAX) {
+  uint64_t multiplier = 1;
+  if (!arg.empty()) {
+    size_t suffix = suffixes.find(arg.back());
+    if (suffix != suffixes.npos) {
+      multiplier = multipliers[suffix];
+      arg.remove_suffix(1);
+    }
+  }
+  if (arg.empty() || arg.size() > 12 || arg.find_first_not_of("0123456789") != arg.npos) {
+    return 0;
+  }
+  uint64_t value = 0;
+  if (__builtin_mul_overflow(std::stoull(std::string(arg)), multiplier, &value) || value > max) {
+    return 0;
+  }
+  return value;
+}
+
+bool is_transport_name(std::string_view arg) {
+  for (const char *name : {"audit", "driver", "syslog", "journal", "stdout", "kernel"}) {
+    if (arg == name) {
+      return true;
+    }
+  }
+  return false;
+}
+
 int parse_options(int argc, const char **argv, Options *options) {
   assert(options != NULL);
   for (int i = 1; i < argc; ++i) {
@@ -55,6 +182,20 @@ int parse_options(int argc, const char **argv, Options *options) {
     case TOKEN_VERSION:
       options->version = true;
       break;
+    case TOKEN_VERBOSE:
+      options->verbose = true;
+      break;
+    case TOKEN_STATS:
+      options->stats = true;
+      break;
+    case TOKEN_STATS_FILE:
+      if (i == argc - 1 || token_of(argv[i + 1]) != TOKEN_STRING) {
+        fprintf(stderr, "expected a filename after %s\n", argv[i]);
+        return 1;
+      }
+      options->stats_file = std::string(argv[i + 1]);
+      i++;
+      break;
     case TOKEN_END:
       if (i == argc - 1) {
         fprintf(stderr, "expected an argument after %s\n", argv[i]);
@@ -115,6 +256,267 @@ int parse_options(int argc, const char **argv, Options *options) {
       // skip past the next argument
       i++;
       break;
+    case TOKEN_ROTATE_SIZE: {
+      const uint64_t multipliers[] = {1ull << 10, 1ull << 20, 1ull << 30};
+      uint64_t size = i == argc - 1 ? 0 : parse_scaled(argv[i + 1], "KMG", multipliers);
+      if (size == 0) {
+        fprintf(stderr, "expected a size in bytes, eg. '64M', after %s\n", argv[i]);
+        return 1;
+      }
+      options->rotate_size = size;
+      i++;
+      break;
+    }
+    case TOKEN_ROTATE_INTERVAL: {
+      const uint64_t multipliers[] = {1, 60, 60 * 60, 24 * 60 * 60};
+      // converted to nanoseconds by the writer.
+      uint64_t interval = i == argc - 1 ? 0
+                                        : parse_scaled(argv[i + 1], "smhd", multipliers,
+                                                       UINT64_MAX / 1'000'000'000);
+      if (interval == 0) {
+        fprintf(stderr, "expected an interval in seconds, eg. '1h', after %s\n", argv[i]);
+        return 1;
+      }
+      options->rotate_interval_sec = interval;
+      i++;
+      break;
+    }
+    case TOKEN_MAX_CHUNK_LATENCY: {
+      const uint64_t multipliers[] = {1000, 60 * 1000, 60 * 60 * 1000};
+      uint64_t latency = i == argc - 1 ? 0
+                                       : parse_scaled(argv[i + 1], "smh", multipliers,
+                                                      UINT64_MAX / 1'000'000);
+      if (latency == 0) {
+        fprintf(stderr, "expected a latency in milliseconds, eg. '500' or '2s', after %s\n",
+                argv[i]);
+        return 1;
+      }
+      options->max_chunk_latency_ms = latency;
+      i++;
+      break;
+    }
+    case TOKEN_COALESCE: {
+      const uint64_t multipliers[] = {1000, 60 * 1000, 60 * 60 * 1000};
+      uint64_t window = i == argc - 1 ? 0
+                                      : parse_scaled(argv[i + 1], "smh", multipliers,
+                                                     UINT64_MAX / 1'000'000);
+      if (window == 0) {
+        fprintf(stderr, "expected a window in milliseconds, eg. '500' or '2s', after %s\n",
+                argv[i]);
+        return 1;
+      }
+      options->coalesce_window_ms = window;
+      i++;
+      break;
+    }
+    case TOKEN_OVERLOAD: {
+      if (i == argc - 1) {
+        fprintf(stderr, "expected an argument after %s\n", argv[i]);
+        return 1;
+      }
+      std::string_view overload(argv[i + 1]);
+      if (overload == "block") {
+        options->overload = OVERLOAD_BLOCK;
+      } else if (overload == "drop") {
+        options->overload = OVERLOAD_DROP;
+      } else if (overload == "sample") {
+        options->overload = OVERLOAD_SAMPLE;
+      } else {
+        fprintf(stderr, "expected 'block', 'drop' or 'sample', got '%s'\n", argv[i + 1]);
+        return 1;
+      }
+      i++;
+      break;
+    }
+    case TOKEN_HIGH_WATERMARK: {
+      const uint64_t multipliers[] = {1000, 1000 * 1000};
+      uint64_t watermark = i == argc - 1 ? 0 : parse_scaled(argv[i + 1], "KM", multipliers);
+      if (watermark == 0) {
+        fprintf(stderr, "expected a number of entries, eg. '50K', after %s\n", argv[i]);
+        return 1;
+      }
+      options->high_watermark = watermark;
+      i++;
+      break;
+    }
+    case TOKEN_STATE_FILE:
+      if (i == argc - 1 || token_of(argv[i + 1]) != TOKEN_STRING) {
+        fprintf(stderr, "expected a filename after %s\n", argv[i]);
+        return 1;
+      }
+      options->state_file = std::string(argv[i + 1]);
+      i++;
+      break;
+    case TOKEN_JOBS: {
+      const uint64_t jobs = i == argc - 1 ? 0 : parse_scaled(argv[i + 1], "", nullptr, MAX_JOBS);
+      if (jobs == 0) {
+        fprintf(stderr, "expected a number of jobs from 1 to %u after %s\n", MAX_JOBS, argv[i]);
+        return 1;
+      }
+      options->jobs = uint32_t(jobs);
+      i++;
+      break;
+    }
+    case TOKEN_COMPRESSION_THREADS:
+      if (i == argc - 1 || token_of(argv[i + 1]) != TOKEN_INT) {
+        fprintf(stderr, "expected a number of threads after %s\n", argv[i]);
+        return 1;
+      }
+      options->compression_threads = std::stoul(std::string(argv[i + 1]));
+      i++;
+      break;
+    case TOKEN_IO: {
+      if (i == argc - 1) {
+        fprintf(stderr, "expected an argument after %s\n", argv[i]);
+        return 1;
+      }
+      std::string_view io(argv[i + 1]);
+      if (io == "stdio") {
+        options->io = IO_STDIO;
+      } else if (io == "thread") {
+        options->io = IO_THREAD;
+      } else if (io == "uring") {
+        options->io = IO_URING;
+      } else {
+        fprintf(stderr, "expected 'stdio', 'thread' or 'uring', got '%s'\n", argv[i + 1]);
+        return 1;
+      }
+      i++;
+      break;
+    }
+    case TOKEN_SYNC_WRITEBACK:
+      options->sync_writeback = true;
+      break;
+    case TOKEN_ZSTD_DICTIONARY:
+      if (i == argc - 1 || token_of(argv[i + 1]) != TOKEN_STRING) {
+        fprintf(stderr, "expected a filename after %s\n", argv[i]);
+        return 1;
+      }
+      options->zstd_dictionary = std::string(argv[i + 1]);
+      i++;
+      break;
+    case TOKEN_TRAIN_DICTIONARY:
+      if (i == argc - 1 || token_of(argv[i + 1]) != TOKEN_STRING) {
+        fprintf(stderr, "expected a filename after %s\n", argv[i]);
+        return 1;
+      }
+      options->train_dictionary = std::string(argv[i + 1]);
+      i++;
+      break;
+    case TOKEN_DIRECTORY:
+      if (i == argc - 1 || token_of(argv[i + 1]) != TOKEN_STRING) {
+        fprintf(stderr, "expected a directory after %s\n", argv[i]);
+        return 1;
+      }
+      options->directories.push_back(std::string(argv[i + 1]));
+      i++;
+      break;
+    case TOKEN_FILE:
+      if (i == argc - 1 || token_of(argv[i + 1]) != TOKEN_STRING) {
+        fprintf(stderr, "expected a filename after %s\n", argv[i]);
+        return 1;
+      }
+      options->files.push_back(std::string(argv[i + 1]));
+      i++;
+      break;
+    case TOKEN_READER: {
+      if (i == argc - 1) {
+        fprintf(stderr, "expected an argument after %s\n", argv[i]);
+        return 1;
+      }
+      std::string_view reader(argv[i + 1]);
+      if (reader == "libsystemd") {
+        options->reader = READER_LIBSYSTEMD;
+      } else if (reader == "mmap") {
+        options->reader = READER_MMAP;
+      } else {
+        fprintf(stderr, "expected 'libsystemd' or 'mmap', got '%s'\n", argv[i + 1]);
+        return 1;
+      }
+      i++;
+      break;
+    }
+    case TOKEN_IMPORT:
+      if (i == argc - 1 || token_of(argv[i + 1]) != TOKEN_STRING) {
+        fprintf(stderr, "expected a filename or '-' after %s\n", argv[i]);
+        return 1;
+      }
+      options->import_file = std::string(argv[i + 1]);
+      i++;
+      break;
+    case TOKEN_UNIT:
+      if (i == argc - 1 || token_of(argv[i + 1]) == TOKEN_EMPTY) {
+        fprintf(stderr, "expected a unit name after %s\n", argv[i]);
+        return 1;
+      }
+      options->units.push_back(std::string(argv[i + 1]));
+      i++;
+      break;
+    case TOKEN_PRIORITY:
+      if (i == argc - 1 || parse_priority(argv[i + 1]) < 0) {
+        fprintf(stderr, "expected a priority from 0-7 or emerg..debug after %s\n",
+                argv[i]);
+        return 1;
+      }
+      options->max_priority = parse_priority(argv[i + 1]);
+      i++;
+      break;
+    case TOKEN_TRANSPORT:
+      if (i == argc - 1 || !is_transport_name(argv[i + 1])) {
+        fprintf(stderr,
+                "expected 'audit', 'driver', 'syslog', 'journal', 'stdout' or "
+                "'kernel' after %s\n",
+                argv[i]);
+        return 1;
+      }
+      options->transports.push_back(std::string(argv[i + 1]));
+      i++;
+      break;
+    case TOKEN_MATCH: {
+      std::string_view match = i == argc - 1 ? std::string_view() : argv[i + 1];
+      size_t eq_pos = match.find('=');
+      if (eq_pos == 0 || eq_pos == match.npos) {
+        fprintf(stderr, "expected FIELD=VALUE after %s\n", argv[i]);
+        return 1;
+      }
+      options->matches.push_back(std::string(match));
+      i++;
+      break;
+    }
+    case TOKEN_ENCODING: {
+      if (i == argc - 1) {
+        fprintf(stderr, "expected an argument after %s\n", argv[i]);
+        return 1;
+      }
+      std::string_view encoding(argv[i + 1]);
+      if (encoding == "json") {
+        options->encoding = ENCODING_JSON;
+      } else if (encoding == "protobuf") {
+        options->encoding = ENCODING_PROTOBUF;
+      } else {
+        fprintf(stderr, "expected 'json' or 'protobuf', got '%s'\n", argv[i + 1]);
+        return 1;
+      }
+      i++;
+      break;
+    }
+    case TOKEN_TOPICS: {
+      if (i == argc - 1) {
+        fprintf(stderr, "expected an argument after %s\n", argv[i]);
+        return 1;
+      }
+      std::string_view topics(argv[i + 1]);
+      if (topics == "transport") {
+        options->topics = TOPICS_TRANSPORT;
+      } else if (topics == "unit") {
+        options->topics = TOPICS_UNIT;
+      } else {
+        fprintf(stderr, "expected 'transport' or 'unit', got '%s'\n", argv[i + 1]);
+        return 1;
+      }
+      i++;
+      break;
+    }
     default:
       fprintf(stderr, "unexpected argument '%s', see --help for usage\n",
               argv[i]);
@@ -0,0 +1,101 @@
+#include <charconv>
+#include <functional>
+#include <string_view>
+#include <utility>
+
+#include "coalesce.hpp"
+
+namespace {
+
+// the fields which identify repeats of an entry, besides its transport.
+constexpr WellKnownField KEY_FIELDS[] = {FIELD_SYSTEMD_UNIT, FIELD_COMM, FIELD_PRIORITY,
+                                         FIELD_MESSAGE};
+
+void append_field(JournalEntry *entry, std::string_view key, uint64_t value) {
+  char digits[24];
+  auto [end, ec] = std::to_chars(digits, digits + sizeof(digits), value);
+  JournalEntry::Field field;
+  field.key_offset = uint32_t(entry->field_data.size());
+  field.key_size = uint32_t(key.size());
+  entry->field_data.append(key);
+  field.value_offset = uint32_t(entry->field_data.size());
+  field.value_size = uint32_t(end - digits);
+  entry->field_data.append(digits, end - digits);
+  entry->fields.push_back(field);
+}
+
+} // namespace
+
+EntryCoalescer::EntryCoalescer(uint64_t window_ns) : window_ns_(window_ns) {}
+
+bool EntryCoalescer::add(const JournalEntry &entry) {
+  summary_ready_ = false;
+  // entries without a message are not worth coalescing, and never match.
+  const bool has_message = entry.find(FIELD_MESSAGE) != nullptr;
+  key_.clear();
+  key_.push_back(char(entry.transport));
+  for (WellKnownField field : KEY_FIELDS) {
+    const JournalEntry::Field *value = entry.find(field);
+    const uint32_t size = value != nullptr ? value->value_size : 0;
+    key_.append((const char *)(&size), sizeof(size));
+    if (value != nullptr) {
+      key_.append(entry.value(*value));
+    }
+  }
+  const size_t hash = std::hash<std::string_view>()(key_);
+  const bool repeat =
+      has_message && has_previous_ && hash == previous_hash_ && key_ == previous_key_;
+  std::swap(key_, previous_key_);
+  previous_hash_ = hash;
+  has_previous_ = has_message;
+  if (!repeat) {
+    end_run();
+    return true;
+  }
+  if (run_count_ > 0 && entry.timestamp - run_.timestamp >= window_ns_) {
+    end_run();
+  }
+  if (run_count_ == 0) {
+    run_.copy_from(entry);
+  }
+  run_count_++;
+  run_last_timestamp_ = entry.timestamp;
+  absorbed_count_++;
+  return false;
+}
+
+void EntryCoalescer::finish() {
+  summary_ready_ = false;
+  end_run();
+}
+
+uint64_t EntryCoalescer::run_deadline() const {
+  return run_count_ > 0 ? run_.timestamp + window_ns_ : UINT64_MAX;
+}
+
+const JournalEntry *EntryCoalescer::take_summary() {
+  if (!summary_ready_) {
+    return nullptr;
+  }
+  summary_ready_ = false;
+  return &summary_;
+}
+
+uint64_t EntryCoalescer::absorbed_count() const { return absorbed_count_; }
+
+uint64_t EntryCoalescer::summary_count() const { return summary_count_; }
+
+void EntryCoalescer::end_run() {
+  if (run_count_ == 0) {
+    return;
+  }
+  // swapping keeps both entries' buffers, so that steady-state runs do not allocate.
+  std::swap(summary_, run_);
+  if (run_count_ > 1) {
+    append_field(&summary_, REPEAT_COUNT_FIELD, run_count_);
+    append_field(&summary_, REPEAT_LAST_TIMESTAMP_FIELD, run_last_timestamp_);
+  }
+  run_count_ = 0;
+  summary_ready_ = true;
+  summary_count_++;
+}
@@ -0,0 +1,69 @@
+#include <cerrno>
+#include <cstdio>
+#include <zdict.h>
+
+#include "dictionary.hpp"
+
+namespace {
+
+// zstd recommends training on about 100 times as much data as the dictionary holds.
+constexpr size_t SAMPLE_BYTES_PER_DICTIONARY_BYTE = 100;
+// zstd cannot train on fewer entries than this.
+constexpr size_t MIN_SAMPLE_COUNT = 16;
+// the largest entry worth sampling: zstd compresses in blocks of this size, so little of a
+// larger entry is like the others.
+constexpr size_t MAX_SAMPLE_SIZE = 128 * 1024;
+
+} // namespace
+
+DictionarySampler::DictionarySampler(size_t dictionary_size)
+    : dictionary_size_(dictionary_size) {}
+
+void DictionarySampler::add(std::string_view entry) {
+  if (full() || entry.empty() || entry.size() > MAX_SAMPLE_SIZE) {
+    return;
+  }
+  samples_.append(entry);
+  sample_sizes_.push_back(entry.size());
+}
+
+bool DictionarySampler::full() const {
+  return samples_.size() >= dictionary_size_ * SAMPLE_BYTES_PER_DICTIONARY_BYTE;
+}
+
+size_t DictionarySampler::sample_count() const { return sample_sizes_.size(); }
+
+int DictionarySampler::train(std::string *dictionary) const {
+  if (sample_sizes_.size() < MIN_SAMPLE_COUNT) {
+    return -ENODATA;
+  }
+  dictionary->resize(dictionary_size_);
+  const size_t size = ZDICT_trainFromBuffer(dictionary->data(), dictionary->size(),
+                                            samples_.data(), sample_sizes_.data(),
+                                            unsigned(sample_sizes_.size()));
+  if (ZDICT_isError(size)) {
+    dictionary->clear();
+    return -EINVAL;
+  }
+  dictionary->resize(size);
+  return 0;
+}
+
+int read_dictionary_file(const std::string &path, std::string *dictionary) {
+  dictionary->clear();
+  FILE *file = fopen(path.c_str(), "rb");
+  if (file == NULL) {
+    return -errno;
+  }
+  char buffer[4096];
+  size_t length = 0;
+  while ((length = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+    dictionary->append(buffer, length);
+  }
+  int err = ferror(file) ? -EIO : 0;
+  fclose(file);
+  if (err == 0 && dictionary->empty()) {
+    err = -ENODATA;
+  }
+  return err;
+}
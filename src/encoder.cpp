@@ -0,0 +1,13 @@
+#include "encoder.hpp"
+#include "json_encoder.hpp"
+#include "protobuf_encoder.hpp"
+
+std::unique_ptr<LogEncoder> make_encoder(Encoding encoding) {
+  switch (encoding) {
+  case ENCODING_PROTOBUF:
+    return std::make_unique<ProtobufEncoder>();
+  case ENCODING_JSON:
+  default:
+    return std::make_unique<JsonEncoder>();
+  }
+}
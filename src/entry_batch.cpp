@@ -0,0 +1,39 @@
+#include "entry_batch.hpp"
+
+void EntryBatch::append(uint64_t timestamp, const ChannelKey &key, std::string_view encoded) {
+  entries_.push_back(Entry{timestamp, key.transport, data_.size(), uint32_t(key.machine.size()),
+                           uint32_t(key.unit.size()), uint32_t(key.comm.size()),
+                           encoded.size()});
+  data_.append(key.machine);
+  data_.append(key.unit);
+  data_.append(key.comm);
+  data_.append(encoded);
+}
+
+void EntryBatch::clear() {
+  data_.clear();
+  entries_.clear();
+}
+
+size_t EntryBatch::size() const { return entries_.size(); }
+
+bool EntryBatch::empty() const { return entries_.empty(); }
+
+uint64_t EntryBatch::timestamp(size_t index) const { return entries_[index].timestamp; }
+
+ChannelKey EntryBatch::key(size_t index) const {
+  const Entry &entry = entries_[index];
+  const std::string_view data(data_);
+  ChannelKey key;
+  key.transport = entry.transport;
+  key.machine = data.substr(entry.offset, entry.machine_size);
+  key.unit = data.substr(entry.offset + entry.machine_size, entry.unit_size);
+  key.comm = data.substr(entry.offset + entry.machine_size + entry.unit_size, entry.comm_size);
+  return key;
+}
+
+std::string_view EntryBatch::encoded(size_t index) const {
+  const Entry &entry = entries_[index];
+  return std::string_view(data_).substr(
+      entry.offset + entry.machine_size + entry.unit_size + entry.comm_size, entry.size);
+}
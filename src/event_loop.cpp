@@ -0,0 +1,198 @@
+#include <algorithm>
+#include <cerrno>
+#include <utility>
+#include <ctime>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include "event_loop.hpp"
+
+uint64_t monotonic_ns() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return uint64_t(now.tv_sec) * 1'000'000'000 + now.tv_nsec;
+}
+
+EventLoop::~EventLoop() {
+  for (int fd : {epoll_fd_, signal_fd_, timer_fd_}) {
+    if (fd >= 0) {
+      close(fd);
+    }
+  }
+  if (restore_mask_) {
+    pthread_sigmask(SIG_SETMASK, &old_mask_, NULL);
+  }
+}
+
+int EventLoop::open(sd_journal *j) {
+  journal_ = j;
+  sigset_t mask;
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGINT);
+  sigaddset(&mask, SIGTERM);
+  int err = pthread_sigmask(SIG_BLOCK, &mask, &old_mask_);
+  if (err != 0) {
+    return -err;
+  }
+  restore_mask_ = true;
+  signal_fd_ = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+  if (signal_fd_ < 0) {
+    return -errno;
+  }
+  timer_fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (timer_fd_ < 0) {
+    return -errno;
+  }
+  epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+  if (epoll_fd_ < 0) {
+    return -errno;
+  }
+  for (int fd : {signal_fd_, timer_fd_}) {
+    struct epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.fd = fd;
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event) != 0) {
+      return -errno;
+    }
+  }
+  return watch_journal(j);
+}
+
+int EventLoop::watch_journal(sd_journal *j) {
+  const int fd = sd_journal_get_fd(j);
+  if (fd < 0) {
+    return fd;
+  }
+  int events = sd_journal_get_events(j);
+  if (events < 0) {
+    return events;
+  }
+  // poll() and epoll share the values of POLLIN and POLLOUT.
+  struct epoll_event event = {};
+  event.events = uint32_t(events);
+  event.data.fd = fd;
+  if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event) != 0) {
+    return -errno;
+  }
+  journal_ = j;
+  journal_fd_ = fd;
+  return 0;
+}
+
+int EventLoop::replace_journal(sd_journal *j) {
+  if (epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, journal_fd_, nullptr) != 0) {
+    return -errno;
+  }
+  return watch_journal(j);
+}
+
+int EventLoop::read_signal() {
+  struct signalfd_siginfo info;
+  ssize_t ret = read(signal_fd_, &info, sizeof(info));
+  if (ret == sizeof(info)) {
+    signal_received_ = true;
+    return 1;
+  }
+  return ret < 0 && errno != EAGAIN ? -errno : 0;
+}
+
+bool EventLoop::signal_pending() {
+  if (!signal_received_) {
+    read_signal();
+  }
+  return signal_received_;
+}
+
+int EventLoop::wait(LoopEvent *event) {
+  while (true) {
+    if (signal_received_) {
+      *event = EVENT_SIGNAL;
+      return 0;
+    }
+    // libsystemd asks for a timeout when it cannot watch the journal files for changes.
+    uint64_t journal_timeout = UINT64_MAX;
+    int err = sd_journal_get_timeout(journal_, &journal_timeout);
+    if (err < 0) {
+      return err;
+    }
+    int timeout_ms = -1;
+    if (journal_timeout != UINT64_MAX) {
+      struct timespec now;
+      clock_gettime(CLOCK_MONOTONIC, &now);
+      uint64_t now_usec = uint64_t(now.tv_sec) * 1'000'000 + now.tv_nsec / 1000;
+      timeout_ms = journal_timeout > now_usec
+                       ? int(std::min<uint64_t>((journal_timeout - now_usec + 999) / 1000,
+                                                INT32_MAX))
+                       : 0;
+    }
+    struct epoll_event events[3];
+    int count = epoll_wait(epoll_fd_, events, 3, timeout_ms);
+    if (count < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -errno;
+    }
+    bool journal_ready = count == 0;
+    bool timer_fired = false;
+    for (int i = 0; i < count; ++i) {
+      if (events[i].data.fd == signal_fd_) {
+        if (int ret = read_signal(); ret < 0) {
+          return ret;
+        }
+      } else if (events[i].data.fd == timer_fd_) {
+        timer_fired = timer_expired();
+      } else {
+        journal_ready = true;
+      }
+    }
+    if (journal_ready) {
+      // acknowledges the change, so the journal fd stops being readable.
+      err = sd_journal_process(journal_);
+      if (err < 0) {
+        return err;
+      }
+    }
+    // `sd_journal_process()` reports a change to the files only once, so it wins over a timer
+    // which fired at the same time; the caller runs its timers before every wait anyway.
+    if (signal_received_) {
+      *event = EVENT_SIGNAL;
+    } else if (journal_ready && err == SD_JOURNAL_INVALIDATE) {
+      *event = EVENT_JOURNAL_FILES;
+    } else if (timer_fired) {
+      *event = EVENT_TIMER;
+    } else if (journal_ready && err != SD_JOURNAL_NOP) {
+      *event = EVENT_JOURNAL;
+    } else {
+      continue;
+    }
+    return 0;
+  }
+}
+
+int EventLoop::set_timer(uint64_t deadline_ns) {
+  struct itimerspec spec = {};
+  // a zero it_value disarms the timer.
+  deadline_ns = std::max<uint64_t>(deadline_ns, 1);
+  spec.it_value.tv_sec = deadline_ns / 1'000'000'000;
+  spec.it_value.tv_nsec = deadline_ns % 1'000'000'000;
+  return timerfd_settime(timer_fd_, TFD_TIMER_ABSTIME, &spec, NULL) == 0 ? 0 : -errno;
+}
+
+bool EventLoop::timer_expired() {
+  uint64_t expirations = 0;
+  return read(timer_fd_, &expirations, sizeof(expirations)) > 0;
+}
+
+int EventLoop::clear_timer() {
+  struct itimerspec spec = {};
+  if (timerfd_settime(timer_fd_, 0, &spec, NULL) != 0) {
+    return -errno;
+  }
+  // drop an expiry which has not been read yet.
+  timer_expired();
+  return 0;
+}
@@ -0,0 +1,287 @@
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "coalesce.hpp"
+#include "export_reader.hpp"
+
+namespace {
+
+// How much of a pipe is read at a time, and the initial size of the buffer it is read into.
+constexpr size_t PIPE_BLOCK_SIZE = 4 << 20;
+// Binary values larger than this are taken to be corrupt rather than waited for.
+constexpr uint64_t MAX_BINARY_VALUE_SIZE = 1ull << 30;
+
+uint64_t read_le64(const char *data) {
+  uint64_t value = 0;
+  for (int i = 7; i >= 0; --i) {
+    value = (value << 8) | uint8_t(data[i]);
+  }
+  return value;
+}
+
+} // namespace
+
+int parse_export_entry(std::string_view data, bool at_end, size_t *size, JournalEntry *entry) {
+  size_t pos = 0;
+  // tolerate extra empty lines between entries.
+  while (pos < data.size() && data[pos] == '\n') {
+    pos++;
+  }
+  const size_t start = pos;
+  // field offsets are relative to the start of the entry, so that they fit in 32 bits
+  // however large the input is.
+  const char *base = data.data() + start;
+  entry->external_data = base;
+  entry->field_data.clear();
+  entry->fields.clear();
+  std::fill(std::begin(entry->well_known), std::end(entry->well_known), -1);
+  bool has_timestamp = false;
+  while (true) {
+    if (pos >= data.size()) {
+      if (!at_end || pos == start) {
+        return 0;
+      }
+      // the last entry need not be followed by an empty line.
+      break;
+    }
+    if (data[pos] == '\n') {
+      pos++;
+      break;
+    }
+    const char *line = data.data() + pos;
+    const char *newline = (const char *)(memchr(line, '\n', data.size() - pos));
+    if (newline == nullptr) {
+      return at_end ? -EBADMSG : 0;
+    }
+    const size_t line_size = newline - line;
+    const char *eq = (const char *)(memchr(line, '=', line_size));
+    std::string_view key;
+    size_t value_pos = 0;
+    size_t value_size = 0;
+    if (eq != nullptr) {
+      key = std::string_view(line, eq - line);
+      value_pos = pos + (eq - line) + 1;
+      value_size = newline - eq - 1;
+      pos += line_size + 1;
+    } else {
+      // a binary field: the key line is followed by the value's length.
+      key = std::string_view(line, line_size);
+      const size_t length_pos = pos + line_size + 1;
+      if (data.size() - length_pos < sizeof(uint64_t)) {
+        return at_end ? -EBADMSG : 0;
+      }
+      const uint64_t length = read_le64(data.data() + length_pos);
+      if (length > MAX_BINARY_VALUE_SIZE) {
+        return -EBADMSG;
+      }
+      value_pos = length_pos + sizeof(uint64_t);
+      value_size = length;
+      if (data.size() - value_pos < value_size + 1) {
+        return at_end ? -EBADMSG : 0;
+      }
+      if (data[value_pos + value_size] != '\n') {
+        return -EBADMSG;
+      }
+      pos = value_pos + value_size + 1;
+    }
+    if (key.empty()) {
+      return -EBADMSG;
+    }
+    if (key.size() >= 2 && key[0] == '_' && key[1] == '_') {
+      if (key == "__REALTIME_TIMESTAMP") {
+        uint64_t usec = 0;
+        const char *value = data.data() + value_pos;
+        auto [end, ec] = std::from_chars(value, value + value_size, usec);
+        if (ec != std::errc() || end != value + value_size || usec > UINT64_MAX / 1000) {
+          return -EBADMSG;
+        }
+        entry->timestamp = usec * 1000;
+        has_timestamp = true;
+      }
+      continue;
+    }
+    if (value_size == 0) {
+      continue;
+    }
+    if (pos - start > UINT32_MAX) {
+      return -EBADMSG;
+    }
+    entry->well_known[classify_field(key)] = entry->fields.size();
+    JournalEntry::Field field;
+    field.key_offset = uint32_t(key.data() - base);
+    field.key_size = uint32_t(key.size());
+    field.value_offset = uint32_t(value_pos - start);
+    field.value_size = uint32_t(value_size);
+    entry->fields.push_back(field);
+  }
+  if (!has_timestamp) {
+    return -EBADMSG;
+  }
+  const JournalEntry::Field *transport = entry->find(FIELD_TRANSPORT);
+  entry->transport =
+      transport != nullptr ? parse_transport(entry->value(*transport)) : TRANSPORT_UNKNOWN;
+  *size = pos;
+  return 1;
+}
+
+ExportReader::~ExportReader() {
+  if (mapping_ != nullptr) {
+    munmap((void *)(mapping_), mapping_size_);
+  }
+  if (close_fd_) {
+    close(fd_);
+  }
+}
+
+int ExportReader::open(const std::string &path) {
+  if (path == "-") {
+    fd_ = STDIN_FILENO;
+  } else {
+    fd_ = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd_ < 0) {
+      return -errno;
+    }
+    close_fd_ = true;
+  }
+  struct stat st;
+  if (fstat(fd_, &st) != 0) {
+    return -errno;
+  }
+  if (S_ISREG(st.st_mode) && st.st_size > 0) {
+    void *mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd_, 0);
+    if (mapping != MAP_FAILED) {
+      // the file is parsed once from start to end, so the kernel can read ahead further and
+      // drop pages behind.
+      madvise(mapping, st.st_size, MADV_SEQUENTIAL);
+      mapping_ = (const char *)(mapping);
+      mapping_size_ = st.st_size;
+      return 0;
+    }
+  }
+  // pipes, and files which cannot be mapped, are read into the buffer.
+  buffer_.resize(PIPE_BLOCK_SIZE);
+  return 0;
+}
+
+int ExportReader::read(JournalEntry *entry) {
+  while (true) {
+    const bool mapped = mapping_ != nullptr;
+    const char *data = mapped ? mapping_ : buffer_.data();
+    const size_t data_size = mapped ? mapping_size_ : buffer_size_;
+    const bool at_end = mapped || at_end_;
+    size_t size = 0;
+    int ret = parse_export_entry(std::string_view(data + position_, data_size - position_),
+                                 at_end, &size, entry);
+    if (ret > 0) {
+      position_ += size;
+      bytes_read_ += size;
+    }
+    if (ret != 0 || at_end) {
+      return ret;
+    }
+    ret = fill_buffer();
+    if (ret < 0) {
+      return ret;
+    }
+  }
+}
+
+uint64_t ExportReader::bytes_read() const { return bytes_read_; }
+
+int ExportReader::fill_buffer() {
+  // keep the start of the entry in progress, and make room for a block after it.
+  const size_t kept = buffer_size_ - position_;
+  memmove(buffer_.data(), buffer_.data() + position_, kept);
+  position_ = 0;
+  buffer_size_ = kept;
+  if (buffer_.size() - buffer_size_ < PIPE_BLOCK_SIZE) {
+    buffer_.resize(std::max(buffer_.size() * 2, buffer_size_ + PIPE_BLOCK_SIZE));
+  }
+  while (true) {
+    const ssize_t length =
+        ::read(fd_, buffer_.data() + buffer_size_, buffer_.size() - buffer_size_);
+    if (length < 0 && errno == EINTR) {
+      continue;
+    }
+    if (length < 0) {
+      return -errno;
+    }
+    if (length == 0) {
+      at_end_ = true;
+    }
+    buffer_size_ += length;
+    return 0;
+  }
+}
+
+bool supports_import(const Options &options) {
+  return options.start != TIME_NOW && options.end != TIME_WAIT && options.state_file.empty() &&
+         options.train_dictionary.empty() && options.directories.empty() &&
+         options.files.empty() && options.units.empty() && options.max_priority < 0 &&
+         options.transports.empty() && options.matches.empty();
+}
+
+int import_export_file(const Options &options, LogWriter *writer) {
+  ExportReader reader;
+  int err = reader.open(options.import_file);
+  if (err != 0) {
+    fprintf(stderr, "failed to open %s: %s\n", options.import_file.c_str(), strerror(-err));
+    return -err;
+  }
+  const uint64_t start_usec = options.start == TIME_UNIX ? options.start_sec * 1'000'000 : 0;
+  const uint64_t end_usec = end_usec_for(options.end, options.end_sec);
+  std::unique_ptr<LogEncoder> encoder = make_encoder(options.encoding);
+  std::unique_ptr<EntryCoalescer> coalescer;
+  if (options.coalesce_window_ms > 0) {
+    coalescer = std::make_unique<EntryCoalescer>(options.coalesce_window_ms * 1'000'000);
+  }
+  auto write = [&](const JournalEntry &entry) {
+    auto res = writer->write(entry.timestamp, channel_key(entry), encoder->encode(entry));
+    if (!res.ok()) {
+      fprintf(stderr, "failed to write message: %s\n", res.message.c_str());
+      return false;
+    }
+    return true;
+  };
+  JournalEntry entry;
+  uint64_t imported = 0;
+  while (true) {
+    err = reader.read(&entry);
+    if (err < 0) {
+      fprintf(stderr, "failed to read %s: %s\n", options.import_file.c_str(), strerror(-err));
+      return -err;
+    }
+    const uint64_t usec = entry.timestamp / 1000;
+    if (err > 0 && (usec < start_usec || usec >= end_usec)) {
+      continue;
+    }
+    const bool absorbed = err > 0 && coalescer != nullptr && !coalescer->add(entry);
+    if (err == 0 && coalescer != nullptr) {
+      coalescer->finish();
+    }
+    if (coalescer != nullptr) {
+      const JournalEntry *summary = coalescer->take_summary();
+      if (summary != nullptr && !write(*summary)) {
+        return 1;
+      }
+    }
+    if (err == 0) {
+      break;
+    }
+    if (!absorbed && !write(entry)) {
+      return 1;
+    }
+    imported++;
+  }
+  if (options.verbose) {
+    fprintf(stderr, "imported %llu entries from %llu bytes\n", (unsigned long long)(imported),
+            (unsigned long long)(reader.bytes_read()));
+  }
+  return 0;
+}
@@ -1,3 +1,9 @@
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstdlib>
+#include <dirent.h>
+
 #include "vendor/json.hpp"
 
 #include <systemd/sd-id128.h>
@@ -25,6 +31,155 @@ const char *name_for_transport(Transport transport) {
   }
 }
 
+Transport parse_transport(std::string_view name) {
+  Transport candidate = TRANSPORT_UNKNOWN;
+  switch (name.empty() ? '\0' : name[0]) {
+  case 'a':
+    candidate = TRANSPORT_AUDIT;
+    break;
+  case 'd':
+    candidate = TRANSPORT_DRIVER;
+    break;
+  case 'j':
+    candidate = TRANSPORT_JOURNAL;
+    break;
+  case 'k':
+    candidate = TRANSPORT_KERNEL;
+    break;
+  case 's':
+    candidate = name.size() > 1 && name[1] == 'y' ? TRANSPORT_SYSLOG : TRANSPORT_STDOUT;
+    break;
+  default:
+    return TRANSPORT_UNKNOWN;
+  }
+  return name == name_for_transport(candidate) ? candidate : TRANSPORT_UNKNOWN;
+}
+
+WellKnownField classify_field(std::string_view key) {
+  // every well-known name has a distinct length except CODE_FILE and CODE_LINE, so at most
+  // two comparisons are needed.
+  WellKnownField candidate = FIELD_OTHER;
+  std::string_view name;
+  switch (key.size()) {
+  case 4:
+    candidate = FIELD_EXE;
+    name = "_EXE";
+    break;
+  case 5:
+    candidate = FIELD_COMM;
+    name = "_COMM";
+    break;
+  case 7:
+    candidate = FIELD_MESSAGE;
+    name = "MESSAGE";
+    break;
+  case 8:
+    candidate = FIELD_PRIORITY;
+    name = "PRIORITY";
+    break;
+  case 9:
+    if (key[5] == 'F') {
+      candidate = FIELD_CODE_FILE;
+      name = "CODE_FILE";
+    } else {
+      candidate = FIELD_CODE_LINE;
+      name = "CODE_LINE";
+    }
+    break;
+  case 10:
+    candidate = FIELD_TRANSPORT;
+    name = "_TRANSPORT";
+    break;
+  case 11:
+    candidate = FIELD_MACHINE_ID;
+    name = "_MACHINE_ID";
+    break;
+  case 13:
+    candidate = FIELD_SYSTEMD_UNIT;
+    name = "_SYSTEMD_UNIT";
+    break;
+  default:
+    return FIELD_OTHER;
+  }
+  return key == name ? candidate : FIELD_OTHER;
+}
+
+void JournalEntry::copy_from(const JournalEntry &other) {
+  if (other.external_data == nullptr) {
+    *this = other;
+    return;
+  }
+  timestamp = other.timestamp;
+  transport = other.transport;
+  fields = other.fields;
+  std::copy(std::begin(other.well_known), std::end(other.well_known), std::begin(well_known));
+  size_t size = 0;
+  for (const Field &field : fields) {
+    size = std::max<size_t>(size, field.value_offset + field.value_size);
+  }
+  field_data.assign(other.external_data, size);
+  external_data = nullptr;
+}
+
+void decode_journal_fields(sd_journal *j, JournalEntry *entry) {
+  entry->external_data = nullptr;
+  entry->field_data.clear();
+  entry->fields.clear();
+  std::fill(std::begin(entry->well_known), std::end(entry->well_known), -1);
+  const void *data;
+  size_t length;
+  SD_JOURNAL_FOREACH_DATA(j, data, length) {
+    std::string_view data_view((const char *)data, length);
+    size_t eq_pos = data_view.find('=');
+    if (eq_pos == data_view.npos) {
+      continue;
+    }
+    if (eq_pos >= length - 1) {
+      continue;
+    }
+    entry->well_known[classify_field(data_view.substr(0, eq_pos))] = entry->fields.size();
+    JournalEntry::Field field;
+    field.key_offset = entry->field_data.size();
+    field.key_size = eq_pos;
+    field.value_offset = field.key_offset + eq_pos + 1;
+    field.value_size = length - eq_pos - 1;
+    entry->field_data.append(data_view);
+    entry->fields.push_back(field);
+  }
+  const JournalEntry::Field *transport = entry->find(FIELD_TRANSPORT);
+  entry->transport =
+      transport != nullptr ? parse_transport(entry->value(*transport)) : TRANSPORT_UNKNOWN;
+}
+
+int read_journal_entry(sd_journal *j, uint64_t end_usec, JournalEntry *entry) {
+  int err = sd_journal_next(j);
+  if (err <= 0) {
+    return err;
+  }
+  uint64_t ts_usec = 0;
+  err = sd_journal_get_realtime_usec(j, &ts_usec);
+  if (err != 0) {
+    return err;
+  }
+  if (ts_usec >= end_usec) {
+    return 0;
+  }
+  if (ts_usec >= (UINT64_MAX / 1000ull)) {
+    return -ERANGE;
+  }
+  entry->timestamp = ts_usec * 1000ull;
+  decode_journal_fields(j, entry);
+  return 1;
+}
+
+uint64_t end_usec_for(TimePoint end, uint64_t end_sec) {
+  if (end == TIME_UNIX) {
+    // the end timestamp is inclusive: an entry logged at exactly end_sec is exported.
+    return (end_sec * 1'000'000) + 1;
+  }
+  return UINT64_MAX;
+}
+
 Transport get_transport(sd_journal *j) {
   size_t length = 0;
   const char *data = NULL;
@@ -38,14 +193,7 @@ Transport get_transport(sd_journal *j) {
   if (data_view.substr(0, prefix.size()) != prefix) {
     return TRANSPORT_UNKNOWN;
   }
-  std::string_view transport_name = data_view.substr(prefix.size(), length);
-  for (int i = 0; i < _TRANSPORT_COUNT; ++i) {
-    const char *candidate = name_for_transport((Transport)(i));
-    if (transport_name == candidate) {
-      return (Transport)(i);
-    }
-  }
-  return TRANSPORT_UNKNOWN;
+  return parse_transport(data_view.substr(prefix.size(), length));
 }
 
 int get_ts(sd_journal *j, uint64_t *out) {
@@ -65,7 +213,7 @@ int get_ts(sd_journal *j, uint64_t *out) {
  * https://wiki.archlinux.org/title/Systemd/Journal#Priority_level
  * https://github.com/foxglove/schemas/blob/main/schemas/jsonschema/Log.json
  */
-int level_for_priority(const std::string &priority) {
+int level_for_priority(std::string_view priority) {
   if (priority == "0" || priority == "1" || priority == "2") {
     // FATAL
     return 5;
@@ -141,7 +289,7 @@ std::string serialize_json(sd_journal *j, uint64_t timestamp) {
   }
   // set level
   if (auto priority_it = out.find("PRIORITY"); priority_it != out.end()) {
-    out["level"] = level_for_priority(priority_it.value());
+    out["level"] = level_for_priority(priority_it.value().get<std::string>());
   } else {
     out["level"] = 0;
   }
@@ -216,6 +364,84 @@ int apply_boot_id_match(sd_journal *j, const Options &options) {
   return 0;
 }
 
+int add_match(sd_journal *j, std::string_view field, std::string_view value) {
+  std::string match;
+  match.reserve(field.size() + 1 + value.size());
+  match.append(field);
+  match.push_back('=');
+  match.append(value);
+  return sd_journal_add_match(j, match.data(), match.size());
+}
+
+/**
+ * @brief matches entries logged by one of `units`, or logged by systemd about one of them.
+ * Unit names without a type suffix are taken to be services, as journalctl does.
+ */
+int add_unit_matches(sd_journal *j, const std::vector<std::string> &units) {
+  std::vector<std::string> names;
+  for (const auto &unit : units) {
+    names.push_back(unit.find('.') == unit.npos ? unit + ".service" : unit);
+  }
+  for (const auto &name : names) {
+    if (int err = add_match(j, "_SYSTEMD_UNIT", name); err != 0) {
+      return err;
+    }
+  }
+  int err = sd_journal_add_disjunction(j);
+  if (err != 0) {
+    return err;
+  }
+  for (const auto &name : names) {
+    if (err = add_match(j, "UNIT", name); err != 0) {
+      return err;
+    }
+  }
+  return add_match(j, "_PID", "1");
+}
+
+int apply_filter_matches(sd_journal *j, const Options &options) {
+  // libsystemd ORs matches on the same field and ANDs different fields. Each filter is
+  // its own conjunction term, so that the unit disjunction does not swallow the others.
+  int err = 0;
+  if (!options.units.empty()) {
+    if ((err = sd_journal_add_conjunction(j)) != 0 ||
+        (err = add_unit_matches(j, options.units)) != 0) {
+      return err;
+    }
+  }
+  if (options.max_priority >= 0) {
+    if ((err = sd_journal_add_conjunction(j)) != 0) {
+      return err;
+    }
+    for (int priority = 0; priority <= options.max_priority; ++priority) {
+      if ((err = add_match(j, "PRIORITY", std::to_string(priority))) != 0) {
+        return err;
+      }
+    }
+  }
+  if (!options.transports.empty()) {
+    if ((err = sd_journal_add_conjunction(j)) != 0) {
+      return err;
+    }
+    for (const auto &transport : options.transports) {
+      if ((err = add_match(j, "_TRANSPORT", transport)) != 0) {
+        return err;
+      }
+    }
+  }
+  if (!options.matches.empty()) {
+    if ((err = sd_journal_add_conjunction(j)) != 0) {
+      return err;
+    }
+    for (const auto &match : options.matches) {
+      if ((err = sd_journal_add_match(j, match.data(), match.size())) != 0) {
+        return err;
+      }
+    }
+  }
+  return 0;
+}
+
 int seek_to_start(sd_journal *j, TimePoint start, uint64_t start_sec) {
   switch (start) {
   case TIME_BOOT:
@@ -230,32 +456,233 @@ int seek_to_start(sd_journal *j, TimePoint start, uint64_t start_sec) {
   return 0;
 }
 
+int seek_after_cursor(sd_journal *j, const char *cursor) {
+  int err = sd_journal_seek_cursor(j, cursor);
+  if (err != 0) {
+    return err;
+  }
+  err = sd_journal_next(j);
+  if (err <= 0) {
+    // no entries at or after the cursor, so the next read finds nothing yet.
+    return err;
+  }
+  err = sd_journal_test_cursor(j, cursor);
+  if (err < 0) {
+    return err;
+  }
+  if (err > 0) {
+    // positioned on the entry for the cursor, which has already been exported.
+    return 0;
+  }
+  // the entry for the cursor is gone, and the current entry is the first one after it. Step
+  // back so that the next read returns it.
+  err = sd_journal_previous(j);
+  if (err == 0) {
+    err = sd_journal_seek_head(j);
+  }
+  return err < 0 ? err : 0;
+}
+
+int cursor_realtime_usec(std::string_view cursor, uint64_t *usec) {
+  // eg. s=<seqnum ID>;i=<seqnum>;b=<boot ID>;m=<monotonic>;t=<realtime>;x=<xor hash>, with
+  // numbers in hex.
+  while (!cursor.empty()) {
+    const size_t end = std::min(cursor.find(';'), cursor.size());
+    const std::string_view item = cursor.substr(0, end);
+    cursor.remove_prefix(std::min(end + 1, cursor.size()));
+    if (item.size() < 3 || item.substr(0, 2) != "t=") {
+      continue;
+    }
+    const auto [ptr, ec] = std::from_chars(item.data() + 2, item.data() + item.size(), *usec, 16);
+    return ec == std::errc() && ptr == item.data() + item.size() ? 0 : -EINVAL;
+  }
+  return -EINVAL;
+}
+
+int get_last_read_cursor(sd_journal *j, uint64_t end_usec, std::string *cursor) {
+  uint64_t ts_usec = 0;
+  int err = sd_journal_get_realtime_usec(j, &ts_usec);
+  if (err != 0) {
+    return err;
+  }
+  if (ts_usec >= end_usec) {
+    // the read which reached the end stopped on an entry that was not exported.
+    err = sd_journal_previous(j);
+    if (err <= 0) {
+      return err < 0 ? err : -ENOENT;
+    }
+  }
+  char *data = NULL;
+  err = sd_journal_get_cursor(j, &data);
+  if (err != 0) {
+    return err;
+  }
+  cursor->assign(data);
+  free(data);
+  return 0;
+}
+
 int next_journal_entry(sd_journal *j, TimePoint end, uint64_t end_sec) {
   switch (end) {
   case TIME_SHUTDOWN:
   case TIME_WAIT:
   case TIME_NOW:
     return sd_journal_next(j);
-  case TIME_UNIX: {
-    int err = sd_journal_next(j);
-    // if there are no more entries or an error occurred, return.
+  case TIME_UNIX:
+    return next_journal_entry_before(j, end_usec_for(end, end_sec));
+  default:
+    assert(false); // no other valid time points for end
+  }
+  return 0;
+}
+
+int next_journal_entry_before(sd_journal *j, uint64_t end_usec) {
+  int err = sd_journal_next(j);
+  // if there are no more entries or an error occurred, return.
+  if (err <= 0) {
+    return err;
+  }
+  uint64_t ts_usec = 0;
+  err = sd_journal_get_realtime_usec(j, &ts_usec);
+  if (err != 0) {
+    return err;
+  }
+  // if this entry is at or after end_usec, return "no more entries"
+  if (ts_usec >= end_usec) {
+    return 0;
+  }
+  // otherwise, return "more entries".
+  return 1;
+}
+
+int get_export_range(sd_journal *j, const Options &options,
+                     uint64_t *start_usec, uint64_t *end_usec) {
+  *start_usec = 0;
+  *end_usec = 0;
+  int err = 0;
+  switch (options.start) {
+  case TIME_UNIX:
+    *start_usec = options.start_sec * 1'000'000;
+    break;
+  case TIME_BOOT:
+    err = sd_journal_seek_head(j);
+    if (err != 0) {
+      return err;
+    }
+    err = sd_journal_next(j);
     if (err <= 0) {
+      // no entries, so the range is empty.
       return err;
     }
-    uint64_t ts_usec = 0;
-    err = sd_journal_get_realtime_usec(j, &ts_usec);
+    err = sd_journal_get_realtime_usec(j, start_usec);
+    if (err != 0) {
+      return err;
+    }
+    break;
+  default:
+    return -EINVAL;
+  }
+  switch (options.end) {
+  case TIME_UNIX:
+    *end_usec = (options.end_sec * 1'000'000) + 1;
+    break;
+  case TIME_NOW:
+  case TIME_SHUTDOWN: {
+    // with the boot ID match applied, the last entry is the last one before shutdown.
+    err = sd_journal_seek_tail(j);
     if (err != 0) {
       return err;
     }
-    // if this entry is after end sec, return "no more entries"
-    if (ts_usec > (end_sec * 1'000'000)) {
+    err = sd_journal_previous(j);
+    if (err < 0) {
+      return err;
+    }
+    if (err == 0) {
+      *end_usec = *start_usec;
       return 0;
     }
-    // otherwise, return "more entries".
-    return 1;
+    uint64_t last_usec = 0;
+    err = sd_journal_get_realtime_usec(j, &last_usec);
+    if (err != 0) {
+      return err;
+    }
+    *end_usec = last_usec + 1;
+    break;
   }
   default:
-    assert(false); // no other valid time points for end
+    return -EINVAL;
+  }
+  *end_usec = std::max(*end_usec, *start_usec);
+  return 0;
+}
+
+std::vector<TimeSlice> split_time_range(uint64_t start_usec, uint64_t end_usec,
+                                        size_t count) {
+  std::vector<TimeSlice> slices;
+  if (end_usec <= start_usec || count == 0) {
+    return slices;
+  }
+  uint64_t duration = end_usec - start_usec;
+  count = std::min<uint64_t>(count, duration);
+  uint64_t slice_duration = duration / count;
+  uint64_t remainder = duration % count;
+  uint64_t slice_start = start_usec;
+  for (size_t i = 0; i < count; ++i) {
+    // spread the remainder over the first slices so they all differ by at most 1us.
+    uint64_t slice_end = slice_start + slice_duration + (i < remainder ? 1 : 0);
+    slices.push_back(TimeSlice{slice_start, slice_end});
+    slice_start = slice_end;
+  }
+  return slices;
+}
+
+namespace {
+
+// journald names each machine's directory by its 128-bit ID, in lowercase hex.
+bool is_machine_id(std::string_view name) {
+  return name.size() == 32 && name.find_first_not_of("0123456789abcdef") == name.npos;
+}
+
+} // namespace
+
+int find_journal_sources(const Options &options, std::vector<JournalSource> *sources) {
+  sources->clear();
+  for (const auto &directory : options.directories) {
+    DIR *dir = opendir(directory.c_str());
+    if (dir == NULL) {
+      return -errno;
+    }
+    // sort the machines, so that sources are listed in the same order on every run.
+    std::vector<std::string> machines;
+    while (struct dirent *child = readdir(dir)) {
+      if ((child->d_type == DT_DIR || child->d_type == DT_UNKNOWN) &&
+          is_machine_id(child->d_name)) {
+        machines.push_back(child->d_name);
+      }
+    }
+    closedir(dir);
+    std::sort(machines.begin(), machines.end());
+    if (machines.empty()) {
+      sources->push_back(JournalSource{directory, {}});
+    }
+    for (const auto &machine : machines) {
+      sources->push_back(JournalSource{directory + "/" + machine, {}});
+    }
+  }
+  // files in the same directory are usually the same machine's, and are read together.
+  const size_t first_file_source = sources->size();
+  std::vector<std::string> file_directories;
+  for (const auto &file : options.files) {
+    const size_t slash = file.rfind('/');
+    const std::string parent = slash == file.npos ? "." : file.substr(0, slash);
+    auto it = std::find(file_directories.begin(), file_directories.end(), parent);
+    if (it == file_directories.end()) {
+      file_directories.push_back(parent);
+      sources->push_back(JournalSource{});
+      sources->back().files.push_back(file);
+    } else {
+      (*sources)[first_file_source + (it - file_directories.begin())].files.push_back(file);
+    }
   }
   return 0;
 }
@@ -0,0 +1,657 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <dirent.h>
+#include <endian.h>
+#include <fcntl.h>
+#include <lz4.h>
+#include <lzma.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zstd.h>
+
+#include "journal_file.hpp"
+
+namespace {
+
+// The layout of journal files, see https://systemd.io/JOURNAL_FILE_FORMAT/
+constexpr char SIGNATURE[8] = {'L', 'P', 'K', 'S', 'H', 'H', 'R', 'H'};
+constexpr size_t HEADER_INCOMPATIBLE_FLAGS = 12;
+constexpr size_t HEADER_STATE = 16;
+constexpr size_t HEADER_TAIL_ENTRY_BOOT_ID = 56;
+constexpr size_t HEADER_SEQNUM_ID = 72;
+constexpr size_t HEADER_HEADER_SIZE = 88;
+constexpr size_t HEADER_ARENA_SIZE = 96;
+constexpr size_t HEADER_N_ENTRIES = 152;
+constexpr size_t HEADER_ENTRY_ARRAY_OFFSET = 176;
+constexpr size_t HEADER_HEAD_ENTRY_REALTIME = 184;
+constexpr size_t HEADER_TAIL_ENTRY_REALTIME = 192;
+// the size of the header written by the first versions of journald, which holds every
+// member used here.
+constexpr size_t MIN_HEADER_SIZE = 208;
+
+constexpr uint8_t STATE_ARCHIVED = 2;
+
+constexpr uint32_t INCOMPATIBLE_COMPRESSED_XZ = 1 << 0;
+constexpr uint32_t INCOMPATIBLE_COMPRESSED_LZ4 = 1 << 1;
+constexpr uint32_t INCOMPATIBLE_KEYED_HASH = 1 << 2;
+constexpr uint32_t INCOMPATIBLE_COMPRESSED_ZSTD = 1 << 3;
+constexpr uint32_t INCOMPATIBLE_COMPACT = 1 << 4;
+constexpr uint32_t SUPPORTED_INCOMPATIBLE_FLAGS =
+    INCOMPATIBLE_COMPRESSED_XZ | INCOMPATIBLE_COMPRESSED_LZ4 | INCOMPATIBLE_KEYED_HASH |
+    INCOMPATIBLE_COMPRESSED_ZSTD | INCOMPATIBLE_COMPACT;
+
+constexpr uint8_t OBJECT_DATA = 1;
+constexpr uint8_t OBJECT_ENTRY = 3;
+constexpr uint8_t OBJECT_ENTRY_ARRAY = 6;
+constexpr size_t OBJECT_HEADER_SIZE = 16;
+constexpr uint8_t OBJECT_COMPRESSED_XZ = 1 << 0;
+constexpr uint8_t OBJECT_COMPRESSED_LZ4 = 1 << 1;
+constexpr uint8_t OBJECT_COMPRESSED_ZSTD = 1 << 2;
+constexpr uint8_t OBJECT_COMPRESSION_MASK =
+    OBJECT_COMPRESSED_XZ | OBJECT_COMPRESSED_LZ4 | OBJECT_COMPRESSED_ZSTD;
+
+constexpr size_t DATA_PAYLOAD = 64;
+constexpr size_t DATA_PAYLOAD_COMPACT = 72;
+constexpr size_t ENTRY_SEQNUM = 16;
+constexpr size_t ENTRY_REALTIME = 24;
+constexpr size_t ENTRY_MONOTONIC = 32;
+constexpr size_t ENTRY_BOOT_ID = 40;
+constexpr size_t ENTRY_XOR_HASH = 56;
+constexpr size_t ENTRY_ITEMS = 64;
+constexpr size_t ENTRY_ARRAY_NEXT = 16;
+constexpr size_t ENTRY_ARRAY_ITEMS = 24;
+
+// journald does not store fields larger than this, so larger sizes are corrupt.
+constexpr uint64_t MAX_FIELD_SIZE = 768ull << 20;
+// Decompressed fields are kept until they add up to this much, and then dropped together.
+constexpr size_t MAX_DECOMPRESSED_CACHE_BYTES = 32 << 20;
+
+uint32_t read_le32(const uint8_t *data) {
+  uint32_t value;
+  memcpy(&value, data, sizeof(value));
+  return le32toh(value);
+}
+
+uint64_t read_le64(const uint8_t *data) {
+  uint64_t value;
+  memcpy(&value, data, sizeof(value));
+  return le64toh(value);
+}
+
+sd_id128_t read_id128(const uint8_t *data) {
+  sd_id128_t id;
+  memcpy(&id, data, sizeof(id));
+  return id;
+}
+
+// checks that a whole object of `type` and at least `min_size` bytes is at `offset`, and
+// returns its size.
+int check_object(const uint8_t *data, size_t size, uint64_t offset, uint8_t type,
+                 uint64_t min_size, uint64_t *object_size) {
+  if (offset % 8 != 0 || offset < MIN_HEADER_SIZE || offset > size - OBJECT_HEADER_SIZE) {
+    return -EBADMSG;
+  }
+  const uint64_t length = read_le64(data + offset + 8);
+  if (data[offset] != type || length < min_size || length > size - offset) {
+    return -EBADMSG;
+  }
+  *object_size = length;
+  return 0;
+}
+
+int decompress_xz(std::string_view compressed, std::string *out) {
+  lzma_stream stream = LZMA_STREAM_INIT;
+  if (lzma_stream_decoder(&stream, UINT64_MAX, 0) != LZMA_OK) {
+    return -ENOMEM;
+  }
+  out->resize(std::max<size_t>(compressed.size() * 4, 4096));
+  stream.next_in = (const uint8_t *)(compressed.data());
+  stream.avail_in = compressed.size();
+  stream.next_out = (uint8_t *)(out->data());
+  stream.avail_out = out->size();
+  int err = 0;
+  while (true) {
+    const lzma_ret ret = lzma_code(&stream, LZMA_FINISH);
+    if (ret == LZMA_STREAM_END) {
+      break;
+    }
+    if (ret != LZMA_OK && ret != LZMA_BUF_ERROR) {
+      err = -EBADMSG;
+      break;
+    }
+    if (stream.avail_out > 0 || out->size() >= MAX_FIELD_SIZE) {
+      // the input ended early, or the field is too large to be journald's.
+      err = -EBADMSG;
+      break;
+    }
+    const size_t used = out->size();
+    out->resize(std::min<uint64_t>(used * 2, MAX_FIELD_SIZE));
+    stream.next_out = (uint8_t *)(out->data() + used);
+    stream.avail_out = out->size() - used;
+  }
+  out->resize(stream.total_out);
+  lzma_end(&stream);
+  return err;
+}
+
+} // namespace
+
+int compare_locations(const JournalLocation &a, const JournalLocation &b) {
+  auto cmp = [](uint64_t x, uint64_t y) { return x < y ? -1 : x > y ? 1 : 0; };
+  const bool same_seqnum_id = sd_id128_equal(a.seqnum_id, b.seqnum_id);
+  const bool same_boot = sd_id128_equal(a.boot_id, b.boot_id);
+  if (same_seqnum_id && same_boot && a.seqnum == b.seqnum &&
+      a.monotonic_usec == b.monotonic_usec && a.realtime_usec == b.realtime_usec &&
+      a.xor_hash == b.xor_hash) {
+    return 0;
+  }
+  if (same_seqnum_id && a.seqnum != b.seqnum) {
+    return cmp(a.seqnum, b.seqnum);
+  }
+  if (same_boot && a.monotonic_usec != b.monotonic_usec) {
+    return cmp(a.monotonic_usec, b.monotonic_usec);
+  }
+  if (a.realtime_usec != b.realtime_usec) {
+    return cmp(a.realtime_usec, b.realtime_usec);
+  }
+  if (a.xor_hash != b.xor_hash) {
+    return cmp(a.xor_hash, b.xor_hash);
+  }
+  return cmp(a.seqnum, b.seqnum);
+}
+
+JournalFile::~JournalFile() {
+  if (data_ != nullptr) {
+    munmap((void *)(data_), mapping_size_);
+  }
+  ZSTD_freeDCtx(zstd_);
+}
+
+int JournalFile::open(const std::string &path) {
+  path_ = path;
+  const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return -errno;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    const int err = -errno;
+    close(fd);
+    return err;
+  }
+  if (size_t(st.st_size) < MIN_HEADER_SIZE) {
+    close(fd);
+    return -EBADMSG;
+  }
+  void *mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  const int err = mapping == MAP_FAILED ? -errno : 0;
+  close(fd);
+  if (err != 0) {
+    return err;
+  }
+  data_ = (const uint8_t *)(mapping);
+  size_ = st.st_size;
+  mapping_size_ = st.st_size;
+  zstd_ = ZSTD_createDCtx();
+  if (zstd_ == nullptr) {
+    return -ENOMEM;
+  }
+  return read_header();
+}
+
+int JournalFile::read_header() {
+  if (memcmp(data_, SIGNATURE, sizeof(SIGNATURE)) != 0) {
+    return -EBADMSG;
+  }
+  const uint32_t incompatible_flags = read_le32(data_ + HEADER_INCOMPATIBLE_FLAGS);
+  if ((incompatible_flags & ~SUPPORTED_INCOMPATIBLE_FLAGS) != 0) {
+    return -EPROTONOSUPPORT;
+  }
+  compact_ = (incompatible_flags & INCOMPATIBLE_COMPACT) != 0;
+  const uint64_t header_size = read_le64(data_ + HEADER_HEADER_SIZE);
+  const uint64_t arena_size = read_le64(data_ + HEADER_ARENA_SIZE);
+  if (header_size < MIN_HEADER_SIZE || header_size > size_) {
+    return -EBADMSG;
+  }
+  // objects are only read from the part of the file journald had written when it was opened.
+  size_ = std::min<uint64_t>(size_, header_size + std::min(arena_size, uint64_t(size_)));
+  location_.seqnum_id = read_id128(data_ + HEADER_SEQNUM_ID);
+  entry_count_ = read_le64(data_ + HEADER_N_ENTRIES);
+  return index_entry_arrays(read_le64(data_ + HEADER_ENTRY_ARRAY_OFFSET));
+}
+
+int JournalFile::index_entry_arrays(uint64_t first_array_offset) {
+  const size_t item_size = compact_ ? sizeof(uint32_t) : sizeof(uint64_t);
+  uint64_t indexed = 0;
+  uint64_t offset = first_array_offset;
+  while (offset != 0 && indexed < entry_count_) {
+    uint64_t object_size = 0;
+    int err = check_object(data_, size_, offset, OBJECT_ENTRY_ARRAY,
+                           ENTRY_ARRAY_ITEMS + item_size, &object_size);
+    if (err != 0) {
+      return err;
+    }
+    if (arrays_.size() > size_ / (ENTRY_ARRAY_ITEMS + item_size)) {
+      // more arrays than fit in the file, so they link in a loop.
+      return -EBADMSG;
+    }
+    const uint64_t count =
+        std::min((object_size - ENTRY_ARRAY_ITEMS) / item_size, entry_count_ - indexed);
+    arrays_.push_back(EntryArray{offset + ENTRY_ARRAY_ITEMS, indexed, count});
+    indexed += count;
+    offset = read_le64(data_ + offset + ENTRY_ARRAY_NEXT);
+  }
+  // a journal which was not closed cleanly may count entries it did not link.
+  entry_count_ = indexed;
+  return 0;
+}
+
+void JournalFile::seek_head() { position_ = 0; }
+
+int JournalFile::entry_offset_at(uint64_t index, uint64_t *offset) const {
+  auto it = std::upper_bound(
+      arrays_.begin(), arrays_.end(), index,
+      [](uint64_t value, const EntryArray &array) { return value < array.first_entry; });
+  const EntryArray &array = *(it - 1);
+  const uint64_t item = index - array.first_entry;
+  const uint8_t *items = data_ + array.items_offset;
+  *offset = compact_ ? read_le32(items + item * sizeof(uint32_t))
+                     : read_le64(items + item * sizeof(uint64_t));
+  return 0;
+}
+
+int JournalFile::load_realtime(uint64_t index, uint64_t *realtime_usec) const {
+  uint64_t offset = 0;
+  uint64_t object_size = 0;
+  int err = entry_offset_at(index, &offset);
+  if (err == 0) {
+    err = check_object(data_, size_, offset, OBJECT_ENTRY, ENTRY_ITEMS, &object_size);
+  }
+  if (err == 0) {
+    *realtime_usec = read_le64(data_ + offset + ENTRY_REALTIME);
+  }
+  return err;
+}
+
+int JournalFile::load_entry(uint64_t index) {
+  uint64_t offset = 0;
+  uint64_t object_size = 0;
+  int err = entry_offset_at(index, &offset);
+  if (err == 0) {
+    err = check_object(data_, size_, offset, OBJECT_ENTRY, ENTRY_ITEMS, &object_size);
+  }
+  if (err != 0) {
+    return err;
+  }
+  const uint8_t *entry = data_ + offset;
+  entry_offset_ = offset;
+  location_.seqnum = read_le64(entry + ENTRY_SEQNUM);
+  location_.realtime_usec = read_le64(entry + ENTRY_REALTIME);
+  location_.monotonic_usec = read_le64(entry + ENTRY_MONOTONIC);
+  location_.boot_id = read_id128(entry + ENTRY_BOOT_ID);
+  location_.xor_hash = read_le64(entry + ENTRY_XOR_HASH);
+  return 0;
+}
+
+int JournalFile::seek_realtime_usec(uint64_t usec) {
+  // find the first entry at or after `usec`.
+  uint64_t low = 0;
+  uint64_t high = entry_count_;
+  while (low < high) {
+    const uint64_t middle = low + (high - low) / 2;
+    uint64_t realtime_usec = 0;
+    int err = load_realtime(middle, &realtime_usec);
+    if (err != 0) {
+      return err;
+    }
+    if (realtime_usec < usec) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+  position_ = low;
+  return 0;
+}
+
+int JournalFile::previous() {
+  if (position_ == 0) {
+    return 0;
+  }
+  int err = load_entry(position_ - 1);
+  return err != 0 ? err : 1;
+}
+
+int JournalFile::next() {
+  if (position_ >= entry_count_) {
+    return 0;
+  }
+  int err = load_entry(position_);
+  if (err != 0) {
+    return err;
+  }
+  position_++;
+  return 1;
+}
+
+const JournalLocation &JournalFile::location() const { return location_; }
+
+const std::string &JournalFile::path() const { return path_; }
+
+uint64_t JournalFile::entry_count() const { return entry_count_; }
+
+int JournalFile::field_payload(uint64_t data_offset, std::string_view *payload) {
+  const size_t payload_start = compact_ ? DATA_PAYLOAD_COMPACT : DATA_PAYLOAD;
+  uint64_t object_size = 0;
+  int err = check_object(data_, size_, data_offset, OBJECT_DATA, payload_start, &object_size);
+  if (err != 0) {
+    return err;
+  }
+  const std::string_view stored((const char *)(data_ + data_offset + payload_start),
+                                object_size - payload_start);
+  const int compression = data_[data_offset + 1] & OBJECT_COMPRESSION_MASK;
+  if (compression == 0) {
+    *payload = stored;
+    return 0;
+  }
+  return decompress(data_offset, compression, stored, payload);
+}
+
+int JournalFile::decompress(uint64_t data_offset, int compression, std::string_view compressed,
+                            std::string_view *payload) {
+  if (auto it = decompressed_.find(data_offset); it != decompressed_.end()) {
+    *payload = it->second;
+    return 0;
+  }
+  std::string out;
+  switch (compression) {
+  case OBJECT_COMPRESSED_XZ: {
+    int err = decompress_xz(compressed, &out);
+    if (err != 0) {
+      return err;
+    }
+    break;
+  }
+  case OBJECT_COMPRESSED_LZ4: {
+    // journald stores the decompressed size before the LZ4 block.
+    if (compressed.size() < sizeof(uint64_t)) {
+      return -EBADMSG;
+    }
+    const uint64_t size = read_le64((const uint8_t *)(compressed.data()));
+    if (size > MAX_FIELD_SIZE) {
+      return -EBADMSG;
+    }
+    out.resize(size);
+    const int length = LZ4_decompress_safe(compressed.data() + sizeof(uint64_t), out.data(),
+                                           int(compressed.size() - sizeof(uint64_t)), int(size));
+    if (length < 0 || uint64_t(length) != size) {
+      return -EBADMSG;
+    }
+    break;
+  }
+  case OBJECT_COMPRESSED_ZSTD: {
+    const unsigned long long size =
+        ZSTD_getFrameContentSize(compressed.data(), compressed.size());
+    if (size == ZSTD_CONTENTSIZE_ERROR || size == ZSTD_CONTENTSIZE_UNKNOWN ||
+        size > MAX_FIELD_SIZE) {
+      return -EBADMSG;
+    }
+    out.resize(size);
+    const size_t length = ZSTD_decompressDCtx(zstd_, out.data(), out.size(), compressed.data(),
+                                              compressed.size());
+    if (ZSTD_isError(length) || length != size) {
+      return -EBADMSG;
+    }
+    break;
+  }
+  default:
+    // more than one compression flag.
+    return -EPROTONOSUPPORT;
+  }
+  if (decompressed_bytes_ + out.size() > MAX_DECOMPRESSED_CACHE_BYTES) {
+    decompressed_.clear();
+    decompressed_bytes_ = 0;
+  }
+  decompressed_bytes_ += out.size();
+  *payload = decompressed_.emplace(data_offset, std::move(out)).first->second;
+  return 0;
+}
+
+void JournalFile::decode_fields(JournalEntry *entry) {
+  entry->external_data = nullptr;
+  entry->field_data.clear();
+  entry->fields.clear();
+  std::fill(std::begin(entry->well_known), std::end(entry->well_known), -1);
+  const uint64_t object_size = read_le64(data_ + entry_offset_ + 8);
+  const size_t item_size = compact_ ? sizeof(uint32_t) : 2 * sizeof(uint64_t);
+  const uint8_t *items = data_ + entry_offset_ + ENTRY_ITEMS;
+  const uint64_t item_count = (object_size - ENTRY_ITEMS) / item_size;
+  for (uint64_t i = 0; i < item_count; ++i) {
+    const uint8_t *item = items + i * item_size;
+    const uint64_t data_offset = compact_ ? read_le32(item) : read_le64(item);
+    std::string_view payload;
+    if (field_payload(data_offset, &payload) != 0) {
+      continue;
+    }
+    const size_t eq_pos = payload.find('=');
+    if (eq_pos == payload.npos || eq_pos >= payload.size() - 1) {
+      continue;
+    }
+    entry->well_known[classify_field(payload.substr(0, eq_pos))] = entry->fields.size();
+    JournalEntry::Field field;
+    field.key_offset = entry->field_data.size();
+    field.key_size = eq_pos;
+    field.value_offset = field.key_offset + eq_pos + 1;
+    field.value_size = payload.size() - eq_pos - 1;
+    entry->field_data.append(payload);
+    entry->fields.push_back(field);
+  }
+  const JournalEntry::Field *transport = entry->find(FIELD_TRANSPORT);
+  entry->transport =
+      transport != nullptr ? parse_transport(entry->value(*transport)) : TRANSPORT_UNKNOWN;
+}
+
+int read_journal_file_header(const std::string &path, JournalFileHeader *header) {
+  const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return -errno;
+  }
+  uint8_t data[MIN_HEADER_SIZE];
+  const ssize_t size = pread(fd, data, sizeof(data), 0);
+  const int err = size < 0 ? -errno : 0;
+  ::close(fd);
+  if (err != 0) {
+    return err;
+  }
+  if (size_t(size) < sizeof(data) || memcmp(data, SIGNATURE, sizeof(SIGNATURE)) != 0) {
+    return -EBADMSG;
+  }
+  header->archived = data[HEADER_STATE] == STATE_ARCHIVED;
+  header->entry_count = read_le64(data + HEADER_N_ENTRIES);
+  header->head_realtime_usec = read_le64(data + HEADER_HEAD_ENTRY_REALTIME);
+  header->tail_realtime_usec = read_le64(data + HEADER_TAIL_ENTRY_REALTIME);
+  header->tail_boot_id = read_id128(data + HEADER_TAIL_ENTRY_BOOT_ID);
+  return 0;
+}
+
+int list_journal_files(const std::string &directory, std::vector<std::string> *paths) {
+  DIR *dir = opendir(directory.c_str());
+  if (dir == NULL) {
+    return -errno;
+  }
+  const size_t first = paths->size();
+  // like libsystemd, read archived and dirty files as well as the active ones.
+  while (struct dirent *child = readdir(dir)) {
+    const std::string_view name(child->d_name);
+    if (name.size() > 8 && (name.substr(name.size() - 8) == ".journal" ||
+                            name.substr(name.size() - 9) == ".journal~")) {
+      paths->push_back(directory + "/" + child->d_name);
+    }
+  }
+  closedir(dir);
+  std::sort(paths->begin() + first, paths->end());
+  return 0;
+}
+
+std::vector<std::string> select_journal_files(const std::vector<std::string> &paths,
+                                              const JournalFileFilter &filter) {
+  std::vector<std::string> selected;
+  for (const auto &path : paths) {
+    JournalFileHeader header;
+    if (read_journal_file_header(path, &header) != 0 || !header.archived) {
+      selected.push_back(path);
+      continue;
+    }
+    if (header.entry_count == 0 || header.tail_realtime_usec < filter.start_usec ||
+        header.head_realtime_usec >= filter.end_usec) {
+      continue;
+    }
+    // entries are appended in order, so a file with an entry of the boot ends in that boot.
+    if (filter.match_boot && !sd_id128_equal(header.tail_boot_id, filter.boot_id)) {
+      continue;
+    }
+    selected.push_back(path);
+  }
+  return selected;
+}
+
+int MappedJournal::open(const JournalSource &source) {
+  std::vector<std::string> paths = source.files;
+  if (!source.directory.empty()) {
+    if (int err = list_journal_files(source.directory, &paths); err != 0) {
+      return err;
+    }
+  }
+  for (const auto &path : paths) {
+    auto file = std::make_unique<JournalFile>();
+    int err = file->open(path);
+    if (err == -EBADMSG && !source.directory.empty()) {
+      // libsystemd skips the files of a directory which it cannot read, such as an empty one
+      // journald has just created.
+      continue;
+    }
+    if (err != 0) {
+      return err;
+    }
+    files_.push_back(std::move(file));
+  }
+  states_.assign(files_.size(), FILE_STALE);
+  return 0;
+}
+
+void MappedJournal::match_boot_id(const sd_id128_t &boot_id) {
+  has_boot_match_ = true;
+  boot_match_ = boot_id;
+}
+
+void MappedJournal::seek_head() {
+  for (auto &file : files_) {
+    file->seek_head();
+  }
+  states_.assign(files_.size(), FILE_STALE);
+  current_ = nullptr;
+  has_location_ = false;
+}
+
+int MappedJournal::seek_realtime_usec(uint64_t usec) {
+  seek_head();
+  for (auto &file : files_) {
+    if (int err = file->seek_realtime_usec(usec); err != 0) {
+      return err;
+    }
+  }
+  return 0;
+}
+
+int MappedJournal::find_boot_before(uint64_t usec, sd_id128_t *boot_id) {
+  int found = 0;
+  JournalLocation last;
+  for (auto &file : files_) {
+    int err = file->seek_realtime_usec(usec);
+    if (err == 0) {
+      err = file->previous();
+    }
+    if (err < 0) {
+      return err;
+    }
+    if (err > 0 && (found == 0 || compare_locations(file->location(), last) > 0)) {
+      last = file->location();
+      found = 1;
+    }
+  }
+  if (found) {
+    *boot_id = last.boot_id;
+  }
+  seek_head();
+  return found;
+}
+
+int MappedJournal::advance(size_t file) {
+  while (true) {
+    int err = files_[file]->next();
+    if (err <= 0) {
+      states_[file] = FILE_DONE;
+      return err;
+    }
+    if (!has_boot_match_ || sd_id128_equal(files_[file]->location().boot_id, boot_match_)) {
+      states_[file] = FILE_READY;
+      return 1;
+    }
+  }
+}
+
+int MappedJournal::next() {
+  while (true) {
+    // libsystemd also compares every file's next entry, rather than keeping a heap.
+    size_t best = files_.size();
+    for (size_t i = 0; i < files_.size(); ++i) {
+      if (states_[i] == FILE_STALE) {
+        if (int err = advance(i); err < 0) {
+          return err;
+        }
+      }
+      if (states_[i] == FILE_READY &&
+          (best == files_.size() ||
+           compare_locations(files_[i]->location(), files_[best]->location()) < 0)) {
+        best = i;
+      }
+    }
+    if (best == files_.size()) {
+      current_ = nullptr;
+      return 0;
+    }
+    states_[best] = FILE_STALE;
+    const JournalLocation &location = files_[best]->location();
+    if (has_location_ && compare_locations(location, last_location_) == 0) {
+      // the same entry in another file, eg. one copied by journal-remote.
+      continue;
+    }
+    current_ = files_[best].get();
+    last_location_ = location;
+    has_location_ = true;
+    return 1;
+  }
+}
+
+const JournalLocation &MappedJournal::location() const { return last_location_; }
+
+int MappedJournal::read_entry(uint64_t end_usec, JournalEntry *entry) {
+  int err = next();
+  if (err <= 0) {
+    return err;
+  }
+  const uint64_t ts_usec = last_location_.realtime_usec;
+  if (ts_usec >= end_usec) {
+    return 0;
+  }
+  if (ts_usec >= (UINT64_MAX / 1000ull)) {
+    return -ERANGE;
+  }
+  entry->timestamp = ts_usec * 1000ull;
+  current_->decode_fields(entry);
+  return 1;
+}
+
+size_t MappedJournal::file_count() const { return files_.size(); }
@@ -0,0 +1,306 @@
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+
+#include "journal.hpp"
+#include "json_encoder.hpp"
+#include "utf8.hpp"
+
+namespace {
+
+/**
+ * Parses a CODE_LINE value with the same rules as `std::stoull`, returning false where
+ * `std::stoull` would throw.
+ */
+bool parse_line(std::string_view value, uint64_t *out) {
+  size_t i = 0;
+  while (i < value.size() && std::isspace((unsigned char)(value[i]))) {
+    ++i;
+  }
+  bool negative = false;
+  if (i < value.size() && (value[i] == '+' || value[i] == '-')) {
+    negative = value[i] == '-';
+    ++i;
+  }
+  const char *begin = value.data() + i;
+  const char *end = value.data() + value.size();
+  uint64_t result = 0;
+  auto [ptr, ec] = std::from_chars(begin, end, result);
+  if (ptr == begin || ec != std::errc()) {
+    return false;
+  }
+  *out = negative ? (0 - result) : result;
+  return true;
+}
+
+void append_uint(std::string *out, uint64_t value) {
+  char buf[24];
+  auto [ptr, ec] = std::to_chars(buf, buf + sizeof(buf), value);
+  out->append(buf, ptr - buf);
+}
+
+// The members serialize_json() adds to each entry, in the order std::map sorts them.
+enum DerivedMember {
+  MEMBER_FILE,
+  MEMBER_LEVEL,
+  MEMBER_LINE,
+  MEMBER_MESSAGE,
+  MEMBER_NAME,
+  MEMBER_TIMESTAMP,
+  _MEMBER_COUNT,
+};
+
+const std::string_view MEMBER_KEYS[_MEMBER_COUNT] = {
+    "file", "level", "line", "message", "name", "timestamp",
+};
+
+const char *SCHEMA_TEXT = R"({
+  "title": "foxglove.Log",
+  "description": "A log message",
+  "$comment": "Generated by https://github.com/foxglove/schemas",
+  "type": "object",
+  "properties": {
+    "timestamp": {
+      "type": "object",
+      "title": "time",
+      "properties": {
+        "sec": {
+          "type": "integer",
+          "minimum": 0
+        },
+        "nsec": {
+          "type": "integer",
+          "minimum": 0,
+          "maximum": 999999999
+        }
+      },
+      "description": "Timestamp of log message"
+    },
+    "level": {
+      "title": "foxglove.LogLevel",
+      "description": "Log level",
+      "oneOf": [
+        {
+          "title": "UNKNOWN",
+          "const": 0
+        },
+        {
+          "title": "DEBUG",
+          "const": 1
+        },
+        {
+          "title": "INFO",
+          "const": 2
+        },
+        {
+          "title": "WARNING",
+          "const": 3
+        },
+        {
+          "title": "ERROR",
+          "const": 4
+        },
+        {
+          "title": "FATAL",
+          "const": 5
+        }
+      ]
+    },
+    "message": {
+      "type": "string",
+      "description": "Log message"
+    },
+    "name": {
+      "type": "string",
+      "description": "Process or node name"
+    },
+    "file": {
+      "type": "string",
+      "description": "Filename"
+    },
+    "line": {
+      "type": "integer",
+      "minimum": 0,
+      "description": "Line number in the file"
+    }
+  }
+})";
+
+} // namespace
+
+void append_json_string(std::string *out, std::string_view value) {
+  static const char HEX[] = "0123456789abcdef";
+  const uint8_t *data = (const uint8_t *)(value.data());
+  const size_t size = value.size();
+  out->push_back('"');
+  size_t run_start = 0;
+  size_t i = 0;
+  while (i < size) {
+    uint8_t c = data[i];
+    if (c >= 0x20 && c < 0x80 && c != '"' && c != '\\') {
+      ++i;
+      continue;
+    }
+    size_t skip = 1;
+    if (c >= 0x80) {
+      bool complete = false;
+      size_t prefix = utf8_prefix_length(data + i, size - i, &complete);
+      if (complete) {
+        i += prefix;
+        continue;
+      }
+      // drop the malformed prefix and re-read the byte that ended it, as nlohmann's
+      // `error_handler_t::replace` mode does.
+      skip = std::max(prefix, size_t(1));
+    }
+    out->append(value.data() + run_start, i - run_start);
+    switch (c) {
+    case '"':
+      out->append("\\\"");
+      break;
+    case '\\':
+      out->append("\\\\");
+      break;
+    case '\b':
+      out->append("\\b");
+      break;
+    case '\t':
+      out->append("\\t");
+      break;
+    case '\n':
+      out->append("\\n");
+      break;
+    case '\f':
+      out->append("\\f");
+      break;
+    case '\r':
+      out->append("\\r");
+      break;
+    default:
+      if (c < 0x20) {
+        const char escape[6] = {'\\', 'u', '0', '0', HEX[c >> 4], HEX[c & 0xF]};
+        out->append(escape, sizeof(escape));
+      } else {
+        out->append("\xEF\xBF\xBD");
+      }
+      break;
+    }
+    i += skip;
+    run_start = i;
+  }
+  out->append(value.data() + run_start, size - run_start);
+  out->push_back('"');
+}
+
+std::string_view JsonEncoder::encode(const JournalEntry &entry) {
+  using Field = JournalEntry::Field;
+  auto key = [&entry](uint32_t index) { return entry.key(entry.fields[index]); };
+  auto value = [&entry](uint32_t index) { return entry.value(entry.fields[index]); };
+
+  // Sort by key, keeping fields with the same key in enumeration order so that the last
+  // value wins, as it does when assigning into the nlohmann::json object.
+  order_.clear();
+  for (uint32_t i = 0; i < entry.fields.size(); ++i) {
+    order_.push_back(i);
+  }
+  std::sort(order_.begin(), order_.end(), [&key](uint32_t a, uint32_t b) {
+    int cmp = key(a).compare(key(b));
+    return cmp < 0 || (cmp == 0 && a < b);
+  });
+  size_t unique_count = 0;
+  for (size_t i = 0; i < order_.size(); ++i) {
+    if (i + 1 < order_.size() && key(order_[i]) == key(order_[i + 1])) {
+      continue;
+    }
+    order_[unique_count++] = order_[i];
+  }
+  order_.resize(unique_count);
+
+  // the well-known fields are the last occurrence of each key, which is the one kept above.
+  const Field *message = entry.find(FIELD_MESSAGE);
+  const Field *name = entry.find(FIELD_SYSTEMD_UNIT);
+  if (name == nullptr) {
+    name = entry.find(FIELD_EXE);
+  }
+  if (name == nullptr) {
+    name = entry.find(FIELD_TRANSPORT);
+  }
+  const Field *file = entry.find(FIELD_CODE_FILE);
+  uint64_t line = 0;
+  const Field *line_field = entry.find(FIELD_CODE_LINE);
+  bool has_line = line_field != nullptr && parse_line(entry.value(*line_field), &line);
+  const Field *priority = entry.find(FIELD_PRIORITY);
+  int level = priority != nullptr ? level_for_priority(entry.value(*priority)) : 0;
+
+  bool present[_MEMBER_COUNT] = {};
+  present[MEMBER_FILE] = file != nullptr;
+  present[MEMBER_LEVEL] = true;
+  present[MEMBER_LINE] = has_line;
+  present[MEMBER_MESSAGE] = message != nullptr;
+  present[MEMBER_NAME] = name != nullptr;
+  present[MEMBER_TIMESTAMP] = true;
+
+  out_.clear();
+  out_.push_back('{');
+  auto append_key = [this](std::string_view k) {
+    if (out_.size() > 1) {
+      out_.push_back(',');
+    }
+    append_json_string(&out_, k);
+    out_.push_back(':');
+  };
+
+  size_t next_field = 0;
+  for (int member = 0; member < _MEMBER_COUNT; ++member) {
+    if (!present[member]) {
+      continue;
+    }
+    std::string_view member_key = MEMBER_KEYS[member];
+    for (; next_field < order_.size() && key(order_[next_field]) < member_key;
+         ++next_field) {
+      append_key(key(order_[next_field]));
+      append_json_string(&out_, value(order_[next_field]));
+    }
+    if (next_field < order_.size() && key(order_[next_field]) == member_key) {
+      // serialize_json() overwrites journal fields which collide with its own members.
+      ++next_field;
+    }
+    append_key(member_key);
+    switch (member) {
+    case MEMBER_FILE:
+      append_json_string(&out_, entry.value(*file));
+      break;
+    case MEMBER_LEVEL:
+      append_uint(&out_, level);
+      break;
+    case MEMBER_LINE:
+      append_uint(&out_, line);
+      break;
+    case MEMBER_MESSAGE:
+      append_json_string(&out_, entry.value(*message));
+      break;
+    case MEMBER_NAME:
+      append_json_string(&out_, entry.value(*name));
+      break;
+    case MEMBER_TIMESTAMP:
+      out_.append("{\"nsec\":");
+      append_uint(&out_, entry.timestamp % 1000000000ull);
+      out_.append(",\"sec\":");
+      append_uint(&out_, entry.timestamp / 1000000000ull);
+      out_.push_back('}');
+      break;
+    }
+  }
+  for (; next_field < order_.size(); ++next_field) {
+    append_key(key(order_[next_field]));
+    append_json_string(&out_, value(order_[next_field]));
+  }
+  out_.push_back('}');
+  return out_;
+}
+
+const char *JsonEncoder::schema_encoding() const { return "jsonschema"; }
+
+std::string_view JsonEncoder::schema_data() const { return SCHEMA_TEXT; }
+
+const char *JsonEncoder::message_encoding() const { return "json"; }
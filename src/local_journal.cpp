@@ -0,0 +1,82 @@
+#include <cerrno>
+#include <cstdio>
+#include <ctime>
+#include <vector>
+
+#include "local_journal.hpp"
+
+namespace {
+
+// where journald keeps the journals of the local machine, in volatile and persistent storage.
+const char *LOCAL_JOURNAL_ROOTS[] = {"/run/log/journal", "/var/log/journal"};
+
+/**
+ * @brief lists the journal files `sd_journal_open()` reads with SD_JOURNAL_LOCAL_ONLY: those in
+ * the journal roots and in their subdirectories for this machine.
+ */
+int list_local_journal_files(std::vector<std::string> *paths) {
+  sd_id128_t machine_id;
+  int err = sd_id128_get_machine(&machine_id);
+  if (err != 0) {
+    return err;
+  }
+  char machine[SD_ID128_STRING_MAX];
+  sd_id128_to_string(machine_id, machine);
+  for (const char *root : LOCAL_JOURNAL_ROOTS) {
+    for (const std::string &directory : {std::string(root), std::string(root) + "/" + machine}) {
+      err = list_journal_files(directory, paths);
+      if (err != 0 && err != -ENOENT) {
+        return err;
+      }
+    }
+  }
+  return 0;
+}
+
+} // namespace
+
+JournalFileFilter journal_file_filter(const Options &options, const std::string &resume_cursor) {
+  JournalFileFilter filter;
+  if (!resume_cursor.empty()) {
+    if (cursor_realtime_usec(resume_cursor, &filter.start_usec) != 0) {
+      filter.start_usec = 0;
+    }
+  } else if (options.start == TIME_UNIX) {
+    filter.start_usec = options.start_sec * 1'000'000;
+  } else if (options.start == TIME_NOW) {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    filter.start_usec = uint64_t(now.tv_sec) * 1'000'000 + uint64_t(now.tv_nsec) / 1000;
+  } else if (options.end != TIME_UNIX) {
+    // `apply_boot_id_match()` matches the current boot.
+    filter.match_boot = sd_id128_get_boot(&filter.boot_id) == 0;
+  }
+  filter.end_usec = end_usec_for(options.end, options.end_sec);
+  return filter;
+}
+
+int open_local_journal(sd_journal **j, const JournalFileFilter &filter, bool follow,
+                       bool verbose, bool *selected) {
+  *selected = false;
+  std::vector<std::string> paths;
+  if (list_local_journal_files(&paths) == 0 && !paths.empty()) {
+    const std::vector<std::string> picked = select_journal_files(paths, filter);
+    std::vector<const char *> c_paths;
+    bool active = false;
+    for (const auto &path : picked) {
+      JournalFileHeader header;
+      active = active || (read_journal_file_header(path, &header) == 0 && !header.archived);
+      c_paths.push_back(path.c_str());
+    }
+    c_paths.push_back(nullptr);
+    if (!picked.empty() && (active || !follow) &&
+        sd_journal_open_files(j, c_paths.data(), 0) == 0) {
+      if (verbose) {
+        fprintf(stderr, "reading %zu of %zu journal files\n", picked.size(), paths.size());
+      }
+      *selected = true;
+      return 0;
+    }
+  }
+  return sd_journal_open(j, SD_JOURNAL_LOCAL_ONLY);
+}
@@ -1,14 +1,23 @@
-#include <signal.h>
-#include <sstream>
+#include <cstring>
 #include <string_view>
 
 #include <systemd/sd-journal.h>
 
-#define MCAP_IMPLEMENTATION
-#include "vendor/mcap/writer.hpp"
-
 #include "cmdline.hpp"
+#include "coalesce.hpp"
+#include "dictionary.hpp"
+#include "encoder.hpp"
+#include "event_loop.hpp"
+#include "export_reader.hpp"
 #include "journal.hpp"
+#include "journal_file.hpp"
+#include "local_journal.hpp"
+#include "merge.hpp"
+#include "output.hpp"
+#include "parallel.hpp"
+#include "pipeline.hpp"
+#include "state.hpp"
+#include "stats.hpp"
 
 const char *VERSION = "0.1.0";
 
@@ -16,7 +25,12 @@ const char *DOC = R"(
 Utility for exporting journald logs to MCAP
 
 Usage:
-  journal2mcap [--output <filename>] [--start <arg>] [--end <arg>] [--verbose] [--help] [--version]
+  journal2mcap [--output <filename>] [--start <arg>] [--end <arg>] [--encoding <arg>] [--topics <arg>] [--jobs <count>] [--compression-threads <count>]
+               [--io <arg>] [--sync-writeback] [--zstd-dictionary <filename>] [--train-dictionary <filename>]
+               [--directory <path>]... [--file <filename>]... [--reader <arg>] [--import <filename>]
+               [--unit <name>]... [--priority <level>] [--transport <name>]... [--match <FIELD=VALUE>]...
+               [--rotate-size <bytes>] [--rotate-interval <seconds>] [--max-chunk-latency <milliseconds>]
+               [--coalesce <milliseconds>] [--overload <arg>] [--high-watermark <entries>] [--state-file <filename>] [--stats] [--stats-file <filename>] [--verbose] [--help] [--version]
 
 Flags:
   -o  --output
@@ -30,10 +44,137 @@ Flags:
     Specify an endpoint for log entries (default is 'now')
     'now' exports entries logged before program start
     'shutdown' exports entries from the endpoint specified by --start until the next shutdown.
-    'wait' continues exporting entries logged after program start until interrupted.
+    'wait' continues exporting entries logged after program start until SIGINT or SIGTERM.
     <timestamp> exports entries logged before this unix timestamp.
+    Archived journal files whose headers show they hold no entries between --start and --end
+    are not opened, so starting from a recent timestamp does not search years of old files.
+  -D  --directory <path>
+    Reads the journal files in this directory instead of the local journal, eg. a copy of
+    another machine's /var/log/journal. May be given more than once.
+    Each machine's subdirectory is read by its own thread, and entries from every source are
+    merged in timestamp order into channels named '/journald/<machine-id>/<transport>', or
+    '/journald/<machine-id>/unit/<unit>' with '--topics unit'.
+    'boot' starts at the first entry in the files rather than the current boot, unless --end
+    is a timestamp. '--start now', '--end wait' and --state-file are not supported.
+  --file <filename>
+    Reads this journal file instead of the local journal, like --directory. May be given
+    more than once; files in the same directory are read together by one thread.
+  --reader libsystemd | mmap
+    How --directory and --file sources are read (default is 'libsystemd')
+    'mmap' parses the journal files from read-only memory mappings instead of making several
+    libsystemd calls for every entry, with the same output. Compressed fields shared by many
+    entries are decompressed once. Journal filters cannot be used with it, and files in a
+    format it does not support are still read with libsystemd.
+  --import <filename> | -
+    Reads entries in the Journal Export Format, as written by 'journalctl -o export', from
+    this file or from stdin, without libsystemd. Files are memory-mapped and parsed in place.
+    Only --start and --end timestamps select entries; 'boot' and 'now' export every entry in
+    the input, which is written in input order.
+  --encoding json | protobuf
+    Message encoding for the foxglove.Log messages (default is 'json')
+    'protobuf' produces smaller files which are faster to write and to decode. Journal fields
+    without a foxglove.Log equivalent are kept in the repeated 'journal_fields' field.
+  --topics transport | unit
+    How entries are split between channels (default is 'transport')
+    'transport' writes each entry to '/journald/<transport>'.
+    'unit' writes entries to '/journald/unit/<unit>', or to '/journald/comm/<command>' for
+    processes outside a unit, so that one unit's entries can be read without scanning the
+    others. Entries with neither, such as kernel messages, go to '/journald/<transport>'.
+  -j  --jobs <count>
+    Number of worker threads to read and serialize entries with (default is 1, at most 64)
+    When both ends of the range are bounded, the range is split into time slices which are
+    exported in parallel and merged in order.
+    With '--start now', '--end wait' or --state-file, entries are read on one thread, serialized
+    by this many threads and written in order by another, so that a slow write does not hold up
+    reading the journal. The output is the same as with one thread.
+  --compression-threads <count>
+    Number of background threads compressing chunks while the next chunk fills (default is 1)
+    '0' compresses each chunk inline before reading further entries.
+  --io stdio | thread | uring
+    How output files are written (default is 'stdio')
+    'stdio' writes through a buffered stream on the thread reading entries.
+    'thread' copies the output into 1 MiB blocks which a background thread writes, so that slow
+    storage only stalls the export once 4 blocks are waiting. Disk space is reserved 16 MiB
+    ahead of the writes, so that the file is laid out contiguously.
+    'uring' submits the blocks through io_uring instead, falling back to 'thread' on kernels
+    without it.
+  --zstd-dictionary <filename>
+    Compresses chunks with the zstd dictionary in this file, eg. one saved by --train-dictionary.
+    Journal entries repeat the same fields and messages, so a dictionary keeps small chunks, as
+    written with --max-chunk-latency or --rotate-size, compressing almost as well as large ones.
+    Each output file starts with the dictionary in a 'journal2mcap.zstd_dictionary' attachment,
+    which readers need to decompress its chunks.
+  --train-dictionary <filename>
+    Instead of exporting, trains a zstd dictionary on the first entries selected by the other
+    options, encoded with the chosen --encoding, and saves it to this file.
+  --sync-writeback
+    With '--io thread' or '--io uring', starts writeback of each block once it is written and
+    waits for the block before it to reach the disk, so that the page cache does not fill with
+    dirty pages which are then written in a burst.
+  -u  --unit <name>
+    Only export entries from this systemd unit, or logged by systemd about it. May be repeated.
+    Names without a suffix are taken to be services, eg. 'sshd' matches 'sshd.service'.
+  -p  --priority <0-7> | emerg | alert | crit | err | warning | notice | info | debug
+    Only export entries with this priority or a more important one.
+  --transport audit | driver | syslog | journal | stdout | kernel
+    Only export entries received over this transport. May be repeated.
+  -m  --match <FIELD=VALUE>
+    Only export entries with a matching field. May be repeated; matches on the same field are
+    alternatives, and matches on different fields must all hold.
+    All filters are applied by libsystemd, so entries which do not match are never read.
+  --rotate-size <bytes>
+    Starts a new output file once the current one reaches this size, eg. '64M'. The suffixes K,
+    M and G are powers of 1024.
+  --rotate-interval <seconds>
+    Starts a new output file for entries logged this long after the first entry in the current
+    one, eg. '1h'. The suffixes s, m, h and d are accepted.
+    When rotating, '{n}' in the output filename is replaced with the file number, or the number
+    is added before the extension: 'out.mcap' becomes 'out.0.mcap', 'out.1.mcap', ...
+    Sequence numbers continue across files, and each file records the range it holds in a
+    'journal2mcap.sequences' metadata record.
+  --max-chunk-latency <milliseconds>
+    With '--end wait', writes out the chunk in progress and flushes the output file once an
+    entry has waited this long, eg. '500' or '2s', so that readers of the growing file see it.
+    The suffixes s, m and h are accepted. Smaller chunks compress less well; --verbose prints
+    the resulting distribution of chunk sizes.
+  --coalesce <milliseconds>
+    Collapses runs of consecutive entries with the same transport, unit, command, priority and
+    message, eg. '500' or '2s'. The first entry of a run is exported as usual, and the repeats
+    after it as a single entry for each window of this length, with the fields
+    JOURNAL2MCAP_REPEAT_COUNT and JOURNAL2MCAP_REPEAT_LAST_TIMESTAMP added when it stands for
+    more than one. The suffixes s, m and h are accepted.
+  --overload block | drop | sample
+    What to do with entries read while the output falls behind, eg. while the disk stalls
+    (default is 'block')
+    'block' stops reading the journal until entries have been written, which may let journald
+    rotate unread entries away.
+    Otherwise, entries are queued in memory to be written, as with --jobs, and once more than
+    the --high-watermark are waiting:
+    'drop' drops DEBUG entries and entries without a priority, then INFO and then WARNING
+    entries as the queue fills further.
+    'sample' keeps one in 10 DEBUG and INFO entries.
+    ERROR entries and worse are never dropped. The number of entries dropped for each unit and
+    level so far is written to the output in a 'journal2mcap.dropped' metadata record every 10
+    seconds while entries are being dropped, and at exit.
+  --high-watermark <entries>
+    With '--overload drop' or 'sample', the number of entries waiting to be written above which
+    entries are dropped, eg. '50K' (default is '20K'). The suffixes K and M are powers of 1000.
+    The queue holds a third more entries than this, so memory use grows with it.
+  --state-file <filename>
+    Saves the cursor of the last exported entry to this file, replacing it atomically. If the
+    file exists, export resumes with the first entry after its cursor and --start is ignored,
+    so repeated runs export every entry exactly once.
+  --stats
+    Prints at exit how long was spent reading, encoding, writing, compressing and syncing, and
+    how many entries and bytes went to each channel. Per-entry stages are timed on a sample of
+    entries, which costs well under 1% of the export time. With --jobs, only the time spent
+    compressing and syncing is reported.
+  --stats-file <filename>
+    Writes the same statistics as JSON to this file at exit, and every 10 seconds with
+    '--end wait'. The file is replaced atomically.
   -v  --verbose
-    Prints info about what entries are captured while running.
+    Prints info about what entries are captured while running, and a summary of the chunks
+    written at exit.
   -h  --help
     Prints this help message and exits.
   --version
@@ -53,6 +194,27 @@ Exports logs starting from now and continues logging until Ctrl-C:
 Exports logs between from Jan 1 2023 and Feb 1 2023
   journal2mcap --start $(date -d 2023-01-01 +%s) --end $(date -d 2023-02-01 +%s)
 
+Exports the same month using 8 worker threads:
+  journal2mcap --start $(date -d 2023-01-01 +%s) --end $(date -d 2023-02-01 +%s) --jobs 8
+
+Converts an export stream from a system without journal2mcap:
+  ssh robot journalctl -o export | journal2mcap --import -
+
+Merges journals copied from two robots into one file:
+  journal2mcap --directory robot1/var/log/journal --directory robot2/var/log/journal
+
+Exports warnings and errors from sshd and nginx since boot:
+  journal2mcap --unit sshd --unit nginx --priority warning
+
+Exports logs until Ctrl-C into hourly files of at most 256MB each:
+  journal2mcap --end wait --output "logs-{n}.mcap" --rotate-interval 1h --rotate-size 256M
+
+Exports logs until Ctrl-C, making each entry visible in the file within a second:
+  journal2mcap --end wait --max-chunk-latency 1s
+
+Exports the entries logged since the previous run, eg. from a timer:
+  journal2mcap --output "logs-$(date +%s).mcap" --state-file /var/lib/journal2mcap/cursor
+
 Exports logs between from midnight Jan 1 2023 until the first shutdown after that.
   journal2mcap --start $(date -d 2023-01-01 +%s) --end shutdown
 
@@ -60,94 +222,84 @@ Exports logs from the last boot before midnight Mar 1 2023 until midnight Mar 1
   journal2mcap --end $(date -d 2023-03-01 +%s)
 )";
 
-static const char *SCHEMA_TEXT = R"({
-  "title": "foxglove.Log",
-  "description": "A log message",
-  "$comment": "Generated by https://github.com/foxglove/schemas",
-  "type": "object",
-  "properties": {
-    "timestamp": {
-      "type": "object",
-      "title": "time",
-      "properties": {
-        "sec": {
-          "type": "integer",
-          "minimum": 0
-        },
-        "nsec": {
-          "type": "integer",
-          "minimum": 0,
-          "maximum": 999999999
-        }
-      },
-      "description": "Timestamp of log message"
-    },
-    "level": {
-      "title": "foxglove.LogLevel",
-      "description": "Log level",
-      "oneOf": [
-        {
-          "title": "UNKNOWN",
-          "const": 0
-        },
-        {
-          "title": "DEBUG",
-          "const": 1
-        },
-        {
-          "title": "INFO",
-          "const": 2
-        },
-        {
-          "title": "WARNING",
-          "const": 3
-        },
-        {
-          "title": "ERROR",
-          "const": 4
-        },
-        {
-          "title": "FATAL",
-          "const": 5
-        }
-      ]
-    },
-    "message": {
-      "type": "string",
-      "description": "Log message"
-    },
-    "name": {
-      "type": "string",
-      "description": "Process or node name"
-    },
-    "file": {
-      "type": "string",
-      "description": "Filename"
-    },
-    "line": {
-      "type": "integer",
-      "minimum": 0,
-      "description": "Line number in the file"
-    }
-  }
-})";
-
-static std::atomic_bool global_signalled = false;
-
-void on_sigint(int signal) { global_signalled = true; }
-
-std::string get_topic(Transport transport) {
-  std::stringstream ss;
-  ss << "/journald/";
-  ss << name_for_transport(transport);
-  return ss.str();
+// how many entries are read between checks for a pending signal or flush while catching up.
+const uint64_t SIGNAL_CHECK_INTERVAL = 256;
+// how often the --stats-file is updated in wait mode.
+const uint64_t STATS_FILE_INTERVAL_NS = 10'000'000'000;
+// how many bytes of chunk indexes a file keeps in memory in wait mode, which may run for weeks.
+const uint64_t WAIT_MAX_INDEX_MEMORY = 1 << 20;
+// the default --high-watermark, about a second of entries at a high logging rate.
+const uint64_t DEFAULT_HIGH_WATERMARK = 20'000;
+// how often the entries dropped by --overload are recorded in the output while dropping.
+const uint64_t DROPPED_METADATA_INTERVAL_NS = 10'000'000'000;
+
+/**
+ * @brief trains a dictionary on the entries from the start of the range, and saves it to the
+ * --train-dictionary file.
+ */
+int train_dictionary(sd_journal *j, const Options &options, LogEncoder *encoder) {
+  const uint64_t end_usec = end_usec_for(options.end, options.end_sec);
+  DictionarySampler sampler;
+  JournalEntry entry;
+  while (!sampler.full()) {
+    int err = read_journal_entry(j, end_usec, &entry);
+    if (err < 0) {
+      fprintf(stderr, "failed to read next entry: %s\n", strerror(-err));
+      return -err;
+    }
+    if (err == 0) {
+      break;
+    }
+    sampler.add(encoder->encode(entry));
+  }
+  std::string dictionary;
+  int err = sampler.train(&dictionary);
+  if (err == -ENODATA) {
+    fprintf(stderr, "too few entries to train a dictionary on\n");
+    return -err;
+  }
+  if (err != 0) {
+    fprintf(stderr, "failed to train dictionary: %s\n", strerror(-err));
+    return -err;
+  }
+  err = replace_file(options.train_dictionary, dictionary);
+  if (err != 0) {
+    fprintf(stderr, "failed to save dictionary: %s\n", strerror(-err));
+    return -err;
+  }
+  if (options.verbose) {
+    fprintf(stderr, "trained a %zu byte dictionary on %zu entries\n", dictionary.size(),
+            sampler.sample_count());
+  }
+  return 0;
+}
+
+void write_stats_file(const std::string &path, const StageTimer &timer,
+                      const LogWriter &writer) {
+  int err = replace_file(path, format_stats_json(timer, writer) + "\n");
+  if (err != 0) {
+    fprintf(stderr, "failed to write stats file: %s\n", strerror(-err));
+  }
+}
+
+/**
+ * @brief prints the statistics requested by --verbose and --stats once the export is done, and
+ * writes them to the --stats-file.
+ */
+void report_stats(const Options &options, const StageTimer &timer, const LogWriter &writer) {
+  if (options.stats) {
+    fprintf(stderr, "%s", format_stats_text(timer, writer).c_str());
+  } else if (options.verbose) {
+    fprintf(stderr, "%s\n", describe_chunk_stats(writer.chunk_stats()).c_str());
+  }
+  if (!options.stats_file.empty()) {
+    write_stats_file(options.stats_file, timer, writer);
+  }
 }
 
 int main(int argc, const char **argv) {
   sd_journal *j;
-  mcap::McapWriter writer;
-  mcap::Message message;
-  mcap::Channel channel;
+  LogWriter writer;
   Options options;
   if (int err = parse_options(argc, argv, &options); err != 0) {
     return err;
@@ -160,96 +312,429 @@ int main(int argc, const char **argv) {
     printf("%s\n", VERSION);
     return 0;
   }
-
+  std::unique_ptr<LogEncoder> encoder = make_encoder(options.encoding);
+  LogWriterOptions writer_options;
+  writer_options.topics = options.topics;
+  writer_options.compression_threads = options.compression_threads;
+  writer_options.rotate_size = options.rotate_size;
+  writer_options.rotate_interval = options.rotate_interval_sec * 1'000'000'000;
+  writer_options.max_chunk_latency = options.max_chunk_latency_ms * 1'000'000;
+  writer_options.io = options.io;
+  writer_options.sync_writeback = options.sync_writeback;
   if (options.end == TIME_WAIT) {
-    signal(SIGINT, on_sigint);
+    writer_options.max_index_memory = WAIT_MAX_INDEX_MEMORY;
   }
-  // open the reader
-  int err = sd_journal_open(&j, SD_JOURNAL_LOCAL_ONLY);
+  if (!options.zstd_dictionary.empty()) {
+    int err = read_dictionary_file(options.zstd_dictionary, &writer_options.zstd_dictionary);
+    if (err != 0) {
+      fprintf(stderr, "failed to read dictionary: %s\n", strerror(-err));
+      return -err;
+    }
+  }
+
+  const bool from_import = !options.import_file.empty();
+  if (from_import && !supports_import(options)) {
+    fprintf(stderr, "--import can only be used with --start and --end timestamps, not with "
+                    "journal filters, --directory, --file, --state-file or --train-dictionary\n");
+    return 1;
+  }
+  const bool from_sources = !options.directories.empty() || !options.files.empty();
+  if (from_sources && !supports_source_export(options)) {
+    fprintf(stderr, "--directory and --file cannot be used with --start now, --end wait, "
+                    "--state-file or --train-dictionary\n");
+    return 1;
+  }
+  if (options.reader == READER_MMAP && !supports_mapped_read(options)) {
+    fprintf(stderr, "--reader mmap can only be used with --directory or --file, not with "
+                    "journal filters\n");
+    return 1;
+  }
+  const bool parallel = options.jobs > 1 && options.train_dictionary.empty();
+  if (options.overload != OVERLOAD_BLOCK &&
+      (from_import || from_sources || (parallel && supports_parallel_export(options)))) {
+    fprintf(stderr, "--overload can only be used when reading the local journal on one thread, "
+                    "not with --import, --directory, --file or a time range split by --jobs\n");
+    return 1;
+  }
+  if (from_import || from_sources || (parallel && supports_parallel_export(options))) {
+    const auto res = writer.open(options.output_filename, *encoder, writer_options);
+    if (!res.ok()) {
+      fprintf(stderr, "open failed: %s\n", res.message.c_str());
+      return 1;
+    }
+    StageTimer timer(options.stats || !options.stats_file.empty());
+    int ret = 0;
+    if (from_import) {
+      ret = import_export_file(options, &writer);
+    } else if (from_sources) {
+      ret = export_sources(options, &writer);
+    } else {
+      ret = export_parallel(options, &writer);
+    }
+    timer.time(STAGE_SYNC, [&]() { writer.close(); });
+    if (writer.output_error() != 0) {
+      fprintf(stderr, "failed to write output: %s\n", strerror(-writer.output_error()));
+      ret = -writer.output_error();
+    }
+    report_stats(options, timer, writer);
+    return ret;
+  }
+  // load the cursor to resume from
+  std::string resume_cursor;
+  if (!options.state_file.empty()) {
+    int err = read_state_file(options.state_file, &resume_cursor);
+    if (err != 0) {
+      fprintf(stderr, "failed to read state file: %s\n", strerror(-err));
+      return -err;
+    }
+  }
+
+  // open the reader on the files which may hold the entries to export.
+  const JournalFileFilter start_filter = journal_file_filter(options, resume_cursor);
+  // a journal opened on a list of files does not see the files journald adds later, so in
+  // wait mode it is reopened after the last entry read when they change.
+  bool selected_files = false;
+  int err = open_local_journal(&j, start_filter, options.end == TIME_WAIT, options.verbose,
+                               &selected_files);
   if (err != 0) {
     fprintf(stderr, "failed to open journal: %s\n", strerror(-err));
     return -err;
   }
-  // filter by boot ID if neccessary
-  err = apply_boot_id_match(j, options);
+  // filter by boot ID if neccessary. A resumed export starts at its cursor instead.
+  if (resume_cursor.empty()) {
+    err = apply_boot_id_match(j, options);
+    if (err != 0) {
+      return -err;
+    }
+  }
+  // skip entries which do not match the filters inside libsystemd
+  err = apply_filter_matches(j, options);
   if (err != 0) {
+    fprintf(stderr, "failed to apply filters: %s\n", strerror(-err));
     return -err;
   }
   // seek to where recording will start
-  err = seek_to_start(j, options.start, options.start_sec);
+  if (resume_cursor.empty()) {
+    err = seek_to_start(j, options.start, options.start_sec);
+  } else {
+    err = seek_after_cursor(j, resume_cursor.c_str());
+  }
   if (err != 0) {
+    fprintf(stderr, "failed to seek to start: %s\n", strerror(-err));
     return -err;
   }
+  if (!options.train_dictionary.empty()) {
+    err = train_dictionary(j, options, encoder.get());
+    sd_journal_close(j);
+    return err;
+  }
+
+  // wake up on new entries and on SIGINT. This blocks the signals, so it must happen before
+  // the writer starts its compression threads.
+  EventLoop loop;
+  if (options.end == TIME_WAIT) {
+    err = loop.open(j);
+    if (err != 0) {
+      fprintf(stderr, "failed to watch journal: %s\n", strerror(-err));
+      return -err;
+    }
+  }
 
   // set up the writer
-  auto writerOptions = mcap::McapWriterOptions("");
-  const auto res = writer.open(options.output_filename, writerOptions);
+  const auto res = writer.open(options.output_filename, *encoder, writer_options);
   if (!res.ok()) {
     fprintf(stderr, "open failed: %s\n", res.message.c_str());
     return 1;
   }
-  // write schema
-  mcap::SchemaId schema_id;
-  {
-    mcap::Schema schema("foxglove.Log", "jsonschema", SCHEMA_TEXT);
-    writer.addSchema(schema);
-    schema_id = schema.id;
-  }
-
-  std::vector<mcap::ChannelId> transport_channel_ids(_TRANSPORT_COUNT, 0);
-  std::vector<uint32_t> sequence_counts(_TRANSPORT_COUNT, 0);
 
-  for (size_t i = 0; i < _TRANSPORT_COUNT; ++i) {
-    mcap::Channel channel(get_topic((Transport)(i)), "json", schema_id);
-    writer.addChannel(channel);
-    transport_channel_ids[i] = channel.id;
+  StageTimer timer(options.stats || !options.stats_file.empty());
+  // with --jobs or --overload, entries are encoded and written by other threads while more
+  // are read.
+  std::unique_ptr<EntryPipeline> pipeline;
+  if (parallel || options.overload != OVERLOAD_BLOCK) {
+    PipelineOptions pipeline_options;
+    pipeline_options.encoding = options.encoding;
+    pipeline_options.encoder_threads = options.jobs;
+    pipeline_options.time_stages = timer.enabled();
+    pipeline_options.overload = options.overload;
+    if (options.overload != OVERLOAD_BLOCK) {
+      pipeline_options.high_watermark =
+          options.high_watermark != 0 ? options.high_watermark : DEFAULT_HIGH_WATERMARK;
+    }
+    pipeline_options.dropped_metadata_interval_ns = DROPPED_METADATA_INTERVAL_NS;
+    if (!options.stats_file.empty()) {
+      pipeline_options.stats_interval_ns = STATS_FILE_INTERVAL_NS;
+      pipeline_options.write_stats = [&](const StageTimer &stage_times) {
+        write_stats_file(options.stats_file, stage_times, writer);
+      };
+    }
+    pipeline = std::make_unique<EntryPipeline>(&writer, pipeline_options);
+    pipeline->start(&timer);
   }
+  // the writer belongs to the pipeline's threads until they are stopped.
+  auto close_output = [&]() {
+    if (pipeline) {
+      pipeline->finish();
+    }
+    writer.close();
+  };
+  auto write_to_pipeline = [&](const JournalEntry &entry) {
+    if (pipeline->write(entry)) {
+      return true;
+    }
+    fprintf(stderr, "failed to write message: %s\n", pipeline->error().c_str());
+    return false;
+  };
+  std::unique_ptr<EntryCoalescer> coalescer;
+  if (options.coalesce_window_ms > 0) {
+    coalescer = std::make_unique<EntryCoalescer>(options.coalesce_window_ms * 1'000'000);
+  }
+  // writes the summary of a run of repeats which has just ended, if any.
+  auto write_summary = [&]() {
+    const JournalEntry *summary = coalescer ? coalescer->take_summary() : nullptr;
+    if (summary == nullptr) {
+      return true;
+    }
+    if (pipeline) {
+      return write_to_pipeline(*summary);
+    }
+    auto res = writer.write(summary->timestamp, channel_key(*summary), encoder->encode(*summary));
+    if (!res.ok()) {
+      fprintf(stderr, "failed to write message: %s\n", res.message.c_str());
+      return false;
+    }
+    return true;
+  };
+  // the pipeline's writer thread flushes the output and writes the stats file itself.
+  uint64_t stats_deadline =
+      options.stats_file.empty() || pipeline ? UINT64_MAX : monotonic_ns();
+  // flushes the output, updates the stats file and ends a run of repeats when they are due,
+  // and keeps the timer armed for whichever is due next. Returns -EIO if the summary of the
+  // run could not be written, which `write_summary()` has reported, or the timer's error.
+  uint64_t timer_deadline = UINT64_MAX;
+  auto run_timers = [&]() {
+    const uint64_t now = monotonic_ns();
+    // runs are timed by entry timestamps, which are wall clock times.
+    uint64_t coalesce_deadline = UINT64_MAX;
+    if (coalescer && coalescer->run_deadline() != UINT64_MAX) {
+      struct timespec realtime;
+      clock_gettime(CLOCK_REALTIME, &realtime);
+      const uint64_t realtime_ns = uint64_t(realtime.tv_sec) * 1'000'000'000 + realtime.tv_nsec;
+      if (realtime_ns >= coalescer->run_deadline()) {
+        coalescer->finish();
+        if (!write_summary()) {
+          return -EIO;
+        }
+      } else {
+        coalesce_deadline = now + (coalescer->run_deadline() - realtime_ns);
+      }
+    }
+    if (!pipeline && now >= writer.flush_deadline()) {
+      timer.time(STAGE_SYNC, [&]() { writer.flush(); });
+    }
+    if (now >= stats_deadline) {
+      write_stats_file(options.stats_file, timer, writer);
+      stats_deadline = now + STATS_FILE_INTERVAL_NS;
+    }
+    const uint64_t flush_deadline = pipeline ? UINT64_MAX : writer.flush_deadline();
+    const uint64_t deadline = std::min({flush_deadline, stats_deadline, coalesce_deadline});
+    if (deadline == timer_deadline) {
+      return 0;
+    }
+    timer_deadline = deadline;
+    return deadline == UINT64_MAX ? loop.clear_timer() : loop.set_timer(deadline);
+  };
+
+  // the cursor of the last entry read, saved before waiting, as the file holding it may be
+  // gone from a journal opened on a list of files once its changes have been processed.
+  std::string last_cursor = resume_cursor;
+  bool read_since_saved = false;
+  bool reopened = false;
+  // once journald rotates or removes the files a journal was opened on, reopens it on every
+  // file after the last entry read, as a journal opened on a list of files does not pick up the
+  // files journald creates. This waits for the next rotation rather than listing the files
+  // again, which may happen before journald has created the new active file.
+  auto reopen_journal = [&]() {
+    sd_journal *opened = nullptr;
+    int err = sd_journal_open(&opened, SD_JOURNAL_LOCAL_ONLY);
+    if (err != 0) {
+      return err;
+    }
+    if (resume_cursor.empty()) {
+      err = apply_boot_id_match(opened, options);
+    }
+    if (err == 0) {
+      err = apply_filter_matches(opened, options);
+    }
+    if (err == 0 && !last_cursor.empty()) {
+      err = seek_after_cursor(opened, last_cursor.c_str());
+    } else if (err == 0 && options.start == TIME_NOW) {
+      // nothing has been read since starting at the tail of the journal then.
+      err = sd_journal_seek_realtime_usec(opened, start_filter.start_usec);
+    } else if (err == 0) {
+      err = seek_to_start(opened, options.start, options.start_sec);
+    }
+    if (err == 0) {
+      err = loop.replace_journal(opened);
+    }
+    if (err != 0) {
+      sd_journal_close(opened);
+      return err;
+    }
+    sd_journal_close(j);
+    j = opened;
+    selected_files = false;
+    reopened = true;
+    return 0;
+  };
 
-  while (!global_signalled) {
-    int err = next_journal_entry(j, options.end, options.end_sec);
+  const uint64_t end_usec = end_usec_for(options.end, options.end_sec);
+  JournalEntry entry;
+  uint64_t exported = 0;
+  while (true) {
+    timer.begin();
+    int err = read_journal_entry(j, end_usec, &entry);
+    timer.lap(STAGE_READ);
     if (err < 0) {
       fprintf(stderr, "failed to read next entry: %s", strerror(-err));
-      writer.close();
+      close_output();
       return -err;
     }
     if (err == 0) {
-      if (options.end == TIME_WAIT) {
-        err = sd_journal_wait(j, 100'000);
+      if (options.end != TIME_WAIT) {
+        break;
+      }
+      LoopEvent event;
+      err = run_timers();
+      // entries read so far, and any summary just written, are written while waiting.
+      if (pipeline) {
+        pipeline->submit();
+      }
+      if (const std::string warning = writer.take_index_warning(); !warning.empty()) {
+        fprintf(stderr, "warning: %s\n", warning.c_str());
+      }
+      if (err == 0 && selected_files && read_since_saved) {
+        err = get_last_read_cursor(j, end_usec, &last_cursor);
+        read_since_saved = false;
+      }
+      if (err == 0) {
+        err = loop.wait(&event);
+      }
+      if (err < 0) {
+        fprintf(stderr, "failed to wait for more entries: %s", strerror(-err));
+        close_output();
+        return -err;
+      }
+      if (event == EVENT_SIGNAL) {
+        break;
+      }
+      if (event == EVENT_JOURNAL_FILES && selected_files) {
+        err = reopen_journal();
         if (err < 0) {
-          fprintf(stderr, "failed to wait for more entries: %s",
-                  strerror(-err));
-          writer.close();
+          fprintf(stderr, "failed to reopen journal: %s", strerror(-err));
+          close_output();
           return -err;
         }
-        continue;
-      } else {
+      }
+      continue;
+    }
+    read_since_saved = true;
+    // a repeat absorbed into a run is not encoded, but still counts as exported.
+    const bool absorbed = coalescer && !coalescer->add(entry);
+    if (!write_summary()) {
+      close_output();
+      return 1;
+    }
+    if (!absorbed && pipeline) {
+      const bool written = write_to_pipeline(entry);
+      timer.lap(STAGE_READ);
+      if (!written) {
+        close_output();
+        return 1;
+      }
+    } else if (!absorbed) {
+      std::string_view encoded = encoder->encode(entry);
+      timer.lap(STAGE_ENCODE);
+      auto res = writer.write(entry.timestamp, channel_key(entry), encoded);
+      timer.lap(STAGE_WRITE);
+      if (!res.ok()) {
+        fprintf(stderr, "failed to write message: %s\n", res.message.c_str());
+        close_output();
+        return 1;
+      }
+    }
+    exported++;
+    if (options.end == TIME_WAIT && exported % SIGNAL_CHECK_INTERVAL == 0) {
+      if (loop.signal_pending()) {
         break;
       }
+      // entries may arrive faster than they are read for a while, so check the timers
+      // without waiting too.
+      if (loop.timer_expired()) {
+        if (int err = run_timers(); err != 0) {
+          if (err != -EIO) {
+            fprintf(stderr, "failed to set timer: %s\n", strerror(-err));
+          }
+          close_output();
+          return 1;
+        }
+      }
     }
-    uint64_t ts = 0;
-    err = get_ts(j, &ts);
-    if (err != 0) {
-      fprintf(stderr, "failed to read entry timestamp: %s\n", strerror(-err));
-      writer.close();
-      return -err;
+  }
+  if (coalescer) {
+    coalescer->finish();
+    if (!write_summary()) {
+      close_output();
+      return 1;
     }
-    message.logTime = ts;
-    message.publishTime = ts;
-    Transport transport = get_transport(j);
-    message.sequence = sequence_counts[transport];
-    sequence_counts[transport]++;
-    message.channelId = transport_channel_ids[transport];
-    std::string json = serialize_json(j, ts);
-    message.data = (const std::byte *)(json.c_str());
-    message.dataSize = json.size();
-    auto res = writer.write(message);
-    if (!res.ok()) {
-      fprintf(stderr, "failed to write message: %s\n", res.message.c_str());
+    if (options.verbose) {
+      fprintf(stderr, "coalesced %llu repeated entries into %llu\n",
+              (unsigned long long)(coalescer->absorbed_count()),
+              (unsigned long long)(coalescer->summary_count()));
+    }
+  }
+  if (pipeline) {
+    const bool written = pipeline->finish();
+    pipeline->add_stage_times(&timer);
+    if (!written) {
+      fprintf(stderr, "failed to write message: %s\n", pipeline->error().c_str());
       writer.close();
+      sd_journal_close(j);
       return 1;
     }
+    if (pipeline->dropped_count() > 0) {
+      fprintf(stderr, "dropped %llu entries while the output fell behind\n",
+              (unsigned long long)(pipeline->dropped_count()));
+    }
+  }
+  timer.time(STAGE_SYNC, [&]() { writer.close(); });
+  if (const std::string warning = writer.take_index_warning(); !warning.empty()) {
+    fprintf(stderr, "warning: %s\n", warning.c_str());
+  }
+  if (writer.output_error() != 0) {
+    fprintf(stderr, "failed to write output: %s\n", strerror(-writer.output_error()));
+    sd_journal_close(j);
+    return -writer.output_error();
+  }
+
+  // only record progress once the output file is complete.
+  if (!options.state_file.empty() && exported > 0) {
+    std::string cursor = last_cursor;
+    err = 0;
+    // otherwise the last entry was read before the journal was reopened.
+    if (read_since_saved || !reopened) {
+      err = get_last_read_cursor(j, end_usec, &cursor);
+    }
+    if (err == 0) {
+      timer.time(STAGE_SYNC, [&]() { err = write_state_file(options.state_file, cursor); });
+    }
+    if (err != 0) {
+      fprintf(stderr, "failed to save state file: %s\n", strerror(-err));
+      sd_journal_close(j);
+      return -err;
+    }
   }
-  writer.close();
+  report_stats(options, timer, writer);
   sd_journal_close(j);
 
   return 0;
@@ -0,0 +1,234 @@
+#include <cstring>
+#include <thread>
+
+#include "batch_merge.hpp"
+#include "coalesce.hpp"
+#include "entry_batch.hpp"
+#include "journal_file.hpp"
+#include "merge.hpp"
+
+namespace {
+
+// Entries per batch handed from a source's thread to the merge.
+constexpr size_t BATCH_ENTRIES = 1024;
+// How many batches each source may read ahead of the merge.
+constexpr size_t MAX_QUEUED_BATCHES = 4;
+// The namespace of entries without a _MACHINE_ID, which journald always adds.
+constexpr std::string_view UNKNOWN_MACHINE = "unknown";
+
+std::string describe_source(const JournalSource &source) {
+  if (!source.directory.empty()) {
+    return source.directory;
+  }
+  std::string files = source.files.front();
+  if (source.files.size() > 1) {
+    files += " and " + std::to_string(source.files.size() - 1) + " more";
+  }
+  return files;
+}
+
+// opens the source with the filters in `options` applied, positioned at the start.
+int open_filtered(const Options &options, const JournalSource &source, sd_journal **j) {
+  int err = open_journal_source(source, j);
+  if (err != 0) {
+    return err;
+  }
+  if (options.start != TIME_BOOT || options.end == TIME_UNIX) {
+    err = apply_boot_id_match(*j, options);
+  }
+  if (err == 0) {
+    err = apply_filter_matches(*j, options);
+  }
+  if (err == 0) {
+    err = seek_to_start(*j, options.start, options.start_sec);
+  }
+  if (err != 0) {
+    sd_journal_close(*j);
+    *j = nullptr;
+  }
+  return err;
+}
+
+// opens the source's files for --reader mmap, selecting the same boot and start as
+// `open_filtered()`.
+int open_mapped(const Options &options, const JournalSource &source, MappedJournal *journal) {
+  int err = journal->open(source);
+  if (err != 0) {
+    return err;
+  }
+  sd_id128_t boot_id;
+  if (options.start == TIME_BOOT && options.end == TIME_UNIX) {
+    err = journal->find_boot_before(options.end_sec * 1'000'000, &boot_id);
+  } else if (options.start == TIME_UNIX && options.end == TIME_SHUTDOWN) {
+    err = journal->seek_realtime_usec(options.start_sec * 1'000'000);
+    if (err == 0) {
+      err = journal->next();
+      boot_id = journal->location().boot_id;
+    }
+  }
+  if (err < 0) {
+    return err;
+  }
+  if (err > 0) {
+    journal->match_boot_id(boot_id);
+  }
+  if (options.start == TIME_UNIX) {
+    return journal->seek_realtime_usec(options.start_sec * 1'000'000);
+  }
+  journal->seek_head();
+  return 0;
+}
+
+// reads the entries `read_entry(end_usec, &entry)` returns into batches for the merge.
+template <typename ReadEntry>
+int read_entries(const Options &options, size_t index, BatchMerger *merger,
+                 ReadEntry read_entry) {
+  std::unique_ptr<LogEncoder> encoder = make_encoder(options.encoding);
+  std::unique_ptr<EntryCoalescer> coalescer;
+  if (options.coalesce_window_ms > 0) {
+    coalescer = std::make_unique<EntryCoalescer>(options.coalesce_window_ms * 1'000'000);
+  }
+  const uint64_t end_usec = end_usec_for(options.end, options.end_sec);
+  EntryBatch batch;
+  auto append = [&](const JournalEntry &entry) {
+    ChannelKey key;
+    key.transport = entry.transport;
+    if (options.topics == TOPICS_UNIT) {
+      key = channel_key(entry);
+    }
+    const JournalEntry::Field *machine = entry.find(FIELD_MACHINE_ID);
+    key.machine = machine != nullptr ? entry.value(*machine) : UNKNOWN_MACHINE;
+    batch.append(entry.timestamp, key, encoder->encode(entry));
+  };
+  JournalEntry entry;
+  int err = 0;
+  while (true) {
+    err = read_entry(end_usec, &entry);
+    if (err < 0) {
+      break;
+    }
+    const bool absorbed = err > 0 && coalescer != nullptr && !coalescer->add(entry);
+    if (err == 0 && coalescer != nullptr) {
+      coalescer->finish();
+    }
+    if (coalescer != nullptr) {
+      if (const JournalEntry *summary = coalescer->take_summary(); summary != nullptr) {
+        append(*summary);
+      }
+    }
+    if (err > 0 && !absorbed) {
+      append(entry);
+    }
+    if ((err == 0 && !batch.empty()) || batch.size() >= BATCH_ENTRIES) {
+      if (!merger->push(index, &batch)) {
+        err = 0;
+        break;
+      }
+    }
+    if (err == 0) {
+      break;
+    }
+  }
+  return err;
+}
+
+int read_source(const Options &options, const JournalSource &source, size_t index,
+                BatchMerger *merger) {
+  if (options.reader == READER_MMAP) {
+    MappedJournal journal;
+    int err = open_mapped(options, source, &journal);
+    if (err != -EPROTONOSUPPORT) {
+      if (err != 0) {
+        return err;
+      }
+      return read_entries(options, index, merger, [&](uint64_t end_usec, JournalEntry *entry) {
+        return journal.read_entry(end_usec, entry);
+      });
+    }
+    // files in a newer format than the mapped reader knows are left to libsystemd.
+    if (options.verbose) {
+      fprintf(stderr, "reading %s with libsystemd: unsupported journal file format\n",
+              describe_source(source).c_str());
+    }
+  }
+  sd_journal *j = nullptr;
+  int err = open_filtered(options, source, &j);
+  if (err != 0) {
+    return err;
+  }
+  err = read_entries(options, index, merger, [&](uint64_t end_usec, JournalEntry *entry) {
+    return read_journal_entry(j, end_usec, entry);
+  });
+  sd_journal_close(j);
+  return err;
+}
+
+void run_reader(const Options &options, const JournalSource &source, size_t index,
+                BatchMerger *merger) {
+  merger->finish(index, read_source(options, source, index, merger));
+}
+
+} // namespace
+
+bool supports_source_export(const Options &options) {
+  return options.start != TIME_NOW && options.end != TIME_WAIT && options.state_file.empty() &&
+         options.train_dictionary.empty();
+}
+
+bool supports_mapped_read(const Options &options) {
+  return (!options.directories.empty() || !options.files.empty()) && options.units.empty() &&
+         options.max_priority < 0 && options.transports.empty() && options.matches.empty();
+}
+
+int open_journal_source(const JournalSource &source, sd_journal **j) {
+  if (!source.directory.empty()) {
+    return sd_journal_open_directory(j, source.directory.c_str(), 0);
+  }
+  std::vector<const char *> paths;
+  for (const auto &file : source.files) {
+    paths.push_back(file.c_str());
+  }
+  paths.push_back(nullptr);
+  return sd_journal_open_files(j, paths.data(), 0);
+}
+
+int export_sources(const Options &options, LogWriter *writer) {
+  std::vector<JournalSource> sources;
+  int err = find_journal_sources(options, &sources);
+  if (err != 0) {
+    fprintf(stderr, "failed to find journal files: %s\n", strerror(-err));
+    return -err;
+  }
+  BatchMerger merger(sources.size(), MAX_QUEUED_BATCHES);
+  std::vector<std::thread> readers;
+  for (size_t i = 0; i < sources.size(); ++i) {
+    readers.emplace_back(run_reader, std::cref(options), std::cref(sources[i]), i, &merger);
+  }
+  size_t failed_source = 0;
+  int ret = merger.merge(
+      [&](uint64_t timestamp, const ChannelKey &key, std::string_view encoded) {
+        auto res = writer->write(timestamp, key, encoded);
+        if (!res.ok()) {
+          fprintf(stderr, "failed to write message: %s\n", res.message.c_str());
+          return false;
+        }
+        return true;
+      },
+      &failed_source);
+  if (ret < 0) {
+    fprintf(stderr, "failed to read %s: %s\n", describe_source(sources[failed_source]).c_str(),
+            strerror(-ret));
+    ret = -ret;
+  }
+  for (auto &reader : readers) {
+    reader.join();
+  }
+  if (options.verbose) {
+    for (size_t i = 0; i < sources.size(); ++i) {
+      fprintf(stderr, "exported %llu entries from %s\n",
+              (unsigned long long)(merger.entry_count(i)),
+              describe_source(sources[i]).c_str());
+    }
+  }
+  return ret;
+}
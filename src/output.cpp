@@ -0,0 +1,479 @@
+#include <algorithm>
+#include <cerrno>
+#include <cinttypes>
+#include <sstream>
+#include <utility>
+
+#define MCAP_IMPLEMENTATION
+#include "dictionary.hpp"
+#include "event_loop.hpp"
+#include "output.hpp"
+#include "utf8.hpp"
+
+namespace {
+
+// with --rotate-size, each file holds at least this many chunks, so it overshoots the size by
+// no more than about 1 / ROTATE_SIZE_CHUNKS.
+constexpr uint64_t ROTATE_SIZE_CHUNKS = 8;
+// smaller chunks compress poorly.
+constexpr uint64_t MIN_ROTATE_CHUNK_SIZE = 64 * 1024;
+constexpr std::string_view UNIT_TOPIC_PREFIX = "/journald/unit/";
+constexpr std::string_view COMM_TOPIC_PREFIX = "/journald/comm/";
+constexpr std::string_view TOPIC_PREFIX = "/journald/";
+// MCAP channel ids are 16 bits, so once a file has this many channels, entries for channels
+// not yet in it go to their transport's channel instead.
+constexpr size_t MAX_FILE_CHANNELS = UINT16_MAX;
+
+int significant_bits(uint64_t value) {
+  int bits = 0;
+  while (value != 0) {
+    value >>= 1;
+    bits++;
+  }
+  return bits;
+}
+
+} // namespace
+
+void ChunkSizeStats::add(uint64_t uncompressed_size, uint64_t compressed_size) {
+  chunk_count++;
+  uncompressed_bytes += uncompressed_size;
+  compressed_bytes += compressed_size;
+  size_histogram[significant_bits(uncompressed_size)]++;
+}
+
+uint64_t ChunkSizeStats::percentile(double fraction) const {
+  uint64_t seen = 0;
+  for (size_t bits = 0; bits < size_histogram.size(); ++bits) {
+    seen += size_histogram[bits];
+    if (seen > 0 && double(seen) >= fraction * double(chunk_count)) {
+      return bits == 64 ? UINT64_MAX : uint64_t(1) << bits;
+    }
+  }
+  return 0;
+}
+
+std::string describe_chunk_stats(const ChunkSizeStats &stats) {
+  char buf[256];
+  snprintf(buf, sizeof(buf),
+           "%" PRIu64 " chunks, %" PRIu64 " flushed early; uncompressed size p50 < %" PRIu64
+           " p90 < %" PRIu64 " p99 < %" PRIu64 " bytes; compression ratio %.2f",
+           stats.chunk_count, stats.forced_flushes, stats.percentile(0.5), stats.percentile(0.9),
+           stats.percentile(0.99),
+           stats.compressed_bytes == 0
+               ? 1.0
+               : double(stats.uncompressed_bytes) / double(stats.compressed_bytes));
+  return buf;
+}
+
+std::string get_topic(Transport transport) {
+  std::stringstream ss;
+  ss << "/journald/";
+  ss << name_for_transport(transport);
+  return ss.str();
+}
+
+ChannelKey channel_key(const JournalEntry &entry) {
+  ChannelKey key;
+  key.transport = entry.transport;
+  if (const JournalEntry::Field *unit = entry.find(FIELD_SYSTEMD_UNIT)) {
+    key.unit = entry.value(*unit);
+  }
+  if (const JournalEntry::Field *comm = entry.find(FIELD_COMM)) {
+    key.comm = entry.value(*comm);
+  }
+  return key;
+}
+
+std::string expand_output_filename(const std::string &filename_template, uint32_t index) {
+  std::string filename = filename_template;
+  const std::string index_str = std::to_string(index);
+  size_t pos = filename.find("{n}");
+  if (pos != std::string::npos) {
+    filename.replace(pos, 3, index_str);
+    return filename;
+  }
+  size_t slash = filename.rfind('/');
+  size_t dot = filename.rfind('.');
+  if (dot == std::string::npos || (slash != std::string::npos && dot < slash) ||
+      dot == (slash == std::string::npos ? 0 : slash + 1)) {
+    return filename + "." + index_str;
+  }
+  return filename.insert(dot, "." + index_str);
+}
+
+LogWriter::~LogWriter() { close(); }
+
+bool LogWriter::rotation_enabled() const {
+  return options_.rotate_size != 0 || options_.rotate_interval != 0;
+}
+
+bool LogWriter::should_rotate(uint64_t timestamp) const {
+  if (!file_has_entries_) {
+    return false;
+  }
+  if (options_.rotate_size != 0 && writer_->dataSink()->size() >= options_.rotate_size) {
+    return true;
+  }
+  return options_.rotate_interval != 0 && timestamp >= file_start_timestamp_ &&
+         timestamp - file_start_timestamp_ >= options_.rotate_interval;
+}
+
+mcap::Status LogWriter::open(const std::string &filename, const LogEncoder &encoder,
+                             const LogWriterOptions &options) {
+  encoder_ = &encoder;
+  options_ = options;
+  filename_template_ = filename;
+  file_index_ = 0;
+  output_error_ = 0;
+  previous_filename_.clear();
+  channel_topics_.clear();
+  sequence_counts_.clear();
+  byte_counts_.clear();
+  file_channel_ids_.clear();
+  unit_channels_.clear();
+  comm_channels_.clear();
+  machine_channels_.clear();
+  channel_names_.clear();
+  for (size_t i = 0; i < _TRANSPORT_COUNT; ++i) {
+    add_channel(get_topic((Transport)(i)));
+  }
+  return open_file(rotation_enabled() ? expand_output_filename(filename, 0) : filename);
+}
+
+mcap::Status LogWriter::open_file(const std::string &filename) {
+  auto writer = std::make_unique<mcap::McapWriter>();
+  auto writer_options = mcap::McapWriterOptions("");
+  writer_options.compression = options_.compression;
+  writer_options.compressionThreads = options_.compression_threads;
+  if (options_.compression == mcap::Compression::Zstd) {
+    writer_options.zstdDictionary = options_.zstd_dictionary;
+  }
+  if (options_.chunk_size != 0) {
+    writer_options.chunkSize = options_.chunk_size;
+  }
+  if (options_.max_index_memory != 0) {
+    writer_options.chunkIndexMemoryLimit = options_.max_index_memory;
+    const size_t slash = filename.rfind('/');
+    writer_options.chunkIndexSpillDirectory =
+        slash == std::string::npos ? "." : slash == 0 ? "/" : filename.substr(0, slash);
+    writer_options.chunkIndexSpillFailedCallback = [this](const mcap::Status &status) {
+      std::lock_guard<std::mutex> lock(index_warning_mutex_);
+      if (index_warning_.empty()) {
+        index_warning_ = status.message;
+      }
+    };
+  }
+  writer_options.chunkWrittenCallback = [this](const mcap::ChunkIndex &chunk_index) {
+    std::lock_guard<std::mutex> lock(chunk_stats_mutex_);
+    chunk_stats_.add(chunk_index.uncompressedSize, chunk_index.compressedSize);
+  };
+  if (options_.rotate_size != 0) {
+    // the file only grows as chunks are written, so keep chunks small relative to the file
+    // size to rotate close to it.
+    writer_options.chunkSize = std::clamp<uint64_t>(options_.rotate_size / ROTATE_SIZE_CHUNKS,
+                                                    MIN_ROTATE_CHUNK_SIZE, writer_options.chunkSize);
+  }
+  std::unique_ptr<AsyncFileWriter> output;
+  mcap::Status res;
+  if (options_.io == IO_STDIO) {
+    res = writer->open(filename, writer_options);
+  } else {
+    AsyncWriterOptions output_options;
+    output_options.io = options_.io;
+    output_options.sync_writeback = options_.sync_writeback;
+    output = std::make_unique<AsyncFileWriter>(output_options);
+    res = output->open(filename);
+    if (res.ok()) {
+      writer->open(*output, writer_options);
+    }
+  }
+  if (!res.ok()) {
+    return res;
+  }
+  if (!writer_options.zstdDictionary.empty()) {
+    // written ahead of the first chunk, so that readers streaming the file have it in time.
+    // Without it no chunk of the file can be decompressed, so the open fails instead.
+    mcap::Attachment attachment;
+    attachment.logTime = 0;
+    attachment.createTime = 0;
+    attachment.name = DICTIONARY_ATTACHMENT_NAME;
+    attachment.mediaType = DICTIONARY_MEDIA_TYPE;
+    attachment.data = (const std::byte *)(options_.zstd_dictionary.data());
+    attachment.dataSize = options_.zstd_dictionary.size();
+    res = writer->write(attachment);
+    if (!res.ok()) {
+      writer->terminate();
+      return res;
+    }
+  }
+  writer_ = std::move(writer);
+  output_ = std::move(output);
+  filename_ = filename;
+  file_has_entries_ = false;
+  unflushed_since_ = 0;
+  file_first_sequences_ = sequence_counts_;
+  // write schema
+  mcap::Schema schema("foxglove.Log", encoder_->schema_encoding(), encoder_->schema_data());
+  writer_->addSchema(schema);
+  schema_id_ = schema.id;
+
+  // every file lists the transport channels; the others are added as they are used.
+  file_channel_ids_.assign(channel_topics_.size(), 0);
+  file_channel_count_ = 0;
+  for (uint32_t i = 0; i < _TRANSPORT_COUNT; ++i) {
+    add_file_channel(i);
+  }
+  return res;
+}
+
+uint32_t LogWriter::add_channel(std::string topic) {
+  channel_topics_.push_back(std::move(topic));
+  sequence_counts_.push_back(0);
+  byte_counts_.push_back(0);
+  file_channel_ids_.push_back(0);
+  return channel_topics_.size() - 1;
+}
+
+uint32_t LogWriter::named_channel(std::unordered_map<std::string_view, uint32_t> *channels,
+                                  std::string_view topic_prefix, std::string_view name) {
+  auto it = channels->find(name);
+  if (it != channels->end()) {
+    return it->second;
+  }
+  std::string topic(topic_prefix);
+  append_utf8(&topic, name);
+  const uint32_t channel = add_channel(std::move(topic));
+  channel_names_.emplace_back(name);
+  channels->emplace(channel_names_.back(), channel);
+  return channel;
+}
+
+uint32_t LogWriter::channel_for(const ChannelKey &key) {
+  if (!key.machine.empty()) {
+    return machine_channel(key);
+  }
+  if (options_.topics == TOPICS_UNIT) {
+    if (!key.unit.empty()) {
+      return named_channel(&unit_channels_, UNIT_TOPIC_PREFIX, key.unit);
+    }
+    if (!key.comm.empty()) {
+      return named_channel(&comm_channels_, COMM_TOPIC_PREFIX, key.comm);
+    }
+  }
+  return key.transport;
+}
+
+uint32_t LogWriter::machine_channel(const ChannelKey &key) {
+  // reusing the buffer keeps finding an existing channel free of allocations.
+  std::string &name = machine_channel_name_;
+  name.assign(key.machine);
+  if (options_.topics == TOPICS_UNIT && !key.unit.empty()) {
+    name.append("/unit/");
+    name.append(key.unit);
+  } else if (options_.topics == TOPICS_UNIT && !key.comm.empty()) {
+    name.append("/comm/");
+    name.append(key.comm);
+  } else {
+    name.push_back('/');
+    name.append(name_for_transport(key.transport));
+  }
+  return named_channel(&machine_channels_, TOPIC_PREFIX, name);
+}
+
+mcap::ChannelId LogWriter::add_file_channel(uint32_t channel) {
+  mcap::Channel mcap_channel(channel_topics_[channel], encoder_->message_encoding(),
+                             schema_id_);
+  writer_->addChannel(mcap_channel);
+  file_channel_ids_[channel] = mcap_channel.id;
+  file_channel_count_++;
+  return mcap_channel.id;
+}
+
+mcap::Metadata LogWriter::sequence_metadata(const std::string &next_filename) const {
+  mcap::Metadata metadata;
+  metadata.name = SEQUENCE_METADATA_NAME;
+  metadata.metadata["file_index"] = std::to_string(file_index_);
+  metadata.metadata["previous_file"] = previous_filename_;
+  metadata.metadata["next_file"] = next_filename;
+  for (size_t i = 0; i < channel_topics_.size(); ++i) {
+    const uint32_t first = i < file_first_sequences_.size() ? file_first_sequences_[i] : 0;
+    if (sequence_counts_[i] == first) {
+      continue;
+    }
+    // the inclusive range of sequence numbers written to this file.
+    metadata.metadata[channel_topics_[i]] =
+        std::to_string(first) + "-" + std::to_string(sequence_counts_[i] - 1);
+  }
+  return metadata;
+}
+
+mcap::Status LogWriter::rotate() {
+  const std::string next_filename = expand_output_filename(filename_template_, file_index_ + 1);
+  // taken before opening the next file resets the sequence numbers it starts from, and only
+  // written once it is open, so that the finished file never names a file which does not exist.
+  mcap::Metadata finished_sequences = sequence_metadata(next_filename);
+  const std::string finished_filename = filename_;
+  std::unique_ptr<mcap::McapWriter> previous = std::move(writer_);
+  std::unique_ptr<AsyncFileWriter> previous_output = std::move(output_);
+  auto res = open_file(next_filename);
+  if (!res.ok()) {
+    writer_ = std::move(previous);
+    output_ = std::move(previous_output);
+    return res;
+  }
+  previous_filename_ = finished_filename;
+  file_index_++;
+  // only one summary is written at a time, which also bounds memory use.
+  if (closer_.joinable()) {
+    closer_.join();
+  }
+  // writing the metadata closes the last chunk, so it is written by the closer too.
+  closer_ = std::thread([this, writer = std::move(previous), output = std::move(previous_output),
+                         metadata = std::move(finished_sequences)]() {
+    close_file(writer.get(), output.get(), &metadata);
+  });
+  return res;
+}
+
+void LogWriter::close_file(mcap::McapWriter *writer, AsyncFileWriter *output,
+                           const mcap::Metadata *metadata) {
+  int error = 0;
+  if (metadata != nullptr && !writer->write(*metadata).ok()) {
+    error = -EIO;
+  }
+  // the compression time is cleared by close(), so count it once the last chunk is written.
+  writer->closeLastChunk();
+  {
+    std::lock_guard<std::mutex> lock(chunk_stats_mutex_);
+    chunk_stats_.compression_ns += writer->compressionTime();
+  }
+  writer->close();
+  if (output != nullptr && output->error() != 0) {
+    error = output->error();
+  }
+  if (error != 0) {
+    int expected = 0;
+    output_error_.compare_exchange_strong(expected, error);
+  }
+}
+
+mcap::Status LogWriter::write(uint64_t timestamp, Transport transport,
+                              std::string_view data) {
+  ChannelKey key;
+  key.transport = transport;
+  return write(timestamp, key, data);
+}
+
+mcap::Status LogWriter::write(uint64_t timestamp, const ChannelKey &key,
+                              std::string_view data) {
+  if (rotation_enabled() && should_rotate(timestamp)) {
+    auto res = rotate();
+    if (!res.ok()) {
+      return res;
+    }
+  }
+  if (!file_has_entries_) {
+    file_has_entries_ = true;
+    file_start_timestamp_ = timestamp;
+  }
+  uint32_t channel = channel_for(key);
+  mcap::ChannelId channel_id = file_channel_ids_[channel];
+  if (channel_id == 0) {
+    if (file_channel_count_ < MAX_FILE_CHANNELS) {
+      channel_id = add_file_channel(channel);
+    } else {
+      channel = key.transport;
+      channel_id = file_channel_ids_[channel];
+    }
+  }
+  mcap::Message message;
+  message.logTime = timestamp;
+  message.publishTime = timestamp;
+  message.sequence = sequence_counts_[channel];
+  sequence_counts_[channel]++;
+  byte_counts_[channel] += data.size();
+  message.channelId = channel_id;
+  message.data = (const std::byte *)(data.data());
+  message.dataSize = data.size();
+  if (options_.max_chunk_latency != 0 && unflushed_since_ == 0) {
+    unflushed_since_ = monotonic_ns();
+  }
+  return writer_->write(message);
+}
+
+uint64_t LogWriter::flush_deadline() const {
+  return unflushed_since_ == 0 ? UINT64_MAX : unflushed_since_ + options_.max_chunk_latency;
+}
+
+mcap::Status LogWriter::write_metadata(const mcap::Metadata &metadata) {
+  if (!writer_) {
+    return mcap::Status(mcap::StatusCode::NotOpen);
+  }
+  return writer_->write(metadata);
+}
+
+void LogWriter::flush() {
+  if (!writer_) {
+    return;
+  }
+  if (unflushed_since_ != 0) {
+    std::lock_guard<std::mutex> lock(chunk_stats_mutex_);
+    chunk_stats_.forced_flushes++;
+    unflushed_since_ = 0;
+  }
+  writer_->closeLastChunk();
+  writer_->dataSink()->flush();
+}
+
+void LogWriter::close() {
+  if (closer_.joinable()) {
+    closer_.join();
+  }
+  if (writer_) {
+    if (rotation_enabled()) {
+      const mcap::Metadata sequences = sequence_metadata("");
+      close_file(writer_.get(), output_.get(), &sequences);
+    } else {
+      close_file(writer_.get(), output_.get(), nullptr);
+    }
+    writer_.reset();
+    output_.reset();
+  }
+}
+
+uint32_t LogWriter::file_count() const { return file_index_ + 1; }
+
+int LogWriter::output_error() const { return output_error_; }
+
+std::string LogWriter::take_index_warning() {
+  std::lock_guard<std::mutex> lock(index_warning_mutex_);
+  return std::exchange(index_warning_, std::string());
+}
+
+ChunkSizeStats LogWriter::chunk_stats() const {
+  ChunkSizeStats stats;
+  {
+    std::lock_guard<std::mutex> lock(chunk_stats_mutex_);
+    stats = chunk_stats_;
+  }
+  // and the time spent compressing the chunks of the open file so far.
+  if (writer_) {
+    stats.compression_ns += writer_->compressionTime();
+  }
+  return stats;
+}
+
+size_t LogWriter::channel_count() const { return channel_topics_.size(); }
+
+const std::string &LogWriter::channel_topic(size_t channel) const {
+  return channel_topics_[channel];
+}
+
+uint64_t LogWriter::entry_count(size_t channel) const {
+  return channel < sequence_counts_.size() ? sequence_counts_[channel] : 0;
+}
+
+uint64_t LogWriter::byte_count(size_t channel) const {
+  return channel < byte_counts_.size() ? byte_counts_[channel] : 0;
+}
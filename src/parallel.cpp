@@ -0,0 +1,206 @@
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <thread>
+
+#include "coalesce.hpp"
+#include "entry_batch.hpp"
+#include "journal.hpp"
+#include "local_journal.hpp"
+#include "parallel.hpp"
+
+namespace {
+
+// Slices per worker. More slices balance uneven log rates better, at the cost of a seek each.
+constexpr size_t SLICES_PER_JOB = 16;
+// How many slices each worker may run ahead of the writer.
+constexpr size_t WINDOW_PER_JOB = 2;
+
+struct SliceResult {
+  EntryBatch entries;
+  int err = 0;
+  bool done = false;
+};
+
+struct SharedState {
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::vector<SliceResult> results;
+  // the next slice to be claimed by a worker.
+  size_t next_slice = 0;
+  // the number of slices the writer has taken.
+  size_t written_slices = 0;
+  bool cancelled = false;
+};
+
+void append_entry(const JournalEntry &entry, TopicScheme topics, LogEncoder *encoder,
+                  SliceResult *result) {
+  // the unit and command are only kept when they pick the channel.
+  ChannelKey key;
+  key.transport = entry.transport;
+  if (topics == TOPICS_UNIT) {
+    key = channel_key(entry);
+  }
+  result->entries.append(entry.timestamp, key, encoder->encode(entry));
+}
+
+// repeats are coalesced within each slice, so a run spanning slices is written as one
+// summary per slice.
+int read_slice(sd_journal *j, const TimeSlice &slice, TopicScheme topics,
+               uint64_t coalesce_window_ns, LogEncoder *encoder, JournalEntry *entry,
+               SliceResult *result) {
+  int err = sd_journal_seek_realtime_usec(j, slice.start_usec);
+  if (err != 0) {
+    return err;
+  }
+  std::unique_ptr<EntryCoalescer> coalescer;
+  if (coalesce_window_ns > 0) {
+    coalescer = std::make_unique<EntryCoalescer>(coalesce_window_ns);
+  }
+  while (true) {
+    err = read_journal_entry(j, slice.end_usec, entry);
+    if (err < 0) {
+      return err;
+    }
+    const bool absorbed = err > 0 && coalescer != nullptr && !coalescer->add(*entry);
+    if (err == 0 && coalescer != nullptr) {
+      coalescer->finish();
+    }
+    if (coalescer != nullptr) {
+      if (const JournalEntry *summary = coalescer->take_summary(); summary != nullptr) {
+        append_entry(*summary, topics, encoder, result);
+      }
+    }
+    if (err == 0) {
+      return 0;
+    }
+    if (!absorbed) {
+      append_entry(*entry, topics, encoder, result);
+    }
+  }
+}
+
+void run_worker(const Options &options, const JournalFileFilter &filter,
+                const std::vector<TimeSlice> &slices, size_t window, SharedState *state) {
+  sd_journal *j = nullptr;
+  bool selected_files = false;
+  int err = open_local_journal(&j, filter, false, false, &selected_files);
+  if (err == 0) {
+    err = apply_boot_id_match(j, options);
+  }
+  if (err == 0) {
+    err = apply_filter_matches(j, options);
+  }
+  std::unique_ptr<LogEncoder> encoder = make_encoder(options.encoding);
+  JournalEntry entry;
+  while (true) {
+    size_t index = 0;
+    {
+      std::unique_lock<std::mutex> lock(state->mutex);
+      state->cv.wait(lock, [&] {
+        return state->cancelled || state->next_slice >= slices.size() ||
+               state->next_slice < state->written_slices + window;
+      });
+      if (state->cancelled || state->next_slice >= slices.size()) {
+        break;
+      }
+      index = state->next_slice++;
+    }
+    SliceResult result;
+    if (err == 0) {
+      err = read_slice(j, slices[index], options.topics, options.coalesce_window_ms * 1'000'000,
+                       encoder.get(), &entry, &result);
+    }
+    result.err = err;
+    result.done = true;
+    {
+      std::lock_guard<std::mutex> lock(state->mutex);
+      state->results[index] = std::move(result);
+    }
+    state->cv.notify_all();
+  }
+  if (j != nullptr) {
+    sd_journal_close(j);
+  }
+}
+
+} // namespace
+
+bool supports_parallel_export(const Options &options) {
+  return options.start != TIME_NOW && options.end != TIME_WAIT && options.state_file.empty();
+}
+
+int export_parallel(const Options &options, LogWriter *writer) {
+  // find the range to export with a journal handle of our own, opened on the same files as
+  // the workers' handles.
+  const JournalFileFilter filter = journal_file_filter(options, "");
+  sd_journal *j = nullptr;
+  bool selected_files = false;
+  int err = open_local_journal(&j, filter, false, options.verbose, &selected_files);
+  if (err != 0) {
+    fprintf(stderr, "failed to open journal: %s\n", strerror(-err));
+    return -err;
+  }
+  err = apply_boot_id_match(j, options);
+  if (err == 0) {
+    err = apply_filter_matches(j, options);
+  }
+  if (err != 0) {
+    sd_journal_close(j);
+    return -err;
+  }
+  uint64_t start_usec = 0;
+  uint64_t end_usec = 0;
+  err = get_export_range(j, options, &start_usec, &end_usec);
+  sd_journal_close(j);
+  if (err != 0) {
+    fprintf(stderr, "failed to find range to export: %s\n", strerror(-err));
+    return -err;
+  }
+
+  std::vector<TimeSlice> slices =
+      split_time_range(start_usec, end_usec, options.jobs * SLICES_PER_JOB);
+  SharedState state;
+  state.results.resize(slices.size());
+  std::vector<std::thread> workers;
+  for (uint32_t i = 0; i < options.jobs; ++i) {
+    workers.emplace_back(run_worker, std::cref(options), std::cref(filter), std::cref(slices),
+                         options.jobs * WINDOW_PER_JOB, &state);
+  }
+
+  int ret = 0;
+  for (size_t i = 0; i < slices.size() && ret == 0; ++i) {
+    SliceResult result;
+    {
+      std::unique_lock<std::mutex> lock(state.mutex);
+      state.cv.wait(lock, [&] { return state.results[i].done; });
+      result = std::move(state.results[i]);
+      state.written_slices = i + 1;
+    }
+    state.cv.notify_all();
+    if (result.err < 0) {
+      fprintf(stderr, "failed to read entries: %s\n", strerror(-result.err));
+      ret = -result.err;
+      break;
+    }
+    const EntryBatch &entries = result.entries;
+    for (size_t index = 0; index < entries.size(); ++index) {
+      auto res = writer->write(entries.timestamp(index), entries.key(index),
+                               entries.encoded(index));
+      if (!res.ok()) {
+        fprintf(stderr, "failed to write message: %s\n", res.message.c_str());
+        ret = 1;
+        break;
+      }
+    }
+  }
+  {
+    std::lock_guard<std::mutex> lock(state.mutex);
+    state.cancelled = true;
+  }
+  state.cv.notify_all();
+  for (auto &worker : workers) {
+    worker.join();
+  }
+  return ret;
+}
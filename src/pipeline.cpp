@@ -0,0 +1,213 @@
+#include <algorithm>
+
+#include "pipeline.hpp"
+
+EntryPipeline::EntryPipeline(LogWriter *writer, const PipelineOptions &options)
+    : writer_(writer), options_(options) {
+  options_.encoder_threads = std::max<uint32_t>(options_.encoder_threads, 1);
+  options_.batch_size = std::max<size_t>(options_.batch_size, 1);
+  options_.batches_per_encoder = std::max<size_t>(options_.batches_per_encoder, 1);
+  // each encoder's raw and encoded batches.
+  const uint64_t lane_entries = 2 * options_.batch_size;
+  const uint64_t wanted = options_.high_watermark + options_.high_watermark / 3;
+  options_.batches_per_encoder =
+      std::max<size_t>(options_.batches_per_encoder,
+                       (wanted + lane_entries * options_.encoder_threads - 1) /
+                           (lane_entries * options_.encoder_threads));
+  const uint64_t capacity =
+      lane_entries * options_.encoder_threads * options_.batches_per_encoder;
+  const uint64_t high_watermark =
+      options_.high_watermark != 0 ? options_.high_watermark : capacity * 3 / 4;
+  shedder_ = std::make_unique<LoadShedder>(options_.overload, high_watermark, capacity);
+  for (uint32_t i = 0; i < options_.encoder_threads; ++i) {
+    auto lane = std::make_unique<Lane>(options_.batches_per_encoder);
+    for (size_t j = 0; j < options_.batches_per_encoder; ++j) {
+      lane->free_raw.push(std::make_unique<RawBatch>());
+      lane->free_encoded.push(std::make_unique<EntryBatch>());
+    }
+    lanes_.push_back(std::move(lane));
+  }
+  timers_.resize(lanes_.size() + 2, StageTimer(options_.time_stages));
+}
+
+EntryPipeline::~EntryPipeline() { finish(); }
+
+void EntryPipeline::start(const StageTimer *reader_timer) {
+  reader_timer_ = reader_timer;
+  running_ = true;
+  for (size_t i = 0; i < lanes_.size(); ++i) {
+    lanes_[i]->thread = std::thread(&EntryPipeline::run_encoder, this, i);
+  }
+  writer_thread_ = std::thread(&EntryPipeline::run_writer, this);
+}
+
+bool EntryPipeline::write(const JournalEntry &entry) {
+  if (failed_.load(std::memory_order_acquire)) {
+    return false;
+  }
+  if (options_.overload != OVERLOAD_BLOCK &&
+      !shedder_->admit(entry, handed_count_ - taken_count_.load(std::memory_order_acquire))) {
+    return true;
+  }
+  if (!current_ && lanes_[next_lane_]->free_raw.pop(&current_) != 1) {
+    return false;
+  }
+  RawBatch &batch = *current_;
+  if (batch.size == batch.entries.size()) {
+    batch.entries.emplace_back();
+  }
+  batch.entries[batch.size++].copy_from(entry);
+  handed_count_++;
+  if (batch.size >= options_.batch_size) {
+    submit();
+  }
+  return true;
+}
+
+void EntryPipeline::submit() {
+  if (!current_ || current_->size == 0) {
+    return;
+  }
+  if (reader_timer_ != nullptr) {
+    publish_timer(lanes_.size() + 1, *reader_timer_);
+  }
+  lanes_[next_lane_]->raw.push(std::move(current_));
+  next_lane_ = (next_lane_ + 1) % lanes_.size();
+}
+
+bool EntryPipeline::finish() {
+  if (running_) {
+    submit();
+    for (auto &lane : lanes_) {
+      lane->raw.close();
+    }
+    for (auto &lane : lanes_) {
+      lane->thread.join();
+    }
+    writer_thread_.join();
+    running_ = false;
+  }
+  return !failed_.load(std::memory_order_acquire);
+}
+
+const std::string &EntryPipeline::error() const { return error_; }
+
+uint64_t EntryPipeline::dropped_count() const { return shedder_->dropped_count(); }
+
+void EntryPipeline::add_stage_times(StageTimer *timer) const {
+  // the reader's times are already in its own timer.
+  for (size_t i = 0; i <= lanes_.size(); ++i) {
+    timer->add(timers_[i]);
+  }
+}
+
+void EntryPipeline::run_encoder(size_t index) {
+  Lane &lane = *lanes_[index];
+  std::unique_ptr<LogEncoder> encoder = make_encoder(options_.encoding);
+  StageTimer timer(options_.time_stages);
+  std::unique_ptr<RawBatch> raw;
+  std::unique_ptr<EntryBatch> encoded;
+  while (lane.raw.pop(&raw) == 1 && lane.free_encoded.pop(&encoded) == 1) {
+    encoded->clear();
+    for (size_t i = 0; i < raw->size; ++i) {
+      const JournalEntry &entry = raw->entries[i];
+      timer.begin();
+      encoded->append(entry.timestamp, channel_key(entry), encoder->encode(entry));
+      timer.lap(STAGE_ENCODE);
+    }
+    raw->size = 0;
+    lane.free_raw.push(std::move(raw));
+    lane.encoded.push(std::move(encoded));
+    publish_timer(index, timer);
+  }
+  lane.encoded.close();
+}
+
+void EntryPipeline::run_writer() {
+  StageTimer timer(options_.time_stages);
+  const uint64_t stats_interval = options_.write_stats ? options_.stats_interval_ns : 0;
+  uint64_t stats_deadline = stats_interval != 0 ? monotonic_ns() + stats_interval : UINT64_MAX;
+  const uint64_t dropped_interval =
+      options_.overload != OVERLOAD_BLOCK ? options_.dropped_metadata_interval_ns : 0;
+  uint64_t dropped_deadline =
+      dropped_interval != 0 ? monotonic_ns() + dropped_interval : UINT64_MAX;
+  // flushes the output and writes the stats when they are due, as the export loop does.
+  auto run_timers = [&]() {
+    const uint64_t now = monotonic_ns();
+    if (now >= writer_->flush_deadline()) {
+      timer.time(STAGE_SYNC, [&]() { writer_->flush(); });
+    }
+    if (now >= stats_deadline) {
+      write_stats(timer);
+      stats_deadline = now + stats_interval;
+    }
+    if (now >= dropped_deadline) {
+      write_dropped_metadata();
+      dropped_deadline = now + dropped_interval;
+    }
+  };
+  std::unique_ptr<EntryBatch> batch;
+  size_t index = 0;
+  while (true) {
+    Lane &lane = *lanes_[index];
+    const int ret = lane.encoded.pop(
+        &batch, std::min({writer_->flush_deadline(), stats_deadline, dropped_deadline}));
+    if (ret == -ETIMEDOUT) {
+      run_timers();
+      continue;
+    }
+    if (ret == 0) {
+      break;
+    }
+    // after a failure, batches are still taken so that the other threads do not block.
+    for (size_t i = 0; i < batch->size() && !failed_.load(std::memory_order_relaxed); ++i) {
+      timer.begin();
+      auto res = writer_->write(batch->timestamp(i), batch->key(i), batch->encoded(i));
+      timer.lap(STAGE_WRITE);
+      if (!res.ok()) {
+        error_ = res.message;
+        failed_.store(true, std::memory_order_release);
+      }
+    }
+    taken_count_.fetch_add(batch->size(), std::memory_order_release);
+    lane.free_encoded.push(std::move(batch));
+    publish_timer(lanes_.size(), timer);
+    run_timers();
+    index = (index + 1) % lanes_.size();
+  }
+  write_dropped_metadata();
+  publish_timer(lanes_.size(), timer);
+}
+
+void EntryPipeline::publish_timer(size_t index, const StageTimer &timer) {
+  if (!options_.time_stages) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(timers_mutex_);
+  timers_[index] = timer;
+}
+
+void EntryPipeline::write_stats(const StageTimer &writer_timer) {
+  StageTimer timer;
+  {
+    std::lock_guard<std::mutex> lock(timers_mutex_);
+    timer = timers_[lanes_.size() + 1];
+    for (size_t i = 0; i < lanes_.size(); ++i) {
+      timer.add(timers_[i]);
+    }
+  }
+  timer.add(writer_timer);
+  options_.write_stats(timer);
+}
+
+void EntryPipeline::write_dropped_metadata() {
+  mcap::Metadata metadata;
+  if (failed_.load(std::memory_order_relaxed) || !shedder_->take_metadata(&metadata)) {
+    return;
+  }
+  auto res = writer_->write_metadata(metadata);
+  if (!res.ok()) {
+    error_ = res.message;
+    failed_.store(true, std::memory_order_release);
+  }
+}
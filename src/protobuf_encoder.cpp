@@ -0,0 +1,260 @@
+#include <charconv>
+
+#include "journal.hpp"
+#include "protobuf_encoder.hpp"
+#include "utf8.hpp"
+
+namespace {
+
+enum WireType {
+  WIRE_VARINT = 0,
+  WIRE_LEN = 2,
+  WIRE_I32 = 5,
+};
+
+void append_varint(std::string *out, uint64_t value) {
+  while (value >= 0x80) {
+    out->push_back(char((value & 0x7F) | 0x80));
+    value >>= 7;
+  }
+  out->push_back(char(value));
+}
+
+size_t varint_size(uint64_t value) {
+  size_t size = 1;
+  while (value >= 0x80) {
+    value >>= 7;
+    size++;
+  }
+  return size;
+}
+
+void append_tag(std::string *out, uint32_t field_number, WireType type) {
+  append_varint(out, (uint64_t(field_number) << 3) | type);
+}
+
+void append_varint_field(std::string *out, uint32_t field_number, uint64_t value) {
+  append_tag(out, field_number, WIRE_VARINT);
+  append_varint(out, value);
+}
+
+void append_bytes_field(std::string *out, uint32_t field_number, std::string_view value) {
+  append_tag(out, field_number, WIRE_LEN);
+  append_varint(out, value.size());
+  out->append(value);
+}
+
+size_t bytes_field_size(uint32_t field_number, size_t size) {
+  return varint_size(uint64_t(field_number) << 3) + varint_size(size) + size;
+}
+
+/**
+ * Returns `value` if it is valid UTF-8, otherwise a copy in `scratch` with malformed
+ * sequences replaced.
+ */
+std::string_view valid_utf8(std::string_view value, std::string *scratch) {
+  if (is_valid_utf8(value)) {
+    return value;
+  }
+  scratch->clear();
+  append_utf8(scratch, value);
+  return *scratch;
+}
+
+/**
+ * Parses a CODE_LINE value if it round-trips exactly through a non-zero fixed32 line number.
+ */
+bool parse_line(std::string_view value, uint32_t *out) {
+  if (value.empty() || value[0] == '0') {
+    return false;
+  }
+  const char *end = value.data() + value.size();
+  auto [ptr, ec] = std::from_chars(value.data(), end, *out);
+  return ptr == end && ec == std::errc();
+}
+
+// Field numbers and enum values from google/protobuf/descriptor.proto.
+enum DescriptorLabel {
+  LABEL_OPTIONAL = 1,
+  LABEL_REPEATED = 3,
+};
+
+enum DescriptorType {
+  TYPE_INT64 = 3,
+  TYPE_INT32 = 5,
+  TYPE_FIXED32 = 7,
+  TYPE_STRING = 9,
+  TYPE_MESSAGE = 11,
+  TYPE_ENUM = 14,
+};
+
+std::string field_descriptor(std::string_view name, uint32_t number, DescriptorLabel label,
+                             DescriptorType type, std::string_view type_name = {}) {
+  std::string out;
+  append_bytes_field(&out, 1, name);
+  append_varint_field(&out, 3, number);
+  append_varint_field(&out, 4, label);
+  append_varint_field(&out, 5, type);
+  if (!type_name.empty()) {
+    append_bytes_field(&out, 6, type_name);
+  }
+  return out;
+}
+
+std::string enum_value_descriptor(std::string_view name, uint32_t number) {
+  std::string out;
+  append_bytes_field(&out, 1, name);
+  append_varint_field(&out, 2, number);
+  return out;
+}
+
+std::string timestamp_file_descriptor() {
+  std::string message;
+  append_bytes_field(&message, 1, "Timestamp");
+  append_bytes_field(&message, 2, field_descriptor("seconds", 1, LABEL_OPTIONAL, TYPE_INT64));
+  append_bytes_field(&message, 2, field_descriptor("nanos", 2, LABEL_OPTIONAL, TYPE_INT32));
+
+  std::string file;
+  append_bytes_field(&file, 1, "google/protobuf/timestamp.proto");
+  append_bytes_field(&file, 2, "google.protobuf");
+  append_bytes_field(&file, 4, message);
+  append_bytes_field(&file, 12, "proto3");
+  return file;
+}
+
+std::string key_value_pair_file_descriptor() {
+  std::string message;
+  append_bytes_field(&message, 1, "KeyValuePair");
+  append_bytes_field(&message, 2, field_descriptor("key", 1, LABEL_OPTIONAL, TYPE_STRING));
+  append_bytes_field(&message, 2, field_descriptor("value", 2, LABEL_OPTIONAL, TYPE_STRING));
+
+  std::string file;
+  append_bytes_field(&file, 1, "foxglove/KeyValuePair.proto");
+  append_bytes_field(&file, 2, "foxglove");
+  append_bytes_field(&file, 4, message);
+  append_bytes_field(&file, 12, "proto3");
+  return file;
+}
+
+std::string log_file_descriptor() {
+  std::string level;
+  append_bytes_field(&level, 1, "Level");
+  const char *level_names[] = {"UNKNOWN", "DEBUG", "INFO", "WARNING", "ERROR", "FATAL"};
+  for (uint32_t i = 0; i < 6; ++i) {
+    append_bytes_field(&level, 2, enum_value_descriptor(level_names[i], i));
+  }
+
+  std::string message;
+  append_bytes_field(&message, 1, "Log");
+  append_bytes_field(&message, 2,
+                     field_descriptor("timestamp", 1, LABEL_OPTIONAL, TYPE_MESSAGE,
+                                      ".google.protobuf.Timestamp"));
+  append_bytes_field(
+      &message, 2,
+      field_descriptor("level", 2, LABEL_OPTIONAL, TYPE_ENUM, ".foxglove.Log.Level"));
+  append_bytes_field(&message, 2, field_descriptor("message", 3, LABEL_OPTIONAL, TYPE_STRING));
+  append_bytes_field(&message, 2, field_descriptor("name", 4, LABEL_OPTIONAL, TYPE_STRING));
+  append_bytes_field(&message, 2, field_descriptor("file", 5, LABEL_OPTIONAL, TYPE_STRING));
+  append_bytes_field(&message, 2, field_descriptor("line", 6, LABEL_OPTIONAL, TYPE_FIXED32));
+  append_bytes_field(&message, 2,
+                     field_descriptor("journal_fields", JOURNAL_FIELDS_FIELD_NUMBER,
+                                      LABEL_REPEATED, TYPE_MESSAGE, ".foxglove.KeyValuePair"));
+  append_bytes_field(&message, 4, level);
+
+  std::string file;
+  append_bytes_field(&file, 1, "foxglove/Log.proto");
+  append_bytes_field(&file, 2, "foxglove");
+  append_bytes_field(&file, 3, "foxglove/KeyValuePair.proto");
+  append_bytes_field(&file, 3, "google/protobuf/timestamp.proto");
+  append_bytes_field(&file, 4, message);
+  append_bytes_field(&file, 12, "proto3");
+  return file;
+}
+
+} // namespace
+
+std::string log_file_descriptor_set() {
+  std::string out;
+  append_bytes_field(&out, 1, timestamp_file_descriptor());
+  append_bytes_field(&out, 1, key_value_pair_file_descriptor());
+  append_bytes_field(&out, 1, log_file_descriptor());
+  return out;
+}
+
+ProtobufEncoder::ProtobufEncoder() : descriptor_set_(log_file_descriptor_set()) {}
+
+std::string_view ProtobufEncoder::encode(const JournalEntry &entry) {
+  const auto &fields = entry.fields;
+  int message = entry.well_known[FIELD_MESSAGE];
+  int unit = entry.well_known[FIELD_SYSTEMD_UNIT];
+  int exe = entry.well_known[FIELD_EXE];
+  int transport = entry.well_known[FIELD_TRANSPORT];
+  int file = entry.well_known[FIELD_CODE_FILE];
+  int line_field = entry.well_known[FIELD_CODE_LINE];
+  int priority = entry.well_known[FIELD_PRIORITY];
+  int name = unit >= 0 ? unit : (exe >= 0 ? exe : transport);
+  uint32_t line = 0;
+  if (line_field >= 0 && !parse_line(entry.value(fields[line_field]), &line)) {
+    // keep the raw value in journal_fields rather than lose it.
+    line_field = -1;
+  }
+  int level = priority >= 0 ? level_for_priority(entry.value(fields[priority])) : 0;
+
+  out_.clear();
+  // timestamp = 1
+  const uint64_t sec = entry.timestamp / 1000000000ull;
+  const uint64_t nsec = entry.timestamp % 1000000000ull;
+  size_t timestamp_size = 0;
+  if (sec != 0) {
+    timestamp_size += 1 + varint_size(sec);
+  }
+  if (nsec != 0) {
+    timestamp_size += 1 + varint_size(nsec);
+  }
+  append_tag(&out_, 1, WIRE_LEN);
+  append_varint(&out_, timestamp_size);
+  if (sec != 0) {
+    append_varint_field(&out_, 1, sec);
+  }
+  if (nsec != 0) {
+    append_varint_field(&out_, 2, nsec);
+  }
+  // level = 2
+  if (level != 0) {
+    append_varint_field(&out_, 2, level);
+  }
+  // message = 3, name = 4, file = 5
+  const std::pair<uint32_t, int> string_fields[] = {{3, message}, {4, name}, {5, file}};
+  for (auto [field_number, index] : string_fields) {
+    if (index >= 0) {
+      append_bytes_field(&out_, field_number,
+                         valid_utf8(entry.value(fields[index]), &value_scratch_));
+    }
+  }
+  // line = 6
+  if (line_field >= 0) {
+    append_tag(&out_, 6, WIRE_I32);
+    for (int shift = 0; shift < 32; shift += 8) {
+      out_.push_back(char((line >> shift) & 0xFF));
+    }
+  }
+  // journal_fields = 15
+  for (int i = 0; i < (int)(fields.size()); ++i) {
+    if (i == message || i == name || i == file || i == line_field) {
+      continue;
+    }
+    std::string_view k = valid_utf8(entry.key(fields[i]), &key_scratch_);
+    std::string_view v = valid_utf8(entry.value(fields[i]), &value_scratch_);
+    append_tag(&out_, JOURNAL_FIELDS_FIELD_NUMBER, WIRE_LEN);
+    append_varint(&out_, bytes_field_size(1, k.size()) + bytes_field_size(2, v.size()));
+    append_bytes_field(&out_, 1, k);
+    append_bytes_field(&out_, 2, v);
+  }
+  return out_;
+}
+
+const char *ProtobufEncoder::schema_encoding() const { return "protobuf"; }
+
+std::string_view ProtobufEncoder::schema_data() const { return descriptor_set_; }
+
+const char *ProtobufEncoder::message_encoding() const { return "protobuf"; }
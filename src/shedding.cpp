@@ -0,0 +1,76 @@
+#include <algorithm>
+
+#include "shedding.hpp"
+
+namespace {
+
+// foxglove.Log level names, indexed by `level_for_priority()`.
+const char *LEVEL_NAMES[] = {"UNKNOWN", "DEBUG", "INFO", "WARNING", "ERROR", "FATAL"};
+
+constexpr int LEVEL_DEBUG = 1;
+constexpr int LEVEL_INFO = 2;
+
+} // namespace
+
+LoadShedder::LoadShedder(OverloadPolicy policy, uint64_t high_watermark, uint64_t capacity)
+    : policy_(policy), high_watermark_(high_watermark),
+      capacity_(std::max(capacity, high_watermark + 1)) {}
+
+bool LoadShedder::admit(const JournalEntry &entry, uint64_t depth) {
+  if (policy_ == OVERLOAD_BLOCK || depth < high_watermark_) {
+    return true;
+  }
+  const JournalEntry::Field *priority = entry.find(FIELD_PRIORITY);
+  const int level = level_for_priority(priority != nullptr ? entry.value(*priority) : "");
+  if (policy_ == OVERLOAD_DROP) {
+    // which third of the way from the watermark to a full queue the depth is in.
+    const uint64_t band = std::min<uint64_t>(
+        (depth - high_watermark_) * 3 / (capacity_ - high_watermark_), 2);
+    if (level > LEVEL_DEBUG + int(band)) {
+      return true;
+    }
+  } else if (level != LEVEL_DEBUG && level != LEVEL_INFO) {
+    return true;
+  } else if (sampled_[level]++ % OVERLOAD_SAMPLE_INTERVAL == 0) {
+    return true;
+  }
+
+  if (const JournalEntry::Field *unit = entry.find(FIELD_SYSTEMD_UNIT)) {
+    key_.assign(entry.value(*unit));
+  } else if (const JournalEntry::Field *comm = entry.find(FIELD_COMM)) {
+    key_.assign(entry.value(*comm));
+  } else {
+    key_.assign(name_for_transport(entry.transport));
+  }
+  key_ += '/';
+  key_ += LEVEL_NAMES[level];
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = counts_.find(key_);
+  if (it == counts_.end()) {
+    counts_.emplace(key_, 1);
+  } else {
+    it->second++;
+  }
+  dropped_++;
+  return false;
+}
+
+uint64_t LoadShedder::dropped_count() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return dropped_;
+}
+
+bool LoadShedder::take_metadata(mcap::Metadata *metadata) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (dropped_ == reported_) {
+    return false;
+  }
+  reported_ = dropped_;
+  metadata->name = DROPPED_METADATA_NAME;
+  metadata->metadata.clear();
+  for (const auto &[key, count] : counts_) {
+    metadata->metadata[key] = std::to_string(count);
+  }
+  metadata->metadata["total"] = std::to_string(dropped_);
+  return true;
+}
@@ -0,0 +1,80 @@
+#include <cerrno>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "state.hpp"
+
+int read_state_file(const std::string &path, std::string *cursor) {
+  cursor->clear();
+  FILE *file = fopen(path.c_str(), "r");
+  if (file == NULL) {
+    return errno == ENOENT ? 0 : -errno;
+  }
+  char buffer[512];
+  size_t length = 0;
+  while ((length = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+    cursor->append(buffer, length);
+  }
+  int err = ferror(file) ? -EIO : 0;
+  fclose(file);
+  // the cursor is written on a line of its own.
+  while (!cursor->empty() && (cursor->back() == '\n' || cursor->back() == '\r')) {
+    cursor->pop_back();
+  }
+  return err;
+}
+
+int write_state_file(const std::string &path, std::string_view cursor) {
+  std::string contents(cursor);
+  contents.push_back('\n');
+  return replace_file(path, contents);
+}
+
+int replace_file(const std::string &path, std::string_view contents) {
+  const std::string tmp_path = path + ".tmp";
+  int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    return -errno;
+  }
+  size_t written = 0;
+  while (written < contents.size()) {
+    ssize_t ret = write(fd, contents.data() + written, contents.size() - written);
+    if (ret < 0 && errno == EINTR) {
+      continue;
+    }
+    if (ret < 0) {
+      int err = -errno;
+      close(fd);
+      unlink(tmp_path.c_str());
+      return err;
+    }
+    written += ret;
+  }
+  // the contents must be on disk before the rename makes them visible.
+  if (fsync(fd) != 0) {
+    int err = -errno;
+    close(fd);
+    unlink(tmp_path.c_str());
+    return err;
+  }
+  if (close(fd) != 0) {
+    int err = -errno;
+    unlink(tmp_path.c_str());
+    return err;
+  }
+  if (rename(tmp_path.c_str(), path.c_str()) != 0) {
+    int err = -errno;
+    unlink(tmp_path.c_str());
+    return err;
+  }
+  // sync the directory so that the rename itself survives a crash.
+  size_t slash = path.rfind('/');
+  std::string dir = slash == std::string::npos ? "." : path.substr(0, slash + 1);
+  int dir_fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (dir_fd >= 0) {
+    fsync(dir_fd);
+    close(dir_fd);
+  }
+  return 0;
+}
@@ -0,0 +1,143 @@
+#include <algorithm>
+#include <cinttypes>
+
+#include "vendor/json.hpp"
+
+#include "stats.hpp"
+
+const char *name_for_stage(Stage stage) {
+  switch (stage) {
+  case STAGE_READ:
+    return "read";
+  case STAGE_ENCODE:
+    return "encode";
+  case STAGE_WRITE:
+    return "write";
+  case STAGE_COMPRESS:
+    return "compress";
+  case STAGE_SYNC:
+    return "sync";
+  default:
+    return "unknown";
+  }
+}
+
+StageTimer::StageTimer(bool enabled) : enabled_(enabled), start_ns_(monotonic_ns()) {}
+
+void StageTimer::begin_sample() {
+  sampling_ = iterations_++ % SAMPLE_INTERVAL == 0;
+  if (sampling_) {
+    sampled_iterations_++;
+    last_ns_ = monotonic_ns();
+  }
+}
+
+void StageTimer::lap_sample(Stage stage) {
+  const uint64_t now = monotonic_ns();
+  sampled_ns_[stage] += now - last_ns_;
+  last_ns_ = now;
+}
+
+void StageTimer::add(const StageTimer &other) {
+  for (size_t stage = 0; stage < _STAGE_COUNT; ++stage) {
+    unsampled_ns_[stage] += uint64_t(other.seconds(Stage(stage)) * 1e9);
+  }
+}
+
+double StageTimer::seconds(Stage stage) const {
+  double ns = double(unsampled_ns_[stage]);
+  if (sampled_iterations_ != 0) {
+    ns += double(sampled_ns_[stage]) * double(iterations_) / double(sampled_iterations_);
+  }
+  return ns / 1e9;
+}
+
+double StageTimer::elapsed_seconds() const { return double(monotonic_ns() - start_ns_) / 1e9; }
+
+namespace {
+
+double stage_seconds(const StageTimer &timer, const ChunkSizeStats &chunks, Stage stage) {
+  return stage == STAGE_COMPRESS ? double(chunks.compression_ns) / 1e9 : timer.seconds(stage);
+}
+
+double compression_ratio(const ChunkSizeStats &chunks) {
+  return chunks.compressed_bytes == 0
+             ? 1.0
+             : double(chunks.uncompressed_bytes) / double(chunks.compressed_bytes);
+}
+
+} // namespace
+
+std::string format_stats_text(const StageTimer &timer, const LogWriter &writer) {
+  const ChunkSizeStats chunks = writer.chunk_stats();
+  const double elapsed = timer.elapsed_seconds();
+  std::string out;
+  char line[512];
+  uint64_t total_entries = 0;
+  uint64_t total_bytes = 0;
+  for (size_t i = 0; i < writer.channel_count(); ++i) {
+    total_entries += writer.entry_count(i);
+    total_bytes += writer.byte_count(i);
+  }
+  snprintf(line, sizeof(line), "exported %" PRIu64 " entries in %.3f s (%.0f entries/s)\n",
+           total_entries, elapsed, elapsed > 0 ? total_entries / elapsed : 0.0);
+  out += line;
+  out += "stage        seconds  share\n";
+  for (int i = 0; i < _STAGE_COUNT; ++i) {
+    const double seconds = stage_seconds(timer, chunks, (Stage)(i));
+    snprintf(line, sizeof(line), "%-10s %9.3f  %4.1f%%\n", name_for_stage((Stage)(i)), seconds,
+             elapsed > 0 ? 100.0 * seconds / elapsed : 0.0);
+    out += line;
+  }
+  // unit topics can be long, so the channel column fits the longest one.
+  int width = 18;
+  for (size_t i = 0; i < writer.channel_count(); ++i) {
+    if (writer.entry_count(i) != 0) {
+      width = std::max(width, int(std::min<size_t>(writer.channel_topic(i).size(), 200)));
+    }
+  }
+  snprintf(line, sizeof(line), "%-*s %10s %12s\n", width, "channel", "entries", "bytes");
+  out += line;
+  for (size_t i = 0; i < writer.channel_count(); ++i) {
+    if (writer.entry_count(i) == 0) {
+      continue;
+    }
+    snprintf(line, sizeof(line), "%-*s %10" PRIu64 " %12" PRIu64 "\n", width,
+             writer.channel_topic(i).c_str(), writer.entry_count(i), writer.byte_count(i));
+    out += line;
+  }
+  snprintf(line, sizeof(line), "%-*s %10" PRIu64 " %12" PRIu64 "\n", width, "total",
+           total_entries, total_bytes);
+  out += line;
+  out += "chunks: " + describe_chunk_stats(chunks) + "\n";
+  return out;
+}
+
+std::string format_stats_json(const StageTimer &timer, const LogWriter &writer) {
+  const ChunkSizeStats chunks = writer.chunk_stats();
+  nlohmann::json out;
+  out["elapsed_sec"] = timer.elapsed_seconds();
+  for (int i = 0; i < _STAGE_COUNT; ++i) {
+    out["stages_sec"][name_for_stage((Stage)(i))] = stage_seconds(timer, chunks, (Stage)(i));
+  }
+  uint64_t total_entries = 0;
+  out["channels"] = nlohmann::json::object();
+  for (size_t i = 0; i < writer.channel_count(); ++i) {
+    total_entries += writer.entry_count(i);
+    if (writer.entry_count(i) == 0) {
+      continue;
+    }
+    auto &channel = out["channels"][writer.channel_topic(i)];
+    channel["entries"] = writer.entry_count(i);
+    channel["bytes"] = writer.byte_count(i);
+  }
+  out["entries"] = total_entries;
+  out["chunks"] = {
+      {"count", chunks.chunk_count},
+      {"flushed_early", chunks.forced_flushes},
+      {"uncompressed_bytes", chunks.uncompressed_bytes},
+      {"compressed_bytes", chunks.compressed_bytes},
+      {"compression_ratio", compression_ratio(chunks)},
+  };
+  return out.dump();
+}
@@ -0,0 +1,81 @@
+#include <algorithm>
+
+#include "utf8.hpp"
+
+size_t utf8_prefix_length(const uint8_t *s, size_t size, bool *complete) {
+  *complete = false;
+  uint8_t lead = s[0];
+  size_t needed = 0;
+  uint8_t second_min = 0x80;
+  uint8_t second_max = 0xBF;
+  if (lead >= 0xC2 && lead <= 0xDF) {
+    needed = 2;
+  } else if (lead >= 0xE0 && lead <= 0xEF) {
+    needed = 3;
+    if (lead == 0xE0) {
+      second_min = 0xA0;
+    } else if (lead == 0xED) {
+      second_max = 0x9F;
+    }
+  } else if (lead >= 0xF0 && lead <= 0xF4) {
+    needed = 4;
+    if (lead == 0xF0) {
+      second_min = 0x90;
+    } else if (lead == 0xF4) {
+      second_max = 0x8F;
+    }
+  } else {
+    return 0;
+  }
+  size_t i = 1;
+  for (; i < needed && i < size; ++i) {
+    uint8_t min = i == 1 ? second_min : 0x80;
+    uint8_t max = i == 1 ? second_max : 0xBF;
+    if (s[i] < min || s[i] > max) {
+      return i;
+    }
+  }
+  *complete = i == needed;
+  return i;
+}
+
+bool is_valid_utf8(std::string_view value) {
+  const uint8_t *data = (const uint8_t *)(value.data());
+  size_t i = 0;
+  while (i < value.size()) {
+    if (data[i] < 0x80) {
+      ++i;
+      continue;
+    }
+    bool complete = false;
+    i += utf8_prefix_length(data + i, value.size() - i, &complete);
+    if (!complete) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void append_utf8(std::string *out, std::string_view value) {
+  const uint8_t *data = (const uint8_t *)(value.data());
+  size_t run_start = 0;
+  size_t i = 0;
+  while (i < value.size()) {
+    if (data[i] < 0x80) {
+      ++i;
+      continue;
+    }
+    bool complete = false;
+    size_t prefix = utf8_prefix_length(data + i, value.size() - i, &complete);
+    if (complete) {
+      i += prefix;
+      continue;
+    }
+    // drop the malformed prefix and re-read the byte that ended it.
+    out->append(value.data() + run_start, i - run_start);
+    out->append("\xEF\xBF\xBD");
+    i += std::max(prefix, size_t(1));
+    run_start = i;
+  }
+  out->append(value.data() + run_start, value.size() - run_start);
+}
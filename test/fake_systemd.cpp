@@ -1,6 +1,10 @@
 #include "fake_systemd.hpp"
 #include <algorithm>
 #include <cstdio>
+#include <cstring>
+#include <poll.h>
+#include <string>
+#include <unistd.h>
 
 int sd_journal_get_data(sd_journal *j, const char *key, const void **data,
                         size_t *length) {
@@ -43,7 +47,7 @@ int sd_journal_enumerate_available_data(sd_journal *j, const void **data,
   if (*(j->field_it) == j->fields.end()) {
     return 0;
   }
-  auto [key, val] = **(j->field_it);
+  const auto &[key, val] = **(j->field_it);
   *length = snprintf(j->field_buffer, sizeof(j->field_buffer), "%s=%s",
                      key.c_str(), val.c_str());
   *data = (const void *)(j->field_buffer);
@@ -80,6 +84,9 @@ int sd_journal_seek_realtime_usec(sd_journal *j, uint64_t usec) {
 int sd_journal_next(sd_journal *j) {
   if (!j->entry_cursor_valid) {
     j->entry_cursor_valid = true;
+  } else if (j->entry_cursor + 1 >= (int)(j->entry_timestamps.size())) {
+    // like libsystemd, stay on the last entry when there are no more.
+    return 0;
   } else {
     j->entry_cursor++;
   }
@@ -110,6 +117,71 @@ int sd_journal_add_match(sd_journal *j, const void *data, size_t len) {
   return 0;
 }
 
+// cursors are "t=<timestamp>", so an entry removed from entry_timestamps models a vacuumed
+// journal.
+int sd_journal_get_cursor(sd_journal *j, char **cursor) {
+  if (!j->entry_cursor_valid) {
+    return -EADDRNOTAVAIL;
+  }
+  std::string out = "t=" + std::to_string(j->entry_timestamps[j->entry_cursor]);
+  *cursor = strdup(out.c_str());
+  return 0;
+}
+
+int sd_journal_seek_cursor(sd_journal *j, const char *cursor) {
+  if (strncmp(cursor, "t=", 2) != 0) {
+    return -EINVAL;
+  }
+  uint64_t ts = std::stoull(cursor + 2);
+  j->entry_cursor_valid = false;
+  j->entry_cursor = std::lower_bound(j->entry_timestamps.begin(), j->entry_timestamps.end(), ts) -
+                    j->entry_timestamps.begin();
+  return 0;
+}
+
+int sd_journal_test_cursor(sd_journal *j, const char *cursor) {
+  if (!j->entry_cursor_valid) {
+    return -EADDRNOTAVAIL;
+  }
+  return ("t=" + std::to_string(j->entry_timestamps[j->entry_cursor])) == cursor;
+}
+
+// conjunctions and disjunctions are recorded in `matches` as "AND" and "OR".
+int sd_journal_add_conjunction(sd_journal *j) {
+  j->matches.push_back("AND");
+  return 0;
+}
+
+int sd_journal_add_disjunction(sd_journal *j) {
+  j->matches.push_back("OR");
+  return 0;
+}
+
+int sd_journal_get_fd(sd_journal *j) { return j->fd >= 0 ? j->fd : -EMEDIUMTYPE; }
+
+int sd_journal_get_events(sd_journal *j) { return POLLIN; }
+
+int sd_journal_get_timeout(sd_journal *j, uint64_t *timeout_usec) {
+  *timeout_usec = UINT64_MAX;
+  return 0;
+}
+
+// drains the pipe, reporting an 'f' written to it as a change to the journal's files and any
+// other bytes as appended entries.
+int sd_journal_process(sd_journal *j) {
+  char buf[64];
+  ssize_t size;
+  int ret = SD_JOURNAL_NOP;
+  while ((size = read(j->fd, buf, sizeof(buf))) > 0) {
+    if (memchr(buf, 'f', size_t(size)) != nullptr) {
+      ret = SD_JOURNAL_INVALIDATE;
+    } else if (ret == SD_JOURNAL_NOP) {
+      ret = SD_JOURNAL_APPEND;
+    }
+  }
+  return ret;
+}
+
 int sd_id128_get_boot(sd_id128_t *out) {
   *out = SD_ID128_MAKE(00, 01, 02, 03, 04, 05, 06, 07, 08, 09, 0a, 0b, 0c, 0d,
                        0e, 0f);
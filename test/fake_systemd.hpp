@@ -16,4 +16,6 @@ struct sd_journal {
     int entry_cursor = 0;
     bool entry_cursor_valid = true;
     std::vector<std::string> matches;
+    // readable end of a pipe which tests write to, to signal that the journal changed.
+    int fd = -1;
 };
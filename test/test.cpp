@@ -1,14 +1,64 @@
+#include <cstdlib>
+#include <fcntl.h>
+#include <fstream>
+#include <lz4.h>
+#include <lzma.h>
+#include <map>
+#include <new>
+#include <random>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <sstream>
 #include <utility>
+#include <zstd.h>
 
 #define CATCH_CONFIG_MAIN
 #include "vendor/catch.hpp"
 #include "vendor/json.hpp"
+#include "vendor/mcap/crc32.hpp"
 
+#include "async_writer.hpp"
+#include "batch_merge.hpp"
 #include "cmdline.hpp"
+#include "coalesce.hpp"
+#include "dictionary.hpp"
+#include "entry_batch.hpp"
+#include "export_reader.hpp"
+#include "journal_file.hpp"
+#include "event_loop.hpp"
 #include "journal.hpp"
+#include "json_encoder.hpp"
+#include "output.hpp"
+#include "pipeline.hpp"
+#include "shedding.hpp"
+#include "protobuf_encoder.hpp"
+#include "state.hpp"
+#include "stats.hpp"
 
 #include "fake_systemd.hpp"
 
+namespace {
+
+// counts this thread's heap allocations while enabled, for the steady-state export loop test.
+thread_local bool count_allocations = false;
+thread_local uint64_t allocation_count = 0;
+
+} // namespace
+
+void *operator new(size_t size) {
+  if (count_allocations) {
+    allocation_count++;
+  }
+  if (void *ptr = malloc(size == 0 ? 1 : size)) {
+    return ptr;
+  }
+  throw std::bad_alloc();
+}
+
+void operator delete(void *ptr) noexcept { free(ptr); }
+
+void operator delete(void *ptr, size_t) noexcept { free(ptr); }
+
 void test_options(std::vector<const char *> args,
                   const Options &expected_options, int expected_rval) {
   Options options;
@@ -25,6 +75,32 @@ void test_options(std::vector<const char *> args,
   REQUIRE(options.version == expected_options.version);
   REQUIRE(options.help == expected_options.help);
   REQUIRE(options.output_filename == expected_options.output_filename);
+  REQUIRE(options.encoding == expected_options.encoding);
+  REQUIRE(options.topics == expected_options.topics);
+  REQUIRE(options.jobs == expected_options.jobs);
+  REQUIRE(options.compression_threads == expected_options.compression_threads);
+  REQUIRE(options.io == expected_options.io);
+  REQUIRE(options.sync_writeback == expected_options.sync_writeback);
+  REQUIRE(options.zstd_dictionary == expected_options.zstd_dictionary);
+  REQUIRE(options.train_dictionary == expected_options.train_dictionary);
+  REQUIRE(options.directories == expected_options.directories);
+  REQUIRE(options.files == expected_options.files);
+  REQUIRE(options.reader == expected_options.reader);
+  REQUIRE(options.import_file == expected_options.import_file);
+  REQUIRE(options.units == expected_options.units);
+  REQUIRE(options.max_priority == expected_options.max_priority);
+  REQUIRE(options.transports == expected_options.transports);
+  REQUIRE(options.matches == expected_options.matches);
+  REQUIRE(options.state_file == expected_options.state_file);
+  REQUIRE(options.rotate_size == expected_options.rotate_size);
+  REQUIRE(options.rotate_interval_sec == expected_options.rotate_interval_sec);
+  REQUIRE(options.max_chunk_latency_ms == expected_options.max_chunk_latency_ms);
+  REQUIRE(options.coalesce_window_ms == expected_options.coalesce_window_ms);
+  REQUIRE(options.overload == expected_options.overload);
+  REQUIRE(options.high_watermark == expected_options.high_watermark);
+  REQUIRE(options.stats == expected_options.stats);
+  REQUIRE(options.stats_file == expected_options.stats_file);
+  REQUIRE(options.verbose == expected_options.verbose);
 }
 
 TEST_CASE("empty", "[cmdline]") { test_options({"exe"}, Options{}, 0); }
@@ -68,6 +144,147 @@ TEST_CASE("set string and int flag", "[cmdline]") {
               .end = TIME_WAIT},
       0);
 }
+TEST_CASE("sets encoding", "[cmdline]") {
+  test_options({"exe", "--encoding", "protobuf"},
+               Options{.encoding = ENCODING_PROTOBUF}, 0);
+  test_options({"exe", "--encoding", "json"}, Options{.encoding = ENCODING_JSON},
+               0);
+  test_options({"exe", "--encoding", "xml"}, Options{}, 1);
+  test_options({"exe", "--encoding"}, Options{}, 1);
+}
+TEST_CASE("sets topics", "[cmdline]") {
+  test_options({"exe", "--topics", "unit"}, Options{.topics = TOPICS_UNIT}, 0);
+  test_options({"exe", "--topics", "transport"}, Options{.topics = TOPICS_TRANSPORT}, 0);
+  test_options({"exe", "--topics", "pid"}, Options{}, 1);
+  test_options({"exe", "--topics"}, Options{}, 1);
+}
+TEST_CASE("sets jobs", "[cmdline]") {
+  test_options({"exe", "--jobs", "8"}, Options{.jobs = 8}, 0);
+  test_options({"exe", "-j", "2", "--end", "now"},
+               Options{.end = TIME_NOW, .jobs = 2}, 0);
+  test_options({"exe", "--jobs", "0"}, Options{}, 1);
+  test_options({"exe", "--jobs", "many"}, Options{}, 1);
+  test_options({"exe", "--jobs", "64"}, Options{.jobs = 64}, 0);
+  test_options({"exe", "--jobs", "65"}, Options{}, 1);
+  test_options({"exe", "--jobs", "100000"}, Options{}, 1);
+  test_options({"exe", "--jobs", "99999999999999999999"}, Options{}, 1);
+  test_options({"exe", "--jobs"}, Options{}, 1);
+}
+TEST_CASE("sets compression threads", "[cmdline]") {
+  test_options({"exe", "--compression-threads", "4"},
+               Options{.compression_threads = 4}, 0);
+  test_options({"exe", "--compression-threads", "0"},
+               Options{.compression_threads = 0}, 0);
+  test_options({"exe", "--compression-threads", "many"}, Options{}, 1);
+  test_options({"exe", "--compression-threads"}, Options{}, 1);
+}
+TEST_CASE("sets io", "[cmdline]") {
+  test_options({"exe", "--io", "uring"}, Options{.io = IO_URING}, 0);
+  test_options({"exe", "--io", "thread", "--sync-writeback"},
+               Options{.io = IO_THREAD, .sync_writeback = true}, 0);
+  test_options({"exe", "--io", "stdio"}, Options{.io = IO_STDIO}, 0);
+  test_options({"exe", "--io", "mmap"}, Options{}, 1);
+  test_options({"exe", "--io"}, Options{}, 1);
+}
+TEST_CASE("sets dictionary files", "[cmdline]") {
+  test_options({"exe", "--zstd-dictionary", "journal.dict"},
+               Options{.zstd_dictionary = "journal.dict"}, 0);
+  test_options({"exe", "--train-dictionary", "journal.dict"},
+               Options{.train_dictionary = "journal.dict"}, 0);
+  test_options({"exe", "--zstd-dictionary"}, Options{}, 1);
+  test_options({"exe", "--train-dictionary", "--verbose"}, Options{}, 1);
+}
+TEST_CASE("sets journal sources", "[cmdline]") {
+  test_options({"exe", "-D", "robot1/var/log/journal", "--directory", "robot2"},
+               Options{.directories = {"robot1/var/log/journal", "robot2"}}, 0);
+  test_options({"exe", "--file", "a/system.journal", "--file", "a/user-1000.journal"},
+               Options{.files = {"a/system.journal", "a/user-1000.journal"}}, 0);
+  test_options({"exe", "-D", "robot1", "--reader", "mmap"},
+               Options{.directories = {"robot1"}, .reader = READER_MMAP}, 0);
+  test_options({"exe", "--reader", "libsystemd"}, Options{.reader = READER_LIBSYSTEMD}, 0);
+  test_options({"exe", "--import", "-"}, Options{.import_file = "-"}, 0);
+  test_options({"exe", "--import", "robot1.export"}, Options{.import_file = "robot1.export"}, 0);
+  test_options({"exe", "--directory"}, Options{}, 1);
+  test_options({"exe", "--file", "-v"}, Options{}, 1);
+  test_options({"exe", "--import"}, Options{}, 1);
+  test_options({"exe", "--reader"}, Options{}, 1);
+  test_options({"exe", "--reader", "fuse"}, Options{}, 1);
+}
+TEST_CASE("sets rotation", "[cmdline]") {
+  test_options({"exe", "--rotate-size", "1000"}, Options{.rotate_size = 1000}, 0);
+  test_options({"exe", "--rotate-size", "64M"}, Options{.rotate_size = 64 << 20}, 0);
+  test_options({"exe", "--rotate-interval", "90"}, Options{.rotate_interval_sec = 90}, 0);
+  test_options({"exe", "--rotate-interval", "2h"},
+               Options{.rotate_interval_sec = 7200}, 0);
+  test_options({"exe", "--rotate-size", "0"}, Options{}, 1);
+  test_options({"exe", "--rotate-size", "M"}, Options{}, 1);
+  test_options({"exe", "--rotate-size", "10X"}, Options{}, 1);
+  test_options({"exe", "--rotate-interval", "-1"}, Options{}, 1);
+  // values which overflow, in bytes or once converted to nanoseconds.
+  test_options({"exe", "--rotate-size", "999999999999G"}, Options{}, 1);
+  test_options({"exe", "--rotate-interval", "999999999999d"}, Options{}, 1);
+  test_options({"exe", "--rotate-interval", "18446744074"}, Options{}, 1);
+  test_options({"exe", "--rotate-interval", "18446744073"},
+               Options{.rotate_interval_sec = 18446744073}, 0);
+  test_options({"exe", "--rotate-interval"}, Options{}, 1);
+}
+TEST_CASE("sets max chunk latency", "[cmdline]") {
+  test_options({"exe", "--max-chunk-latency", "250"}, Options{.max_chunk_latency_ms = 250}, 0);
+  test_options({"exe", "--max-chunk-latency", "2s", "-v"},
+               Options{.max_chunk_latency_ms = 2000, .verbose = true}, 0);
+  test_options({"exe", "--max-chunk-latency", "0"}, Options{}, 1);
+  test_options({"exe", "--max-chunk-latency", "1ms"}, Options{}, 1);
+  test_options({"exe", "--max-chunk-latency", "999999999999h"}, Options{}, 1);
+  test_options({"exe", "--max-chunk-latency"}, Options{}, 1);
+}
+TEST_CASE("sets coalesce window", "[cmdline]") {
+  test_options({"exe", "--coalesce", "500"}, Options{.coalesce_window_ms = 500}, 0);
+  test_options({"exe", "--coalesce", "1m"}, Options{.coalesce_window_ms = 60000}, 0);
+  test_options({"exe", "--coalesce", "0"}, Options{}, 1);
+  test_options({"exe", "--coalesce", "1d"}, Options{}, 1);
+  test_options({"exe", "--coalesce", "999999999999h"}, Options{}, 1);
+  test_options({"exe", "--coalesce"}, Options{}, 1);
+}
+TEST_CASE("sets overload policy", "[cmdline]") {
+  test_options({"exe", "--overload", "drop"}, Options{.overload = OVERLOAD_DROP}, 0);
+  test_options({"exe", "--overload", "sample", "--high-watermark", "50K"},
+               Options{.overload = OVERLOAD_SAMPLE, .high_watermark = 50000}, 0);
+  test_options({"exe", "--overload", "block"}, Options{.overload = OVERLOAD_BLOCK}, 0);
+  test_options({"exe", "--overload", "shed"}, Options{}, 1);
+  test_options({"exe", "--overload"}, Options{}, 1);
+  test_options({"exe", "--high-watermark", "0"}, Options{}, 1);
+  test_options({"exe", "--high-watermark"}, Options{}, 1);
+}
+
+TEST_CASE("sets stats", "[cmdline]") {
+  test_options({"exe", "--stats"}, Options{.stats = true}, 0);
+  test_options({"exe", "--stats-file", "/run/journal2mcap.json", "--stats"},
+               Options{.stats = true, .stats_file = "/run/journal2mcap.json"}, 0);
+  test_options({"exe", "--stats-file"}, Options{}, 1);
+}
+TEST_CASE("sets state file", "[cmdline]") {
+  test_options({"exe", "--state-file", "/var/lib/cursor"},
+               Options{.state_file = "/var/lib/cursor"}, 0);
+  test_options({"exe", "--state-file"}, Options{}, 1);
+}
+TEST_CASE("sets filters", "[cmdline]") {
+  test_options({"exe", "--unit", "sshd", "-u", "nginx.service"},
+               Options{.units = {"sshd", "nginx.service"}}, 0);
+  test_options({"exe", "--priority", "warning"}, Options{.max_priority = 4}, 0);
+  test_options({"exe", "-p", "0"}, Options{.max_priority = 0}, 0);
+  test_options({"exe", "--transport", "kernel", "--transport", "stdout"},
+               Options{.transports = {"kernel", "stdout"}}, 0);
+  test_options({"exe", "--match", "_PID=1", "-m", "MESSAGE=a=b"},
+               Options{.matches = {"_PID=1", "MESSAGE=a=b"}}, 0);
+  test_options({"exe", "--unit"}, Options{}, 1);
+  test_options({"exe", "--unit", ""}, Options{}, 1);
+  test_options({"exe", "--priority", "8"}, Options{}, 1);
+  test_options({"exe", "--priority", "loud"}, Options{}, 1);
+  test_options({"exe", "--transport", "carrier-pigeon"}, Options{}, 1);
+  test_options({"exe", "--match", "=1"}, Options{}, 1);
+  test_options({"exe", "--match", "_PID"}, Options{}, 1);
+  test_options({"exe", "--match"}, Options{}, 1);
+}
 
 void test_get_ts(uint64_t expected, uint64_t actual_usec, int journald_rval,
                  int expected_rval) {
@@ -110,6 +327,60 @@ TEST_CASE("return unknown for unknown transports", "[get_transport]") {
 TEST_CASE("return unkown on err return from journald", "[get_transport]") {
   test_get_transport({{"_TRANSPORT", "audit"}}, 1, TRANSPORT_UNKNOWN);
 }
+TEST_CASE("parses transport names", "[get_transport]") {
+  for (int i = 0; i < _TRANSPORT_COUNT; ++i) {
+    Transport t = (Transport)(i);
+    REQUIRE(parse_transport(name_for_transport(t)) == t);
+  }
+  for (const char *name : {"", "s", "sys", "syslogd", "stdou", "Audit", "unknown"}) {
+    REQUIRE(parse_transport(name) == TRANSPORT_UNKNOWN);
+  }
+}
+
+TEST_CASE("classifies well-known fields", "[journal_entry]") {
+  REQUIRE(classify_field("MESSAGE") == FIELD_MESSAGE);
+  REQUIRE(classify_field("PRIORITY") == FIELD_PRIORITY);
+  REQUIRE(classify_field("_TRANSPORT") == FIELD_TRANSPORT);
+  REQUIRE(classify_field("_SYSTEMD_UNIT") == FIELD_SYSTEMD_UNIT);
+  REQUIRE(classify_field("_EXE") == FIELD_EXE);
+  REQUIRE(classify_field("CODE_FILE") == FIELD_CODE_FILE);
+  REQUIRE(classify_field("CODE_LINE") == FIELD_CODE_LINE);
+  REQUIRE(classify_field("_COMM") == FIELD_COMM);
+  REQUIRE(classify_field("_MACHINE_ID") == FIELD_MACHINE_ID);
+  for (const char *key : {"", "_PID", "MESSAGE_ID", "message", "CODE_FUNC", "CODE_FILX",
+                          "_SYSTEMD_USER", "_TRANSPORTS", "_COMMS", "_CMDL", "_MACHINE_IX"}) {
+    REQUIRE(classify_field(key) == FIELD_OTHER);
+  }
+}
+
+TEST_CASE("decodes an entry in one pass", "[journal_entry]") {
+  sd_journal j;
+  j.rval = 0;
+  j.fields = {{"MESSAGE", "foo"},
+              {"_TRANSPORT", "syslog"},
+              {"EMPTY", ""},
+              {"CODE_LINE", "12"},
+              {"_PID", "99"}};
+  j.entry_timestamps = {100, 200, 300};
+  j.entry_cursor_valid = false;
+  JournalEntry entry;
+  REQUIRE(read_journal_entry(&j, 250, &entry) == 1);
+  REQUIRE(entry.timestamp == 100000);
+  REQUIRE(entry.transport == TRANSPORT_SYSLOG);
+  REQUIRE(entry.fields.size() == 4);
+  REQUIRE(entry.value(*entry.find(FIELD_MESSAGE)) == "foo");
+  REQUIRE(entry.value(*entry.find(FIELD_CODE_LINE)) == "12");
+  REQUIRE(entry.find(FIELD_PRIORITY) == nullptr);
+  REQUIRE(read_journal_entry(&j, 250, &entry) == 1);
+  REQUIRE(entry.timestamp == 200000);
+  REQUIRE(read_journal_entry(&j, 250, &entry) == 0);
+
+  j.fields = {{"_TRANSPORT", "wubbus"}};
+  decode_journal_fields(&j, &entry);
+  REQUIRE(entry.transport == TRANSPORT_UNKNOWN);
+  REQUIRE(entry.fields.size() == 1);
+  REQUIRE(entry.find(FIELD_MESSAGE) == nullptr);
+}
 
 void test_serialize_json(const std::map<std::string, std::string> &base_fields,
                          const nlohmann::json &extra, uint64_t timestamp) {
@@ -222,6 +493,863 @@ TEST_CASE("sets debug file info", "[serialize_json]") {
       10000000050ull);
 }
 
+// decodes the fake journal's current entry as the exporter would.
+JournalEntry decode_entry(sd_journal *j, uint64_t timestamp) {
+  JournalEntry entry;
+  decode_journal_fields(j, &entry);
+  entry.timestamp = timestamp;
+  return entry;
+}
+
+TEST_CASE("coalesces runs of repeated entries", "[coalesce]") {
+  sd_journal j;
+  j.rval = 0;
+  auto make = [&](const std::string &message, uint64_t timestamp) {
+    j.fields = {{"_TRANSPORT", "kernel"}, {"PRIORITY", "3"}, {"MESSAGE", message}};
+    return decode_entry(&j, timestamp);
+  };
+  auto field = [](const JournalEntry &entry, const char *key) {
+    for (const auto &field : entry.fields) {
+      if (entry.key(field) == key) {
+        return std::string(entry.value(field));
+      }
+    }
+    return std::string();
+  };
+  EntryCoalescer coalescer(1000);
+  uint64_t written = 0;
+  uint64_t counted = 0;
+  // returns the timestamps of the summary, if any, and of the entry, if it was not absorbed.
+  auto add = [&](const JournalEntry &entry) {
+    std::vector<uint64_t> timestamps;
+    const bool kept = coalescer.add(entry);
+    if (const JournalEntry *summary = coalescer.take_summary(); summary != nullptr) {
+      timestamps.push_back(summary->timestamp);
+      const std::string count = field(*summary, REPEAT_COUNT_FIELD);
+      counted += count.empty() ? 1 : std::stoull(count);
+      written++;
+    }
+    if (kept) {
+      timestamps.push_back(entry.timestamp);
+      counted++;
+      written++;
+    }
+    return timestamps;
+  };
+
+  REQUIRE(add(make("link down", 0)) == std::vector<uint64_t>{0});
+  // a single repeat is written unchanged, once the next entry ends its run.
+  REQUIRE(add(make("link down", 10)).empty());
+  REQUIRE(add(make("link up", 20)) == std::vector<uint64_t>{10, 20});
+  REQUIRE(coalescer.absorbed_count() == 1);
+
+  // a storm is written as its first entry and one summary per window.
+  for (uint64_t ts = 100; ts < 2600; ts += 10) {
+    auto timestamps = add(make("device descriptor read/64, error -71", ts));
+    if (ts == 100) {
+      REQUIRE(timestamps == std::vector<uint64_t>{100});
+    } else if (ts == 1110 || ts == 2110) {
+      REQUIRE(timestamps == std::vector<uint64_t>{ts - 1000});
+    } else {
+      REQUIRE(timestamps.empty());
+    }
+  }
+  REQUIRE(coalescer.run_deadline() == 2110 + 1000);
+  coalescer.finish();
+  REQUIRE(coalescer.run_deadline() == UINT64_MAX);
+  const JournalEntry *summary = coalescer.take_summary();
+  REQUIRE(summary != nullptr);
+  REQUIRE(summary->timestamp == 2110);
+  REQUIRE(field(*summary, "MESSAGE") == "device descriptor read/64, error -71");
+  REQUIRE(field(*summary, REPEAT_COUNT_FIELD) == "49");
+  REQUIRE(field(*summary, REPEAT_LAST_TIMESTAMP_FIELD) == "2590");
+  counted += 49;
+  written++;
+  REQUIRE(coalescer.take_summary() == nullptr);
+  // a repeat after finish() starts a new run.
+  REQUIRE(add(make("device descriptor read/64, error -71", 2600)).empty());
+  REQUIRE(add(make("link up", 2610)) == std::vector<uint64_t>{2600, 2610});
+
+  // every entry is counted once.
+  REQUIRE(counted == 3 + 250 + 2);
+  REQUIRE(written == 3 + 4 + 2);
+  REQUIRE(coalescer.absorbed_count() == 1 + 249 + 1);
+  REQUIRE(coalescer.summary_count() == 1 + 3 + 1);
+
+  // entries which differ in their unit, or have no message, are never coalesced.
+  j.fields = {{"_TRANSPORT", "stdout"}, {"_SYSTEMD_UNIT", "a.service"}, {"MESSAGE", "x"}};
+  REQUIRE(add(decode_entry(&j, 3000)) == std::vector<uint64_t>{3000});
+  j.fields = {{"_TRANSPORT", "stdout"}, {"_SYSTEMD_UNIT", "b.service"}, {"MESSAGE", "x"}};
+  REQUIRE(add(decode_entry(&j, 3010)) == std::vector<uint64_t>{3010});
+  j.fields = {{"_TRANSPORT", "stdout"}, {"_SYSTEMD_UNIT", "b.service"}};
+  REQUIRE(add(decode_entry(&j, 3020)) == std::vector<uint64_t>{3020});
+  REQUIRE(add(decode_entry(&j, 3030)) == std::vector<uint64_t>{3030});
+}
+
+void test_json_encoder(const std::map<std::string, std::string> &fields,
+                       uint64_t timestamp) {
+  sd_journal j;
+  j.fields = fields;
+  j.rval = 0;
+  JsonEncoder encoder;
+  std::string expected = serialize_json(&j, timestamp);
+  JournalEntry entry = decode_entry(&j, timestamp);
+  REQUIRE(encoder.encode(entry) == expected);
+  // a second encode with the same encoder reuses its buffers
+  REQUIRE(encoder.encode(entry) == expected);
+}
+
+TEST_CASE("drops the least important entries first", "[shedding]") {
+  sd_journal j;
+  j.rval = 0;
+  auto make = [&](const char *unit, const char *priority) {
+    j.fields = {{"_TRANSPORT", "stdout"}, {"MESSAGE", "hello"}, {"_SYSTEMD_UNIT", unit}};
+    if (priority != nullptr) {
+      j.fields["PRIORITY"] = priority;
+    }
+    return decode_entry(&j, 1000);
+  };
+  const JournalEntry debug = make("a.service", "7");
+  const JournalEntry unknown = make("a.service", nullptr);
+  const JournalEntry info = make("b.service", "6");
+  const JournalEntry warning = make("b.service", "4");
+  const JournalEntry error = make("b.service", "3");
+
+  LoadShedder block(OVERLOAD_BLOCK, 100, 400);
+  REQUIRE(block.admit(debug, 1000));
+
+  // the watermark is 100 and the queue holds 400, so each band is 100 entries deep.
+  LoadShedder drop(OVERLOAD_DROP, 100, 400);
+  for (const JournalEntry *entry : {&debug, &unknown, &info, &warning, &error}) {
+    REQUIRE(drop.admit(*entry, 99));
+  }
+  REQUIRE_FALSE(drop.admit(debug, 100));
+  REQUIRE_FALSE(drop.admit(unknown, 150));
+  REQUIRE(drop.admit(info, 199));
+  REQUIRE_FALSE(drop.admit(info, 200));
+  REQUIRE(drop.admit(warning, 299));
+  REQUIRE_FALSE(drop.admit(warning, 300));
+  REQUIRE_FALSE(drop.admit(warning, 1000));
+  REQUIRE(drop.admit(error, 1000));
+  REQUIRE(drop.dropped_count() == 5);
+
+  mcap::Metadata metadata;
+  REQUIRE(drop.take_metadata(&metadata));
+  REQUIRE(metadata.name == DROPPED_METADATA_NAME);
+  REQUIRE(metadata.metadata == mcap::KeyValueMap{{"a.service/DEBUG", "1"},
+                                                 {"a.service/UNKNOWN", "1"},
+                                                 {"b.service/INFO", "1"},
+                                                 {"b.service/WARNING", "2"},
+                                                 {"total", "5"}});
+  // a record is only due once more entries have been dropped.
+  REQUIRE_FALSE(drop.take_metadata(&metadata));
+  REQUIRE_FALSE(drop.admit(debug, 100));
+  REQUIRE(drop.take_metadata(&metadata));
+  REQUIRE(metadata.metadata["a.service/DEBUG"] == "2");
+  REQUIRE(metadata.metadata["total"] == "6");
+
+  LoadShedder sample(OVERLOAD_SAMPLE, 100, 400);
+  uint64_t kept = 0;
+  for (int i = 0; i < 100; ++i) {
+    kept += sample.admit(debug, 1000) ? 1 : 0;
+    kept += sample.admit(info, 1000) ? 1 : 0;
+    REQUIRE(sample.admit(warning, 1000));
+    REQUIRE(sample.admit(unknown, 1000));
+  }
+  REQUIRE(kept == 2 * 100 / OVERLOAD_SAMPLE_INTERVAL);
+  REQUIRE(sample.dropped_count() == 200 - kept);
+}
+
+TEST_CASE("matches serialize_json for well-known fields", "[json_encoder]") {
+  test_json_encoder({{"MESSAGE", "foo"}}, 10000000050ull);
+  test_json_encoder({{"MESSAGE", "foo"}, {"PRIORITY", "3"}}, 0);
+  test_json_encoder({{"MESSAGE", "foo"}, {"PRIORITY", "wubbus"}}, 1);
+  test_json_encoder({{"_TRANSPORT", "audit"}, {"_EXE", "/usr/bin/ldd"}},
+                    UINT64_MAX);
+  test_json_encoder({{"_SYSTEMD_UNIT", "ldd.service"},
+                     {"CODE_FILE", "main.cpp"},
+                     {"CODE_LINE", "99"}},
+                    10000000050ull);
+  test_json_encoder({{"CODE_LINE", " -7"}}, 10);
+  test_json_encoder({{"CODE_LINE", "12abc"}}, 10);
+  test_json_encoder({{"EMPTY", ""}, {"MESSAGE", "has an empty field"}}, 10);
+}
+
+TEST_CASE("overwrites colliding fields like serialize_json", "[json_encoder]") {
+  test_json_encoder({{"message", "lower"}, {"MESSAGE", "upper"}}, 10);
+  test_json_encoder({{"message", "lower"}}, 10);
+  test_json_encoder({{"timestamp", "1"}, {"level", "2"}, {"zzz", "3"}}, 10);
+  test_json_encoder({{"file", "a"}, {"line", "b"}, {"name", "c"}}, 10);
+}
+
+TEST_CASE("escapes strings like serialize_json", "[json_encoder]") {
+  test_json_encoder({{"MESSAGE", "quote \" backslash \\ slash /"}}, 10);
+  test_json_encoder({{"MESSAGE", "\b\f\n\r\t\x01\x1f\x7f"}}, 10);
+  test_json_encoder({{"MESSAGE", "caf\xc3\xa9 \xe6\x97\xa5 \xf0\x9f\x98\x80"}}, 10);
+}
+
+TEST_CASE("matches serialize_json for random entries", "[json_encoder]") {
+  const std::vector<std::string> keys = {
+      "MESSAGE", "PRIORITY",  "_TRANSPORT", "_EXE", "_SYSTEMD_UNIT",
+      "CODE_FILE", "CODE_LINE", "_PID",      "_COMM", "SYSLOG_IDENTIFIER",
+      "message", "timestamp", "A",         "Z_",    "_"};
+  const std::vector<std::string> alphabet = {
+      "a", "Z", "0", "7", " ", "=", "\"", "\\", "/", "\n", "\t",
+      "\x01", "\x1f", "\x7f", "\xc3\xa9", "\xe6\x97\xa5", "\xf0\x9f\x98\x80"};
+  std::mt19937 rng(1234);
+  for (int entry = 0; entry < 2000; ++entry) {
+    std::map<std::string, std::string> fields;
+    size_t field_count = rng() % keys.size();
+    for (size_t i = 0; i < field_count; ++i) {
+      const std::string &key = keys[rng() % keys.size()];
+      std::string value;
+      if (key == "CODE_LINE" || key == "PRIORITY") {
+        value = std::to_string(rng() % 100);
+      } else {
+        size_t value_size = rng() % 40;
+        for (size_t c = 0; c < value_size; ++c) {
+          value += alphabet[rng() % alphabet.size()];
+        }
+      }
+      fields[key] = value;
+    }
+    test_json_encoder(fields, (uint64_t(rng()) << 32) | rng());
+  }
+}
+
+TEST_CASE("omits unparseable line numbers", "[json_encoder]") {
+  sd_journal j;
+  j.fields = {{"CODE_LINE", "wubbus"}};
+  j.rval = 0;
+  JsonEncoder encoder;
+  REQUIRE(encoder.encode(decode_entry(&j, 10)) ==
+          R"({"CODE_LINE":"wubbus","level":0,"timestamp":{"nsec":10,"sec":0}})");
+}
+
+TEST_CASE("replaces invalid UTF-8 like nlohmann's replace mode", "[json_encoder]") {
+  const std::vector<std::string> cases = {
+      "\x80",         "\xff",         "ab\xc3",     "\xc3(",       "\xe0\x80\x80",
+      "\xed\xa0\x80", "\xf4\x90\x80\x80", "\xe6\x97",  "\xe6\x97x",    "\xf0\x9f\x98",
+      "\xc0\xaf",     "x\xf8y",      "\xc3\xa9\xa9", "\xf0\x9f\x98\x80\x80"};
+  for (const auto &value : cases) {
+    std::string out;
+    append_json_string(&out, value);
+    REQUIRE(out == nlohmann::json(value).dump(
+                       -1, ' ', false, nlohmann::json::error_handler_t::replace));
+  }
+}
+
+// formats an entry in the Journal Export Format, with binary fields for values containing
+// a newline, as journalctl does.
+std::string export_entry(const std::vector<std::pair<std::string, std::string>> &fields) {
+  std::string out;
+  for (const auto &[key, value] : fields) {
+    if (value.find('\n') == value.npos) {
+      out += key + "=" + value + "\n";
+      continue;
+    }
+    out += key + "\n";
+    for (int i = 0; i < 8; ++i) {
+      out.push_back(char((uint64_t(value.size()) >> (8 * i)) & 0xff));
+    }
+    out += value + "\n";
+  }
+  return out + "\n";
+}
+
+TEST_CASE("parses the journal export format", "[export_reader]") {
+  std::string traceback = "Traceback:\n  File \"x.py\"\nError: =";
+  traceback += '\0';
+  const std::string first = export_entry({{"__CURSOR", "s=abc;i=1"},
+                                          {"__REALTIME_TIMESTAMP", "1700000000123456"},
+                                          {"__MONOTONIC_TIMESTAMP", "42"},
+                                          {"MESSAGE", traceback},
+                                          {"PRIORITY", "3"},
+                                          {"EMPTY", ""},
+                                          {"SYSLOG_IDENTIFIER", "a=b"},
+                                          {"_TRANSPORT", "stdout"}});
+  const std::string second =
+      export_entry({{"__REALTIME_TIMESTAMP", "1700000000200000"}, {"MESSAGE", "second"}});
+  const std::string data = first + "\n" + second;
+  JournalEntry entry;
+  size_t size = 0;
+  REQUIRE(parse_export_entry(data, false, &size, &entry) == 1);
+  REQUIRE(size == first.size());
+  REQUIRE(entry.timestamp == 1700000000123456000ull);
+  REQUIRE(entry.transport == TRANSPORT_STDOUT);
+  REQUIRE(entry.fields.size() == 4);
+  REQUIRE(entry.key(entry.fields[0]) == "MESSAGE");
+  REQUIRE(entry.value(*entry.find(FIELD_MESSAGE)) == traceback);
+  REQUIRE(entry.value(*entry.find(FIELD_PRIORITY)) == "3");
+  REQUIRE(entry.value(entry.fields[2]) == "a=b");
+  // the entry views the input.
+  REQUIRE(entry.value(entry.fields[1]).data() > data.data());
+  REQUIRE(entry.value(entry.fields[1]).data() < data.data() + data.size());
+  // a copy can outlive the input.
+  JournalEntry copy;
+  copy.copy_from(entry);
+  REQUIRE(copy.external_data == nullptr);
+  REQUIRE(copy.value(*copy.find(FIELD_MESSAGE)) == traceback);
+  REQUIRE(copy.value(copy.fields[2]) == "a=b");
+
+  // the rest parses after extra empty lines, and needs no empty line at the end.
+  const std::string_view rest = std::string_view(data).substr(size);
+  REQUIRE(parse_export_entry(rest, false, &size, &entry) == 1);
+  REQUIRE(size == rest.size());
+  REQUIRE(entry.value(entry.fields[0]) == "second");
+  REQUIRE(entry.transport == TRANSPORT_UNKNOWN);
+  const std::string_view unterminated = rest.substr(0, rest.size() - 1);
+  REQUIRE(parse_export_entry(unterminated, false, &size, &entry) == 0);
+  REQUIRE(parse_export_entry(unterminated, true, &size, &entry) == 1);
+  REQUIRE(size == unterminated.size());
+  REQUIRE(parse_export_entry("\n\n", true, &size, &entry) == 0);
+
+  // a prefix of an entry is incomplete while more may follow, and malformed at the end.
+  for (size_t length = 0; length < first.size(); ++length) {
+    const std::string_view prefix = std::string_view(first).substr(0, length);
+    INFO(length);
+    REQUIRE(parse_export_entry(prefix, false, &size, &entry) == 0);
+    // prefixes ending with a whole line are entries themselves, if they have a timestamp.
+    if (length > 0 && prefix.back() != '\n') {
+      REQUIRE(parse_export_entry(prefix, true, &size, &entry) == -EBADMSG);
+    }
+  }
+  REQUIRE(parse_export_entry("MESSAGE=no timestamp\n\n", true, &size, &entry) == -EBADMSG);
+  REQUIRE(parse_export_entry("__REALTIME_TIMESTAMP=12x\n\n", true, &size, &entry) == -EBADMSG);
+  REQUIRE(parse_export_entry("=value\n\n", true, &size, &entry) == -EBADMSG);
+  std::string bad_binary = export_entry({{"__REALTIME_TIMESTAMP", "1"}, {"A", "x\ny"}});
+  bad_binary[bad_binary.size() - 2] = '!';
+  REQUIRE(parse_export_entry(bad_binary, true, &size, &entry) == -EBADMSG);
+}
+
+TEST_CASE("encodes imported entries like serialize_json", "[export_reader]") {
+  sd_journal j;
+  j.rval = 0;
+  j.fields = {{"CODE_FILE", "main.cpp"}, {"CODE_LINE", "99"},
+              {"MESSAGE", "two\nlines"}, {"PRIORITY", "4"},
+              {"_SYSTEMD_UNIT", "ldd.service"}, {"_TRANSPORT", "journal"}};
+  std::vector<std::pair<std::string, std::string>> fields = {
+      {"__REALTIME_TIMESTAMP", "10000000"}};
+  fields.insert(fields.end(), j.fields.begin(), j.fields.end());
+  const std::string data = export_entry(fields);
+  JournalEntry entry;
+  size_t size = 0;
+  REQUIRE(parse_export_entry(data, true, &size, &entry) == 1);
+  JsonEncoder encoder;
+  REQUIRE(encoder.encode(entry) == serialize_json(&j, 10000000000ull));
+  ProtobufEncoder protobuf;
+  const std::string imported(protobuf.encode(entry));
+  REQUIRE(imported == protobuf.encode(decode_entry(&j, 10000000000ull)));
+}
+
+TEST_CASE("reads export files and pipes", "[export_reader]") {
+  std::string data;
+  for (int i = 0; i < 2000; ++i) {
+    data += export_entry({{"__REALTIME_TIMESTAMP", std::to_string((1000 + i) * 1'000'000ull)},
+                          {"MESSAGE", "entry " + std::to_string(i) + std::string(i, '\n')},
+                          {"_TRANSPORT", i % 2 == 0 ? "kernel" : "syslog"}});
+  }
+  char dir[] = "/tmp/journal2mcap-test-XXXXXX";
+  REQUIRE(mkdtemp(dir) != nullptr);
+  const std::string file = std::string(dir) + "/journal.export";
+  const std::string fifo = std::string(dir) + "/journal.fifo";
+  {
+    std::ofstream out(file, std::ios::binary);
+    out << data;
+  }
+  REQUIRE(mkfifo(fifo.c_str(), 0600) == 0);
+  // feeds the pipe in small writes, so that entries span reads.
+  std::thread feeder([&]() {
+    int fd = open(fifo.c_str(), O_WRONLY);
+    for (size_t pos = 0; pos < data.size(); pos += 999) {
+      const size_t length = std::min<size_t>(999, data.size() - pos);
+      REQUIRE(write(fd, data.data() + pos, length) == ssize_t(length));
+    }
+    close(fd);
+  });
+  for (const std::string &path : {file, fifo}) {
+    ExportReader reader;
+    REQUIRE(reader.open(path) == 0);
+    JournalEntry entry;
+    for (int i = 0; i < 2000; ++i) {
+      REQUIRE(reader.read(&entry) == 1);
+      REQUIRE(entry.timestamp == (1000 + i) * 1'000'000'000ull);
+      REQUIRE(entry.value(*entry.find(FIELD_MESSAGE)) ==
+              "entry " + std::to_string(i) + std::string(i, '\n'));
+    }
+    REQUIRE(reader.read(&entry) == 0);
+    REQUIRE(reader.bytes_read() == data.size());
+  }
+  feeder.join();
+
+  // the whole file is imported with the journal's channels, between --start and --end.
+  const std::string output = std::string(dir) + "/out.mcap";
+  LogWriter writer;
+  JsonEncoder encoder;
+  REQUIRE(writer.open(output, encoder).ok());
+  REQUIRE(import_export_file(Options{.start = TIME_UNIX,
+                                     .start_sec = 1500,
+                                     .end = TIME_UNIX,
+                                     .end_sec = 1999,
+                                     .import_file = file},
+                             &writer) == 0);
+  writer.close();
+  REQUIRE(writer.entry_count(TRANSPORT_KERNEL) == 250);
+  REQUIRE(writer.entry_count(TRANSPORT_SYSLOG) == 250);
+  REQUIRE(import_export_file(Options{.import_file = std::string(dir) + "/missing"}, &writer) ==
+          ENOENT);
+  REQUIRE(std::system(("rm -r " + std::string(dir)).c_str()) == 0);
+}
+
+struct TestJournalEntry {
+  uint64_t seqnum;
+  uint64_t realtime_usec;
+  uint8_t boot;
+  std::vector<std::string> fields;
+};
+
+void append_le(std::string *out, uint64_t value, size_t size) {
+  for (size_t i = 0; i < size; ++i) {
+    out->push_back(char((value >> (8 * i)) & 0xff));
+  }
+}
+
+// writes `entries` in the journal file format, with `compression` (1 for XZ, 2 for LZ4 and
+// 4 for ZSTD) used for fields of 64 bytes or more, and entry arrays of 3 items. Identical
+// fields share a DATA object, as journald writes them. `state` 2 marks the file archived.
+std::string write_journal_file(const std::string &path,
+                               const std::vector<TestJournalEntry> &entries, bool compact,
+                               uint8_t compression, uint8_t seqnum_id = 1, uint8_t state = 0) {
+  constexpr size_t HEADER_SIZE = 272;
+  constexpr size_t ARRAY_CAPACITY = 3;
+  std::string out(HEADER_SIZE, '\0');
+  auto begin_object = [&](uint8_t type, uint8_t flags) {
+    out.resize((out.size() + 7) / 8 * 8, '\0');
+    const size_t offset = out.size();
+    out.push_back(char(type));
+    out.push_back(char(flags));
+    out.append(14, '\0');
+    return offset;
+  };
+  auto end_object = [&](size_t offset) {
+    std::string size;
+    append_le(&size, out.size() - offset, 8);
+    out.replace(offset + 8, 8, size);
+  };
+  std::map<std::string, size_t> data_offsets;
+  std::vector<size_t> entry_offsets;
+  for (const auto &entry : entries) {
+    std::vector<size_t> items;
+    for (const auto &field : entry.fields) {
+      if (auto it = data_offsets.find(field); it != data_offsets.end()) {
+        items.push_back(it->second);
+        continue;
+      }
+      std::string payload = field;
+      uint8_t flags = field.size() >= 64 ? compression : 0;
+      if (flags == 1) {
+        payload.resize(lzma_stream_buffer_bound(field.size()));
+        size_t size = 0;
+        REQUIRE(lzma_easy_buffer_encode(6, LZMA_CHECK_CRC64, nullptr,
+                                        (const uint8_t *)(field.data()), field.size(),
+                                        (uint8_t *)(payload.data()), &size,
+                                        payload.size()) == LZMA_OK);
+        payload.resize(size);
+      } else if (flags == 2) {
+        payload.clear();
+        append_le(&payload, field.size(), 8);
+        payload.resize(8 + LZ4_compressBound(int(field.size())));
+        const int size = LZ4_compress_default(field.data(), payload.data() + 8,
+                                              int(field.size()), int(payload.size() - 8));
+        REQUIRE(size > 0);
+        payload.resize(8 + size);
+      } else if (flags == 4) {
+        payload.resize(ZSTD_compressBound(field.size()));
+        const size_t size =
+            ZSTD_compress(payload.data(), payload.size(), field.data(), field.size(), 3);
+        REQUIRE(!ZSTD_isError(size));
+        payload.resize(size);
+      }
+      const size_t offset = begin_object(1, flags);
+      // hash, hash chain, field chain, entry and entry array links, entry count.
+      out.append(48, '\0');
+      if (compact) {
+        out.append(8, '\0');
+      }
+      out += payload;
+      end_object(offset);
+      data_offsets[field] = offset;
+      items.push_back(offset);
+    }
+    const size_t offset = begin_object(3, 0);
+    append_le(&out, entry.seqnum, 8);
+    append_le(&out, entry.realtime_usec, 8);
+    append_le(&out, entry.realtime_usec - 1'000'000, 8);
+    out.append(16, char(entry.boot));
+    append_le(&out, entry.seqnum * 31, 8);
+    for (size_t item : items) {
+      append_le(&out, item, compact ? 4 : 8);
+      if (!compact) {
+        append_le(&out, 0, 8);
+      }
+    }
+    end_object(offset);
+    entry_offsets.push_back(offset);
+  }
+  size_t first_array = 0;
+  size_t previous_array = 0;
+  for (size_t i = 0; i < entry_offsets.size(); i += ARRAY_CAPACITY) {
+    const size_t offset = begin_object(6, 0);
+    append_le(&out, 0, 8);
+    for (size_t j = i; j < i + ARRAY_CAPACITY; ++j) {
+      append_le(&out, j < entry_offsets.size() ? entry_offsets[j] : 0, compact ? 4 : 8);
+    }
+    end_object(offset);
+    if (previous_array != 0) {
+      std::string link;
+      append_le(&link, offset, 8);
+      out.replace(previous_array + 16, 8, link);
+    } else {
+      first_array = offset;
+    }
+    previous_array = offset;
+  }
+  std::string header = "LPKSHHRH";
+  append_le(&header, 0, 4);
+  const uint8_t compression_flag = compression == 4 ? 8 : compression;
+  append_le(&header, (compact ? 16 : 0) | (compression != 0 ? compression_flag : 0), 4);
+  header.push_back(char(state));
+  header.append(39, '\0');
+  header.append(16, char(entries.empty() ? 0 : entries.back().boot));
+  header.append(16, char(seqnum_id));
+  append_le(&header, HEADER_SIZE, 8);
+  append_le(&header, out.size() - HEADER_SIZE, 8);
+  header.append(48, '\0');
+  append_le(&header, entries.size(), 8);
+  header.append(16, '\0');
+  append_le(&header, first_array, 8);
+  append_le(&header, entries.empty() ? 0 : entries.front().realtime_usec, 8);
+  append_le(&header, entries.empty() ? 0 : entries.back().realtime_usec, 8);
+  out.replace(0, header.size(), header);
+  std::ofstream file(path, std::ios::binary);
+  file << out;
+  return out;
+}
+
+std::vector<std::pair<std::string, std::string>> entry_fields(const JournalEntry &entry) {
+  std::vector<std::pair<std::string, std::string>> fields;
+  for (const auto &field : entry.fields) {
+    fields.emplace_back(entry.key(field), entry.value(field));
+  }
+  return fields;
+}
+
+TEST_CASE("reads journal files without libsystemd", "[journal_file]") {
+  const std::string trace = "Traceback (most recent call last):\n" + std::string(200, 'x');
+  std::vector<TestJournalEntry> entries;
+  for (uint64_t i = 0; i < 10; ++i) {
+    entries.push_back(TestJournalEntry{
+        100 + i, 1'000'000'000 + i * 1000, 1,
+        {"MESSAGE=" + (i % 2 == 0 ? trace : "line " + std::to_string(i)), "PRIORITY=3",
+         "EMPTY=", "NO_EQUALS", i < 5 ? "_TRANSPORT=kernel" : "_TRANSPORT=stdout"}});
+  }
+  char dir[] = "/tmp/journal2mcap-test-XXXXXX";
+  REQUIRE(mkdtemp(dir) != nullptr);
+  const std::string path = std::string(dir) + "/system.journal";
+  for (auto [compact, compression] : std::vector<std::pair<bool, uint8_t>>{
+           {false, 0}, {false, 1}, {false, 2}, {false, 4}, {true, 0}, {true, 4}}) {
+    INFO("compact " << compact << " compression " << int(compression));
+    write_journal_file(path, entries, compact, compression);
+    JournalFile file;
+    REQUIRE(file.open(path) == 0);
+    REQUIRE(file.entry_count() == 10);
+    JournalEntry entry;
+    for (uint64_t i = 0; i < 10; ++i) {
+      REQUIRE(file.next() == 1);
+      REQUIRE(file.location().seqnum == 100 + i);
+      REQUIRE(file.location().realtime_usec == 1'000'000'000 + i * 1000);
+      file.decode_fields(&entry);
+      // fields without a value or an '=' are skipped, as by decode_journal_fields().
+      REQUIRE(entry_fields(entry) ==
+              std::vector<std::pair<std::string, std::string>>{
+                  {"MESSAGE", i % 2 == 0 ? trace : "line " + std::to_string(i)},
+                  {"PRIORITY", "3"},
+                  {"_TRANSPORT", i < 5 ? "kernel" : "stdout"}});
+      REQUIRE(entry.transport == (i < 5 ? TRANSPORT_KERNEL : TRANSPORT_STDOUT));
+      REQUIRE(entry.value(*entry.find(FIELD_PRIORITY)) == "3");
+    }
+    REQUIRE(file.next() == 0);
+
+    REQUIRE(file.seek_realtime_usec(1'000'004'500) == 0);
+    REQUIRE(file.previous() == 1);
+    REQUIRE(file.location().seqnum == 104);
+    REQUIRE(file.next() == 1);
+    REQUIRE(file.location().seqnum == 105);
+    REQUIRE(file.seek_realtime_usec(2'000'000'000) == 0);
+    REQUIRE(file.next() == 0);
+    file.seek_head();
+    REQUIRE(file.previous() == 0);
+    REQUIRE(file.next() == 1);
+    REQUIRE(file.location().seqnum == 100);
+  }
+
+  // files which are not journal files, or use unknown format features, are rejected.
+  std::string data = write_journal_file(path, entries, true, 0);
+  data[12] = char(0x80);
+  std::ofstream(path, std::ios::binary) << data;
+  REQUIRE(JournalFile().open(path) == -EPROTONOSUPPORT);
+  data[0] = 'X';
+  std::ofstream(path, std::ios::binary) << data;
+  REQUIRE(JournalFile().open(path) == -EBADMSG);
+  std::ofstream(path, std::ios::binary) << "";
+  REQUIRE(JournalFile().open(path) == -EBADMSG);
+  REQUIRE(JournalFile().open(std::string(dir) + "/missing.journal") == -ENOENT);
+  REQUIRE(std::system(("rm -r " + std::string(dir)).c_str()) == 0);
+}
+
+TEST_CASE("interleaves journal files in libsystemd's order", "[journal_file]") {
+  char dir[] = "/tmp/journal2mcap-test-XXXXXX";
+  REQUIRE(mkdtemp(dir) != nullptr);
+  auto entry = [](uint64_t seqnum, uint64_t realtime_sec, uint8_t boot) {
+    return TestJournalEntry{seqnum, realtime_sec * 1'000'000, boot,
+                            {"MESSAGE=" + std::to_string(seqnum)}};
+  };
+  // an archived file and the active one of the same journald, which are interleaved by
+  // sequence number, and an entry in both of them.
+  write_journal_file(std::string(dir) + "/system@1.journal",
+                     {entry(1, 10, 1), entry(2, 11, 1), entry(4, 20, 2), entry(5, 21, 2)}, true,
+                     4);
+  write_journal_file(std::string(dir) + "/system.journal",
+                     {entry(3, 12, 1), entry(5, 21, 2), entry(6, 22, 2), entry(7, 23, 2)},
+                     false, 0);
+  // a file from another journald, whose entries are ordered by time.
+  write_journal_file(std::string(dir) + "/user-1000.journal", {entry(1, 13, 1)}, false, 0, 2);
+  std::ofstream(std::string(dir) + "/ignored.txt") << "not a journal";
+  std::ofstream(std::string(dir) + "/empty.journal~");
+
+  MappedJournal journal;
+  REQUIRE(journal.open(JournalSource{dir, {}}) == 0);
+  REQUIRE(journal.file_count() == 3);
+  auto read_all = [&](uint64_t end_usec) {
+    std::vector<std::string> messages;
+    JournalEntry read;
+    int err = 0;
+    while ((err = journal.read_entry(end_usec, &read)) > 0) {
+      messages.emplace_back(read.value(*read.find(FIELD_MESSAGE)));
+    }
+    REQUIRE(err == 0);
+    return messages;
+  };
+  journal.seek_head();
+  REQUIRE(read_all(UINT64_MAX) ==
+          std::vector<std::string>{"1", "2", "3", "1", "4", "5", "6", "7"});
+  journal.seek_head();
+  REQUIRE(read_all(11'000'000) == std::vector<std::string>{"1"});
+
+  sd_id128_t boot;
+  REQUIRE(journal.find_boot_before(21'000'000, &boot) == 1);
+  REQUIRE(boot.bytes[0] == 2);
+  REQUIRE(journal.find_boot_before(12'500'000, &boot) == 1);
+  REQUIRE(boot.bytes[0] == 1);
+  REQUIRE(journal.find_boot_before(10'000'000, &boot) == 0);
+  journal.match_boot_id(boot);
+  journal.seek_head();
+  REQUIRE(read_all(UINT64_MAX) == std::vector<std::string>{"1", "2", "3", "1"});
+  REQUIRE(journal.seek_realtime_usec(11'000'000) == 0);
+  REQUIRE(read_all(UINT64_MAX) == std::vector<std::string>{"2", "3", "1"});
+
+  MappedJournal files;
+  REQUIRE(files.open(JournalSource{"", {std::string(dir) + "/system.journal"}}) == 0);
+  files.seek_head();
+  REQUIRE(files.next() == 1);
+  REQUIRE(files.location().seqnum == 3);
+  MappedJournal missing;
+  REQUIRE(missing.open(JournalSource{"", {std::string(dir) + "/empty.journal~"}}) == -EBADMSG);
+  REQUIRE(std::system(("rm -r " + std::string(dir)).c_str()) == 0);
+}
+
+TEST_CASE("selects the journal files which may hold the exported entries", "[journal_file]") {
+  char dir[] = "/tmp/journal2mcap-test-XXXXXX";
+  REQUIRE(mkdtemp(dir) != nullptr);
+  auto entry = [](uint64_t seqnum, uint64_t realtime_sec, uint8_t boot) {
+    return TestJournalEntry{seqnum, realtime_sec * 1'000'000, boot,
+                            {"MESSAGE=" + std::to_string(seqnum)}};
+  };
+  const std::string old_boot = std::string(dir) + "/system@1.journal";
+  const std::string spanning = std::string(dir) + "/system@2.journal";
+  const std::string empty = std::string(dir) + "/system@3.journal";
+  const std::string active = std::string(dir) + "/system.journal";
+  const std::string truncated = std::string(dir) + "/user-1000.journal";
+  write_journal_file(old_boot, {entry(1, 10, 1), entry(2, 20, 1)}, true, 0, 1, 2);
+  write_journal_file(spanning, {entry(3, 30, 1), entry(4, 40, 2)}, true, 0, 1, 2);
+  write_journal_file(empty, {}, true, 0, 1, 2);
+  write_journal_file(active, {entry(5, 50, 2)}, true, 0, 1, 1);
+  std::ofstream(truncated, std::ios::binary) << "LPKSHHRH";
+
+  JournalFileHeader header;
+  REQUIRE(read_journal_file_header(spanning, &header) == 0);
+  REQUIRE(header.archived);
+  REQUIRE(header.entry_count == 2);
+  REQUIRE(header.head_realtime_usec == 30'000'000);
+  REQUIRE(header.tail_realtime_usec == 40'000'000);
+  REQUIRE(header.tail_boot_id.bytes[0] == 2);
+  REQUIRE(read_journal_file_header(active, &header) == 0);
+  REQUIRE(!header.archived);
+  REQUIRE(read_journal_file_header(truncated, &header) == -EBADMSG);
+  REQUIRE(read_journal_file_header(std::string(dir) + "/missing.journal", &header) == -ENOENT);
+
+  std::vector<std::string> paths;
+  REQUIRE(list_journal_files(dir, &paths) == 0);
+  REQUIRE(paths.size() == 5);
+  auto select = [&](JournalFileFilter filter) {
+    std::vector<std::string> selected = select_journal_files(paths, filter);
+    std::sort(selected.begin(), selected.end());
+    return selected;
+  };
+  // the active file and files which cannot be judged by their header are always opened.
+  REQUIRE(select(JournalFileFilter{}) ==
+          std::vector<std::string>{active, old_boot, spanning, truncated});
+  REQUIRE(select(JournalFileFilter{.start_usec = 25'000'000}) ==
+          std::vector<std::string>{active, spanning, truncated});
+  REQUIRE(select(JournalFileFilter{.start_usec = 40'000'001}) ==
+          std::vector<std::string>{active, truncated});
+  REQUIRE(select(JournalFileFilter{.end_usec = 30'000'000}) ==
+          std::vector<std::string>{active, old_boot, truncated});
+  sd_id128_t boot;
+  memset(boot.bytes, 2, sizeof(boot.bytes));
+  REQUIRE(select(JournalFileFilter{.match_boot = true, .boot_id = boot}) ==
+          std::vector<std::string>{active, spanning, truncated});
+  REQUIRE(std::system(("rm -r " + std::string(dir)).c_str()) == 0);
+}
+
+struct WireField {
+  uint32_t number;
+  uint32_t wire_type;
+  uint64_t varint;
+  std::string bytes;
+};
+
+// decodes the top level of a protobuf message, failing the test on malformed input.
+std::vector<WireField> decode_wire(std::string_view data) {
+  std::vector<WireField> fields;
+  size_t pos = 0;
+  auto read_varint = [&]() {
+    uint64_t value = 0;
+    for (int shift = 0;; shift += 7) {
+      REQUIRE(pos < data.size());
+      uint8_t byte = data[pos++];
+      value |= uint64_t(byte & 0x7F) << shift;
+      if ((byte & 0x80) == 0) {
+        return value;
+      }
+    }
+  };
+  while (pos < data.size()) {
+    uint64_t tag = read_varint();
+    WireField field{uint32_t(tag >> 3), uint32_t(tag & 7), 0, {}};
+    switch (field.wire_type) {
+    case 0:
+      field.varint = read_varint();
+      break;
+    case 2: {
+      uint64_t size = read_varint();
+      REQUIRE(pos + size <= data.size());
+      field.bytes = std::string(data.substr(pos, size));
+      pos += size;
+      break;
+    }
+    case 5:
+      REQUIRE(pos + 4 <= data.size());
+      field.bytes = std::string(data.substr(pos, 4));
+      pos += 4;
+      break;
+    default:
+      FAIL("unexpected wire type " << field.wire_type);
+    }
+    fields.push_back(field);
+  }
+  return fields;
+}
+
+TEST_CASE("encodes a minimal log message", "[protobuf_encoder]") {
+  sd_journal j;
+  j.fields = {{"MESSAGE", "foo"}, {"PRIORITY", "4"}};
+  j.rval = 0;
+  ProtobufEncoder encoder;
+  // timestamp {seconds: 10, nanos: 50}, level: WARNING, message: "foo",
+  // journal_fields {key: "PRIORITY", value: "4"}
+  std::string expected("\x0a\x04\x08\x0a\x10\x32"
+                       "\x10\x03"
+                       "\x1a\x03"
+                       "foo"
+                       "\x7a\x0d\x0a\x08"
+                       "PRIORITY"
+                       "\x12\x01"
+                       "4");
+  REQUIRE(encoder.encode(decode_entry(&j, 10000000050ull)) == expected);
+}
+
+TEST_CASE("keeps unrecognized fields as journal_fields", "[protobuf_encoder]") {
+  sd_journal j;
+  j.fields = {{"MESSAGE", "foo"},
+              {"_SYSTEMD_UNIT", "ldd.service"},
+              {"_EXE", "/usr/bin/ldd"},
+              {"_TRANSPORT", "stdout"},
+              {"CODE_FILE", "main.cpp"},
+              {"CODE_LINE", "99"},
+              {"BAD_UTF8", "a\xff"}};
+  j.rval = 0;
+  ProtobufEncoder encoder;
+  std::vector<WireField> fields = decode_wire(encoder.encode(decode_entry(&j, 0)));
+  std::map<std::string, std::string> journal_fields;
+  std::map<uint32_t, WireField> log_fields;
+  for (const auto &field : fields) {
+    if (field.number == JOURNAL_FIELDS_FIELD_NUMBER) {
+      std::vector<WireField> pair = decode_wire(field.bytes);
+      REQUIRE(pair.size() == 2);
+      journal_fields[pair[0].bytes] = pair[1].bytes;
+    } else {
+      log_fields[field.number] = field;
+    }
+  }
+  REQUIRE(log_fields.at(1).bytes == "");
+  REQUIRE(log_fields.count(2) == 0);
+  REQUIRE(log_fields.at(3).bytes == "foo");
+  REQUIRE(log_fields.at(4).bytes == "ldd.service");
+  REQUIRE(log_fields.at(5).bytes == "main.cpp");
+  REQUIRE(log_fields.at(6).bytes == std::string("\x63\x00\x00\x00", 4));
+  REQUIRE(journal_fields == std::map<std::string, std::string>{
+                                {"_EXE", "/usr/bin/ldd"},
+                                {"_TRANSPORT", "stdout"},
+                                {"BAD_UTF8", "a\xef\xbf\xbd"}});
+}
+
+TEST_CASE("keeps non-canonical line numbers as journal_fields",
+          "[protobuf_encoder]") {
+  for (std::string line : {"0", "099", "12abc", "4294967296", "-1"}) {
+    sd_journal j;
+    j.fields = {{"CODE_LINE", line}};
+    j.rval = 0;
+    ProtobufEncoder encoder;
+    std::vector<WireField> fields = decode_wire(encoder.encode(decode_entry(&j, 0)));
+    REQUIRE(fields.size() == 2);
+    REQUIRE(fields[1].number == JOURNAL_FIELDS_FIELD_NUMBER);
+    REQUIRE(decode_wire(fields[1].bytes)[1].bytes == line);
+  }
+}
+
+TEST_CASE("describes foxglove.Log", "[protobuf_encoder]") {
+  std::vector<WireField> files = decode_wire(log_file_descriptor_set());
+  std::vector<std::string> names;
+  for (const auto &file : files) {
+    REQUIRE(file.number == 1);
+    names.push_back(decode_wire(file.bytes)[0].bytes);
+  }
+  REQUIRE(names == std::vector<std::string>{"google/protobuf/timestamp.proto",
+                                            "foxglove/KeyValuePair.proto",
+                                            "foxglove/Log.proto"});
+}
+
 TEST_CASE("uses current boot ID", "[apply_boot_id_match]") {
   Options options{.start = TIME_BOOT, .end = TIME_NOW};
   sd_journal j;
@@ -230,3 +1358,1281 @@ TEST_CASE("uses current boot ID", "[apply_boot_id_match]") {
   REQUIRE(j.matches == std::vector<std::string>{
                            "_BOOT_ID=000102030405060708090a0b0c0d0e0f"});
 }
+
+TEST_CASE("adds no matches without filters", "[apply_filter_matches]") {
+  sd_journal j;
+  REQUIRE(apply_filter_matches(&j, Options{}) == 0);
+  REQUIRE(j.matches.empty());
+}
+
+TEST_CASE("adds each filter as a conjunction term", "[apply_filter_matches]") {
+  Options options{.units = {"sshd", "nginx.service"},
+                  .max_priority = 2,
+                  .transports = {"stdout"},
+                  .matches = {"_PID=1", "_COMM=ssh"}};
+  sd_journal j;
+  REQUIRE(apply_filter_matches(&j, options) == 0);
+  REQUIRE(j.matches == std::vector<std::string>{"AND",
+                                                "_SYSTEMD_UNIT=sshd.service",
+                                                "_SYSTEMD_UNIT=nginx.service",
+                                                "OR",
+                                                "UNIT=sshd.service",
+                                                "UNIT=nginx.service",
+                                                "_PID=1",
+                                                "AND",
+                                                "PRIORITY=0",
+                                                "PRIORITY=1",
+                                                "PRIORITY=2",
+                                                "AND",
+                                                "_TRANSPORT=stdout",
+                                                "AND",
+                                                "_PID=1",
+                                                "_COMM=ssh"});
+}
+
+TEST_CASE("resumes after the saved entry", "[cursor]") {
+  sd_journal j;
+  j.rval = 0;
+  j.entry_timestamps = {100, 200, 300};
+  JournalEntry entry;
+  REQUIRE(seek_after_cursor(&j, "t=200") == 0);
+  REQUIRE(read_journal_entry(&j, UINT64_MAX, &entry) == 1);
+  REQUIRE(entry.timestamp == 300000);
+  REQUIRE(read_journal_entry(&j, UINT64_MAX, &entry) == 0);
+
+  // the saved entry was vacuumed, so resume with the first entry after it.
+  j.entry_timestamps = {100, 300};
+  REQUIRE(seek_after_cursor(&j, "t=200") == 0);
+  REQUIRE(read_journal_entry(&j, UINT64_MAX, &entry) == 1);
+  REQUIRE(entry.timestamp == 300000);
+
+  // ... including when it was the first entry.
+  j.entry_timestamps = {300};
+  REQUIRE(seek_after_cursor(&j, "t=200") == 0);
+  REQUIRE(read_journal_entry(&j, UINT64_MAX, &entry) == 1);
+  REQUIRE(entry.timestamp == 300000);
+
+  // nothing new since the saved entry.
+  j.entry_timestamps = {100, 200};
+  REQUIRE(seek_after_cursor(&j, "t=200") == 0);
+  REQUIRE(read_journal_entry(&j, UINT64_MAX, &entry) == 0);
+}
+
+TEST_CASE("gets the cursor of the last entry read", "[cursor]") {
+  sd_journal j;
+  j.rval = 0;
+  j.entry_timestamps = {100, 200, 300};
+  JournalEntry entry;
+  std::string cursor;
+  sd_journal_seek_head(&j);
+  while (read_journal_entry(&j, UINT64_MAX, &entry) == 1) {
+  }
+  REQUIRE(get_last_read_cursor(&j, UINT64_MAX, &cursor) == 0);
+  REQUIRE(cursor == "t=300");
+
+  // the read which hit the end bound stopped on an entry that was not exported.
+  sd_journal_seek_head(&j);
+  while (read_journal_entry(&j, 250, &entry) == 1) {
+  }
+  REQUIRE(get_last_read_cursor(&j, 250, &cursor) == 0);
+  REQUIRE(cursor == "t=200");
+}
+
+TEST_CASE("parses the timestamp of a cursor", "[cursor]") {
+  uint64_t usec = 0;
+  REQUIRE(cursor_realtime_usec("s=0123abcd;i=1f;b=4567;m=2a;t=5f5e100;x=89ab", &usec) == 0);
+  REQUIRE(usec == 100'000'000);
+  REQUIRE(cursor_realtime_usec("t=200", &usec) == 0);
+  REQUIRE(usec == 0x200);
+  REQUIRE(cursor_realtime_usec("s=0123abcd;i=1f", &usec) == -EINVAL);
+  REQUIRE(cursor_realtime_usec("t=;i=1f", &usec) == -EINVAL);
+}
+
+TEST_CASE("round trips the state file", "[state_file]") {
+  char dir_template[] = "/tmp/journal2mcap-test-XXXXXX";
+  REQUIRE(mkdtemp(dir_template) != nullptr);
+  const std::string path = std::string(dir_template) + "/state";
+  std::string cursor = "unchanged";
+  REQUIRE(read_state_file(path, &cursor) == 0);
+  REQUIRE(cursor.empty());
+  REQUIRE(write_state_file(path, "s=abc;i=1") == 0);
+  REQUIRE(read_state_file(path, &cursor) == 0);
+  REQUIRE(cursor == "s=abc;i=1");
+  REQUIRE(write_state_file(path, "s=abc;i=2") == 0);
+  REQUIRE(read_state_file(path, &cursor) == 0);
+  REQUIRE(cursor == "s=abc;i=2");
+  REQUIRE(access((path + ".tmp").c_str(), F_OK) != 0);
+  REQUIRE(unlink(path.c_str()) == 0);
+  REQUIRE(rmdir(dir_template) == 0);
+  REQUIRE(write_state_file(path, "x") == -ENOENT);
+}
+
+TEST_CASE("stops before the end timestamp", "[next_journal_entry]") {
+  sd_journal j;
+  j.rval = 0;
+  j.entry_timestamps = {100, 200, 300};
+  sd_journal_seek_head(&j);
+  REQUIRE(next_journal_entry_before(&j, 250) == 1);
+  REQUIRE(next_journal_entry_before(&j, 250) == 1);
+  REQUIRE(next_journal_entry_before(&j, 250) == 0);
+  sd_journal_seek_head(&j);
+  REQUIRE(next_journal_entry_before(&j, 100) == 0);
+}
+
+TEST_CASE("includes entries logged at the end timestamp", "[next_journal_entry]") {
+  sd_journal j;
+  j.rval = 0;
+  j.entry_timestamps = {1'000'000, 1'999'999, 2'000'000, 2'000'001};
+  sd_journal_seek_head(&j);
+  REQUIRE(next_journal_entry(&j, TIME_UNIX, 2) == 1);
+  REQUIRE(next_journal_entry(&j, TIME_UNIX, 2) == 1);
+  REQUIRE(next_journal_entry(&j, TIME_UNIX, 2) == 1);
+  REQUIRE(next_journal_entry(&j, TIME_UNIX, 2) == 0);
+}
+
+TEST_CASE("splits a time range into contiguous slices", "[split_time_range]") {
+  auto slices = split_time_range(100, 110, 3);
+  REQUIRE(slices.size() == 3);
+  REQUIRE(slices[0].start_usec == 100);
+  REQUIRE(slices[0].end_usec == 104);
+  REQUIRE(slices[1].start_usec == 104);
+  REQUIRE(slices[1].end_usec == 107);
+  REQUIRE(slices[2].start_usec == 107);
+  REQUIRE(slices[2].end_usec == 110);
+  REQUIRE(split_time_range(100, 102, 8).size() == 2);
+  REQUIRE(split_time_range(100, 100, 8).empty());
+  REQUIRE(split_time_range(100, 200, 0).empty());
+}
+
+TEST_CASE("finds a source for each machine and file directory", "[find_journal_sources]") {
+  char root[] = "/tmp/journal2mcap-test-XXXXXX";
+  REQUIRE(mkdtemp(root) != nullptr);
+  const std::string journal = std::string(root) + "/journal";
+  const std::string machine_a = "0123456789abcdef0123456789abcdef";
+  const std::string machine_b = "fedcba9876543210fedcba9876543210";
+  const std::string flat = std::string(root) + "/flat";
+  for (const std::string &dir : {journal, journal + "/" + machine_b, journal + "/" + machine_a,
+                                 journal + "/not-a-machine", flat}) {
+    REQUIRE(mkdir(dir.c_str(), 0755) == 0);
+  }
+  std::vector<JournalSource> sources;
+  REQUIRE(find_journal_sources(Options{.directories = {journal, flat},
+                                       .files = {"a/system.journal", "b/system.journal",
+                                                 "a/user-1000.journal", "system.journal"}},
+                               &sources) == 0);
+  REQUIRE(sources.size() == 6);
+  REQUIRE(sources[0].directory == journal + "/" + machine_a);
+  REQUIRE(sources[1].directory == journal + "/" + machine_b);
+  REQUIRE(sources[2].directory == flat);
+  REQUIRE(sources[3].directory.empty());
+  REQUIRE(sources[3].files ==
+          std::vector<std::string>{"a/system.journal", "a/user-1000.journal"});
+  REQUIRE(sources[4].files == std::vector<std::string>{"b/system.journal"});
+  REQUIRE(sources[5].files == std::vector<std::string>{"system.journal"});
+  REQUIRE(find_journal_sources(Options{.directories = {std::string(root) + "/missing"}},
+                               &sources) == -ENOENT);
+  REQUIRE(std::system(("rm -r " + std::string(root)).c_str()) == 0);
+}
+
+// a merged entry: the source it came from and its position there, from its machine and
+// encoded bytes.
+struct MergedEntry {
+  uint64_t timestamp;
+  size_t source;
+  size_t position;
+};
+
+// pushes `timestamps` for `source` in batches of `batch_size`, then finishes with `err`.
+void push_source(BatchMerger *merger, size_t source, const std::vector<uint64_t> &timestamps,
+                 size_t batch_size, int err) {
+  const std::string machine = std::to_string(source);
+  EntryBatch batch;
+  for (size_t i = 0; i < timestamps.size(); ++i) {
+    ChannelKey key;
+    key.machine = machine;
+    batch.append(timestamps[i], key, std::to_string(i));
+    if ((batch.size() == batch_size || i + 1 == timestamps.size()) &&
+        !merger->push(source, &batch)) {
+      break;
+    }
+  }
+  merger->finish(source, err);
+}
+
+TEST_CASE("merges sources by timestamp", "[merge]") {
+  std::mt19937 rng(1234);
+  // interleaved timestamps, with ties within and between sources.
+  std::vector<std::vector<uint64_t>> sources(4);
+  for (auto &timestamps : sources) {
+    uint64_t timestamp = 1000;
+    for (int i = 0; i < 3000; ++i) {
+      timestamp += rng() % 4;
+      timestamps.push_back(timestamp);
+    }
+  }
+  auto merge = [&](const std::vector<int> &errors, size_t max_writes,
+                   std::vector<MergedEntry> *merged, size_t *failed_source) {
+    BatchMerger merger(sources.size(), 2);
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < sources.size(); ++i) {
+      threads.emplace_back(push_source, &merger, i, std::cref(sources[i]), 1 + i * 50,
+                           errors[i]);
+    }
+    const int ret = merger.merge(
+        [&](uint64_t timestamp, const ChannelKey &key, std::string_view encoded) {
+          merged->push_back(MergedEntry{timestamp, size_t(std::stoul(std::string(key.machine))),
+                                        size_t(std::stoul(std::string(encoded)))});
+          return merged->size() < max_writes;
+        },
+        failed_source);
+    for (auto &thread : threads) {
+      thread.join();
+    }
+    return ret;
+  };
+  // every entry is written once, by timestamp and then by source, each source in its order.
+  auto check_order = [&](const std::vector<MergedEntry> &merged) {
+    std::vector<size_t> next(sources.size(), 0);
+    for (size_t i = 0; i < merged.size(); ++i) {
+      const MergedEntry &entry = merged[i];
+      REQUIRE(entry.position == next[entry.source]++);
+      REQUIRE(entry.timestamp == sources[entry.source][entry.position]);
+      if (i > 0) {
+        const MergedEntry &previous = merged[i - 1];
+        REQUIRE(std::make_pair(previous.timestamp, previous.source) <=
+                std::make_pair(entry.timestamp, entry.source));
+      }
+    }
+    return next;
+  };
+  std::vector<MergedEntry> merged;
+  size_t failed_source = SIZE_MAX;
+  REQUIRE(merge({0, 0, 0, 0}, SIZE_MAX, &merged, &failed_source) == 0);
+  REQUIRE(failed_source == SIZE_MAX);
+  for (size_t count : check_order(merged)) {
+    REQUIRE(count == 3000);
+  }
+
+  // a failing source stops the merge, and the others are not left waiting.
+  merged.clear();
+  REQUIRE(merge({0, 0, -EIO, 0}, SIZE_MAX, &merged, &failed_source) == -EIO);
+  REQUIRE(failed_source == 2);
+  check_order(merged);
+  REQUIRE(merged.size() < 4 * 3000);
+
+  // as does a failed write.
+  merged.clear();
+  failed_source = SIZE_MAX;
+  REQUIRE(merge({0, 0, 0, 0}, 100, &merged, &failed_source) == 1);
+  REQUIRE(failed_source == SIZE_MAX);
+  REQUIRE(merged.size() == 100);
+  check_order(merged);
+}
+
+TEST_CASE("finds the export range", "[get_export_range]") {
+  sd_journal j;
+  j.rval = 0;
+  j.entry_timestamps = {5'000'000, 6'000'000, 7'000'000};
+  uint64_t start = 0;
+  uint64_t end = 0;
+  REQUIRE(get_export_range(&j, Options{.start = TIME_BOOT, .end = TIME_NOW},
+                           &start, &end) == 0);
+  REQUIRE(start == 5'000'000);
+  REQUIRE(end == 7'000'001);
+  REQUIRE(get_export_range(&j,
+                           Options{.start = TIME_UNIX,
+                                   .start_sec = 6,
+                                   .end = TIME_UNIX,
+                                   .end_sec = 9},
+                           &start, &end) == 0);
+  REQUIRE(start == 6'000'000);
+  REQUIRE(end == 9'000'001);
+  REQUIRE(get_export_range(&j,
+                           Options{.start = TIME_UNIX,
+                                   .start_sec = 9,
+                                   .end = TIME_SHUTDOWN},
+                           &start, &end) == 0);
+  REQUIRE(start == 9'000'000);
+  REQUIRE(end == 9'000'000);
+  REQUIRE(get_export_range(&j, Options{.start = TIME_NOW}, &start, &end) ==
+          -EINVAL);
+  REQUIRE(get_export_range(&j, Options{.end = TIME_WAIT}, &start, &end) ==
+          -EINVAL);
+}
+
+// counts the chunk index spill failures reported in `spill_failures`, if not null.
+std::string write_test_mcap(mcap::Compression compression, uint32_t compression_threads,
+                            uint64_t *chunk_count, uint64_t chunk_index_memory_limit = 0,
+                            const std::string &spill_directory = "",
+                            uint32_t *spill_failures = nullptr) {
+  std::ostringstream out;
+  mcap::McapWriterOptions options("");
+  options.compression = compression;
+  options.chunkSize = 512;
+  options.compressionThreads = compression_threads;
+  options.chunkIndexMemoryLimit = chunk_index_memory_limit;
+  options.chunkIndexSpillDirectory = spill_directory;
+  if (spill_failures != nullptr) {
+    options.chunkIndexSpillFailedCallback = [=](const mcap::Status &status) {
+      REQUIRE(status.code == mcap::StatusCode::OpenFailed);
+      ++*spill_failures;
+    };
+  }
+  mcap::McapWriter writer;
+  writer.open(out, options);
+  mcap::Schema schema("foxglove.Log", "jsonschema", "{}");
+  writer.addSchema(schema);
+  std::vector<mcap::ChannelId> channel_ids;
+  for (int i = 0; i < 3; ++i) {
+    mcap::Channel channel("/journald/" + std::to_string(i), "json", schema.id);
+    writer.addChannel(channel);
+    channel_ids.push_back(channel.id);
+  }
+  std::mt19937 rng(1234);
+  for (uint32_t i = 0; i < 5000; ++i) {
+    if (i == 2500) {
+      mcap::Metadata metadata;
+      metadata.name = "midpoint";
+      REQUIRE(writer.write(metadata).ok());
+    }
+    std::string data = "{\"message\":\"entry " + std::to_string(i) + " " +
+                       std::string(rng() % 200, 'a' + (rng() % 26)) + "\"}";
+    mcap::Message message;
+    message.channelId = channel_ids[rng() % channel_ids.size()];
+    message.sequence = i;
+    message.logTime = 1000 + i;
+    message.publishTime = message.logTime;
+    message.data = (const std::byte *)(data.data());
+    message.dataSize = data.size();
+    REQUIRE(writer.write(message).ok());
+  }
+  *chunk_count = writer.statistics().chunkCount;
+  writer.close();
+  return out.str();
+}
+
+TEST_CASE("computes the same CRC32 with every implementation", "[crc32]") {
+  using namespace mcap::internal;
+  const std::string check = "123456789";
+  REQUIRE(crc32Final(crc32Update(CRC32_INIT, (const std::byte *)(check.data()), check.size())) ==
+          0xcbf43926);
+  std::mt19937 rng(1234);
+  std::vector<std::byte> buffer(4096 + 64);
+  for (auto &b : buffer) {
+    b = std::byte(rng());
+  }
+  // every alignment, and every length around the 64-byte folding loop and 16-byte tail.
+  for (size_t offset = 0; offset < 64; ++offset) {
+    for (size_t length = 0; length <= 1024; ++length) {
+      const std::byte *data = buffer.data() + offset;
+      const uint32_t prev = rng();
+      const uint32_t expected = crc32UpdateTable(prev, data, length);
+      REQUIRE(crc32Update(prev, data, length) == expected);
+#ifdef MCAP_CRC32_PCLMUL
+      if (crc32HasPclmul()) {
+        REQUIRE(crc32UpdatePclmul(prev, data, length) == expected);
+      }
+#endif
+    }
+  }
+  // a CRC computed in pieces matches one over the whole buffer.
+  uint32_t pieces = CRC32_INIT;
+  for (size_t offset = 0; offset < 4096;) {
+    const size_t length = std::min<size_t>(rng() % 300, 4096 - offset);
+    pieces = crc32Update(pieces, buffer.data() + offset, length);
+    offset += length;
+  }
+  REQUIRE(pieces == crc32UpdateTable(CRC32_INIT, buffer.data(), 4096));
+}
+
+TEST_CASE("background chunk compression writes the same file", "[writer]") {
+  for (auto compression : {mcap::Compression::Zstd, mcap::Compression::Lz4}) {
+    uint64_t inline_chunks = 0;
+    const std::string expected = write_test_mcap(compression, 0, &inline_chunks);
+    REQUIRE(inline_chunks > 100);
+    for (uint32_t threads : {1, 3}) {
+      uint64_t chunks = 0;
+      REQUIRE(write_test_mcap(compression, threads, &chunks) == expected);
+    }
+  }
+}
+
+TEST_CASE("spilled chunk indexes write the same file", "[writer]") {
+  uint64_t chunks = 0;
+  const std::string expected = write_test_mcap(mcap::Compression::Zstd, 0, &chunks);
+  // enough chunk indexes that close() copies the spilled ones back in several pieces.
+  REQUIRE(chunks > 1000);
+  // spilling after every record, after a few, and never.
+  for (uint64_t limit : {1, 4096, 1 << 30}) {
+    REQUIRE(write_test_mcap(mcap::Compression::Zstd, 0, &chunks, limit) == expected);
+    REQUIRE(write_test_mcap(mcap::Compression::Zstd, 2, &chunks, limit) == expected);
+  }
+  // records which cannot be spilled stay in memory, and the failure is reported once.
+  uint32_t failures = 0;
+  REQUIRE(write_test_mcap(mcap::Compression::Zstd, 0, &chunks, 1, "/nonexistent", &failures) ==
+          expected);
+  REQUIRE(failures == 1);
+}
+
+TEST_CASE("expands rotated output filenames", "[output]") {
+  REQUIRE(expand_output_filename("out.mcap", 3) == "out.3.mcap");
+  REQUIRE(expand_output_filename("logs-{n}.mcap", 12) == "logs-12.mcap");
+  REQUIRE(expand_output_filename("out", 0) == "out.0");
+  REQUIRE(expand_output_filename("/var/log.d/out", 1) == "/var/log.d/out.1");
+  REQUIRE(expand_output_filename("dir/.hidden", 2) == "dir/.hidden.2");
+}
+
+std::string read_file(const std::string &path) {
+  std::ifstream file(path, std::ios::binary);
+  std::stringstream ss;
+  ss << file.rdbuf();
+  return ss.str();
+}
+
+TEST_CASE("rotates output between entries", "[output]") {
+  char dir_template[] = "/tmp/journal2mcap-test-XXXXXX";
+  REQUIRE(mkdtemp(dir_template) != nullptr);
+  const std::string dir(dir_template);
+  JsonEncoder encoder;
+  LogWriterOptions options;
+  options.rotate_interval = 3'000'000'000;
+  {
+    LogWriter writer;
+    REQUIRE(writer.open(dir + "/out-{n}.mcap", encoder, options).ok());
+    for (uint64_t sec = 0; sec < 10; ++sec) {
+      REQUIRE(writer.write(sec * 1'000'000'000, TRANSPORT_STDOUT, "{}").ok());
+    }
+    REQUIRE(writer.write(9'500'000'000, TRANSPORT_KERNEL, "{}").ok());
+    writer.close();
+    REQUIRE(writer.file_count() == 4);
+  }
+  // each file records which sequence numbers it holds, and its neighbours.
+  const std::vector<std::vector<std::string>> expected = {
+      {"0-2", "out-1.mcap"},
+      {"3-5", "out-0.mcap", "out-2.mcap"},
+      {"6-8", "out-1.mcap", "out-3.mcap"},
+      {"9-9", "0-0", "out-2.mcap"},
+  };
+  for (uint32_t i = 0; i < expected.size(); ++i) {
+    const std::string path = dir + "/out-" + std::to_string(i) + ".mcap";
+    const std::string contents = read_file(path);
+    REQUIRE(contents.find(SEQUENCE_METADATA_NAME) != std::string::npos);
+    for (const auto &value : expected[i]) {
+      REQUIRE(contents.find(value) != std::string::npos);
+    }
+    REQUIRE(unlink(path.c_str()) == 0);
+  }
+
+  // a file which fails to rotate keeps being written, and does not name the missing next file.
+  const std::string blocked = dir + "/out-1.mcap";
+  REQUIRE(mkdir(blocked.c_str(), 0755) == 0);
+  {
+    LogWriter writer;
+    REQUIRE(writer.open(dir + "/out-{n}.mcap", encoder, options).ok());
+    REQUIRE(writer.write(0, TRANSPORT_STDOUT, "{}").ok());
+    REQUIRE(!writer.write(4'000'000'000, TRANSPORT_STDOUT, "{}").ok());
+    writer.close();
+    REQUIRE(writer.file_count() == 1);
+  }
+  const std::string contents = read_file(dir + "/out-0.mcap");
+  REQUIRE(contents.find(SEQUENCE_METADATA_NAME) != std::string::npos);
+  REQUIRE(contents.find("out-1.mcap") == std::string::npos);
+  REQUIRE(unlink((dir + "/out-0.mcap").c_str()) == 0);
+  REQUIRE(rmdir(blocked.c_str()) == 0);
+  REQUIRE(rmdir(dir_template) == 0);
+}
+
+TEST_CASE("wakes on journal changes, timers and signals", "[event_loop]") {
+  int pipe_fds[2];
+  REQUIRE(pipe2(pipe_fds, O_NONBLOCK) == 0);
+  sd_journal j;
+  j.fd = pipe_fds[0];
+  {
+    EventLoop loop;
+    REQUIRE(loop.open(&j) == 0);
+    LoopEvent event;
+
+    REQUIRE(write(pipe_fds[1], "x", 1) == 1);
+    REQUIRE(loop.wait(&event) == 0);
+    REQUIRE(event == EVENT_JOURNAL);
+
+    REQUIRE(loop.set_timer(1) == 0);
+    REQUIRE(loop.wait(&event) == 0);
+    REQUIRE(event == EVENT_TIMER);
+
+    // a cleared timer does not fire.
+    REQUIRE(loop.set_timer(1) == 0);
+    REQUIRE(loop.clear_timer() == 0);
+    REQUIRE(write(pipe_fds[1], "x", 1) == 1);
+    REQUIRE(loop.wait(&event) == 0);
+    REQUIRE(event == EVENT_JOURNAL);
+
+    REQUIRE(write(pipe_fds[1], "f", 1) == 1);
+    REQUIRE(loop.wait(&event) == 0);
+    REQUIRE(event == EVENT_JOURNAL_FILES);
+
+    // a change to the files is not lost to a timer which fires at the same time.
+    REQUIRE(loop.set_timer(1) == 0);
+    REQUIRE(write(pipe_fds[1], "f", 1) == 1);
+    REQUIRE(loop.wait(&event) == 0);
+    REQUIRE(event == EVENT_JOURNAL_FILES);
+    REQUIRE(loop.clear_timer() == 0);
+
+    // once replaced, only the new journal's changes wake the loop.
+    int replacement_fds[2];
+    REQUIRE(pipe2(replacement_fds, O_NONBLOCK) == 0);
+    sd_journal replacement;
+    replacement.fd = replacement_fds[0];
+    REQUIRE(loop.replace_journal(&replacement) == 0);
+    REQUIRE(write(pipe_fds[1], "x", 1) == 1);
+    REQUIRE(loop.set_timer(monotonic_ns() + 10'000'000) == 0);
+    REQUIRE(loop.wait(&event) == 0);
+    REQUIRE(event == EVENT_TIMER);
+    REQUIRE(write(replacement_fds[1], "x", 1) == 1);
+    REQUIRE(loop.wait(&event) == 0);
+    REQUIRE(event == EVENT_JOURNAL);
+    REQUIRE(loop.replace_journal(&j) == 0);
+    close(replacement_fds[0]);
+    close(replacement_fds[1]);
+
+    REQUIRE_FALSE(loop.signal_pending());
+    REQUIRE(raise(SIGINT) == 0);
+    REQUIRE(loop.signal_pending());
+    REQUIRE(loop.wait(&event) == 0);
+    REQUIRE(event == EVENT_SIGNAL);
+  }
+  close(pipe_fds[0]);
+  close(pipe_fds[1]);
+}
+
+TEST_CASE("flushes the chunk in progress", "[output]") {
+  char path[] = "/tmp/journal2mcap-test-XXXXXX";
+  int fd = mkstemp(path);
+  REQUIRE(fd >= 0);
+  close(fd);
+  JsonEncoder encoder;
+  LogWriterOptions options;
+  options.max_chunk_latency = 1'000'000'000;
+  {
+    LogWriter writer;
+    REQUIRE(writer.open(path, encoder, options).ok());
+    REQUIRE(writer.flush_deadline() == UINT64_MAX);
+    REQUIRE(writer.write(1, TRANSPORT_STDOUT, "{\"MESSAGE\":\"first\"}").ok());
+    REQUIRE(writer.flush_deadline() != UINT64_MAX);
+    const size_t size_before = read_file(path).size();
+    writer.flush();
+    REQUIRE(writer.flush_deadline() == UINT64_MAX);
+    // the chunk holding the entry is on disk before the file is closed.
+    const size_t size_flushed = read_file(path).size();
+    REQUIRE(size_flushed > size_before);
+    // nothing is waiting, so this flush writes nothing and is not counted.
+    writer.flush();
+    REQUIRE(read_file(path).size() == size_flushed);
+    REQUIRE(writer.write(2, TRANSPORT_STDOUT, "{\"MESSAGE\":\"second\"}").ok());
+    writer.close();
+    const ChunkSizeStats stats = writer.chunk_stats();
+    REQUIRE(stats.chunk_count == 2);
+    REQUIRE(stats.forced_flushes == 1);
+    REQUIRE(stats.uncompressed_bytes > 0);
+  }
+  REQUIRE(unlink(path) == 0);
+}
+
+TEST_CASE("bounds the chunk indexes kept in memory", "[output]") {
+  char dir[] = "/tmp/journal2mcap-test-XXXXXX";
+  REQUIRE(mkdtemp(dir) != nullptr);
+  const std::string path = std::string(dir) + "/out.mcap";
+  JsonEncoder encoder;
+  std::vector<std::string> contents;
+  std::vector<ChunkSizeStats> stats;
+  for (uint64_t max_index_memory : {0, 256}) {
+    LogWriterOptions options;
+    options.chunk_size = 1024;
+    options.max_index_memory = max_index_memory;
+    LogWriter writer;
+    REQUIRE(writer.open(path, encoder, options).ok());
+    for (uint64_t i = 0; i < 3000; ++i) {
+      const std::string data = "{\"MESSAGE\":\"entry " + std::to_string(i) + "\"}";
+      REQUIRE(writer.write(i, (Transport)(i % _TRANSPORT_COUNT), data).ok());
+      if (i % 100 == 0) {
+        writer.flush();
+      }
+    }
+    writer.close();
+    stats.push_back(writer.chunk_stats());
+    contents.push_back(read_file(path));
+    REQUIRE(unlink(path.c_str()) == 0);
+  }
+  REQUIRE(stats[0].chunk_count > 100);
+  REQUIRE(stats[1].chunk_count == stats[0].chunk_count);
+  REQUIRE(stats[1].size_histogram == stats[0].size_histogram);
+  REQUIRE(contents[1] == contents[0]);
+  // the spill files were unlinked as soon as they were created, so the directory is empty.
+  REQUIRE(rmdir(dir) == 0);
+}
+
+TEST_CASE("writes files in blocks in the background", "[async_writer]") {
+  for (OutputIo io : {IO_THREAD, IO_URING}) {
+    char path[] = "/tmp/journal2mcap-test-XXXXXX";
+    int fd = mkstemp(path);
+    REQUIRE(fd >= 0);
+    close(fd);
+    AsyncWriterOptions options;
+    options.io = io;
+    options.block_size = 4096;
+    options.max_in_flight = 2;
+    options.preallocate_size = 64 * 1024;
+    options.sync_writeback = io == IO_URING;
+    AsyncFileWriter writer(options);
+    REQUIRE(writer.open(path).ok());
+    std::mt19937 rng(1234);
+    std::string expected;
+    for (int i = 0; i < 200; ++i) {
+      // pieces which straddle block boundaries, and some larger than a block.
+      std::string piece(rng() % (i % 20 == 0 ? 10000 : 300), char('a' + i % 26));
+      writer.handleWrite((const std::byte *)(piece.data()), piece.size());
+      expected += piece;
+      if (i == 100) {
+        // a flush makes the partly filled block visible, which is rewritten as it fills.
+        writer.flush();
+        REQUIRE(read_file(path) == expected);
+      }
+    }
+    REQUIRE(writer.size() == expected.size());
+    writer.end();
+    REQUIRE(writer.error() == 0);
+    REQUIRE(read_file(path) == expected);
+    // the space reserved past the end of the file is released.
+    struct stat st;
+    REQUIRE(stat(path, &st) == 0);
+    REQUIRE(uint64_t(st.st_size) == expected.size());
+    REQUIRE(uint64_t(st.st_blocks) * 512 < expected.size() + 64 * 1024);
+
+    // buffers which cannot be allocated fail the open rather than the first write.
+    AsyncWriterOptions huge = options;
+    huge.block_size = uint64_t(1) << 60;
+    REQUIRE(AsyncFileWriter(huge).open(path).code == mcap::StatusCode::OpenFailed);
+    REQUIRE(unlink(path) == 0);
+  }
+}
+
+TEST_CASE("writes the same file with each kind of io", "[output]") {
+  JsonEncoder encoder;
+  std::vector<std::string> contents;
+  for (OutputIo io : {IO_STDIO, IO_THREAD, IO_URING}) {
+    char path[] = "/tmp/journal2mcap-test-XXXXXX";
+    int fd = mkstemp(path);
+    REQUIRE(fd >= 0);
+    close(fd);
+    LogWriterOptions options;
+    options.chunk_size = 4096;
+    options.io = io;
+    {
+      LogWriter writer;
+      REQUIRE(writer.open(path, encoder, options).ok());
+      for (uint64_t i = 0; i < 2000; ++i) {
+        const std::string data = "{\"MESSAGE\":\"entry " + std::to_string(i) + "\"}";
+        REQUIRE(writer.write(i, (Transport)(i % _TRANSPORT_COUNT), data).ok());
+        if (i == 1000) {
+          writer.flush();
+        }
+      }
+      writer.close();
+      REQUIRE(writer.output_error() == 0);
+    }
+    contents.push_back(read_file(path));
+    REQUIRE(unlink(path) == 0);
+  }
+  REQUIRE(contents[0].size() > 8192);
+  REQUIRE(contents[1] == contents[0]);
+  REQUIRE(contents[2] == contents[0]);
+}
+
+TEST_CASE("hands values between threads in order", "[pipeline]") {
+  SpscRing<std::unique_ptr<uint64_t>> ring(3);
+  std::unique_ptr<uint64_t> value;
+  REQUIRE(ring.pop(&value, monotonic_ns() + 1'000'000) == -ETIMEDOUT);
+  constexpr uint64_t COUNT = 100000;
+  uint64_t pushed = 0;
+  std::thread producer([&]() {
+    for (uint64_t i = 0; i < COUNT; ++i) {
+      pushed += ring.push(std::make_unique<uint64_t>(i)) ? 1 : 0;
+    }
+    ring.close();
+  });
+  uint64_t expected = 0;
+  while (ring.pop(&value) == 1) {
+    REQUIRE(*value == expected);
+    expected++;
+  }
+  producer.join();
+  REQUIRE(pushed == COUNT);
+  REQUIRE(expected == COUNT);
+  REQUIRE_FALSE(ring.push(std::make_unique<uint64_t>(0)));
+}
+
+TEST_CASE("pipelined encoding writes the same file", "[pipeline]") {
+  std::mt19937 rng(1234);
+  std::string stream;
+  const char *units[] = {"a.service", "b.service", "c.service"};
+  const char *transports[] = {"stdout", "journal", "kernel", "syslog"};
+  for (uint64_t i = 0; i < 3000; ++i) {
+    std::vector<std::pair<std::string, std::string>> fields = {
+        {"__REALTIME_TIMESTAMP", std::to_string(1'700'000'000'000'000 + i * 1000)},
+        {"MESSAGE", "entry " + std::to_string(i) + std::string(rng() % 300, 'x')},
+        {"PRIORITY", std::to_string(rng() % 8)},
+        {"_TRANSPORT", transports[rng() % 4]}};
+    if (rng() % 4 != 0) {
+      fields.push_back({"_SYSTEMD_UNIT", units[rng() % 3]});
+    }
+    stream += export_entry(fields);
+  }
+  std::vector<JournalEntry> entries;
+  for (size_t pos = 0, size = 0; pos < stream.size(); pos += size) {
+    JournalEntry entry;
+    REQUIRE(parse_export_entry(std::string_view(stream).substr(pos), true, &size, &entry) == 1);
+    entries.push_back(entry);
+  }
+  REQUIRE(entries.size() == 3000);
+
+  char path[] = "/tmp/journal2mcap-test-XXXXXX";
+  int fd = mkstemp(path);
+  REQUIRE(fd >= 0);
+  close(fd);
+  for (Encoding encoding : {ENCODING_JSON, ENCODING_PROTOBUF}) {
+    std::unique_ptr<LogEncoder> encoder = make_encoder(encoding);
+    LogWriterOptions writer_options;
+    writer_options.topics = TOPICS_UNIT;
+    writer_options.chunk_size = 8192;
+    std::string expected;
+    {
+      LogWriter writer;
+      REQUIRE(writer.open(path, *encoder, writer_options).ok());
+      for (const auto &entry : entries) {
+        REQUIRE(writer.write(entry.timestamp, channel_key(entry), encoder->encode(entry)).ok());
+      }
+      writer.close();
+      expected = read_file(path);
+    }
+    for (uint32_t threads : {1, 3}) {
+      PipelineOptions options;
+      options.encoding = encoding;
+      options.encoder_threads = threads;
+      options.batch_size = 7;
+      options.batches_per_encoder = 2;
+      options.time_stages = true;
+      LogWriter writer;
+      REQUIRE(writer.open(path, *encoder, writer_options).ok());
+      EntryPipeline pipeline(&writer, options);
+      StageTimer timer(true);
+      pipeline.start(&timer);
+      for (size_t i = 0; i < entries.size(); ++i) {
+        REQUIRE(pipeline.write(entries[i]));
+        // partly filled batches, as handed over before waiting for more entries.
+        if (i % 100 == 0) {
+          pipeline.submit();
+        }
+      }
+      REQUIRE(pipeline.finish());
+      pipeline.add_stage_times(&timer);
+      REQUIRE(timer.seconds(STAGE_ENCODE) > 0);
+      REQUIRE(timer.seconds(STAGE_WRITE) > 0);
+      writer.close();
+      REQUIRE(read_file(path) == expected);
+    }
+  }
+  REQUIRE(unlink(path) == 0);
+}
+
+TEST_CASE("drops entries while the output is stalled", "[pipeline]") {
+  std::string stream;
+  // DEBUG entries, some of which are dropped, followed by a few WARNING and ERROR entries,
+  // which are not at this depth.
+  for (uint64_t i = 0; i < 20000; ++i) {
+    stream += export_entry({{"__REALTIME_TIMESTAMP", std::to_string(1'700'000'000'000'000 + i)},
+                            {"MESSAGE", "entry " + std::to_string(i) + std::string(100, 'x')},
+                            {"PRIORITY", i < 19990 ? "7" : i % 2 == 0 ? "4" : "3"},
+                            {"_TRANSPORT", "stdout"},
+                            {"_SYSTEMD_UNIT", "noisy.service"}});
+  }
+  std::vector<JournalEntry> entries;
+  for (size_t pos = 0, size = 0; pos < stream.size(); pos += size) {
+    JournalEntry entry;
+    REQUIRE(parse_export_entry(std::string_view(stream).substr(pos), true, &size, &entry) == 1);
+    entries.push_back(entry);
+  }
+
+  // the output is a pipe which is not read until every entry has been handed over, so the
+  // writer thread stalls once the pipe is full.
+  char dir_template[] = "/tmp/journal2mcap-test-XXXXXX";
+  REQUIRE(mkdtemp(dir_template) != nullptr);
+  const std::string fifo = std::string(dir_template) + "/out.mcap";
+  REQUIRE(mkfifo(fifo.c_str(), 0600) == 0);
+  const int read_fd = open(fifo.c_str(), O_RDONLY | O_NONBLOCK);
+  REQUIRE(read_fd >= 0);
+  JsonEncoder encoder;
+  LogWriterOptions writer_options;
+  writer_options.compression = mcap::Compression::None;
+  writer_options.chunk_size = 4096;
+  LogWriter writer;
+  REQUIRE(writer.open(fifo, encoder, writer_options).ok());
+
+  PipelineOptions options;
+  options.encoder_threads = 1;
+  options.batch_size = 8;
+  options.overload = OVERLOAD_DROP;
+  options.high_watermark = 300;
+  EntryPipeline pipeline(&writer, options);
+  pipeline.start();
+  for (const auto &entry : entries) {
+    REQUIRE(pipeline.write(entry));
+  }
+  REQUIRE(pipeline.dropped_count() > 0);
+  std::string contents;
+  REQUIRE(fcntl(read_fd, F_SETFL, 0) == 0);
+  std::thread drain([&]() {
+    char buf[1 << 16];
+    ssize_t length;
+    while ((length = read(read_fd, buf, sizeof(buf))) > 0) {
+      contents.append(buf, size_t(length));
+    }
+  });
+  REQUIRE(pipeline.finish());
+  writer.close();
+  drain.join();
+  close(read_fd);
+  REQUIRE(unlink(fifo.c_str()) == 0);
+  REQUIRE(rmdir(dir_template) == 0);
+
+  // every entry is either written or counted, and the count is in the output.
+  const uint64_t dropped = pipeline.dropped_count();
+  REQUIRE(writer.entry_count(TRANSPORT_STDOUT) + dropped == entries.size());
+  REQUIRE(contents.find(DROPPED_METADATA_NAME) != std::string::npos);
+  REQUIRE(contents.find("noisy.service/DEBUG") != std::string::npos);
+  REQUIRE(contents.find(std::to_string(dropped)) != std::string::npos);
+  for (uint64_t i = 19990; i < 20000; ++i) {
+    REQUIRE(contents.find("entry " + std::to_string(i)) != std::string::npos);
+  }
+}
+
+TEST_CASE("summarizes chunk sizes", "[output]") {
+  ChunkSizeStats stats;
+  REQUIRE(stats.percentile(0.5) == 0);
+  for (int i = 0; i < 98; ++i) {
+    stats.add(1000, 250);
+  }
+  stats.add(5000, 1250);
+  stats.add(1 << 20, 1 << 18);
+  REQUIRE(stats.chunk_count == 100);
+  REQUIRE(stats.percentile(0.5) == 1024);
+  REQUIRE(stats.percentile(0.99) == 8192);
+  REQUIRE(stats.percentile(1.0) == 2 << 20);
+  REQUIRE(describe_chunk_stats(stats) ==
+          "100 chunks, 0 flushed early; uncompressed size p50 < 1024 p90 < 1024 p99 < 8192 "
+          "bytes; compression ratio 4.00");
+}
+
+TEST_CASE("reports stage times and channel counters", "[stats]") {
+  StageTimer disabled;
+  disabled.begin();
+  disabled.lap(STAGE_READ);
+  disabled.time(STAGE_SYNC, []() {});
+  REQUIRE(disabled.seconds(STAGE_READ) == 0);
+  REQUIRE(disabled.seconds(STAGE_SYNC) == 0);
+
+  StageTimer timer(true);
+  for (uint32_t i = 0; i < 4 * StageTimer::SAMPLE_INTERVAL; ++i) {
+    timer.begin();
+    usleep(10);
+    timer.lap(STAGE_READ);
+  }
+  // 64 iterations of at least 10us each, estimated from 4 samples.
+  REQUIRE(timer.seconds(STAGE_READ) >= 64 * 10e-6);
+  REQUIRE(timer.seconds(STAGE_ENCODE) < timer.seconds(STAGE_READ));
+
+  char path[] = "/tmp/journal2mcap-test-XXXXXX";
+  int fd = mkstemp(path);
+  REQUIRE(fd >= 0);
+  close(fd);
+  JsonEncoder encoder;
+  LogWriter writer;
+  REQUIRE(writer.open(path, encoder).ok());
+  REQUIRE(writer.write(1, TRANSPORT_KERNEL, "{\"a\":1}").ok());
+  REQUIRE(writer.write(2, TRANSPORT_KERNEL, "{}").ok());
+  REQUIRE(writer.write(3, TRANSPORT_STDOUT, "{}").ok());
+  writer.close();
+  auto stats = nlohmann::json::parse(format_stats_json(timer, writer));
+  REQUIRE(stats["entries"] == 3);
+  REQUIRE(stats["channels"]["/journald/kernel"]["entries"] == 2);
+  REQUIRE(stats["channels"]["/journald/kernel"]["bytes"] == 9);
+  REQUIRE(stats["channels"]["/journald/stdout"]["entries"] == 1);
+  REQUIRE(stats["channels"].size() == 2);
+  REQUIRE(stats["chunks"]["count"] == 1);
+  REQUIRE(stats["stages_sec"]["read"] > 0);
+  const std::string text = format_stats_text(timer, writer);
+  REQUIRE(text.find("exported 3 entries") == 0);
+  REQUIRE(text.find("/journald/kernel") != std::string::npos);
+  REQUIRE(unlink(path) == 0);
+}
+
+TEST_CASE("exports entries without allocating once warmed up", "[output]") {
+  // a few kinds of entry, each read from its own journal, so entries of different sizes
+  // interleave across channels as they do in a real journal.
+  const std::vector<std::map<std::string, std::string>> entry_fields = {
+      {{"MESSAGE", "usb 1-1: new high-speed USB device number 3 using xhci_hcd"},
+       {"PRIORITY", "6"},
+       {"_TRANSPORT", "kernel"}},
+      {{"MESSAGE", "GET /api/v1/status 200 " + std::string(300, 'x')},
+       {"PRIORITY", "6"},
+       {"_TRANSPORT", "stdout"},
+       {"_SYSTEMD_UNIT", "api.service"},
+       {"_PID", "4242"}},
+      {{"MESSAGE", "retrying connection"},
+       {"PRIORITY", "4"},
+       {"_TRANSPORT", "journal"},
+       {"CODE_FILE", "src/client.c"},
+       {"CODE_LINE", "88"},
+       {"_EXE", "/usr/bin/client"}},
+  };
+  constexpr uint64_t WARM_UP_ENTRIES = 3000;
+  constexpr uint64_t MEASURED_ENTRIES = 6000;
+  for (Encoding encoding : {ENCODING_JSON, ENCODING_PROTOBUF}) {
+    std::vector<sd_journal> journals(entry_fields.size());
+    for (size_t i = 0; i < journals.size(); ++i) {
+      journals[i].rval = 0;
+      journals[i].fields = entry_fields[i];
+      journals[i].entry_cursor_valid = false;
+      journals[i].entry_timestamps.clear();
+      for (uint64_t n = 0; n < WARM_UP_ENTRIES + MEASURED_ENTRIES; ++n) {
+        journals[i].entry_timestamps.push_back(1000 + n);
+      }
+    }
+    char path[] = "/tmp/journal2mcap-test-XXXXXX";
+    int fd = mkstemp(path);
+    REQUIRE(fd >= 0);
+    close(fd);
+    std::unique_ptr<LogEncoder> encoder = make_encoder(encoding);
+    LogWriterOptions options;
+    // small chunks, so many chunk boundaries fall in the measured entries.
+    options.chunk_size = 16 * 1024;
+    LogWriter writer;
+    REQUIRE(writer.open(path, *encoder, options).ok());
+    JournalEntry entry;
+    uint64_t chunks_before = 0;
+    uint64_t allocating_entries = 0;
+    for (uint64_t n = 0; n < WARM_UP_ENTRIES + MEASURED_ENTRIES; ++n) {
+      if (n == WARM_UP_ENTRIES) {
+        chunks_before = writer.chunk_stats().chunk_count;
+      }
+      allocation_count = 0;
+      count_allocations = n >= WARM_UP_ENTRIES;
+      int err = read_journal_entry(&journals[n % journals.size()], UINT64_MAX, &entry);
+      std::string_view encoded = encoder->encode(entry);
+      bool ok = writer.write(entry.timestamp, entry.transport, encoded).ok();
+      count_allocations = false;
+      REQUIRE(err == 1);
+      REQUIRE(ok);
+      if (allocation_count != 0) {
+        allocating_entries++;
+      }
+    }
+    const uint64_t measured_chunks = writer.chunk_stats().chunk_count - chunks_before;
+    writer.close();
+    REQUIRE(measured_chunks > 10);
+    // only entries which close a chunk allocate, for the chunk's index in the summary.
+    REQUIRE(allocating_entries <= measured_chunks);
+    REQUIRE(unlink(path) == 0);
+  }
+}
+
+/**
+ * @brief a log line from one of a few services, as the JSON encoder might write it. Like
+ * journal entries, most of each line repeats one of a few templates.
+ */
+std::string make_log_line(std::mt19937 *rng) {
+  static const char *const templates[][2] = {
+      {"sshd.service", "Accepted publickey for user%u from 10.0.%u.%u port %u ssh2: RSA SHA256"},
+      {"sshd.service", "pam_unix(sshd:session): session opened for user user%u(uid=%u) by (uid=0)"},
+      {"cron.service", "(root) CMD (run-parts --report /etc/cron.hourly) [pid %u, job %u.%u.%u]"},
+      {"nginx.service", "10.1.%u.%u - - \\\"GET /api/v1/status HTTP/1.1\\\" 200 %u \\\"-\\\" %u"},
+      {"systemd-logind.service", "New session %u of user user%u. Seat seat%u, display :%u"},
+      {"kubelet.service", "I1016 %u:%u:%u.000000 reconciler.go:224] operationExecutor.VerifyControllerAttachedVolume started"},
+      {"dockerd.service", "time=\\\"%u\\\" level=info msg=\\\"ignoring event\\\" container=%u%u%u module=libcontainerd"},
+      {"NetworkManager.service", "<info>  [%u.%u] dhcp4 (eth%u): state changed bound -> bound, lease %u"},
+  };
+  const auto &entry = templates[(*rng)() % 8];
+  char message[256];
+  snprintf(message, sizeof(message), entry[1], unsigned((*rng)() % 256),
+           unsigned((*rng)() % 256), unsigned((*rng)() % 256), unsigned((*rng)() % 65536));
+  return "{\"timestamp\":{\"sec\":" + std::to_string(1700000000 + (*rng)() % 1000) +
+         ",\"nsec\":0},\"level\":2,\"message\":\"" + message + "\",\"name\":\"" + entry[0] +
+         "\",\"file\":\"\",\"line\":0}";
+}
+
+TEST_CASE("trains and loads zstd dictionaries", "[dictionary]") {
+  std::mt19937 rng(1234);
+  DictionarySampler sampler(4096);
+  std::string dictionary;
+  for (int i = 0; i < 10; ++i) {
+    sampler.add(make_log_line(&rng));
+  }
+  REQUIRE(sampler.train(&dictionary) == -ENODATA);
+  while (!sampler.full()) {
+    sampler.add(make_log_line(&rng));
+  }
+  const size_t count = sampler.sample_count();
+  sampler.add(make_log_line(&rng));
+  REQUIRE(sampler.sample_count() == count);
+  REQUIRE(sampler.train(&dictionary) == 0);
+  REQUIRE(!dictionary.empty());
+  REQUIRE(dictionary.size() <= 4096);
+
+  char path[] = "/tmp/journal2mcap-test-XXXXXX";
+  int fd = mkstemp(path);
+  REQUIRE(fd >= 0);
+  close(fd);
+  std::string loaded;
+  REQUIRE(read_dictionary_file(path, &loaded) == -ENODATA);
+  REQUIRE(replace_file(path, dictionary) == 0);
+  REQUIRE(read_dictionary_file(path, &loaded) == 0);
+  REQUIRE(loaded == dictionary);
+  REQUIRE(unlink(path) == 0);
+  REQUIRE(read_dictionary_file(path, &loaded) == -ENOENT);
+}
+
+uint64_t read_le(std::string_view data, size_t offset, size_t bytes) {
+  REQUIRE(offset + bytes <= data.size());
+  uint64_t value = 0;
+  for (size_t i = 0; i < bytes; ++i) {
+    value |= uint64_t(uint8_t(data[offset + i])) << (8 * i);
+  }
+  return value;
+}
+
+struct McapRecord {
+  uint8_t opcode;
+  std::string_view body;
+};
+
+/**
+ * @brief splits the data section of an MCAP file into records, up to the Data End record.
+ */
+std::vector<McapRecord> read_mcap_records(std::string_view file) {
+  std::vector<McapRecord> records;
+  size_t offset = 8;
+  while (offset < file.size()) {
+    const uint8_t opcode = uint8_t(file[offset]);
+    const uint64_t length = read_le(file, offset + 1, 8);
+    REQUIRE(offset + 9 + length <= file.size());
+    if (opcode == 0x0f) {
+      break;
+    }
+    records.push_back({opcode, file.substr(offset + 9, length)});
+    offset += 9 + length;
+  }
+  return records;
+}
+
+std::string_view read_mcap_string(std::string_view body, size_t *offset) {
+  const uint64_t length = read_le(body, *offset, 4);
+  std::string_view value = body.substr(*offset + 4, length);
+  *offset += 4 + length;
+  return value;
+}
+
+TEST_CASE("compresses small chunks with a zstd dictionary", "[output]") {
+  std::mt19937 rng(1234);
+  DictionarySampler sampler(16 * 1024);
+  while (!sampler.full()) {
+    sampler.add(make_log_line(&rng));
+  }
+  std::string dictionary;
+  REQUIRE(sampler.train(&dictionary) == 0);
+  std::vector<std::string> lines;
+  for (int i = 0; i < 5000; ++i) {
+    lines.push_back(make_log_line(&rng));
+  }
+  JsonEncoder encoder;
+  std::string contents[2];
+  for (int with_dictionary = 0; with_dictionary < 2; ++with_dictionary) {
+    char path[] = "/tmp/journal2mcap-test-XXXXXX";
+    int fd = mkstemp(path);
+    REQUIRE(fd >= 0);
+    close(fd);
+    LogWriterOptions options;
+    options.chunk_size = 4096;
+    options.compression_threads = with_dictionary;
+    if (with_dictionary) {
+      options.zstd_dictionary = dictionary;
+    }
+    LogWriter writer;
+    REQUIRE(writer.open(path, encoder, options).ok());
+    for (size_t i = 0; i < lines.size(); ++i) {
+      REQUIRE(writer.write(i, TRANSPORT_SYSLOG, lines[i]).ok());
+    }
+    writer.close();
+    contents[with_dictionary] = read_file(path);
+    REQUIRE(unlink(path) == 0);
+  }
+  // small chunks compress far better starting from the dictionary, even with a copy of it and
+  // the message indexes in the file.
+  REQUIRE(contents[1].size() * 100 < contents[0].size() * 85);
+  REQUIRE(contents[0].find(DICTIONARY_ATTACHMENT_NAME) == std::string::npos);
+
+  // the dictionary is attached ahead of the first chunk, and decompresses every chunk.
+  const auto records = read_mcap_records(contents[1]);
+  REQUIRE(records.size() > 2);
+  REQUIRE(records[0].opcode == 0x01);
+  REQUIRE(records[1].opcode == 0x09);
+  size_t offset = 16;
+  REQUIRE(read_mcap_string(records[1].body, &offset) == DICTIONARY_ATTACHMENT_NAME);
+  REQUIRE(read_mcap_string(records[1].body, &offset) == DICTIONARY_MEDIA_TYPE);
+  REQUIRE(records[1].body.substr(offset + 8, read_le(records[1].body, offset, 8)) ==
+          dictionary);
+  ZSTD_DDict *ddict = ZSTD_createDDict(dictionary.data(), dictionary.size());
+  ZSTD_DCtx *dctx = ZSTD_createDCtx();
+  size_t chunk_count = 0;
+  size_t lines_found = 0;
+  for (const auto &record : records) {
+    if (record.opcode != 0x06) {
+      continue;
+    }
+    chunk_count++;
+    const uint64_t uncompressed_size = read_le(record.body, 16, 8);
+    const uint32_t uncompressed_crc = uint32_t(read_le(record.body, 24, 4));
+    offset = 28;
+    REQUIRE(read_mcap_string(record.body, &offset) == "zstd");
+    const std::string_view compressed =
+        record.body.substr(offset + 8, read_le(record.body, offset, 8));
+    std::string uncompressed(uncompressed_size, '\0');
+    REQUIRE(ZSTD_isError(ZSTD_decompress(uncompressed.data(), uncompressed.size(),
+                                         compressed.data(), compressed.size())));
+    REQUIRE(ZSTD_decompress_usingDDict(dctx, uncompressed.data(), uncompressed.size(),
+                                       compressed.data(), compressed.size(),
+                                       ddict) == uncompressed_size);
+    using namespace mcap::internal;
+    REQUIRE(crc32Final(crc32Update(CRC32_INIT, (const std::byte *)(uncompressed.data()),
+                                   uncompressed.size())) == uncompressed_crc);
+    for (size_t i = lines_found; i < lines.size(); ++i) {
+      if (uncompressed.find(lines[i]) == std::string::npos) {
+        break;
+      }
+      lines_found++;
+    }
+  }
+  ZSTD_freeDCtx(dctx);
+  ZSTD_freeDDict(ddict);
+  REQUIRE(chunk_count > 50);
+  REQUIRE(lines_found == lines.size());
+}
+
+TEST_CASE("routes entries to unit and command channels", "[output]") {
+  char path[] = "/tmp/journal2mcap-test-XXXXXX";
+  int fd = mkstemp(path);
+  REQUIRE(fd >= 0);
+  close(fd);
+  JsonEncoder encoder;
+  ChannelKey sshd{TRANSPORT_SYSLOG, "sshd.service", "sshd"};
+  ChannelKey cron{TRANSPORT_STDOUT, "", "cron"};
+  ChannelKey kernel{TRANSPORT_KERNEL, "", ""};
+  ChannelKey invalid{TRANSPORT_JOURNAL, "bad\xff.service", ""};
+  {
+    // with transport topics, the unit and command are ignored.
+    LogWriter writer;
+    REQUIRE(writer.open(path, encoder).ok());
+    REQUIRE(writer.write(1, sshd, "{}").ok());
+    REQUIRE(writer.write(2, cron, "{}").ok());
+    writer.close();
+    REQUIRE(writer.channel_count() == _TRANSPORT_COUNT);
+    REQUIRE(writer.entry_count(TRANSPORT_SYSLOG) == 1);
+    REQUIRE(writer.entry_count(TRANSPORT_STDOUT) == 1);
+  }
+  LogWriterOptions options;
+  options.topics = TOPICS_UNIT;
+  // enough units that channel lookups must not depend on the number of channels.
+  constexpr uint32_t UNIT_COUNT = 3000;
+  std::vector<std::string> units;
+  for (uint32_t i = 0; i < UNIT_COUNT; ++i) {
+    units.push_back("worker@" + std::to_string(i) + ".service");
+  }
+  LogWriter writer;
+  REQUIRE(writer.open(path, encoder, options).ok());
+  REQUIRE(writer.write(1, sshd, "{\"a\":1}").ok());
+  REQUIRE(writer.write(2, cron, "{}").ok());
+  REQUIRE(writer.write(3, kernel, "{}").ok());
+  REQUIRE(writer.write(4, invalid, "{}").ok());
+  for (uint32_t round = 0; round < 3; ++round) {
+    for (uint32_t i = 0; i < UNIT_COUNT; ++i) {
+      REQUIRE(writer.write(10 + i, ChannelKey{TRANSPORT_STDOUT, units[i], "worker"}, "{}").ok());
+    }
+  }
+  // the channel is found by the unit's bytes, not by the view's address.
+  const std::string sshd_copy(sshd.unit);
+  REQUIRE(writer.write(5, ChannelKey{TRANSPORT_SYSLOG, sshd_copy, ""}, "{}").ok());
+  writer.close();
+
+  REQUIRE(writer.channel_count() == _TRANSPORT_COUNT + 3 + UNIT_COUNT);
+  REQUIRE(writer.channel_topic(_TRANSPORT_COUNT) == "/journald/unit/sshd.service");
+  REQUIRE(writer.entry_count(_TRANSPORT_COUNT) == 2);
+  REQUIRE(writer.byte_count(_TRANSPORT_COUNT) == 9);
+  REQUIRE(writer.channel_topic(_TRANSPORT_COUNT + 1) == "/journald/comm/cron");
+  REQUIRE(writer.channel_topic(_TRANSPORT_COUNT + 2) == "/journald/unit/bad\xef\xbf\xbd.service");
+  REQUIRE(writer.entry_count(TRANSPORT_KERNEL) == 1);
+  REQUIRE(writer.entry_count(TRANSPORT_SYSLOG) == 0);
+  REQUIRE(writer.entry_count(TRANSPORT_STDOUT) == 0);
+  for (uint32_t i = 0; i < UNIT_COUNT; ++i) {
+    REQUIRE(writer.channel_topic(_TRANSPORT_COUNT + 3 + i) == "/journald/unit/" + units[i]);
+    REQUIRE(writer.entry_count(_TRANSPORT_COUNT + 3 + i) == 3);
+  }
+  const std::string contents = read_file(path);
+  REQUIRE(contents.find("/journald/unit/worker@2999.service") != std::string::npos);
+  REQUIRE(unlink(path) == 0);
+}
+
+TEST_CASE("namespaces channels by machine", "[output]") {
+  char path[] = "/tmp/journal2mcap-test-XXXXXX";
+  int fd = mkstemp(path);
+  REQUIRE(fd >= 0);
+  close(fd);
+  JsonEncoder encoder;
+  const std::string machine_a = "0123456789abcdef0123456789abcdef";
+  const std::string machine_b = "fedcba9876543210fedcba9876543210";
+  EntryBatch batch;
+  batch.append(1, ChannelKey{TRANSPORT_KERNEL, "", "", machine_a}, "{\"a\":1}");
+  batch.append(2, ChannelKey{TRANSPORT_STDOUT, "sshd.service", "sshd", machine_b}, "{}");
+  batch.append(3, ChannelKey{TRANSPORT_STDOUT, "", "cron", machine_a}, "{}");
+  batch.append(4, ChannelKey{TRANSPORT_KERNEL, "", "", machine_a}, "{\"a\":2}");
+  batch.append(5, ChannelKey{TRANSPORT_SYSLOG, "", "", ""}, "{}");
+  REQUIRE(batch.size() == 5);
+  REQUIRE(batch.timestamp(3) == 4);
+  REQUIRE(batch.encoded(3) == "{\"a\":2}");
+  REQUIRE(batch.key(1).machine == machine_b);
+  REQUIRE(batch.key(1).unit == "sshd.service");
+  REQUIRE(batch.key(1).comm == "sshd");
+  REQUIRE(batch.key(4).machine.empty());
+
+  for (TopicScheme topics : {TOPICS_TRANSPORT, TOPICS_UNIT}) {
+    LogWriterOptions options;
+    options.topics = topics;
+    LogWriter writer;
+    REQUIRE(writer.open(path, encoder, options).ok());
+    for (size_t i = 0; i < batch.size(); ++i) {
+      REQUIRE(writer.write(batch.timestamp(i), batch.key(i), batch.encoded(i)).ok());
+    }
+    writer.close();
+    REQUIRE(writer.channel_count() == _TRANSPORT_COUNT + 3);
+    REQUIRE(writer.channel_topic(_TRANSPORT_COUNT) == "/journald/" + machine_a + "/kernel");
+    REQUIRE(writer.entry_count(_TRANSPORT_COUNT) == 2);
+    REQUIRE(writer.entry_count(TRANSPORT_SYSLOG) == 1);
+    if (topics == TOPICS_TRANSPORT) {
+      REQUIRE(writer.channel_topic(_TRANSPORT_COUNT + 1) == "/journald/" + machine_b + "/stdout");
+      REQUIRE(writer.channel_topic(_TRANSPORT_COUNT + 2) == "/journald/" + machine_a + "/stdout");
+    } else {
+      REQUIRE(writer.channel_topic(_TRANSPORT_COUNT + 1) ==
+              "/journald/" + machine_b + "/unit/sshd.service");
+      REQUIRE(writer.channel_topic(_TRANSPORT_COUNT + 2) ==
+              "/journald/" + machine_a + "/comm/cron");
+    }
+  }
+  REQUIRE(unlink(path) == 0);
+}